@@ -0,0 +1,4 @@
+"""
+Benchmarks of pylibtiff. Each module is run from the root of the
+repository, e.g. ``python -m benchmarks.stack_writer --help``.
+"""
@@ -0,0 +1,50 @@
+"""
+Benchmark of opening a TIFF file with many subfiles. The constructor only
+walks the chain of directories, while the TIFF Tags of a subfile are
+parsed on first access.
+"""
+from argparse import ArgumentParser
+import os
+import tempfile
+import time
+
+from pylibtiff import TiffFile
+from tests.tiff_samples import write_subfile_chain
+
+
+def main():
+    parser = ArgumentParser("Measures the time to open a multi-page file.")
+    parser.add_argument(
+        "--subfiles", type=int, default=5000,
+        help="Number of subfiles."
+    )
+    parser.add_argument(
+        "--repeat", type=int, default=10,
+        help="Number of measurements, of which the fastest is reported."
+    )
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        file_path = os.path.join(tmp_dir, "chain.tif")
+        write_subfile_chain(file_path, args.subfiles)
+
+        open_times, parse_times = [], []
+        for _ in range(args.repeat):
+            start = time.perf_counter()
+            tiff_file = TiffFile(file_path)
+            open_times.append(time.perf_counter() - start)
+
+            # the first access of each subfile parses its directory
+            start = time.perf_counter()
+            for subfile_idx in range(len(tiff_file.subfile_tags)):
+                tiff_file.subfile_tags[subfile_idx]
+            parse_times.append(time.perf_counter() - start)
+
+    print("%d subfiles" % args.subfiles)
+    print("open %.1f ms, parse all directories %.1f ms" % (
+        1000 * min(open_times), 1000 * min(parse_times)
+    ))
+
+
+if __name__ == "__main__":
+    main()
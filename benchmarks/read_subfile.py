@@ -0,0 +1,74 @@
+"""
+Benchmark of a full read of an uncompressed tiled subfile from the page
+cache. Interior tiles are read straight into the destination array, which
+is reported by the statistic bytes_saved.
+"""
+from argparse import ArgumentParser
+import numpy as np
+import os
+import tempfile
+import time
+
+from pylibtiff import TiffFile, TiffFileExtension, TiffTags
+
+
+def main():
+    parser = ArgumentParser("Measures the time of a full subfile read.")
+    parser.add_argument(
+        "--size", type=int, default=8192,
+        help="Width and length of the 16-bit subfile."
+    )
+    parser.add_argument(
+        "--tile-size", dest="tile_size", type=int, default=256,
+        help="Width and length of a tile."
+    )
+    parser.add_argument(
+        "--repeat", type=int, default=10,
+        help="Number of measurements, of which the fastest is reported."
+    )
+    args = parser.parse_args()
+
+    image = np.arange(args.size * args.size, dtype=np.uint16)
+    image = image.reshape(args.size, args.size)
+
+    tiff_tags = TiffTags()
+    tiff_tags.new_subfile_type = 0  # undefined
+    tiff_tags.image_width = args.size
+    tiff_tags.image_length = args.size
+    tiff_tags.bits_per_sample = 16
+    tiff_tags.compression = 1  # uncompressed
+    tiff_tags.photometric = 1  # min is black
+    tiff_tags.samples_per_pixel = 1
+    tiff_tags.rows_per_strip = 2**32 - 1
+    tiff_tags.min_sample_value = 0
+    tiff_tags.max_sample_value = 65535
+    tiff_tags.planar_config = 1  # chunky format
+    tiff_tags.tile_width = args.tile_size
+    tiff_tags.tile_length = args.tile_size
+    tiff_tags.sample_format = 1  # unsigned integer
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        file_path = os.path.join(tmp_dir, "tiled.tif")
+        TiffFileExtension(file_path).write_subfile_16(image, tiff_tags)
+
+        tiff_file = TiffFile(file_path)
+        # the first read fills the page cache
+        np.testing.assert_array_equal(tiff_file.read_subfile(0), image)
+        times = []
+        for _ in range(args.repeat):
+            tiff_file.reset_io_stats()
+            start = time.perf_counter()
+            tiff_file.read_subfile(0)
+            times.append(time.perf_counter() - start)
+        io_stats = tiff_file.io_stats
+
+    print("%d MiB subfile of %dx%d tiles" % (
+        image.nbytes >> 20, args.tile_size, args.tile_size
+    ))
+    print("read %.1f ms, %d MiB read straight into the array" % (
+        1000 * min(times), io_stats["bytes_saved"] >> 20
+    ))
+
+
+if __name__ == "__main__":
+    main()
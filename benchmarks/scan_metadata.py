@@ -0,0 +1,52 @@
+"""
+Benchmark of the parallel metadata scan of many TIFF files by
+scan_metadata(), e.g. to index a directory of acquisitions.
+"""
+from argparse import ArgumentParser
+import os
+import tempfile
+import time
+
+from pylibtiff import scan_metadata
+from tests.tiff_samples import write_subfile_chain
+
+
+def main():
+    parser = ArgumentParser("Measures the files per second of a scan.")
+    parser.add_argument(
+        "--files", type=int, default=2000,
+        help="Number of single-page files."
+    )
+    parser.add_argument(
+        "--threads", type=int, nargs="+", default=[1, 4, 0],
+        help="Numbers of threads to measure (0 = hardware threads)."
+    )
+    parser.add_argument(
+        "--repeat", type=int, default=5,
+        help="Number of measurements, of which the fastest is reported."
+    )
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        paths = [
+            os.path.join(tmp_dir, "%d.tif" % file_idx)
+            for file_idx in range(args.files)
+        ]
+        for path in paths:
+            write_subfile_chain(path, 1)
+
+        # the files are read from the page cache after the first scan
+        scan_metadata(paths)
+        for threads in args.threads:
+            times = []
+            for _ in range(args.repeat):
+                start = time.perf_counter()
+                metadata = scan_metadata(paths, threads)
+                times.append(time.perf_counter() - start)
+            print("threads %d: %.0f files/s, %d valid" % (
+                threads, args.files / min(times), metadata["valid"].sum()
+            ))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,57 @@
+"""
+Benchmark of the fixed-layout stack writer: the time per frame of
+TiffFile.write_frame() into a stack created by TiffFile.create_stack().
+"""
+from argparse import ArgumentParser
+import numpy as np
+import os
+import tempfile
+import time
+
+from pylibtiff import TiffFile
+
+
+def main():
+    parser = ArgumentParser("Measures the time per frame of the stack writer.")
+    parser.add_argument(
+        "--frames", type=int, default=2000,
+        help="Number of frames."
+    )
+    parser.add_argument(
+        "--width", type=int, default=320,
+        help="Width of a frame."
+    )
+    parser.add_argument(
+        "--length", type=int, default=240,
+        help="Length of a frame."
+    )
+    parser.add_argument(
+        "--dir", default=None,
+        help="Directory of the temporary TIFF file."
+    )
+    args = parser.parse_args()
+
+    frame = np.arange(args.length * args.width, dtype=np.uint16)
+    frame = frame.reshape(args.length, args.width)
+    with tempfile.TemporaryDirectory(dir=args.dir) as tmp_dir:
+        tiff_file = TiffFile(os.path.join(tmp_dir, "stack.tif"))
+        tiff_file.create_stack(
+            args.frames, (args.length, args.width), np.uint16
+        )
+        times = np.empty(args.frames)
+        for frame_idx in range(args.frames):
+            start = time.perf_counter()
+            tiff_file.write_frame(frame, frame_idx)
+            times[frame_idx] = time.perf_counter() - start
+        tiff_file.close_stack()
+
+    print("%d frames of %dx%d pixels (uint16)" % (
+        args.frames, args.width, args.length
+    ))
+    print("average %.3f ms, worst %.3f ms per frame" % (
+        1000 * times.mean(), 1000 * times.max()
+    ))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,50 @@
+"""
+Benchmark of reading the TIFF Tags of all subfiles at once. Files on disk
+are parsed by the native IFD parser, while files in memory are parsed by
+libtiff, which serves as the reference.
+"""
+from argparse import ArgumentParser
+import os
+import tempfile
+import time
+
+from pylibtiff import TiffFile
+from tests.tiff_samples import write_subfile_chain
+
+
+def main():
+    parser = ArgumentParser("Measures the time to read the tags of a file.")
+    parser.add_argument(
+        "--subfiles", type=int, default=5000,
+        help="Number of subfiles."
+    )
+    parser.add_argument(
+        "--repeat", type=int, default=10,
+        help="Number of measurements, of which the fastest is reported."
+    )
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        file_path = os.path.join(tmp_dir, "chain.tif")
+        write_subfile_chain(file_path, args.subfiles)
+        with open(file_path, "rb") as f:
+            buffer = f.read()
+
+        native_times, libtiff_times = [], []
+        for _ in range(args.repeat):
+            start = time.perf_counter()
+            TiffFile(file_path).subfile_tags.to_array()
+            native_times.append(time.perf_counter() - start)
+
+            start = time.perf_counter()
+            TiffFile.from_buffer(buffer).subfile_tags.to_array()
+            libtiff_times.append(time.perf_counter() - start)
+
+    print("%d subfiles" % args.subfiles)
+    print("native parser %.1f ms, libtiff %.1f ms" % (
+        1000 * min(native_times), 1000 * min(libtiff_times)
+    ))
+
+
+if __name__ == "__main__":
+    main()
@@ -15,11 +15,13 @@ if platform.system() == "Windows":
         'ext/jpeg-9d/include',
         'ext/zlib-1.2.11/include'
     ]
+    extra_compile_args=[]
     extra_link_args=['-static']
 else:
     library_dirs = []
     include_dirs = []
-    extra_link_args=[]
+    extra_compile_args=['-pthread']
+    extra_link_args=['-pthread']
 
 
 class LazyPyBind11IncludeDirWrapper(object):
@@ -37,6 +39,15 @@ tiff_extention_module = Extension(
     libraries=['tiff', 'jpeg', 'z'],
     sources=[
         'src/ext/utils.cpp',
+        'src/ext/buffer_pool.cpp',
+        'src/ext/file_watcher.cpp',
+        'src/ext/io_ring.cpp',
+        'src/ext/thread_pool.cpp',
+        'src/ext/tiff_append_stream.cpp',
+        'src/ext/tiff_directory.cpp',
+        'src/ext/tiff_file_stream.cpp',
+        'src/ext/tiff_ifd.cpp',
+        'src/ext/tiff_memory_stream.cpp',
         'src/ext/tiff_reader.cpp',
         'src/ext/tiff_writer.cpp',
         'src/ext/tiff_file.cpp'
@@ -46,7 +57,7 @@ tiff_extention_module = Extension(
         LazyPyBind11IncludeDirWrapper(user=True),
         *include_dirs
     ],
-    extra_compile_args=['-std=c++14'],
+    extra_compile_args=['-std=c++14', *extra_compile_args],
     extra_link_args=extra_link_args,
     language='c++',
 )
@@ -0,0 +1,159 @@
+#include "buffer_pool.h"
+
+#include <cstdlib>
+#include <new>
+#include <utility>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+
+std::atomic<bool> BufferPool::huge_pages_(false);
+std::atomic<uint64> BufferPool::allocation_count_(0);
+std::atomic<uint64> BufferPool::reuse_count_(0);
+std::atomic<uint64> BufferPool::cached_bytes_(0);
+
+// buffers released after the thread cache was destroyed are freed directly
+static thread_local bool thread_cache_destroyed = false;
+
+
+BufferPool::Buffer::Buffer(Buffer&& other) :
+    data_(other.data_), size_(other.size_), size_class_(other.size_class_)
+{
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) {
+    if (this != &other) {
+        BufferPool::Release(data_, size_class_);
+        data_ = other.data_;
+        size_ = other.size_;
+        size_class_ = other.size_class_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+BufferPool::Buffer::~Buffer() {
+    BufferPool::Release(data_, size_class_);
+}
+
+BufferPool::ThreadCache::~ThreadCache() {
+    thread_cache_destroyed = true;
+    for (std::vector<uint8*>& class_buffers: buffers) {
+        for (uint8* data: class_buffers)
+            Free(data);
+    }
+    cached_bytes_ -= cached_bytes;
+}
+
+BufferPool::ThreadCache& BufferPool::GetThreadCache() {
+    static thread_local ThreadCache cache;
+    return cache;
+}
+
+int BufferPool::GetSizeClass(size_t size) {
+    for (int size_class = 0; size_class < kClassCount; size_class++) {
+        if (size <= GetClassSize(size_class))
+            return size_class;
+    }
+    return -1;
+}
+
+uint8* BufferPool::Allocate(size_t capacity) {
+    const bool huge_pages = huge_pages_ && capacity >= kHugePageSize;
+    // huge pages require buffers aligned to the size of a huge page
+    const size_t alignment = huge_pages ? kHugePageSize : kAlignment;
+    capacity = (capacity + alignment - 1) / alignment * alignment;
+
+    void* data;
+#ifdef _WIN32
+    data = _aligned_malloc(capacity, alignment);
+#else
+    if (posix_memalign(&data, alignment, capacity) != 0)
+        data = nullptr;
+#endif
+    if (data == nullptr)
+        throw std::bad_alloc();
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (huge_pages)
+        madvise(data, capacity, MADV_HUGEPAGE);  // a hint, which may be ignored
+#endif
+    allocation_count_ += 1;
+    return static_cast<uint8*>(data);
+}
+
+void BufferPool::Free(uint8* data) {
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+void BufferPool::Release(uint8* data, int size_class) {
+    if (data == nullptr)
+        return;
+    if (size_class < 0 || thread_cache_destroyed) {
+        Free(data);
+        return;
+    }
+
+    ThreadCache& cache = GetThreadCache();
+    const size_t class_size = GetClassSize(size_class);
+    std::vector<uint8*>& class_buffers = cache.buffers[size_class];
+    if (class_buffers.size() >= kMaxCachedPerClass || cache.cached_bytes + class_size > kMaxCachedBytes) {
+        Free(data);
+        return;
+    }
+    class_buffers.push_back(data);
+    cache.cached_bytes += class_size;
+    cached_bytes_ += class_size;
+}
+
+BufferPool::Buffer BufferPool::Acquire(size_t size) {
+    const int size_class = GetSizeClass(size);
+    if (size_class < 0)
+        return Buffer(Allocate(size), size, -1);
+
+    if (!thread_cache_destroyed) {
+        ThreadCache& cache = GetThreadCache();
+        std::vector<uint8*>& class_buffers = cache.buffers[size_class];
+        if (!class_buffers.empty()) {
+            uint8* data = class_buffers.back();
+            class_buffers.pop_back();
+            cache.cached_bytes -= GetClassSize(size_class);
+            cached_bytes_ -= GetClassSize(size_class);
+            reuse_count_ += 1;
+            return Buffer(data, size, size_class);
+        }
+    }
+    return Buffer(Allocate(GetClassSize(size_class)), size, size_class);
+}
+
+void BufferPool::Trim() {
+    if (thread_cache_destroyed)
+        return;
+
+    ThreadCache& cache = GetThreadCache();
+    for (std::vector<uint8*>& class_buffers: cache.buffers) {
+        for (uint8* data: class_buffers)
+            Free(data);
+        class_buffers.clear();
+    }
+    cached_bytes_ -= cache.cached_bytes;
+    cache.cached_bytes = 0;
+}
+
+BufferPool::Stats BufferPool::GetStats() {
+    Stats stats;
+    stats.allocation_count = allocation_count_;
+    stats.reuse_count = reuse_count_;
+    stats.cached_bytes = cached_bytes_;
+    return stats;
+}
@@ -0,0 +1,183 @@
+#ifndef __BUFFERPOOL_H__
+#define __BUFFERPOOL_H__
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include <tiffio.h>
+
+
+/**
+ * Internal class pooling the scratch buffers of the readers and writers.
+ * The buffers are grouped into power-of-two size classes and released
+ * buffers are cached per thread, so that repeated reads and writes reuse
+ * the memory of earlier calls without locking. All buffers are aligned to
+ * cache lines, and large buffers may be backed by huge pages.
+ */
+class BufferPool {
+    public:
+        /**
+         * Structure for the statistics of the buffer pool.
+         */
+        struct Stats {
+            uint64 allocation_count = 0;    /**< Number of buffers allocated from the system. */
+            uint64 reuse_count = 0;         /**< Number of buffers reused from a thread cache. */
+            uint64 cached_bytes = 0;        /**< Number of bytes cached by all threads. */
+        };
+
+        /**
+         * Move-only handle of a pooled buffer, which returns the buffer to
+         * the cache of the releasing thread on destruction.
+         */
+        class Buffer {
+            private:
+                uint8* data_;       /**< Start of the buffer. */
+                size_t size_;       /**< Requested size in bytes. */
+                int size_class_;    /**< Size class of the buffer (-1 = not pooled). */
+
+            public:
+                /**
+                 * Constructor to initialize an empty Buffer.
+                 */
+                Buffer() : data_(nullptr), size_(0), size_class_(-1) {}
+
+                /**
+                 * Constructor to take over an allocated buffer.
+                 * @param data Start of the buffer.
+                 * @param size Requested size in bytes.
+                 * @param size_class Size class of the buffer (-1 = not pooled).
+                 */
+                Buffer(uint8* data, size_t size, int size_class) : data_(data), size_(size), size_class_(size_class) {}
+
+                Buffer(Buffer&& other);
+                Buffer& operator=(Buffer&& other);
+                Buffer(const Buffer&) = delete;
+                Buffer& operator=(const Buffer&) = delete;
+
+                /**
+                 * Destructor which returns the buffer to the pool.
+                 */
+                ~Buffer();
+
+                /**
+                 * Get the start of the buffer.
+                 * @tparam T Data type of the buffer components.
+                 * @return Start of the buffer
+                 */
+                template <typename T=uint8>
+                T* GetData() const { return reinterpret_cast<T*>(data_); }
+
+                /**
+                 * Get the requested size of the buffer.
+                 * @return Size in bytes
+                 */
+                size_t GetSize() const { return size_; }
+        };
+
+    private:
+        static const size_t kAlignment = 64;                    /**< Alignment of all buffers (cache line). */
+        static const size_t kHugePageSize = 2 * 1024 * 1024;    /**< Size and alignment of a huge page. */
+        static const int kMinClassShift = 12;                   /**< The smallest size class holds 4 KiB. */
+        static const int kClassCount = 15;                      /**< The largest size class holds 64 MiB. */
+        static const size_t kMaxCachedPerClass = 4;             /**< Maximum number of cached buffers per thread and size class. */
+        static const size_t kMaxCachedBytes = 64 * 1024 * 1024; /**< Maximum number of cached bytes per thread. */
+
+        /**
+         * Structure for the released buffers of a thread.
+         */
+        struct ThreadCache {
+            std::array<std::vector<uint8*>, kClassCount> buffers;   /**< Released buffers per size class. */
+            size_t cached_bytes = 0;                                /**< Number of cached bytes. */
+
+            /**
+             * Destructor which frees the cached buffers on thread exit.
+             */
+            ~ThreadCache();
+        };
+
+        static std::atomic<bool> huge_pages_;           /**< If true, large buffers are backed by huge pages. */
+        static std::atomic<uint64> allocation_count_;   /**< Number of buffers allocated from the system. */
+        static std::atomic<uint64> reuse_count_;        /**< Number of buffers reused from a thread cache. */
+        static std::atomic<uint64> cached_bytes_;       /**< Number of bytes cached by all threads. */
+
+        /**
+         * Get the cache of the calling thread.
+         * @return Thread cache
+         */
+        static ThreadCache& GetThreadCache();
+
+        /**
+         * Get the size class of a buffer size.
+         * @param size Size in bytes.
+         * @return Size class (-1 = too large to be pooled, i.e. allocated with the exact size)
+         */
+        static int GetSizeClass(size_t size);
+
+        /**
+         * Get the capacity of a size class.
+         * @param size_class Size class.
+         * @return Capacity in bytes
+         */
+        static size_t GetClassSize(int size_class) { return size_t(1) << (size_class + kMinClassShift); }
+
+        /**
+         * Allocates an aligned buffer from the system.
+         * @param capacity Capacity in bytes.
+         * @return Start of the buffer
+         */
+        static uint8* Allocate(size_t capacity);
+
+        /**
+         * Frees a buffer allocated by Allocate().
+         * @param data Start of the buffer.
+         */
+        static void Free(uint8* data);
+
+        /**
+         * Returns a buffer to the cache of the calling thread, or frees it
+         * if the cache is full.
+         * @param data Start of the buffer.
+         * @param size_class Size class of the buffer (-1 = not pooled).
+         */
+        static void Release(uint8* data, int size_class);
+
+    public:
+        /**
+         * Acquires a buffer from the cache of the calling thread, or
+         * allocates a new one. The content of the buffer is undefined.
+         * @param size Size in bytes.
+         * @return Buffer of at least the requested size
+         */
+        static Buffer Acquire(size_t size);
+
+        /**
+         * Frees the buffers cached by the calling thread, e.g. by a worker
+         * thread which becomes idle and would otherwise hold its cache
+         * until it exits.
+         */
+        static void Trim();
+
+        /**
+         * Check if large buffers are backed by huge pages.
+         * @return True, if huge pages are used. Otherwise, false.
+         */
+        static bool GetHugePages() { return huge_pages_; }
+
+        /**
+         * Set if large buffers are backed by huge pages. Huge pages reduce
+         * the TLB misses when decoding large tiles and strips but are only
+         * supported on Linux (transparent huge pages).
+         * @param huge_pages If true, huge pages are used for buffers of at least 2 MiB.
+         */
+        static void SetHugePages(bool huge_pages) { huge_pages_ = huge_pages; }
+
+        /**
+         * Get the statistics of the buffer pool.
+         * @return Statistics of the buffer pool
+         */
+        static Stats GetStats();
+};
+
+#endif /* __BUFFERPOOL_H__ */
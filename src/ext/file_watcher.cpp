@@ -0,0 +1,113 @@
+#include "file_watcher.h"
+
+#include <chrono>
+#include <sys/stat.h>
+#include <thread>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+
+FileWatcher::FileWatcher(const std::string& file_path) :
+    file_path_(file_path), inotify_fd_(-1), watch_descriptor_(-1)
+{
+#ifdef __linux__
+    inotify_fd_ = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_fd_ >= 0)
+        watch_descriptor_ = inotify_add_watch(
+            inotify_fd_, file_path_.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF
+        );
+#endif
+    state_ = GetState();
+}
+
+FileWatcher::~FileWatcher() {
+#ifdef __linux__
+    if (inotify_fd_ >= 0)
+        close(inotify_fd_);
+#endif
+}
+
+std::pair<int64_t, int64_t> FileWatcher::GetState() const {
+#ifdef _WIN32
+    struct _stat64 stat_buffer;
+    if (_stat64(file_path_.c_str(), &stat_buffer) != 0)
+        return std::make_pair(int64_t(-1), int64_t(0));
+    return std::make_pair(int64_t(stat_buffer.st_size), int64_t(stat_buffer.st_mtime) * 1000000000);
+#else
+    struct stat stat_buffer;
+    if (stat(file_path_.c_str(), &stat_buffer) != 0)
+        return std::make_pair(int64_t(-1), int64_t(0));
+#if defined(__APPLE__)
+    const int64_t mtime = int64_t(stat_buffer.st_mtimespec.tv_sec) * 1000000000 + stat_buffer.st_mtimespec.tv_nsec;
+#else
+    const int64_t mtime = int64_t(stat_buffer.st_mtim.tv_sec) * 1000000000 + stat_buffer.st_mtim.tv_nsec;
+#endif
+    return std::make_pair(int64_t(stat_buffer.st_size), mtime);
+#endif
+}
+
+bool FileWatcher::ReadEvents() {
+    bool pending = false;
+#ifdef __linux__
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t count;
+    while ((count = read(inotify_fd_, buffer, sizeof(buffer))) > 0) {
+        pending = true;
+        for (ssize_t position = 0; position < count;) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(&buffer[position]);
+            // the watch is removed if the file was deleted or replaced
+            if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                if (watch_descriptor_ >= 0 && !(event->mask & IN_IGNORED))
+                    inotify_rm_watch(inotify_fd_, watch_descriptor_);
+                watch_descriptor_ = -1;
+            }
+            position += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#endif
+    return pending;
+}
+
+bool FileWatcher::Wait(uint32_t timeout_ms) {
+#ifdef __linux__
+    // e.g. the file did not exist at the previous wait
+    if (inotify_fd_ >= 0 && watch_descriptor_ < 0)
+        watch_descriptor_ = inotify_add_watch(
+            inotify_fd_, file_path_.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF
+        );
+#endif
+
+    // modifications which were not watched are found by the file state
+    std::pair<int64_t, int64_t> state = GetState();
+    if (state != state_) {
+        state_ = state;
+        ReadEvents();
+        return true;
+    }
+
+#ifdef __linux__
+    if (watch_descriptor_ >= 0) {
+        struct pollfd poll_fd = {inotify_fd_, POLLIN, 0};
+        bool modified = ReadEvents();
+        if (!modified && poll(&poll_fd, 1, static_cast<int>(timeout_ms)) > 0)
+            modified = ReadEvents();
+        state_ = GetState();
+        return modified;
+    }
+#endif
+
+    // polls the size and the modification time of the file
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        state = GetState();
+        if (state != state_) {
+            state_ = state;
+            return true;
+        }
+    }
+    return false;
+}
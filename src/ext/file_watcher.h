@@ -0,0 +1,60 @@
+#ifndef __FILEWATCHER_H__
+#define __FILEWATCHER_H__
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+
+/**
+ * Internal class watching a file for modifications.
+ * On Linux, the file is watched by an inotify watch which persists between
+ * two waits, so modifications in between are reported by the next wait.
+ * Otherwise, or while the file does not exist, the size and the
+ * modification time of the file are compared with those seen by the
+ * previous wait.
+ */
+class FileWatcher {
+    private:
+        std::string file_path_;                 /**< Path to the watched file. */
+        int inotify_fd_;                        /**< Descriptor of the inotify instance (-1 = not supported). */
+        int watch_descriptor_;                  /**< Descriptor of the watch (-1 = the file is not watched). */
+        std::pair<int64_t, int64_t> state_;     /**< Size and modification time of the file seen last. */
+
+        /**
+         * Get the size and the modification time of the file.
+         * @return Size and modification time in nanoseconds (-1 = the file does not exist)
+         */
+        std::pair<int64_t, int64_t> GetState() const;
+
+        /**
+         * Reads all pending events of the inotify instance.
+         * @return True, if an event was pending
+         */
+        bool ReadEvents();
+
+    public:
+        /**
+         * Constructor which starts watching a file.
+         * @param file_path Path to the file.
+         */
+        explicit FileWatcher(const std::string& file_path);
+
+        FileWatcher(const FileWatcher&) = delete;
+        FileWatcher& operator=(const FileWatcher&) = delete;
+
+        /**
+         * Destructor which stops watching the file.
+         */
+        ~FileWatcher();
+
+        /**
+         * Blocks until the file is modified or the timeout expires.
+         * Modifications since the previous wait return immediately.
+         * @param timeout_ms Timeout in milliseconds.
+         * @return True, if the file was modified
+         */
+        bool Wait(uint32_t timeout_ms);
+};
+
+#endif /* __FILEWATCHER_H__ */
@@ -0,0 +1,189 @@
+#include "io_ring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__linux__) && !defined(PYLIBTIFF_NO_IO_URING) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        // IORING_OP_READ is an enumerator, the features of Linux >= 5.6 imply it
+        #if defined(IORING_FEAT_SINGLE_MMAP) && defined(IORING_FEAT_RW_CUR_POS)
+            #define PYLIBTIFF_IO_URING
+        #endif
+    #endif
+#endif
+
+#ifdef PYLIBTIFF_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+IoRing::IoRing() :
+    ring_fd_(-1), entries_(0), to_submit_(0),
+    sq_ring_(nullptr), cq_ring_(nullptr), sqes_(nullptr),
+    sq_ring_size_(0), cq_ring_size_(0), sqes_size_(0), depth_(0)
+{
+}
+
+IoRing::~IoRing() {
+    Close();
+}
+
+#ifdef PYLIBTIFF_IO_URING
+
+bool IoRing::Open(uint32_t entries) {
+    Close();
+    depth_ = entries;
+
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd < 0)
+        return false;  // e.g. not supported by the kernel or disabled by a seccomp filter
+    ring_fd_ = ring_fd;
+    // kernels before Linux 5.6 lack IORING_OP_READ and fail each read
+    const uint32_t features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_RW_CUR_POS;
+    if ((params.features & features) != features) {
+        Close();
+        return false;
+    }
+    entries_ = params.sq_entries;
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+        sq_ring_ = nullptr;
+        Close();
+        return false;
+    }
+    cq_ring_ = sq_ring_;  // IORING_FEAT_SINGLE_MMAP
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = nullptr;
+        Close();
+        return false;
+    }
+
+    char* sq_ring = static_cast<char*>(sq_ring_);
+    char* cq_ring = static_cast<char*>(cq_ring_);
+    sq_tail_ = reinterpret_cast<uint32_t*>(sq_ring + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<uint32_t*>(sq_ring + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<uint32_t*>(sq_ring + params.sq_off.array);
+    cq_head_ = reinterpret_cast<uint32_t*>(cq_ring + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<uint32_t*>(cq_ring + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<uint32_t*>(cq_ring + params.cq_off.ring_mask);
+    cqes_ = cq_ring + params.cq_off.cqes;
+    return true;
+}
+
+void IoRing::Close() {
+    if (sqes_ != nullptr)
+        munmap(sqes_, sqes_size_);
+    if (cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+        munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != nullptr)
+        munmap(sq_ring_, sq_ring_size_);
+    if (ring_fd_ >= 0)
+        close(ring_fd_);
+    ring_fd_ = -1;
+    entries_ = 0;
+    to_submit_ = 0;
+    sq_ring_ = cq_ring_ = sqes_ = nullptr;
+}
+
+void IoRing::PrepareRead(int fd, void* data, uint32_t size, uint64_t offset, uint64_t user_data) {
+    // only this thread writes the tail, the kernel reads it
+    uint32_t tail = *sq_tail_;
+    uint32_t idx = tail & sq_mask_;
+    io_uring_sqe* sqe = &static_cast<io_uring_sqe*>(sqes_)[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    sq_array_[idx] = idx;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    to_submit_ += 1;
+}
+
+void IoRing::Submit() {
+    while (to_submit_ > 0) {
+        int submitted = syscall(__NR_io_uring_enter, ring_fd_, to_submit_, 0, 0, nullptr, 0);
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            throw std::runtime_error("Could not submit reads: " + std::string(std::strerror(errno)) + "!");
+        }
+        to_submit_ -= submitted;
+    }
+}
+
+std::pair<uint64_t, int32_t> IoRing::Wait() {
+    Submit();
+
+    uint32_t head = *cq_head_;
+    while (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        int result = syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (result < 0 && errno != EINTR)
+            throw std::runtime_error("Could not wait for reads: " + std::string(std::strerror(errno)) + "!");
+    }
+
+    const io_uring_cqe* cqe = &static_cast<const io_uring_cqe*>(cqes_)[head & cq_mask_];
+    std::pair<uint64_t, int32_t> completion(cqe->user_data, cqe->res);
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    return completion;
+}
+
+bool IoRing::Peek(std::pair<uint64_t, int32_t>& completion) {
+    uint32_t head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+        return false;
+
+    const io_uring_cqe* cqe = &static_cast<const io_uring_cqe*>(cqes_)[head & cq_mask_];
+    completion = std::make_pair(cqe->user_data, cqe->res);
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#else
+
+bool IoRing::Open(uint32_t entries) {
+    depth_ = entries;
+    return false;
+}
+
+void IoRing::Close() {
+}
+
+void IoRing::PrepareRead(int, void*, uint32_t, uint64_t, uint64_t) {
+    throw std::runtime_error("io_uring is not supported!");
+}
+
+void IoRing::Submit() {
+}
+
+std::pair<uint64_t, int32_t> IoRing::Wait() {
+    throw std::runtime_error("io_uring is not supported!");
+}
+
+bool IoRing::Peek(std::pair<uint64_t, int32_t>&) {
+    return false;
+}
+
+#endif
+
+bool IoRing::IsAvailable() {
+    static const bool available = IoRing().Open(1);
+    return available;
+}
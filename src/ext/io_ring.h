@@ -0,0 +1,119 @@
+#ifndef __IORING_H__
+#define __IORING_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+
+/**
+ * Internal class for reading files with many reads in flight.
+ * The class is a minimal io_uring submission and completion ring on top
+ * of the raw system calls. The reads use IORING_OP_READ, so io_uring is
+ * used with the kernel headers and the kernel of Linux >= 5.6 only. If
+ * io_uring is not available at build time or is refused by the kernel at
+ * run time, Open() fails and the caller falls back to synchronous reads.
+ */
+class IoRing {
+    private:
+        int ring_fd_;               /**< File descriptor of the ring (-1 = not open). */
+        uint32_t entries_;          /**< Number of submission queue entries. */
+        uint32_t to_submit_;        /**< Number of prepared but not yet submitted reads. */
+        void* sq_ring_;             /**< Mapped submission queue ring. */
+        void* cq_ring_;             /**< Mapped completion queue ring (may equal sq_ring_). */
+        void* sqes_;                /**< Mapped submission queue entries. */
+        size_t sq_ring_size_;       /**< Size of the mapped submission queue ring. */
+        size_t cq_ring_size_;       /**< Size of the mapped completion queue ring. */
+        size_t sqes_size_;          /**< Size of the mapped submission queue entries. */
+        uint32_t depth_;            /**< Number of reads in flight requested by Open(). */
+        uint32_t* sq_tail_;         /**< Tail of the submission queue (written by the application). */
+        uint32_t sq_mask_;          /**< Mask of the submission queue indices. */
+        uint32_t* sq_array_;        /**< Indices of the submitted entries. */
+        uint32_t* cq_head_;         /**< Head of the completion queue (written by the application). */
+        uint32_t* cq_tail_;         /**< Tail of the completion queue (written by the kernel). */
+        uint32_t cq_mask_;          /**< Mask of the completion queue indices. */
+        void* cqes_;                /**< Completion queue entries. */
+
+    public:
+        /**
+         * Constructor to initialize a closed IoRing.
+         */
+        IoRing();
+
+        /**
+         * Destructor which releases the ring.
+         * @note All submitted reads must be completed beforehand.
+         */
+        ~IoRing();
+
+        IoRing(const IoRing&) = delete;
+        IoRing& operator=(const IoRing&) = delete;
+
+        /**
+         * Creates the ring.
+         * @param entries Maximum number of reads in flight.
+         * @return True, if io_uring is available
+         */
+        bool Open(uint32_t entries);
+
+        /**
+         * Releases the ring. Reads in flight are cancelled by the kernel.
+         */
+        void Close();
+
+        /**
+         * Checks whether the ring is open.
+         * @return True, if the ring is open
+         */
+        bool IsOpen() const { return ring_fd_ >= 0; }
+
+        /**
+         * Get the maximum number of reads in flight.
+         * @return Number of submission queue entries
+         */
+        uint32_t GetEntryCount() const { return entries_; }
+
+        /**
+         * Get the number of reads in flight requested by Open(), which may
+         * be rounded up by the kernel, see GetEntryCount().
+         * @return Requested queue depth (0 = not opened yet)
+         */
+        uint32_t GetDepth() const { return depth_; }
+
+        /**
+         * Prepares a read, which is passed to the kernel by the next Submit() or Wait().
+         * @note At most GetEntryCount() reads may be in flight.
+         * @param fd File descriptor of the file.
+         * @param data Buffer where to read to (must stay valid until completion).
+         * @param size Number of bytes to read.
+         * @param offset Offset within the file.
+         * @param user_data Value returned with the completion.
+         */
+        void PrepareRead(int fd, void* data, uint32_t size, uint64_t offset, uint64_t user_data);
+
+        /**
+         * Passes all prepared reads to the kernel.
+         */
+        void Submit();
+
+        /**
+         * Blocks until a read completes.
+         * @return User data of the read and its result (number of bytes read or -errno)
+         */
+        std::pair<uint64_t, int32_t> Wait();
+
+        /**
+         * Get a completed read without blocking.
+         * @param completion User data of the read and its result (number of bytes read or -errno).
+         * @return True, if a read has completed
+         */
+        bool Peek(std::pair<uint64_t, int32_t>& completion);
+
+        /**
+         * Checks whether io_uring is supported by the build and the kernel.
+         * @return True, if io_uring is available
+         */
+        static bool IsAvailable();
+};
+
+#endif /* __IORING_H__ */
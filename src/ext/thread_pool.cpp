@@ -0,0 +1,68 @@
+#include "thread_pool.h"
+
+#include "buffer_pool.h"
+
+
+ThreadPool::ThreadPool(unsigned int thread_count) :
+    active_count_(0), stop_(false)
+{
+    if (thread_count == 0)
+        thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0)
+        thread_count = 1;  // hardware_concurrency() may not be computable
+
+    for (unsigned int i = 0; i < thread_count; i++)
+        threads_.emplace_back(&ThreadPool::Run, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    task_cv_.notify_all();
+    for (std::thread& thread: threads_)
+        thread.join();
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        tasks_.push(std::move(task));
+    }
+    task_cv_.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cv_.wait(lock, [this] { return tasks_.empty() && active_count_ == 0; });
+}
+
+void ThreadPool::Run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            task_cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if (stop_ && tasks_.empty())
+                return;
+            task = std::move(tasks_.front());
+            tasks_.pop();
+            active_count_ += 1;
+        }
+
+        task();
+
+        bool idle;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            active_count_ -= 1;
+            if (tasks_.empty() && active_count_ == 0)
+                idle_cv_.notify_all();
+            idle = tasks_.empty();
+        }
+        // an idle worker does not hold pooled buffers, e.g. of a long-lived writer
+        if (idle)
+            BufferPool::Trim();
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Internal class for running tasks on a fixed number of worker threads.
+ * A worker which finds the queue empty frees the buffers it cached from
+ * the BufferPool, so idle workers hold no scratch memory.
+ */
+class ThreadPool {
+    private:
+        std::vector<std::thread> threads_;          /**< Worker threads. */
+        std::queue<std::function<void()>> tasks_;   /**< Queue of pending tasks. */
+        std::mutex mutex_;                          /**< Mutex guarding the task queue. */
+        std::condition_variable task_cv_;           /**< Signals a new task or the shutdown of the pool. */
+        std::condition_variable idle_cv_;           /**< Signals that all tasks are done. */
+        unsigned int active_count_;                 /**< Number of tasks currently running. */
+        bool stop_;                                 /**< If true, the workers terminate once the queue is empty. */
+
+        /**
+         * Main loop of a worker thread.
+         */
+        void Run();
+
+    public:
+        /**
+         * Constructor to initialize a ThreadPool.
+         * @param thread_count Number of worker threads (0 = number of hardware threads).
+         */
+        explicit ThreadPool(unsigned int thread_count=0);
+
+        /**
+         * Destructor which finishes all pending tasks and joins the worker threads.
+         */
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /**
+         * Get the number of worker threads.
+         * @return Number of worker threads
+         */
+        unsigned int GetThreadCount() { return threads_.size(); }
+
+        /**
+         * Adds a task to the queue.
+         * @note A task may submit further tasks but must not throw.
+         * @param task Task to run on a worker thread.
+         */
+        void Submit(std::function<void()> task);
+
+        /**
+         * Blocks until the queue is empty and no task is running.
+         */
+        void Wait();
+};
+
+#endif /* __THREADPOOL_H__ */
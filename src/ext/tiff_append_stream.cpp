@@ -0,0 +1,152 @@
+#include "tiff_append_stream.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+
+TiffAppendStream::TiffAppendStream(int fd, uint8 header_size, int direct_fd) :
+    fd_(fd), header_size_(header_size), position_(0), direct_fd_(direct_fd),
+    staging_(nullptr, free), staging_offset_(0), staged_begin_(0), staged_size_(0)
+{
+    std::memset(header_, 0, sizeof(header_));
+    start_size_ = get_file_size(fd_);
+    // the data of the first subfile of a file follows the header
+    size_ = std::max<uint64>(start_size_, header_size_);
+    if (direct_fd_ >= 0)
+        staging_ = allocate_aligned(kDirectStagingSize, kDirectBlockSize);
+}
+
+TIFF* TiffAppendStream::Open(const std::string& mode) {
+    position_ = 0;
+    return TIFFClientOpen(
+        "append", mode.c_str(), static_cast<thandle_t>(this),
+        ReadProc, WriteProc, SeekProc, CloseProc, SizeProc, MapProc, UnmapProc
+    );
+}
+
+void TiffAppendStream::Stage(const uint8* data, uint64 size, uint64 offset) {
+    if (staged_size_ > 0 && offset != staging_offset_ + staged_size_)
+        Flush();
+
+    if (staged_size_ == 0) {
+        // the partial block before the bytes is read when it is written
+        staging_offset_ = offset - offset % kDirectBlockSize;
+        staged_begin_ = staged_size_ = offset - staging_offset_;
+    }
+
+    while (size > 0) {
+        const uint64 count = std::min(size, kDirectStagingSize - staged_size_);
+        std::memcpy(staging_.get() + staged_size_, data, count);
+        staged_size_ += count;
+        data += count;
+        size -= count;
+        if (staged_size_ == kDirectStagingSize) {
+            write_staged_direct(direct_fd_, fd_, staging_.get(), staging_offset_, staged_begin_, staged_size_);
+            staging_offset_ += staged_size_;
+            staged_begin_ = staged_size_ = 0;
+        }
+    }
+}
+
+void TiffAppendStream::Flush() {
+    if (staged_size_ == 0)
+        return;
+
+    write_staged_direct(direct_fd_, fd_, staging_.get(), staging_offset_, staged_begin_, staged_size_);
+    staged_begin_ = staged_size_ = 0;
+}
+
+void TiffAppendStream::Discard() {
+    staged_size_ = 0;
+    truncate_file(fd_, start_size_);
+    size_ = std::max<uint64>(start_size_, header_size_);
+}
+
+tmsize_t TiffAppendStream::ReadProc(thandle_t handle, void* data, tmsize_t size) {
+    TiffAppendStream* stream = static_cast<TiffAppendStream*>(handle);
+    if (stream->position_ >= stream->size_)
+        return 0;
+    uint64 available = stream->size_ - stream->position_;
+    if (static_cast<uint64>(size) > available)
+        size = available;
+
+    uint8* ptr = static_cast<uint8*>(data);
+    uint64 position = stream->position_;
+    uint64 remaining = size;
+    if (position < stream->header_size_) {
+        uint64 count = std::min<uint64>(remaining, stream->header_size_ - position);
+        std::memcpy(ptr, &stream->header_[position], count);
+        ptr += count;
+        position += count;
+        remaining -= count;
+    }
+    try {
+        stream->Flush();
+        if (remaining > 0)
+            read_at(stream->fd_, ptr, remaining, position);
+    } catch (const std::runtime_error&) {
+        return -1;  // exceptions must not pass through libtiff
+    }
+    stream->position_ += size;
+    return size;
+}
+
+tmsize_t TiffAppendStream::WriteProc(thandle_t handle, void* data, tmsize_t size) {
+    TiffAppendStream* stream = static_cast<TiffAppendStream*>(handle);
+    const uint8* ptr = static_cast<const uint8*>(data);
+    uint64 position = stream->position_;
+    uint64 remaining = size;
+
+    // the header of the new file must not overwrite the existing file
+    if (position < stream->header_size_) {
+        uint64 count = std::min<uint64>(remaining, stream->header_size_ - position);
+        std::memcpy(&stream->header_[position], ptr, count);
+        ptr += count;
+        position += count;
+        remaining -= count;
+    }
+    if (remaining > 0 && position < stream->start_size_)
+        return -1;  // the existing file is never modified
+    try {
+        if (remaining > 0 && stream->direct_fd_ >= 0)
+            stream->Stage(ptr, remaining, position);
+        else if (remaining > 0)
+            write_at(stream->fd_, ptr, remaining, position);
+    } catch (const std::runtime_error&) {
+        return -1;
+    }
+    stream->position_ += size;
+    stream->size_ = std::max(stream->size_, stream->position_);
+    return size;
+}
+
+toff_t TiffAppendStream::SeekProc(thandle_t handle, toff_t offset, int whence) {
+    TiffAppendStream* stream = static_cast<TiffAppendStream*>(handle);
+    switch (whence) {
+        case SEEK_SET:
+            stream->position_ = offset;
+            break;
+        case SEEK_CUR:
+            stream->position_ += offset;
+            break;
+        case SEEK_END:
+            stream->position_ = stream->size_ + offset;
+            break;
+    }
+    return stream->position_;
+}
+
+int TiffAppendStream::CloseProc(thandle_t) {
+    return 0;  // the file is closed by the owner of the descriptor
+}
+
+toff_t TiffAppendStream::SizeProc(thandle_t handle) {
+    return static_cast<TiffAppendStream*>(handle)->size_;
+}
+
+int TiffAppendStream::MapProc(thandle_t, void**, toff_t*) {
+    return 0;
+}
+
+void TiffAppendStream::UnmapProc(thandle_t, void*, toff_t) {
+}
@@ -0,0 +1,99 @@
+#ifndef __TIFFAPPENDSTREAM_H__
+#define __TIFFAPPENDSTREAM_H__
+
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <tiffio.h>
+
+#include "utils.h"
+
+
+/**
+ * Internal class providing libtiff with a new TIFF file which is appended
+ * to an existing file. The stream is opened by TIFFClientOpen() in write
+ * mode and starts at the end of the existing file, so libtiff writes the
+ * tiles/strips and the directory of a subfile straight to their final
+ * offsets. Only the header of the new file is kept in memory, because it
+ * would overwrite the header of the existing file. Thus, a subfile is
+ * streamed to disk while it is encoded and the caller publishes it by
+ * writing the header or by linking its directory. With direct I/O, the
+ * written bytes are collected in a bounded staging buffer, which is
+ * written by large aligned writes whenever it is full.
+ */
+class TiffAppendStream {
+    private:
+        int fd_;                    /**< File descriptor of the existing file. */
+        uint8 header_[16];          /**< Header of the new file. */
+        uint8 header_size_;         /**< Size of the header in bytes (8 = classic TIFF, 16 = BigTIFF). */
+        uint64 start_size_;         /**< Size of the existing file in bytes. */
+        uint64 size_;               /**< Size of the file including the appended data in bytes. */
+        uint64 position_;           /**< Current position within the file. */
+        int direct_fd_;             /**< File descriptor of the existing file for direct I/O (-1 = buffered I/O). */
+        std::unique_ptr<char, void (*)(void*)> staging_;    /**< Aligned staging buffer of the direct writes. */
+        uint64 staging_offset_;     /**< File offset of the staging buffer (block-aligned). */
+        uint64 staged_begin_;       /**< Position of the first staged byte within the staging buffer. */
+        uint64 staged_size_;        /**< Number of bytes held by the staging buffer (including the partial block before the staged bytes). */
+
+        /**
+         * Writes a block of bytes through the staging buffer. The buffer is
+         * written whenever it is full, or flushed first if the bytes do not
+         * continue the staged ones.
+         * @param data Source buffer.
+         * @param size Number of bytes to write.
+         * @param offset File offset of the first byte.
+         */
+        void Stage(const uint8* data, uint64 size, uint64 offset);
+
+        static tmsize_t ReadProc(thandle_t handle, void* data, tmsize_t size);    /**< Read routine for libtiff. */
+        static tmsize_t WriteProc(thandle_t handle, void* data, tmsize_t size);   /**< Write routine for libtiff. */
+        static toff_t SeekProc(thandle_t handle, toff_t offset, int whence);      /**< Seek routine for libtiff. */
+        static int CloseProc(thandle_t handle);                                   /**< Close routine for libtiff. */
+        static toff_t SizeProc(thandle_t handle);                                 /**< Size routine for libtiff. */
+        static int MapProc(thandle_t handle, void** base, toff_t* size);          /**< Map routine for libtiff. */
+        static void UnmapProc(thandle_t handle, void* base, toff_t size);         /**< Unmap routine for libtiff. */
+
+    public:
+        /**
+         * Constructor to initialize a TiffAppendStream at the end of a file.
+         * @param fd File descriptor of the existing file (opened for writing).
+         * @param header_size Size of the header in bytes (8 = classic TIFF, 16 = BigTIFF).
+         * @param direct_fd File descriptor of the existing file opened by open_file_direct() (-1 = buffered I/O).
+         */
+        TiffAppendStream(int fd, uint8 header_size, int direct_fd=-1);
+
+        TiffAppendStream(const TiffAppendStream&) = delete;
+        TiffAppendStream& operator=(const TiffAppendStream&) = delete;
+
+        /**
+         * Opens the new file.
+         * @note The stream must outlive the returned TIFF handle.
+         * @param mode File mode as for TIFFOpen() (write mode).
+         * @return TIFF handle from libtiff
+         */
+        TIFF* Open(const std::string& mode);
+
+        /**
+         * Get the header of the new file, which holds the offset of its
+         * first directory once the TIFF handle is closed.
+         * @return Header of the new file
+         */
+        const uint8* GetHeader() const { return header_; }
+
+        /**
+         * Writes the bytes held by the staging buffer by
+         * write_staged_direct(), which pads the partial blocks with the
+         * content of the file. Must be called once the TIFF handle is
+         * closed.
+         */
+        void Flush();
+
+        /**
+         * Truncates the existing file to its size before the stream was
+         * opened, e.g. to drop the data of a subfile which failed to encode.
+         */
+        void Discard();
+};
+
+#endif /* __TIFFAPPENDSTREAM_H__ */
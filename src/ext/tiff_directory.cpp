@@ -0,0 +1,302 @@
+#include "tiff_directory.h"
+
+
+TiffDirectory::TiffDirectory(int fd, uint64 offset) :
+    fd_(fd), offset_(offset)
+{
+    uint8 header[4];
+    read_at(fd_, header, 4, 0);
+    big_endian_ = header[0] == 'M';
+    big_tiff_ = DecodeUInt(&header[2], 2, big_endian_) == 43;
+
+    const uint8 count_size = big_tiff_ ? 8 : 2;
+    const uint8 entry_size = big_tiff_ ? 20 : 12;
+    const uint8 offset_size = big_tiff_ ? 8 : 4;
+
+    uint8 count_bytes[8];
+    read_at(fd_, count_bytes, count_size, offset_);
+    uint64 entry_count = DecodeUInt(count_bytes, count_size, big_endian_);
+
+    std::vector<uint8> bytes(entry_count * entry_size);
+    read_at(fd_, bytes.data(), bytes.size(), offset_ + count_size);
+    for (uint64 entry_idx = 0; entry_idx < entry_count; entry_idx++) {
+        const uint8* entry_ptr = &bytes[entry_idx * entry_size];
+        const uint64 entry_position = offset_ + count_size + entry_idx * entry_size;
+
+        Entry entry;
+        entry.position = entry_position;
+        entry.tag = DecodeUInt(entry_ptr, 2, big_endian_);
+        entry.type = DecodeUInt(entry_ptr + 2, 2, big_endian_);
+        entry.count = DecodeUInt(entry_ptr + 4, offset_size, big_endian_);
+        // values which fit into the value field are stored inline
+        if (entry.count * GetTypeSize(entry.type) <= offset_size) {
+            entry.value_position = entry_position + 4 + offset_size;
+        } else {
+            entry.value_position = DecodeUInt(entry_ptr + 4 + offset_size, offset_size, big_endian_);
+        }
+        entries_[entry.tag] = entry;
+    }
+    next_position_ = offset_ + count_size + entry_count * entry_size;
+}
+
+uint8 TiffDirectory::GetTypeSize(uint16 type) {
+    switch (type) {
+        case TIFF_BYTE:
+        case TIFF_ASCII:
+        case TIFF_SBYTE:
+        case TIFF_UNDEFINED:
+            return 1;
+        case TIFF_SHORT:
+        case TIFF_SSHORT:
+            return 2;
+        case TIFF_LONG:
+        case TIFF_SLONG:
+        case TIFF_FLOAT:
+        case TIFF_IFD:
+            return 4;
+        case TIFF_RATIONAL:
+        case TIFF_SRATIONAL:
+        case TIFF_DOUBLE:
+        case TIFF_LONG8:
+        case TIFF_SLONG8:
+        case TIFF_IFD8:
+            return 8;
+        default:
+            throw std::runtime_error("Found unsupported field type: " + std::to_string(type) + "!");
+    }
+}
+
+uint64 TiffDirectory::GetFirstOffset(int fd) {
+    uint8 header[16];
+    read_at(fd, header, 8, 0);
+    bool big_endian = header[0] == 'M';
+    if (DecodeUInt(&header[2], 2, big_endian) == 43) {
+        read_at(fd, &header[8], 8, 8);
+        return DecodeUInt(&header[8], 8, big_endian);
+    }
+    return DecodeUInt(&header[4], 4, big_endian);
+}
+
+void TiffDirectory::SetFirstOffset(int fd, uint64 first_offset) {
+    uint8 header[8];
+    read_at(fd, header, 4, 0);
+    bool big_endian = header[0] == 'M';
+    if (DecodeUInt(&header[2], 2, big_endian) == 43) {
+        EncodeUInt(header, 8, first_offset, big_endian);
+        write_at(fd, header, 8, 8);
+    } else {
+        EncodeUInt(header, 4, first_offset, big_endian);
+        write_at(fd, header, 4, 4);
+    }
+}
+
+std::vector<uint64> TiffDirectory::GetChainOffsets(int fd, uint64 offset) {
+    uint8 header[4];
+    read_at(fd, header, 4, 0);
+    const bool big_endian = header[0] == 'M';
+    const bool big_tiff = DecodeUInt(&header[2], 2, big_endian) == 43;
+    const uint8 count_size = big_tiff ? 8 : 2;
+    const uint8 entry_size = big_tiff ? 20 : 12;
+    const uint8 offset_size = big_tiff ? 8 : 4;
+    const uint64 file_size = get_file_size(fd);
+
+    if (offset == 0)
+        offset = GetFirstOffset(fd);
+
+    std::vector<uint64> offsets;
+    std::set<uint64> visited;
+    uint8 bytes[8];
+    while (offset != 0 && offset + count_size <= file_size && visited.insert(offset).second) {
+        read_at(fd, bytes, count_size, offset);
+        uint64 next_position = offset + count_size + DecodeUInt(bytes, count_size, big_endian) * entry_size;
+        if (next_position + offset_size > file_size)
+            break;  // the IFD is still being written
+        offsets.push_back(offset);
+
+        read_at(fd, bytes, offset_size, next_position);
+        offset = DecodeUInt(bytes, offset_size, big_endian);
+    }
+    return offsets;
+}
+
+uint64 TiffDirectory::DecodeUInt(const uint8* bytes, uint8 size, bool big_endian) {
+    uint64 value = 0;
+    for (uint8 i = 0; i < size; i++)
+        value |= uint64(bytes[big_endian ? size - 1 - i : i]) << (8 * i);
+    return value;
+}
+
+void TiffDirectory::EncodeUInt(uint8* bytes, uint8 size, uint64 value, bool big_endian) {
+    for (uint8 i = 0; i < size; i++)
+        bytes[big_endian ? size - 1 - i : i] = (value >> (8 * i)) & 0xff;
+}
+
+const TiffDirectory::Entry& TiffDirectory::GetEntry(uint16 tag) const {
+    auto it = entries_.find(tag);
+    if (it == entries_.end())
+        throw std::runtime_error("Missing field '" + std::to_string(tag) + "'!");
+    return it->second;
+}
+
+uint64 TiffDirectory::GetValue(uint16 tag, uint64 value_idx) const {
+    const Entry& entry = GetEntry(tag);
+    if (value_idx >= entry.count)
+        throw std::out_of_range("Value index out of range!");
+
+    uint8 size = GetTypeSize(entry.type);
+    uint8 bytes[8];
+    read_at(fd_, bytes, size, entry.value_position + value_idx * size);
+    return DecodeUInt(bytes, size, big_endian_);
+}
+
+std::vector<uint64> TiffDirectory::GetValues(uint16 tag) const {
+    const Entry& entry = GetEntry(tag);
+
+    uint8 size = GetTypeSize(entry.type);
+    std::vector<uint8> bytes(entry.count * size);
+    read_at(fd_, bytes.data(), bytes.size(), entry.value_position);
+
+    std::vector<uint64> values(entry.count);
+    for (uint64 value_idx = 0; value_idx < entry.count; value_idx++)
+        values[value_idx] = DecodeUInt(&bytes[value_idx * size], size, big_endian_);
+    return values;
+}
+
+std::vector<uint8> TiffDirectory::GetRawValues(uint16 tag) const {
+    const Entry& entry = GetEntry(tag);
+
+    std::vector<uint8> bytes(entry.count * GetTypeSize(entry.type));
+    read_at(fd_, bytes.data(), bytes.size(), entry.value_position);
+    return bytes;
+}
+
+void TiffDirectory::SetValue(uint16 tag, uint64 value_idx, uint64 value) {
+    const Entry& entry = GetEntry(tag);
+    if (value_idx >= entry.count)
+        throw std::out_of_range("Value index out of range!");
+
+    uint8 size = GetTypeSize(entry.type);
+    if (size < 8 && (value >> (8 * size)) != 0)
+        throw std::runtime_error(
+            "Value " + std::to_string(value) + " exceeds the field type of tag '" + std::to_string(tag) + "'!"
+        );
+
+    uint8 bytes[8];
+    EncodeUInt(bytes, size, value, big_endian_);
+    write_at(fd_, bytes, size, entry.value_position + value_idx * size);
+}
+
+uint64 TiffDirectory::GetNextOffset() const {
+    uint8 size = big_tiff_ ? 8 : 4;
+    uint8 bytes[8];
+    read_at(fd_, bytes, size, next_position_);
+    return DecodeUInt(bytes, size, big_endian_);
+}
+
+void TiffDirectory::SetNextOffset(uint64 next_offset) {
+    uint8 size = big_tiff_ ? 8 : 4;
+    uint8 bytes[8];
+    EncodeUInt(bytes, size, next_offset, big_endian_);
+    write_at(fd_, bytes, size, next_position_);
+}
+
+void TiffDirectory::Relocate(
+    uint8* bytes, uint64 size, uint64 position, uint64 ifd_offset, uint64 delta, bool big_endian, bool big_tiff
+) {
+    const uint8 count_size = big_tiff ? 8 : 2;
+    const uint8 entry_size = big_tiff ? 20 : 12;
+    const uint8 offset_size = big_tiff ? 8 : 4;
+
+    // the positions are checked, as a corrupt IFD must not patch other bytes
+    auto get_ptr = [bytes, size, position](uint64 offset, uint64 count) {
+        if (offset < position || offset - position > size || count > size - (offset - position))
+            throw std::runtime_error("The directory refers to data outside of the relocated bytes!");
+        return bytes + (offset - position);
+    };
+
+    const uint64 entry_count = DecodeUInt(get_ptr(ifd_offset, count_size), count_size, big_endian);
+    uint8* entries_ptr = get_ptr(ifd_offset + count_size, entry_count * entry_size);
+    for (uint64 entry_idx = 0; entry_idx < entry_count; entry_idx++) {
+        uint8* entry_ptr = entries_ptr + entry_idx * entry_size;
+        const uint16 tag = DecodeUInt(entry_ptr, 2, big_endian);
+        const uint8 type_size = GetTypeSize(DecodeUInt(entry_ptr + 2, 2, big_endian));
+        const uint64 count = DecodeUInt(entry_ptr + 4, offset_size, big_endian);
+        uint8* value_ptr = entry_ptr + 4 + offset_size;
+
+        // values which fit into the value field are stored inline
+        if (count * type_size > offset_size) {
+            const uint64 value_position = DecodeUInt(value_ptr, offset_size, big_endian);
+            EncodeUInt(value_ptr, offset_size, value_position + delta, big_endian);
+            if (tag == TIFFTAG_TILEOFFSETS || tag == TIFFTAG_STRIPOFFSETS)
+                value_ptr = get_ptr(value_position, count * type_size);
+        }
+        if (tag != TIFFTAG_TILEOFFSETS && tag != TIFFTAG_STRIPOFFSETS)
+            continue;
+
+        for (uint64 value_idx = 0; value_idx < count; value_idx++) {
+            uint8* ptr = value_ptr + value_idx * type_size;
+            const uint64 value = DecodeUInt(ptr, type_size, big_endian) + delta;
+            if (type_size < 8 && (value >> (8 * type_size)) != 0)
+                throw std::runtime_error(
+                    "Value " + std::to_string(value) + " exceeds the field type of tag '" + std::to_string(tag) + "'!"
+                );
+            EncodeUInt(ptr, type_size, value, big_endian);
+        }
+    }
+}
+
+uint64 TiffDirectory::CopyTo(int out_fd, const std::map<uint16, std::vector<uint64>>& values) const {
+    const uint8 count_size = big_tiff_ ? 8 : 2;
+    const uint8 entry_size = big_tiff_ ? 20 : 12;
+    const uint8 offset_size = big_tiff_ ? 8 : 4;
+
+    // IFDs and values are written at word boundaries
+    uint64 offset = get_file_size(out_fd);
+    offset += offset & 1;
+
+    // the entries are followed by the next IFD offset (0) and the values
+    // which do not fit into the value field
+    std::vector<uint8> bytes(count_size + entries_.size() * entry_size + offset_size, 0);
+    EncodeUInt(bytes.data(), count_size, entries_.size(), big_endian_);
+
+    uint64 entry_idx = 0;
+    for (const auto& item: entries_) {  // ordered by tag as required
+        const Entry& entry = item.second;
+        uint8* entry_ptr = &bytes[count_size + entry_idx * entry_size];
+        entry_idx += 1;
+
+        std::vector<uint8> value_bytes;
+        auto it = values.find(entry.tag);
+        if (it != values.end()) {
+            const uint8 size = GetTypeSize(entry.type);
+            if (it->second.size() != entry.count)
+                throw std::runtime_error("Invalid number of values for tag '" + std::to_string(entry.tag) + "'!");
+            value_bytes.resize(entry.count * size);
+            for (uint64 value_idx = 0; value_idx < entry.count; value_idx++) {
+                uint64 value = it->second[value_idx];
+                if (size < 8 && (value >> (8 * size)) != 0)
+                    throw std::runtime_error(
+                        "Value " + std::to_string(value) + " exceeds the field type of tag '" + std::to_string(entry.tag) + "'!"
+                    );
+                EncodeUInt(&value_bytes[value_idx * size], size, value, big_endian_);
+            }
+        } else {
+            value_bytes = GetRawValues(entry.tag);
+        }
+
+        EncodeUInt(entry_ptr, 2, entry.tag, big_endian_);
+        EncodeUInt(entry_ptr + 2, 2, entry.type, big_endian_);
+        EncodeUInt(entry_ptr + 4, offset_size, entry.count, big_endian_);
+        if (value_bytes.size() <= offset_size) {
+            std::copy(value_bytes.begin(), value_bytes.end(), entry_ptr + 4 + offset_size);
+        } else {
+            EncodeUInt(entry_ptr + 4 + offset_size, offset_size, offset + bytes.size(), big_endian_);
+            bytes.insert(bytes.end(), value_bytes.begin(), value_bytes.end());
+            if (bytes.size() & 1)
+                bytes.push_back(0);
+        }
+    }
+
+    write_at(out_fd, bytes.data(), bytes.size(), offset);
+    return offset;
+}
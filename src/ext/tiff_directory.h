@@ -0,0 +1,205 @@
+#ifndef __TIFFDIRECTORY_H__
+#define __TIFFDIRECTORY_H__
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <tiffio.h>
+#include "utils.h"
+
+
+/**
+ * Internal class providing raw access to an image file directory (IFD).
+ * libtiff can only append to a TIFF file. This class reads the entries of
+ * an IFD and patches their values in place, e.g. to relocate a tile.
+ */
+class TiffDirectory {
+    public:
+        /**
+         * Structure for an IFD entry.
+         */
+        struct Entry {
+            uint16 tag;             /**< Tag of the entry. */
+            uint16 type;            /**< Field type of the entry (e.g. TIFF_LONG). */
+            uint64 count;           /**< Number of values. */
+            uint64 value_position;  /**< File position of the first value. */
+            uint64 position;        /**< File position of the entry. */
+        };
+
+    private:
+        int fd_;                            /**< File descriptor of the TIFF file. */
+        bool big_endian_;                   /**< If true, the TIFF file uses the big-endian byte order. */
+        bool big_tiff_;                     /**< If true, the TIFF file is a BigTIFF file. */
+        uint64 offset_;                     /**< File offset of the IFD. */
+        uint64 next_position_;              /**< File position of the offset to the next IFD. */
+        std::map<uint16, Entry> entries_;   /**< Map of the entries per tag. */
+
+    public:
+        /**
+         * Decodes an unsigned integer stored in a given byte order.
+         * @param bytes Encoded integer.
+         * @param size Size of the integer in bytes.
+         * @param big_endian If true, the integer is stored in big-endian byte order.
+         * @return Decoded integer
+         */
+        static uint64 DecodeUInt(const uint8* bytes, uint8 size, bool big_endian);
+
+        /**
+         * Encodes an unsigned integer in a given byte order.
+         * @param bytes Destination of the encoded integer.
+         * @param size Size of the integer in bytes.
+         * @param value Integer to encode.
+         * @param big_endian If true, the integer is stored in big-endian byte order.
+         */
+        static void EncodeUInt(uint8* bytes, uint8 size, uint64 value, bool big_endian);
+
+        /**
+         * Constructor which reads the entries of an IFD.
+         * @param fd File descriptor of the TIFF file.
+         * @param offset File offset of the IFD.
+         */
+        TiffDirectory(int fd, uint64 offset);
+
+        /**
+         * Get the size of a value of a field type.
+         * @param type Field type (e.g. TIFF_LONG).
+         * @return Size of a value in bytes
+         */
+        static uint8 GetTypeSize(uint16 type);
+
+        /**
+         * Get the offset of the first IFD from the header of a TIFF file.
+         * @param fd File descriptor of the TIFF file.
+         * @return File offset of the first IFD
+         */
+        static uint64 GetFirstOffset(int fd);
+
+        /**
+         * Overwrites the offset of the first IFD within the header of a TIFF file.
+         * @param fd File descriptor of the TIFF file.
+         * @param first_offset File offset of the first IFD.
+         */
+        static void SetFirstOffset(int fd, uint64 first_offset);
+
+        /**
+         * Get the offsets of the IFDs of a chain. Only the entry count and the
+         * offset to the next IFD are read per IFD, the entries are skipped.
+         * The walk ends at an IFD beyond the end of the file or at a loop.
+         * @param fd File descriptor of the TIFF file.
+         * @param offset File offset of the first IFD to visit (0 = first IFD of the file).
+         * @return File offsets of the IFDs in the order of the chain
+         */
+        static std::vector<uint64> GetChainOffsets(int fd, uint64 offset=0);
+
+        /**
+         * Get the file offset of the IFD.
+         * @return File offset of the IFD
+         */
+        uint64 GetOffset() const { return offset_; }
+
+        /**
+         * Check if the TIFF file is a BigTIFF file.
+         * @return True, if the file is a BigTIFF file. Otherwise, false.
+         */
+        bool IsBigTiff() const { return big_tiff_; }
+
+        /**
+         * Check if the TIFF file uses the big-endian byte order.
+         * @return True, if the file is big-endian. Otherwise, false.
+         */
+        bool IsBigEndian() const { return big_endian_; }
+
+        /**
+         * Get all entries of the IFD.
+         * @return Map of the entries per tag
+         */
+        const std::map<uint16, Entry>& GetEntries() const { return entries_; }
+
+        /**
+         * Check if the IFD has an entry for a tag.
+         * @param tag Tag of the entry.
+         * @return True, if the entry exists. Otherwise, false.
+         */
+        bool HasEntry(uint16 tag) const { return entries_.count(tag) > 0; }
+
+        /**
+         * Get the entry of a tag.
+         * @param tag Tag of the entry.
+         * @return Entry of the tag
+         */
+        const Entry& GetEntry(uint16 tag) const;
+
+        /**
+         * Get a single integer value of an entry.
+         * @param tag Tag of the entry.
+         * @param value_idx Index of the value.
+         * @return Value of the entry
+         */
+        uint64 GetValue(uint16 tag, uint64 value_idx=0) const;
+
+        /**
+         * Get all integer values of an entry.
+         * @param tag Tag of the entry.
+         * @return Values of the entry
+         */
+        std::vector<uint64> GetValues(uint16 tag) const;
+
+        /**
+         * Get the values of an entry as stored in the file.
+         * @param tag Tag of the entry.
+         * @return Values of the entry in the byte order of the file
+         */
+        std::vector<uint8> GetRawValues(uint16 tag) const;
+
+        /**
+         * Overwrites a single integer value of an entry within the file.
+         * @param tag Tag of the entry.
+         * @param value_idx Index of the value.
+         * @param value New value.
+         */
+        void SetValue(uint16 tag, uint64 value_idx, uint64 value);
+
+        /**
+         * Get the offset of the next IFD.
+         * @return File offset of the next IFD (0 = end of the chain)
+         */
+        uint64 GetNextOffset() const;
+
+        /**
+         * Overwrites the offset of the next IFD within the file.
+         * @param next_offset File offset of the next IFD (0 = end of the chain).
+         */
+        void SetNextOffset(uint64 next_offset);
+
+        /**
+         * Moves all file offsets of an IFD held in memory, i.e. the positions
+         * of the values and the tile/strip offsets, before the IFD and the
+         * data it refers to are written to another position of the file.
+         * Thus, the IFD is written once with its final offsets.
+         * @param bytes Bytes holding the IFD and the values it refers to.
+         * @param size Number of bytes.
+         * @param position File offset of the first byte before the move.
+         * @param ifd_offset File offset of the IFD before the move.
+         * @param delta Distance the data is moved by in bytes.
+         * @param big_endian If true, the TIFF file uses the big-endian byte order.
+         * @param big_tiff If true, the TIFF file is a BigTIFF file.
+         */
+        static void Relocate(
+            uint8* bytes, uint64 size, uint64 position, uint64 ifd_offset, uint64 delta, bool big_endian, bool big_tiff
+        );
+
+        /**
+         * Appends a copy of the IFD to another TIFF file of the same byte
+         * order and version. The offset to the next IFD of the copy is 0.
+         * @param out_fd File descriptor of the TIFF file to write to.
+         * @param values Map of the integer values per tag replacing those of this IFD (e.g. relocated tiles).
+         * @return File offset of the copied IFD
+         */
+        uint64 CopyTo(int out_fd, const std::map<uint16, std::vector<uint64>>& values) const;
+};
+
+#endif /* __TIFFDIRECTORY_H__ */
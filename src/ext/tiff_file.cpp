@@ -1,401 +1,1774 @@
 #include "tiff_file.h"
 
 
-TiffFile::TiffFile(const std::string& file_path, uint8 version) :
-    file_path_(file_path), version_(version), subfile_count_(0)
+TiffFile::TiffFile() :
+    version_(42), subfile_count_(0),
+    session_fd_(-1), session_big_endian_(false), session_direct_fd_(-1), direct_io_(false), stack_frame_count_(0),
+    memory_tiff_(nullptr), buffer_data_(nullptr), buffer_size_(0), read_gap_(64 * 1024), queue_depth_(64), readahead_(16 * 1024 * 1024), use_index_(false),
+    output_pool_size_(0), output_pool_uses_(0)
 {
+}
+
+TiffFile::TiffFile(const std::string& file_path, uint8 version, bool use_index) : TiffFile() {
+    file_path_ = file_path;
+    version_ = version;
+    use_index_ = use_index;
     if (!file_exists(file_path_))
         return;
 
-    TIFF* tiff = TIFFOpen(file_path_.c_str(), "r");
+    bool complete;
+    if (use_index_ && LoadIndex(complete)) {
+        if (!complete) {
+            // only the appended subfiles are parsed
+            Refresh();
+            SaveIndex();
+        }
+        return;
+    }
+
+    // only the IFD chain is walked, the directories are parsed on first access
+    int fd = open_file(file_path_);
+    try {
+        uint8 header[4];
+        if (get_file_size(fd) < 8)
+            throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
+        read_at(fd, header, 4, 0);
+        if ((header[0] != 'I' || header[1] != 'I') && (header[0] != 'M' || header[1] != 'M'))
+            throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
+
+        uint16 version = TiffDirectory::DecodeUInt(&header[2], 2, header[0] == 'M');
+        if (version != 42 && version != 43)
+            throw std::runtime_error("Found unsupported TIFF version: " + std::to_string(version) + "!");
+        version_ = version;
+
+        ReadChain(fd, 0, 0);
+    } catch (...) {
+        close_file(fd);
+        throw;
+    }
+    close_file(fd);
+
+    if (use_index_)
+        SaveIndex();
+}
+
+TiffFile::~TiffFile() {
+    if (async_writer_ != nullptr)
+        StopAsyncWriter();
+    if (session_direct_fd_ >= 0)
+        close_file(session_direct_fd_);
+    if (session_fd_ >= 0)
+        close_file(session_fd_);
+    if (memory_tiff_ != nullptr)
+        TIFFClose(memory_tiff_);
+}
+
+std::unique_ptr<TiffFile> TiffFile::FromBuffer(py::buffer buffer) {
+    py::buffer_info info = buffer.request();
+    if (info.ndim != 1 || info.strides[0] != info.itemsize)
+        throw std::runtime_error("The buffer must be one-dimensional and contiguous!");
+
+    // the buffer is referenced, not copied
+    std::unique_ptr<TiffFile> tiff_file(new TiffFile());
+    tiff_file->buffer_data_ = static_cast<const uint8*>(info.ptr);
+    tiff_file->buffer_size_ = uint64(info.size) * info.itemsize;
+    // the export holds a reference to the object and locks its buffer
+    tiff_file->buffer_info_ = std::move(info);
+    if (tiff_file->buffer_size_ < 8)
+        throw std::runtime_error("The buffer does not contain a TIFF file!");
+
+    const uint8* header = tiff_file->buffer_data_;
+    tiff_file->version_ = TiffDirectory::DecodeUInt(&header[2], 2, header[0] == 'M');
+    if (tiff_file->version_ != 42 && tiff_file->version_ != 43)
+        throw std::runtime_error("Found unsupported TIFF version: " + std::to_string(tiff_file->version_) + "!");
+
+    TIFF* tiff = tiff_file->OpenTiff("r");
     if (tiff == nullptr)
-        throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
+        throw std::runtime_error("Could not open the TIFF file in memory!");
+    tiff_file->ReadSubfiles(tiff);
+    TIFFClose(tiff);
+
+    return tiff_file;
+}
+
+std::unique_ptr<TiffFile> TiffFile::CreateInMemory(uint8 version) {
+    if (version != 42 && version != 43)
+        throw std::runtime_error("Found unsupported TIFF version: " + std::to_string(version) + "!");
+
+    std::unique_ptr<TiffFile> tiff_file(new TiffFile());
+    tiff_file->version_ = version;
+    tiff_file->memory_stream_.reset(new TiffMemoryStream());
+    tiff_file->memory_tiff_ = tiff_file->memory_stream_->Open((version == 42) ? "w" : "w8");
+    if (tiff_file->memory_tiff_ == nullptr)
+        throw std::runtime_error("Could not open in-memory TIFF file!");
 
-    std::fstream fs(file_path_.c_str(), std::ios::in | std::ios::binary);
-    char byte_order;
-    fs.read(&byte_order, 1);
-    if (byte_order == 'I') {  // little-endian byte order
-        fs.seekg(2);
-    } else {                  // big-endian byte order
-        fs.seekg(3);
+    return tiff_file;
+}
+
+py::array_t<TiffFile::FileMetadata> TiffFile::ScanMetadata(const std::vector<std::string>& file_paths, uint32 threads) {
+    py::array_t<FileMetadata> array(file_paths.size());
+    FileMetadata* array_ptr = static_cast<FileMetadata*>(array.request().ptr);
+
+    py::gil_scoped_release release;
+    {
+        // the files are submitted in batches to keep the overhead of the task queue low
+        const size_t batch_size = 64;
+        ThreadPool pool(threads);
+        for (size_t first_idx = 0; first_idx < file_paths.size(); first_idx += batch_size) {
+            const size_t last_idx = std::min(first_idx + batch_size, file_paths.size());
+            pool.Submit([&file_paths, array_ptr, first_idx, last_idx]() {
+                for (size_t file_idx = first_idx; file_idx < last_idx; file_idx++)
+                    array_ptr[file_idx] = ReadFileMetadata(file_paths[file_idx]);
+            });
+        }
+        pool.Wait();
     }
-    fs.read(reinterpret_cast<char*>(&version_), 1);
-    fs.close();
+    return array;
+}
+
+py::bytes TiffFile::ToBytes() {
+    if (memory_tiff_ == nullptr)
+        throw std::runtime_error("The TIFF file is not written in memory!");
 
-    if (version_ != 42 && version_ != 43) {
-        throw std::runtime_error("Found unsupported TIFF version: " + std::to_string(version_) + "!");
+    const std::vector<uint8>& buffer = memory_stream_->GetBuffer();
+    return py::bytes(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+}
+
+TIFF* TiffFile::OpenTiff(const std::string& mode, TiffFileStream* stream) {
+    if (memory_tiff_ != nullptr) {
+        // the directories written so far are complete within the buffer
+        const std::vector<uint8>& buffer = memory_stream_->GetBuffer();
+        return TiffMemoryStream::OpenView(buffer.data(), buffer.size(), mode);
     }
+    if (buffer_data_ != nullptr)
+        return TiffMemoryStream::OpenView(buffer_data_, buffer_size_, mode);
+    if (stream != nullptr)
+        return stream->Open(mode);
+    return TIFFOpen(file_path_.c_str(), mode.c_str());
+}
 
-    subfile_count_ = 0;
+void TiffFile::CheckFileBacked() const {
+    if (IsInMemory())
+        throw std::runtime_error("Not supported for TIFF files in memory!");
+}
+
+void TiffFile::CheckNoAsyncWriter() const {
+    if (async_writer_ != nullptr)
+        throw std::runtime_error("Not supported while an asynchronous writer is open!");
+}
+
+void TiffFile::ClearSubfiles(uint32 subfile_idx) {
+    subfile_tags_.erase(subfile_tags_.lower_bound(subfile_idx), subfile_tags_.end());
+    subfile_offsets_.erase(subfile_offsets_.lower_bound(subfile_idx), subfile_offsets_.end());
+    subifd_offsets_.erase(subifd_offsets_.lower_bound(subfile_idx), subifd_offsets_.end());
+    subifd_tags_.erase(subifd_tags_.lower_bound(subfile_idx), subifd_tags_.end());
+    subfile_chunks_.erase(subfile_chunks_.lower_bound(subfile_idx), subfile_chunks_.end());
+}
+
+void TiffFile::ReadSubfiles(TIFF* tiff, uint32 subfile_idx) {
+    ClearSubfiles(subfile_idx);
+
+    std::vector<uint32> subfiles_with_levels;
+    subfile_count_ = subfile_idx;
     do {
-        TiffTags tiff_tags;
-
-        // Baseline
-        if (!TIFFGetField(tiff, TIFFTAG_SUBFILETYPE, &tiff_tags.new_subfile_type))
-            tiff_tags.new_subfile_type = 0;  // default
-        if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &tiff_tags.image_width))
-            throw std::runtime_error("Missing field 'ImageWidth'!");
-        if (!TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &tiff_tags.image_length))
-            throw std::runtime_error("Missing field 'ImageLength'!");
-        if (!TIFFGetField(tiff, TIFFTAG_BITSPERSAMPLE, &tiff_tags.bits_per_sample))
-            tiff_tags.bits_per_sample = 1;  // default
-        if (!TIFFGetField(tiff, TIFFTAG_COMPRESSION, &tiff_tags.compression))
-            tiff_tags.compression = 1;  // default
-        if (!TIFFGetField(tiff, TIFFTAG_PHOTOMETRIC, &tiff_tags.photometric))
-            throw std::runtime_error("Missing field 'PhotometricInterpretation'!");
-        if (!TIFFGetField(tiff, TIFFTAG_SAMPLESPERPIXEL, &tiff_tags.samples_per_pixel))
-            tiff_tags.samples_per_pixel = 1;  // default
-        if (!TIFFGetField(tiff, TIFFTAG_ROWSPERSTRIP, &tiff_tags.rows_per_strip))
-            tiff_tags.rows_per_strip = 4294967295;  // default: 2**32 - 1
-        if (!TIFFGetField(tiff, TIFFTAG_MINSAMPLEVALUE, &tiff_tags.min_sample_value))
-            tiff_tags.min_sample_value = 0;  // default
-        if (!TIFFGetField(tiff, TIFFTAG_MAXSAMPLEVALUE, &tiff_tags.max_sample_value))
-            tiff_tags.max_sample_value = (1 << tiff_tags.bits_per_sample) - 1;  // default
-        if (!TIFFGetField(tiff, TIFFTAG_PLANARCONFIG, &tiff_tags.planar_config))
-            tiff_tags.planar_config = 1;  // default
-        // Extension
-        if(
-            !TIFFGetField(
-                tiff, TIFFTAG_PAGENUMBER,
-                &tiff_tags.page_number.page_number, &tiff_tags.page_number.page_count
-            )
-        ) {
-            tiff_tags.page_number.page_number = 0;
-            tiff_tags.page_number.page_count = 0;
+        subfile_tags_[subfile_count_] = ReadTiffTags(tiff);
+        subfile_offsets_[subfile_count_] = TIFFCurrentDirOffset(tiff);
+        if (use_index_)
+            ReadSubfileChunks(tiff, subfile_count_);
+
+        uint16 subifd_count;
+        uint64* subifd_offsets;
+        if (TIFFGetField(tiff, TIFFTAG_SUBIFD, &subifd_count, &subifd_offsets) && subifd_count > 0)
+            subfiles_with_levels.push_back(subfile_count_);
+
+        subfile_count_ += 1;
+    } while (TIFFReadDirectory(tiff) > 0);
+
+    // SubIFDs are not part of the main IFD chain and must be read
+    // after the chain has been traversed.
+    for (uint32 subfile_idx: subfiles_with_levels) {
+        TIFFSetSubDirectory(tiff, subfile_offsets_[subfile_idx]);
+        ReadSubfileLevels(tiff, subfile_idx);
+    }
+}
+
+void TiffFile::ReadChain(int fd, uint32 subfile_idx, uint64 offset) {
+    ClearSubfiles(subfile_idx);
+
+    subfile_count_ = subfile_idx;
+    for (uint64 ifd_offset: TiffDirectory::GetChainOffsets(fd, offset)) {
+        subfile_offsets_[subfile_count_] = ifd_offset;
+        subfile_count_ += 1;
+    }
+}
+
+void TiffFile::LoadSubfiles(uint32 first_idx, uint32 last_idx) {
+    std::vector<uint32> subfile_indices;
+    for (uint32 subfile_idx = first_idx; subfile_idx < last_idx; subfile_idx++) {
+        if (subfile_tags_.count(subfile_idx) == 0)
+            subfile_indices.push_back(subfile_idx);
+    }
+    if (subfile_indices.empty())
+        return;
+
+    for (uint32 subfile_idx: subfile_indices) {
+        if (subfile_offsets_.count(subfile_idx) == 0)
+            throw std::runtime_error("Could not read subfile '" + std::to_string(subfile_idx) + "'!");
+    }
+
+    if (IsInMemory()) {
+        // a single handle parses all requested directories
+        TIFF* tiff = OpenTiff((version_ == 42) ? "r" : "r8");
+        if (tiff == nullptr)
+            throw std::runtime_error("Could not open the TIFF file in memory!");
+        try {
+            for (uint32 subfile_idx: subfile_indices) {
+                if (!TIFFSetSubDirectory(tiff, subfile_offsets_[subfile_idx]))
+                    throw std::runtime_error("Could not read subfile '" + std::to_string(subfile_idx) + "'!");
+                TiffTags tiff_tags = ReadTiffTags(tiff);
+                if (use_index_)
+                    ReadSubfileChunks(tiff, subfile_idx);
+                ReadSubfileLevels(tiff, subfile_idx);
+                subfile_tags_[subfile_idx] = tiff_tags;
+            }
+        } catch (...) {
+            TIFFClose(tiff);
+            throw;
         }
-        if(!TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &tiff_tags.tile_width)) {
-            if (TIFFIsTiled(tiff))
-                throw std::runtime_error("Missing field 'TileWidth'!");
-            tiff_tags.tile_width = 0;
+        TIFFClose(tiff);
+        return;
+    }
+
+    // the directories of a file are parsed without libtiff
+    int fd = open_file(file_path_);
+    try {
+        const TiffIfd::Header header = TiffIfd::ReadHeader(fd);
+        for (uint32 subfile_idx: subfile_indices) {
+            TiffIfd ifd(fd, header, subfile_offsets_[subfile_idx]);
+            TiffTags tiff_tags = ReadTiffTags(ifd);
+            if (use_index_) {
+                subfile_chunks_[subfile_idx] = std::make_pair(
+                    ifd.GetArray(ifd.IsTiled() ? TIFFTAG_TILEOFFSETS : TIFFTAG_STRIPOFFSETS).ReadAll(),
+                    ifd.GetArray(ifd.IsTiled() ? TIFFTAG_TILEBYTECOUNTS : TIFFTAG_STRIPBYTECOUNTS).ReadAll()
+                );
+            }
+
+            subifd_offsets_[subfile_idx] = ifd.GetArray(TIFFTAG_SUBIFD).ReadAll();
+            subifd_tags_[subfile_idx].clear();
+            for (uint64 subifd_offset: subifd_offsets_[subfile_idx])
+                subifd_tags_[subfile_idx].push_back(ReadTiffTags(TiffIfd(fd, header, subifd_offset)));
+            subfile_tags_[subfile_idx] = tiff_tags;
         }
-        if (!TIFFGetField(tiff, TIFFTAG_TILELENGTH, &tiff_tags.tile_length)) {
-            if (TIFFIsTiled(tiff))
-                throw std::runtime_error("Missing field 'TileLength'!");
-            tiff_tags.tile_length = 0;
+    } catch (...) {
+        close_file(fd);
+        throw;
+    }
+    close_file(fd);
+}
+
+TiffFile::TiffTags& TiffFile::LoadSubfile(uint32 subfile_idx) {
+    LoadSubfiles(subfile_idx, subfile_idx + 1);
+    return subfile_tags_[subfile_idx];
+}
+
+void TiffFile::ReadSubfileChunks(TIFF* tiff, uint32 subfile_idx) {
+    // the tile/strip offsets are copied as libtiff releases them when changing the directory
+    uint64* offsets;
+    uint64* byte_counts;
+    bool tiled = TIFFIsTiled(tiff);
+    uint32 chunk_count = tiled ? TIFFNumberOfTiles(tiff) : TIFFNumberOfStrips(tiff);
+    if (
+        TIFFGetField(tiff, tiled ? TIFFTAG_TILEOFFSETS : TIFFTAG_STRIPOFFSETS, &offsets) &&
+        TIFFGetField(tiff, tiled ? TIFFTAG_TILEBYTECOUNTS : TIFFTAG_STRIPBYTECOUNTS, &byte_counts)
+    ) {
+        subfile_chunks_[subfile_idx] = std::make_pair(
+            std::vector<uint64>(offsets, offsets + chunk_count),
+            std::vector<uint64>(byte_counts, byte_counts + chunk_count)
+        );
+    }
+}
+
+namespace {
+
+/**
+ * Get the default of field 'MaxSampleValue', i.e. 2**BitsPerSample - 1.
+ * The value is computed in 64 bits and clamped to the 16 bits of the field.
+ */
+uint16 default_max_sample_value(uint16 bits_per_sample) {
+    if (bits_per_sample >= 16)
+        return std::numeric_limits<uint16>::max();
+    return static_cast<uint16>((uint64(1) << bits_per_sample) - 1);
+}
+
+const char kIndexMagic[8] = {'P', 'L', 'T', 'F', 'I', 'D', 'X', '3'};
+
+/**
+ * Appends a value to an index in host byte order.
+ */
+template <typename T>
+void put_value(std::vector<uint8>& index, const T& value) {
+    const uint8* ptr = reinterpret_cast<const uint8*>(&value);
+    index.insert(index.end(), ptr, ptr + sizeof(T));
+}
+
+/**
+ * Reads a value from an index and advances the position.
+ */
+template <typename T>
+T get_value(const std::vector<uint8>& index, size_t& position) {
+    if (position + sizeof(T) > index.size())
+        throw std::runtime_error("Truncated index!");
+    T value;
+    std::memcpy(&value, &index[position], sizeof(T));
+    position += sizeof(T);
+    return value;
+}
+
+}  // namespace
+
+bool TiffFile::LoadIndex(bool& complete) {
+    // the index is only a cache, so any mismatch falls back to parsing
+    std::vector<uint8> index;
+    try {
+        int fd = open_file(GetIndexPath());
+        try {
+            index.resize(get_file_size(fd));
+            read_at(fd, index.data(), index.size(), 0);
+        } catch (...) {
+            close_file(fd);
+            throw;
         }
-        if (!TIFFGetField(tiff, TIFFTAG_SAMPLEFORMAT, &tiff_tags.sample_format))
-            tiff_tags.sample_format = 1;  // default
+        close_file(fd);
+    } catch (const std::runtime_error&) {
+        return false;
+    }
 
-        subfile_tags_[subfile_count_] = tiff_tags;
+    std::map<uint32, TiffTags> subfile_tags;
+    std::map<uint32, uint64> subfile_offsets;
+    std::map<uint32, std::vector<uint64>> subifd_offsets;
+    std::map<uint32, std::vector<TiffTags>> subifd_tags;
+    std::map<uint32, std::pair<std::vector<uint64>, std::vector<uint64>>> subfile_chunks;
+    uint8 version;
+    uint32 subfile_count;
+    uint64 indexed_size;
+    int64_t indexed_mtime;
+    uint64 indexed_first_offset;
+    uint64 indexed_next_offset;
+    uint64 indexed_entry_count;
+    try {
+        size_t position = 0;
+        if (index.size() < sizeof(kIndexMagic) || std::memcmp(index.data(), kIndexMagic, sizeof(kIndexMagic)) != 0)
+            return false;
+        position += sizeof(kIndexMagic);
+        if (get_value<uint32>(index, position) != 0x01020304 || get_value<uint32>(index, position) != sizeof(TiffTags))
+            return false;  // written by another platform or build
+
+        indexed_size = get_value<uint64>(index, position);
+        indexed_mtime = get_value<int64_t>(index, position);
+        indexed_first_offset = get_value<uint64>(index, position);
+        indexed_next_offset = get_value<uint64>(index, position);
+        indexed_entry_count = get_value<uint64>(index, position);
+
+        version = get_value<uint8>(index, position);
+        subfile_count = get_value<uint32>(index, position);
+        for (uint32 subfile_idx = 0; subfile_idx < subfile_count; subfile_idx++) {
+            subfile_offsets[subfile_idx] = get_value<uint64>(index, position);
+            subfile_tags[subfile_idx] = get_value<TiffTags>(index, position);
+
+            uint32 level_count = get_value<uint32>(index, position);
+            if (level_count > 0) {
+                for (uint32 level = 0; level < level_count; level++) {
+                    subifd_offsets[subfile_idx].push_back(get_value<uint64>(index, position));
+                    subifd_tags[subfile_idx].push_back(get_value<TiffTags>(index, position));
+                }
+            }
+
+            uint32 chunk_count = get_value<uint32>(index, position);
+            if (position + uint64(chunk_count) * 16 > index.size())
+                return false;
+            std::vector<uint64> offsets(chunk_count), byte_counts(chunk_count);
+            for (uint32 chunk = 0; chunk < chunk_count; chunk++) {
+                offsets[chunk] = get_value<uint64>(index, position);
+                byte_counts[chunk] = get_value<uint64>(index, position);
+            }
+            subfile_chunks[subfile_idx] = std::make_pair(std::move(offsets), std::move(byte_counts));
+        }
+    } catch (const std::runtime_error&) {
+        return false;
+    }
 
-        subfile_count_ += 1;
-    } while (TIFFReadDirectory(tiff) > 0);
+    try {
+        int fd = open_file(file_path_);
+        try {
+            const uint64 file_size = get_file_size(fd);
+            if (file_size < indexed_size || TiffDirectory::GetFirstOffset(fd) != indexed_first_offset) {
+                close_file(fd);
+                return false;  // the TIFF file was rewritten
+            }
+            complete = file_size == indexed_size && get_file_mtime(file_path_) == indexed_mtime;
+
+            // the index is only extended if the last indexed directory is
+            // unchanged, apart from a link to a directory appended since
+            if (subfile_count > 0) {
+                TiffDirectory directory(fd, subfile_offsets[subfile_count - 1]);
+                const uint64 next_offset = directory.GetNextOffset();
+                if (
+                    directory.GetEntries().size() != indexed_entry_count ||
+                    (next_offset != indexed_next_offset && (complete || next_offset < indexed_size))
+                ) {
+                    close_file(fd);
+                    return false;
+                }
+            }
+        } catch (...) {
+            close_file(fd);
+            throw;
+        }
+        close_file(fd);
+    } catch (const std::runtime_error&) {
+        return false;
+    }
 
-    TIFFClose(tiff);
+    version_ = version;
+    subfile_count_ = subfile_count;
+    subfile_tags_ = std::move(subfile_tags);
+    subfile_offsets_ = std::move(subfile_offsets);
+    subifd_offsets_ = std::move(subifd_offsets);
+    subifd_tags_ = std::move(subifd_tags);
+    subfile_chunks_ = std::move(subfile_chunks);
+    return true;
+}
+
+void TiffFile::SaveIndex() {
+    std::vector<uint8> index(kIndexMagic, kIndexMagic + sizeof(kIndexMagic));
+    put_value<uint32>(index, 0x01020304);
+    put_value<uint32>(index, sizeof(TiffTags));
+
+    try {
+        LoadSubfiles(0, subfile_count_);
+
+        int fd = open_file(file_path_);
+        try {
+            put_value<uint64>(index, get_file_size(fd));
+            put_value<int64_t>(index, get_file_mtime(file_path_));
+            put_value<uint64>(index, TiffDirectory::GetFirstOffset(fd));
+
+            // the last directory is verified before the index is extended
+            uint64 next_offset = 0;
+            uint64 entry_count = 0;
+            if (subfile_count_ > 0) {
+                TiffDirectory directory(fd, subfile_offsets_[subfile_count_ - 1]);
+                next_offset = directory.GetNextOffset();
+                entry_count = directory.GetEntries().size();
+            }
+            put_value<uint64>(index, next_offset);
+            put_value<uint64>(index, entry_count);
+        } catch (...) {
+            close_file(fd);
+            throw;
+        }
+        close_file(fd);
+
+        put_value<uint8>(index, version_);
+        put_value<uint32>(index, subfile_count_);
+        for (uint32 subfile_idx = 0; subfile_idx < subfile_count_; subfile_idx++) {
+            if (subfile_offsets_.count(subfile_idx) == 0)
+                return;  // only subfiles parsed from the TIFF file are indexed
+            put_value<uint64>(index, subfile_offsets_[subfile_idx]);
+            put_value<TiffTags>(index, subfile_tags_[subfile_idx]);
+
+            const std::vector<uint64>& level_offsets = subifd_offsets_[subfile_idx];
+            put_value<uint32>(index, level_offsets.size());
+            for (size_t level = 0; level < level_offsets.size(); level++) {
+                put_value<uint64>(index, level_offsets[level]);
+                put_value<TiffTags>(index, subifd_tags_[subfile_idx][level]);
+            }
+
+            const std::pair<std::vector<uint64>, std::vector<uint64>>& chunks = subfile_chunks_[subfile_idx];
+            put_value<uint32>(index, chunks.first.size());
+            for (size_t chunk = 0; chunk < chunks.first.size(); chunk++) {
+                put_value<uint64>(index, chunks.first[chunk]);
+                put_value<uint64>(index, chunks.second[chunk]);
+            }
+        }
+
+        // readers never see a partially written index
+        const std::string temp_path = GetIndexPath() + ".tmp";
+        fd = create_file(temp_path);
+        try {
+            write_at(fd, index.data(), index.size(), 0);
+        } catch (...) {
+            close_file(fd);
+            std::remove(temp_path.c_str());
+            throw;
+        }
+        close_file(fd);
+        replace_file(temp_path, GetIndexPath());
+    } catch (const std::runtime_error&) {
+        // the index is optional
+    }
+}
+
+void TiffFile::InvalidateIndex() {
+    subfile_chunks_.clear();
+    // an index saved by another TiffFile is removed as well
+    std::remove(GetIndexPath().c_str());
+}
+
+TiffFile::TiffTags TiffFile::ReadTiffTags(const TiffIfd& ifd) {
+    TiffTags tiff_tags;
+
+    // Baseline
+    if (!ifd.GetValue(TIFFTAG_SUBFILETYPE, tiff_tags.new_subfile_type))
+        tiff_tags.new_subfile_type = 0;  // default
+    if (!ifd.GetValue(TIFFTAG_IMAGEWIDTH, tiff_tags.image_width))
+        throw std::runtime_error("Missing field 'ImageWidth'!");
+    if (!ifd.GetValue(TIFFTAG_IMAGELENGTH, tiff_tags.image_length))
+        throw std::runtime_error("Missing field 'ImageLength'!");
+    if (!ifd.GetValue(TIFFTAG_BITSPERSAMPLE, tiff_tags.bits_per_sample))
+        tiff_tags.bits_per_sample = 1;  // default
+    if (!ifd.GetValue(TIFFTAG_COMPRESSION, tiff_tags.compression))
+        tiff_tags.compression = 1;  // default
+    if (!ifd.GetValue(TIFFTAG_PHOTOMETRIC, tiff_tags.photometric))
+        throw std::runtime_error("Missing field 'PhotometricInterpretation'!");
+    if (!ifd.GetValue(TIFFTAG_SAMPLESPERPIXEL, tiff_tags.samples_per_pixel))
+        tiff_tags.samples_per_pixel = 1;  // default
+    if (!ifd.GetValue(TIFFTAG_ROWSPERSTRIP, tiff_tags.rows_per_strip))
+        tiff_tags.rows_per_strip = 4294967295;  // default: 2**32 - 1
+    if (!ifd.GetValue(TIFFTAG_MINSAMPLEVALUE, tiff_tags.min_sample_value))
+        tiff_tags.min_sample_value = 0;  // default
+    if (!ifd.GetValue(TIFFTAG_MAXSAMPLEVALUE, tiff_tags.max_sample_value))
+        tiff_tags.max_sample_value = default_max_sample_value(tiff_tags.bits_per_sample);  // default
+    if (!ifd.GetValue(TIFFTAG_PLANARCONFIG, tiff_tags.planar_config))
+        tiff_tags.planar_config = 1;  // default
+    // Extension
+    if (
+        !ifd.GetValue(TIFFTAG_PAGENUMBER, tiff_tags.page_number.page_number, 0) ||
+        !ifd.GetValue(TIFFTAG_PAGENUMBER, tiff_tags.page_number.page_count, 1)
+    ) {
+        tiff_tags.page_number.page_number = 0;
+        tiff_tags.page_number.page_count = 0;
+    }
+    if (!ifd.GetValue(TIFFTAG_TILEWIDTH, tiff_tags.tile_width))
+        tiff_tags.tile_width = 0;
+    if (!ifd.GetValue(TIFFTAG_TILELENGTH, tiff_tags.tile_length)) {
+        if (ifd.IsTiled())
+            throw std::runtime_error("Missing field 'TileLength'!");
+        tiff_tags.tile_length = 0;
+    }
+    if (!ifd.GetValue(TIFFTAG_SAMPLEFORMAT, tiff_tags.sample_format))
+        tiff_tags.sample_format = 1;  // default
+
+    return tiff_tags;
+}
+
+TiffFile::FileMetadata TiffFile::ReadFileMetadata(const std::string& file_path) {
+    FileMetadata file_metadata;
+    int fd;
+    try {
+        fd = open_file(file_path);
+    } catch (const std::exception&) {
+        return FileMetadata();
+    }
+
+    try {
+        const TiffIfd::Header header = TiffIfd::ReadHeader(fd);
+        TiffIfd ifd(fd, header, header.first_offset);
+        file_metadata.tiff_tags = ReadTiffTags(ifd);
+        file_metadata.level_count = ifd.GetArray(TIFFTAG_SUBIFD).GetSize() + 1;
+        file_metadata.subfile_count = TiffDirectory::GetChainOffsets(fd, header.first_offset).size();
+        file_metadata.version = header.big_tiff ? 43 : 42;
+        file_metadata.big_endian = header.big_endian;
+        file_metadata.file_size = get_file_size(fd);
+        file_metadata.valid = true;
+    } catch (const std::exception&) {
+        file_metadata = FileMetadata();
+    }
+    close_file(fd);
+    return file_metadata;
+}
+
+void TiffFile::AddIoStats(const TiffFileStream& stream) {
+    io_stats_.read_count += stream.GetReadCount();
+    io_stats_.bytes_read += stream.GetBytesRead();
+    io_stats_.max_queue_depth = std::max(io_stats_.max_queue_depth, stream.GetMaxQueueDepth());
+    io_stats_.read_time += stream.GetReadTime();
+}
+
+TiffFile::TiffTags TiffFile::ReadTiffTags(TIFF* tiff) {
+    TiffTags tiff_tags;
+
+    // Baseline
+    if (!TIFFGetField(tiff, TIFFTAG_SUBFILETYPE, &tiff_tags.new_subfile_type))
+        tiff_tags.new_subfile_type = 0;  // default
+    if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &tiff_tags.image_width))
+        throw std::runtime_error("Missing field 'ImageWidth'!");
+    if (!TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &tiff_tags.image_length))
+        throw std::runtime_error("Missing field 'ImageLength'!");
+    if (!TIFFGetField(tiff, TIFFTAG_BITSPERSAMPLE, &tiff_tags.bits_per_sample))
+        tiff_tags.bits_per_sample = 1;  // default
+    if (!TIFFGetField(tiff, TIFFTAG_COMPRESSION, &tiff_tags.compression))
+        tiff_tags.compression = 1;  // default
+    if (!TIFFGetField(tiff, TIFFTAG_PHOTOMETRIC, &tiff_tags.photometric))
+        throw std::runtime_error("Missing field 'PhotometricInterpretation'!");
+    if (!TIFFGetField(tiff, TIFFTAG_SAMPLESPERPIXEL, &tiff_tags.samples_per_pixel))
+        tiff_tags.samples_per_pixel = 1;  // default
+    if (!TIFFGetField(tiff, TIFFTAG_ROWSPERSTRIP, &tiff_tags.rows_per_strip))
+        tiff_tags.rows_per_strip = 4294967295;  // default: 2**32 - 1
+    if (!TIFFGetField(tiff, TIFFTAG_MINSAMPLEVALUE, &tiff_tags.min_sample_value))
+        tiff_tags.min_sample_value = 0;  // default
+    if (!TIFFGetField(tiff, TIFFTAG_MAXSAMPLEVALUE, &tiff_tags.max_sample_value))
+        tiff_tags.max_sample_value = default_max_sample_value(tiff_tags.bits_per_sample);  // default
+    if (!TIFFGetField(tiff, TIFFTAG_PLANARCONFIG, &tiff_tags.planar_config))
+        tiff_tags.planar_config = 1;  // default
+    // Extension
+    if(
+        !TIFFGetField(
+            tiff, TIFFTAG_PAGENUMBER,
+            &tiff_tags.page_number.page_number, &tiff_tags.page_number.page_count
+        )
+    ) {
+        tiff_tags.page_number.page_number = 0;
+        tiff_tags.page_number.page_count = 0;
+    }
+    if(!TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &tiff_tags.tile_width)) {
+        if (TIFFIsTiled(tiff))
+            throw std::runtime_error("Missing field 'TileWidth'!");
+        tiff_tags.tile_width = 0;
+    }
+    if (!TIFFGetField(tiff, TIFFTAG_TILELENGTH, &tiff_tags.tile_length)) {
+        if (TIFFIsTiled(tiff))
+            throw std::runtime_error("Missing field 'TileLength'!");
+        tiff_tags.tile_length = 0;
+    }
+    if (!TIFFGetField(tiff, TIFFTAG_SAMPLEFORMAT, &tiff_tags.sample_format))
+        tiff_tags.sample_format = 1;  // default
+
+    return tiff_tags;
+}
+
+void TiffFile::SetTiledTiffTags(TIFF* tiff, const TiffTags& tiff_tags) {
+    // Baseline
+    TIFFSetField(tiff, TIFFTAG_SUBFILETYPE, tiff_tags.new_subfile_type);
+    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, tiff_tags.image_width);
+    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, tiff_tags.image_length);
+    TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, tiff_tags.bits_per_sample);
+    TIFFSetField(tiff, TIFFTAG_COMPRESSION, tiff_tags.compression);
+    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, tiff_tags.photometric);
+    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, tiff_tags.samples_per_pixel);
+    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, tiff_tags.rows_per_strip);
+    TIFFSetField(tiff, TIFFTAG_MINSAMPLEVALUE, tiff_tags.min_sample_value);
+    TIFFSetField(tiff, TIFFTAG_MAXSAMPLEVALUE, tiff_tags.max_sample_value);
+    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, tiff_tags.planar_config);
+    // Extension
+    TIFFSetField(tiff, TIFFTAG_TILEWIDTH, tiff_tags.tile_width);
+    TIFFSetField(tiff, TIFFTAG_TILELENGTH, tiff_tags.tile_length);
+    TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, tiff_tags.sample_format);
+}
+
+void TiffFile::SetSubfileTags(TIFF* tiff, const TiffTags& tiff_tags, bool tiled) {
+    // Baseline
+    TIFFSetField(tiff, TIFFTAG_SUBFILETYPE, tiff_tags.new_subfile_type);
+    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, tiff_tags.image_width);
+    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, tiff_tags.image_length);
+    TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, tiff_tags.bits_per_sample);
+    TIFFSetField(tiff, TIFFTAG_COMPRESSION, tiff_tags.compression);
+    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, tiff_tags.photometric);
+    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, tiff_tags.samples_per_pixel);
+    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, tiff_tags.rows_per_strip);
+    TIFFSetField(tiff, TIFFTAG_MINSAMPLEVALUE, tiff_tags.min_sample_value);
+    TIFFSetField(tiff, TIFFTAG_MAXSAMPLEVALUE, tiff_tags.max_sample_value);
+    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, tiff_tags.planar_config);
+    // Extension
+    if (tiff_tags.new_subfile_type == 2) {  // add metadata for page file type
+        TIFFSetField(
+            tiff, TIFFTAG_PAGENUMBER,
+            tiff_tags.page_number.page_number, tiff_tags.page_number.page_count
+        );
+    }
+
+    if (tiled) {
+        TIFFSetField(tiff, TIFFTAG_TILEWIDTH, tiff_tags.tile_width);  // sets tif->tif_flags |= TIFF_ISTILED
+        TIFFSetField(tiff, TIFFTAG_TILELENGTH, tiff_tags.tile_length);  // sets tif->tif_flags |= TIFF_ISTILED
+    }
+    TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, tiff_tags.sample_format);
+}
+
+void TiffFile::ReadSubfileLevels(TIFF* tiff, uint32 subfile_idx) {
+    uint16 subifd_count;
+    uint64* subifd_offsets;
+    if (!TIFFGetField(tiff, TIFFTAG_SUBIFD, &subifd_count, &subifd_offsets))
+        subifd_count = 0;
+
+    // copy the offsets as libtiff releases them when changing the directory
+    subifd_offsets_[subfile_idx] = std::vector<uint64>(
+        subifd_offsets, subifd_offsets + subifd_count
+    );
+    subifd_tags_[subfile_idx].clear();
+    for (uint64 subifd_offset: subifd_offsets_[subfile_idx]) {
+        if (!TIFFSetSubDirectory(tiff, subifd_offset))
+            throw std::runtime_error("Could not read SubIFD of subfile '" + std::to_string(subfile_idx) + "'!");
+        subifd_tags_[subfile_idx].push_back(ReadTiffTags(tiff));
+    }
 }
 
-TiffFile::TiffTags TiffFile::GetSubfileTags(uint16 subfile_idx) {
+TIFF* TiffFile::OpenSubfile(uint32 subfile_idx, uint16 level, TiffFileStream* stream) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx];
+    if(level < 0 || GetSubfileLevelCount(subfile_idx) <= level)
+        throw std::out_of_range("Level out of range!");
+
+    TIFF* tiff = OpenTiff((version_ == 42) ? "r" : "r8", stream);
+    if (tiff == nullptr) {
+        throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
+    }
+
+    int success;
+    if (level > 0) {
+        success = TIFFSetSubDirectory(tiff, subifd_offsets_[subfile_idx][level - 1]);
+    } else if (subfile_offsets_.count(subfile_idx) > 0) {
+        success = TIFFSetSubDirectory(tiff, subfile_offsets_[subfile_idx]);
+    } else if (!IsInMemory()) {
+        // the offset of a newly written subfile is looked up once
+        int fd = open_file(file_path_);
+        try {
+            success = TIFFSetSubDirectory(tiff, GetSubfileOffset(fd, subfile_idx));
+        } catch (...) {
+            close_file(fd);
+            TIFFClose(tiff);
+            throw;
+        }
+        close_file(fd);
+    } else {
+        // the chain is followed from the closest known directory, as
+        // TIFFSetDirectory() cannot count beyond 65535 directories
+        uint32 idx = 0;
+        success = TIFFSetDirectory(tiff, 0);
+        std::map<uint32, uint64>::iterator it = subfile_offsets_.lower_bound(subfile_idx);
+        if (it != subfile_offsets_.begin()) {
+            --it;
+            idx = it->first;
+            success = TIFFSetSubDirectory(tiff, it->second);
+        }
+        for (; success && idx < subfile_idx; idx++) {
+            success = TIFFReadDirectory(tiff);
+            if (success)
+                subfile_offsets_[idx + 1] = TIFFCurrentDirOffset(tiff);
+        }
+        if (success)
+            subfile_offsets_[subfile_idx] = TIFFCurrentDirOffset(tiff);
+    }
+
+    if (!success) {
+        TIFFClose(tiff);
+        throw std::runtime_error("Could not read subfile '" + std::to_string(subfile_idx) + "'!");
+    }
+
+    return tiff;
 }
 
-uint32 TiffFile::GetSubfileType(uint16 subfile_idx) {
+std::vector<uint32> TiffFile::GetLevelFactors(
+    const TiffTags& tiff_tags, const std::vector<uint32>& factors, uint32 min_level_size
+) {
+    for (uint32 factor: factors) {
+        if (factor < 2)
+            throw std::runtime_error("Downscale factors must be at least 2!");
+    }
+
+    std::vector<uint32> level_factors;
+    uint64 cumulative_factor = 1;
+    while (true) {
+        uint32 factor = factors.empty() ? 2 : factors[min(level_factors.size(), factors.size() - 1)];
+        TiffTags level_tags = GetLevelTags(tiff_tags, cumulative_factor * factor);
+        if (min_level_size > 0) {
+            // a level must not be smaller than the minimum level size
+            if (max(level_tags.image_width, level_tags.image_length) < min_level_size)
+                break;
+        } else {
+            // the levels continue until a level fits into half a tile
+            if (
+                float(max(tiff_tags.image_width, tiff_tags.image_length)) / cumulative_factor <=
+                tiff_tags.tile_length / 2.f
+            )
+                break;
+        }
+        if (cumulative_factor * factor > uint64(max(tiff_tags.image_width, tiff_tags.image_length)) + 1)
+            break;
+        level_factors.push_back(factor);
+        cumulative_factor *= factor;
+    }
+    return level_factors;
+}
+
+TiffFile::TiffTags TiffFile::GetLevelTags(const TiffTags& tiff_tags, uint64 cumulative_factor) {
+    TiffTags level_tags = tiff_tags;
+    level_tags.new_subfile_type = FILETYPE_REDUCEDIMAGE;
+    level_tags.image_width = max(1, (tiff_tags.image_width + 1) / cumulative_factor);
+    level_tags.image_length = max(1, (tiff_tags.image_length + 1) / cumulative_factor);
+    return level_tags;
+}
+
+uint32 TiffFile::FindLevelFactor(const TiffTags& tiff_tags, uint64 cumulative_factor, const TiffTags& level_tags) {
+    if (level_tags.image_width == 0 || level_tags.image_length == 0)
+        return 0;
+    uint64 max_factor = (uint64(tiff_tags.image_width) + 1) / (cumulative_factor * level_tags.image_width);
+    for (uint64 factor = 2; factor <= max_factor; factor++) {
+        TiffTags expected_tags = GetLevelTags(tiff_tags, cumulative_factor * factor);
+        if (
+            expected_tags.image_width == level_tags.image_width &&
+            expected_tags.image_length == level_tags.image_length
+        )
+            return factor;
+    }
+    return 0;
+}
+
+std::vector<uint64> TiffFile::GetLevelOffsets(uint32 subfile_idx, std::vector<uint32>& factors) {
+    TIFFClose(OpenSubfile(subfile_idx));
+    std::vector<uint64> level_offsets = {subfile_offsets_[subfile_idx]};
+    factors.clear();
+
+    const TiffTags& tiff_tags = LoadSubfile(subfile_idx);
+    uint64 cumulative_factor = 1;
+    if (GetSubfileLevelCount(subfile_idx) > 1) {
+        for (uint32 level = 1; level < GetSubfileLevelCount(subfile_idx); level++) {
+            uint32 factor = FindLevelFactor(tiff_tags, cumulative_factor, subifd_tags_[subfile_idx][level - 1]);
+            if (factor == 0)
+                break;
+            level_offsets.push_back(subifd_offsets_[subfile_idx][level - 1]);
+            factors.push_back(factor);
+            cumulative_factor *= factor;
+        }
+        return level_offsets;
+    }
+
+    for (uint32 idx = subfile_idx + 1; idx < GetSubfileCount(); idx++) {
+        const TiffTags& level_tags = LoadSubfile(idx);
+        uint32 factor = FindLevelFactor(tiff_tags, cumulative_factor, level_tags);
+        if (level_tags.new_subfile_type != FILETYPE_REDUCEDIMAGE || factor == 0)
+            break;
+        TIFFClose(OpenSubfile(idx));
+        level_offsets.push_back(subfile_offsets_[idx]);
+        factors.push_back(factor);
+        cumulative_factor *= factor;
+    }
+    return level_offsets;
+}
+
+TiffFile::TiffTags TiffFile::GetSubfileTags(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].new_subfile_type;
+    return LoadSubfile(subfile_idx);
+}
+
+py::array_t<TiffFile::TiffTags> TiffFile::GetSubfileTagsArray() {
+    LoadSubfiles(0, subfile_count_);
+
+    py::array_t<TiffTags> array(subfile_count_);
+    TiffTags* array_ptr = static_cast<TiffTags*>(array.request().ptr);
+    for (uint32 subfile_idx = 0; subfile_idx < subfile_count_; subfile_idx++)
+        array_ptr[subfile_idx] = subfile_tags_[subfile_idx];
+    return array;
 }
-uint32 TiffFile::GetImageWidth(uint16 subfile_idx) {
+
+uint16 TiffFile::GetSubfileLevelCount(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].image_width;
+    LoadSubfile(subfile_idx);
+    if (subifd_offsets_.count(subfile_idx) == 0)
+        return 1;
+    return subifd_offsets_[subfile_idx].size() + 1;
+}
+
+TiffFile::TiffTags TiffFile::GetSubfileLevelTags(uint32 subfile_idx, uint16 level) {
+    if(level < 0 || GetSubfileLevelCount(subfile_idx) <= level)
+        throw std::out_of_range("Level out of range!");
+    if (level == 0)
+        return LoadSubfile(subfile_idx);
+    return subifd_tags_[subfile_idx][level - 1];
 }
-uint32 TiffFile::GetImageLength(uint16 subfile_idx) {
+
+uint32 TiffFile::GetSubfileType(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].image_length;
+    return LoadSubfile(subfile_idx).new_subfile_type;
 }
-uint16 TiffFile::GetBitsPerSample(uint16 subfile_idx) {
+uint32 TiffFile::GetImageWidth(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].bits_per_sample;
+    return LoadSubfile(subfile_idx).image_width;
 }
-uint16 TiffFile::GetCompression(uint16 subfile_idx) {
+uint32 TiffFile::GetImageLength(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].compression;
+    return LoadSubfile(subfile_idx).image_length;
 }
-uint16 TiffFile::GetPhotometricInterpretation(uint16 subfile_idx) {
+uint16 TiffFile::GetBitsPerSample(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].photometric;
+    return LoadSubfile(subfile_idx).bits_per_sample;
 }
-uint16 TiffFile::GetSamplesPerPixel(uint16 subfile_idx) {
+uint16 TiffFile::GetCompression(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].samples_per_pixel;
+    return LoadSubfile(subfile_idx).compression;
 }
-uint32 TiffFile::GetRowsPerStrip(uint16 subfile_idx) {
+uint16 TiffFile::GetPhotometricInterpretation(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].rows_per_strip;
+    return LoadSubfile(subfile_idx).photometric;
 }
-uint16 TiffFile::GetMinSampleValue(uint16 subfile_idx) {
+uint16 TiffFile::GetSamplesPerPixel(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].min_sample_value;
+    return LoadSubfile(subfile_idx).samples_per_pixel;
 }
-uint16 TiffFile::GetMaxSampleValue(uint16 subfile_idx) {
+uint32 TiffFile::GetRowsPerStrip(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].max_sample_value;
+    return LoadSubfile(subfile_idx).rows_per_strip;
 }
-uint16 TiffFile::GetPlanarConfiguration(uint16 subfile_idx) {
+uint16 TiffFile::GetMinSampleValue(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].planar_config;
+    return LoadSubfile(subfile_idx).min_sample_value;
 }
-uint16 TiffFile::GetPageNumber(uint16 subfile_idx) {
+uint16 TiffFile::GetMaxSampleValue(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].page_number.page_number;
+    return LoadSubfile(subfile_idx).max_sample_value;
 }
-uint16 TiffFile::GetPageCount(uint16 subfile_idx) {
+uint16 TiffFile::GetPlanarConfiguration(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].page_number.page_count;
+    return LoadSubfile(subfile_idx).planar_config;
 }
-uint32 TiffFile::GetTileWidth(uint16 subfile_idx) {
+uint16 TiffFile::GetPageNumber(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].tile_width;
+    return LoadSubfile(subfile_idx).page_number.page_number;
 }
-uint32 TiffFile::GetTileLength(uint16 subfile_idx) {
+uint16 TiffFile::GetPageCount(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].tile_length;
+    return LoadSubfile(subfile_idx).page_number.page_count;
 }
-uint16 TiffFile::GetSampleFormat(uint16 subfile_idx) {
+uint32 TiffFile::GetTileWidth(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
-    return subfile_tags_[subfile_idx].sample_format;
+    return LoadSubfile(subfile_idx).tile_width;
 }
-
-template <typename T>
-py::array_t<T> TiffFile::ReadSubfile(uint16 subfile_idx) {
+uint32 TiffFile::GetTileLength(uint32 subfile_idx) {
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
+    return LoadSubfile(subfile_idx).tile_length;
+}
+uint16 TiffFile::GetSampleFormat(uint32 subfile_idx) {
+    if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
+        throw std::out_of_range("Subfile index out of range!");
+    return LoadSubfile(subfile_idx).sample_format;
+}
+
+void TiffFile::SetOutputPoolSize(uint32 output_pool_size) {
+    output_pool_size_ = output_pool_size;
+    output_pool_.clear();
+}
+
+template <typename T>
+py::array_t<T> TiffFile::AllocateOutputArray(uint32 length, uint32 width) {
+    // the caller gets a new array object, which keeps the pooled array in
+    // use as its base, so no two reads ever share an array object
+    auto make_view = [length, width](py::array& pooled) {
+        return py::array_t<T>(
+            { length, width }, { sizeof(T) * width, sizeof(T) }, static_cast<T*>(pooled.mutable_data()), pooled
+        );
+    };
+
+    OutputRing* ring = nullptr;
+    if (output_pool_size_ > 0) {
+        const std::tuple<uint32, uint32, size_t> shape = std::make_tuple(length, width, sizeof(T));
+        if (output_pool_.count(shape) == 0 && output_pool_.size() >= kMaxOutputRings) {
+            // the pool is bounded, so the least recently read shape is released
+            auto oldest = output_pool_.begin();
+            for (auto it = output_pool_.begin(); it != output_pool_.end(); ++it) {
+                if (it->second.last_use < oldest->second.last_use)
+                    oldest = it;
+            }
+            output_pool_.erase(oldest);
+        }
+        ring = &output_pool_[shape];
+        ring->last_use = ++output_pool_uses_;
+
+        // an array referenced by the pool only was released by the caller
+        for (size_t i = 0; i < ring->arrays.size(); i++) {
+            size_t array_idx = (ring->next + i) % ring->arrays.size();
+            if (ring->arrays[array_idx].ref_count() == 1) {
+                ring->next = (array_idx + 1) % ring->arrays.size();
+                return make_view(ring->arrays[array_idx]);
+            }
+        }
+    }
+
+    py::array_t<T> array = py::array(
+        py::buffer_info(
+            nullptr,                                // Pointer to data (nullptr -> ask NumPy to allocate!)
+            sizeof(T),                              // Size of one item
+            py::format_descriptor<T>::value,        // Buffer format
+            2,                                      // How many dimensions?
+            { length, width },                      // Number of elements for each dimension
+            { sizeof(T) * width, sizeof(T) }        // Strides for each dimension
+        )
+    );
+    // a full ring whose arrays are all in use falls back to unpooled arrays
+    if (ring != nullptr && ring->arrays.size() < output_pool_size_) {
+        std::memset(array.mutable_data(), 0, array.nbytes());  // faults in the pages once
+        ring->arrays.push_back(array);
+        return make_view(ring->arrays.back());
+    }
+    return array;
+}
+
+template <typename T>
+py::array_t<T> TiffFile::ReadSubfile(uint32 subfile_idx, uint16 level) {
+    // buffers and in-memory files are mapped by libtiff and need no stream
+    std::unique_ptr<TiffFileStream> stream;
+    if (!IsInMemory())
+        stream.reset(new TiffFileStream(file_path_));
+    TIFF* tiff = OpenSubfile(subfile_idx, level, stream.get());
+    TiffTags tiff_tags = GetSubfileLevelTags(subfile_idx, level);
+    if (stream != nullptr && readahead_ > 0) {
+        stream->SetReadahead(
+            TiffReader::GetRegionByteRanges(tiff, 0, 0, tiff_tags.image_width, tiff_tags.image_length), readahead_
+        );
+    }
+
+    py::array_t<T> image = AllocateOutputArray<T>(tiff_tags.image_length, tiff_tags.image_width);
+    T* image_ptr = static_cast<T*>(image.request().ptr);
+
+    try {
+        if (TIFFIsTiled(tiff)) {
+            io_stats_.bytes_saved += TiffReader::ReadSubfileByTile<T>(
+                tiff, image_ptr
+            );
+        } else {
+            TiffReader::ReadSubfileByScanline<T>(
+                tiff, image_ptr
+            );
+        }
+    } catch (...) {
+        // the handle reads through the stream and is closed before it
+        TIFFClose(tiff);
+        throw;
+    }
+
+    TIFFClose(tiff);
+    if (stream != nullptr)
+        AddIoStats(*stream);
 
-    TIFF* tiff = nullptr;
-    if (version_ == 42) {
-        tiff = TIFFOpen(file_path_.c_str(), "r");
+    return image;
+}
+
+template <typename T>
+std::vector<py::array_t<T>> TiffFile::ReadRegions(
+    uint32 subfile_idx, const std::vector<std::array<uint32, 4>>& regions, uint16 level
+) {
+    // buffers and in-memory files are mapped by libtiff and need no stream
+    std::unique_ptr<TiffFileStream> stream;
+    if (!IsInMemory()) {
+        // a ring refused by the kernel stays closed until the queue depth changes
+        if (queue_depth_ > 1 && io_ring_.GetDepth() != queue_depth_)
+            io_ring_.Open(queue_depth_);
+        stream.reset(new TiffFileStream(file_path_, queue_depth_ > 1 ? &io_ring_ : nullptr));
+    }
+    TIFF* tiff = OpenSubfile(subfile_idx, level, stream.get());
+
+    std::vector<py::array_t<T>> arrays;
+    try {
+        if (stream != nullptr) {
+            std::vector<std::pair<uint64, uint64>> ranges;
+            // the tile/strip tables of an index spare reading them from the directory
+            const bool indexed = level == 0 && subfile_chunks_.count(subfile_idx) > 0;
+            const TiffTags& tiff_tags = LoadSubfile(subfile_idx);
+            const bool tiled = tiff_tags.tile_width > 0 && tiff_tags.tile_length > 0;
+            for (const std::array<uint32, 4>& region: regions) {
+                std::vector<std::pair<uint64, uint64>> region_ranges;
+                if (indexed) {
+                    const std::pair<std::vector<uint64>, std::vector<uint64>>& chunks = subfile_chunks_[subfile_idx];
+                    region_ranges = TiffReader::GetRegionByteRanges(
+                        tiff_tags.image_width, tiff_tags.image_length,
+                        tiled ? tiff_tags.tile_width : tiff_tags.image_width,
+                        tiled ? tiff_tags.tile_length : tiff_tags.rows_per_strip,
+                        chunks.first.data(), chunks.second.data(), chunks.first.size(),
+                        region[0], region[1], region[2], region[3]
+                    );
+                } else {
+                    region_ranges = TiffReader::GetRegionByteRanges(
+                        tiff, region[0], region[1], region[2], region[3]
+                    );
+                }
+                ranges.insert(ranges.end(), region_ranges.begin(), region_ranges.end());
+            }
+            stream->Prefetch(ranges, read_gap_);
+        }
+
+        for (const std::array<uint32, 4>& region: regions) {
+            uint32 x1 = region[0], y1 = region[1], x2 = region[2], y2 = region[3];
+            uint32 region_length = y2 - y1;
+            uint32 region_width = x2 - x1;
+
+            DEBUG_PRINTF("crop_length/crop_width: %d, %d\n", region_length, region_width);
+
+            py::array_t<T> array = AllocateOutputArray<T>(region_length, region_width);
+            T* array_ptr = static_cast<T*>(array.request().ptr);
+
+            if (TIFFIsTiled(tiff)) {
+                io_stats_.bytes_saved += TiffReader::ReadSubfileRegionByTile<T>(
+                    tiff, array_ptr, x1, y1, x2, y2
+                );
+            } else {
+                TiffReader::ReadSubfileRegionByScanline<T>(
+                    tiff, array_ptr, x1, y1, x2, y2
+                );
+            }
+            arrays.push_back(array);
+        }
+    } catch (...) {
+        TIFFClose(tiff);
+        throw;
+    }
+
+    TIFFClose(tiff);
+    if (stream != nullptr)
+        AddIoStats(*stream);
+
+    return arrays;
+}
+
+template <typename T>
+py::array_t<T> TiffFile::ReadSubfileRegion(
+    uint32 subfile_idx, uint32 x1, uint32 y1, uint32 x2, uint32 y2, uint16 level
+) {
+    return ReadRegions<T>(subfile_idx, { { x1, y1, x2, y2 } }, level)[0];
+}
+
+template <typename T>
+std::vector<py::array_t<T>> TiffFile::ReadSubfileRegions(
+    uint32 subfile_idx, std::vector<std::array<uint32, 4>> regions, uint16 level
+) {
+    return ReadRegions<T>(subfile_idx, regions, level);
+}
+
+void TiffFile::OpenSession() {
+    CheckFileBacked();
+    if (session_fd_ >= 0)
+        throw std::runtime_error("A write session is already open!");
+
+    if (!file_exists(file_path_)) {
+        // the header of the first subfile becomes the header of the file
+        const uint16 byte_order_mark = 1;
+        InvalidateIndex();
+        session_fd_ = create_file(file_path_);
+        session_big_endian_ = *reinterpret_cast<const uint8*>(&byte_order_mark) == 0;
     } else {
-        tiff = TIFFOpen(file_path_.c_str(), "r8");
+        session_fd_ = open_file(file_path_, true);
+        uint8 byte_order;
+        read_at(session_fd_, &byte_order, 1, 0);
+        session_big_endian_ = byte_order == 'M';
     }
 
-    if (tiff == nullptr) {
-        throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
+    if (direct_io_)
+        session_direct_fd_ = open_file_direct(file_path_);
+}
+
+void TiffFile::CloseSession() {
+    if (session_fd_ < 0)
+        return;
+    if (async_writer_ != nullptr)
+        throw std::runtime_error("Cannot close the write session while an asynchronous writer is open!");
+
+    if (session_direct_fd_ >= 0)
+        close_file(session_direct_fd_);
+    close_file(session_fd_);
+    session_direct_fd_ = -1;
+    session_fd_ = -1;
+    stack_frame_count_ = 0;
+}
+
+void TiffFile::SetDirectIo(bool direct_io) {
+    if (session_fd_ >= 0)
+        throw std::runtime_error("Cannot change the I/O mode while a write session is open!");
+    direct_io_ = direct_io;
+}
+
+void TiffFile::WriteSessionData(const void* data, uint64 size, uint64 offset) {
+    if (session_direct_fd_ >= 0)
+        write_at_direct(session_direct_fd_, session_fd_, data, size, offset);
+    else
+        write_at(session_fd_, data, size, offset);
+}
+
+template <typename T>
+std::vector<uint8> TiffFile::EncodeSubfile(T* image_ptr, const TiffTags& tiff_tags, bool tiled) {
+    std::string mode = (version_ == 42) ? "w" : "w8";
+    mode += session_big_endian_ ? "b" : "l";
+
+    TiffMemoryStream stream;
+    TIFF* tiff = stream.Open(mode);
+    if (tiff == nullptr)
+        throw std::runtime_error("Could not open in-memory TIFF file!");
+
+    SetSubfileTags(tiff, tiff_tags, tiled);
+    try {
+        if (tiled) {
+            TiffWriter::WriteSubfileByTile<T>(tiff, image_ptr);
+        } else {
+            TiffWriter::WriteSubfileByScanline<T>(tiff, image_ptr);
+        }
+    } catch (...) {
+        TIFFClose(tiff);
+        throw;
+    }
+    TIFFClose(tiff);
+
+    return std::move(stream.GetBuffer());
+}
+
+template <typename T>
+uint64 TiffFile::StreamSubfile(T* image_ptr, const TiffTags& tiff_tags, bool tiled, uint64 last_offset) {
+    std::string mode = (version_ == 42) ? "w" : "w8";
+    mode += session_big_endian_ ? "b" : "l";
+    const uint8 header_size = (version_ == 42) ? 8 : 16;
+
+    TiffAppendStream stream(session_fd_, header_size, session_direct_fd_);
+    TIFF* tiff = stream.Open(mode);
+    if (tiff == nullptr)
+        throw std::runtime_error("Could not open file '" + std::string(file_path_) + "' for appending!");
+
+    SetSubfileTags(tiff, tiff_tags, tiled);
+    try {
+        if (tiled) {
+            TiffWriter::WriteSubfileByTile<T>(tiff, image_ptr);
+        } else {
+            TiffWriter::WriteSubfileByScanline<T>(tiff, image_ptr);
+        }
+    } catch (...) {
+        TIFFClose(tiff);
+        stream.Discard();
+        throw;
+    }
+    TIFFClose(tiff);
+    try {
+        stream.Flush();
+    } catch (...) {
+        stream.Discard();
+        throw;
+    }
+
+    const uint8* header = stream.GetHeader();
+    const bool big_endian = header[0] == 'M';
+    const uint64 ifd_offset = (version_ == 42)
+        ? TiffDirectory::DecodeUInt(&header[4], 4, big_endian)
+        : TiffDirectory::DecodeUInt(&header[8], 8, big_endian);
+    if (ifd_offset == 0) {
+        stream.Discard();
+        throw std::runtime_error("Could not write the directory of the subfile!");
+    }
+
+    // the header is written last, so a concurrent reader never finds an
+    // incomplete directory
+    if (last_offset == 0)
+        write_at(session_fd_, header, header_size, 0);
+    else
+        TiffDirectory(session_fd_, last_offset).SetNextOffset(ifd_offset);
+    return ifd_offset;
+}
+
+uint64 TiffFile::GetSubfileOffset(int fd, uint32 subfile_idx) {
+    if (subfile_idx >= subfile_count_)
+        throw std::out_of_range("Subfile index out of range!");
+    if (subfile_offsets_.count(subfile_idx) > 0)
+        return subfile_offsets_[subfile_idx];
+
+    // the chain is followed from the closest known directory
+    uint32 idx = 0;
+    uint64 offset = TiffDirectory::GetFirstOffset(fd);
+    std::map<uint32, uint64>::iterator it = subfile_offsets_.lower_bound(subfile_idx);
+    if (it != subfile_offsets_.begin()) {
+        --it;
+        idx = it->first;
+        offset = it->second;
+    }
+    const TiffIfd::Header header = TiffIfd::ReadHeader(fd);
+    for (; idx < subfile_idx; idx++) {
+        offset = TiffIfd(fd, header, offset).GetNextOffset();
+        if (offset == 0)
+            throw std::runtime_error("Could not read subfile '" + std::to_string(subfile_idx) + "'!");
+        subfile_offsets_[idx + 1] = offset;
+    }
+    subfile_offsets_[subfile_idx] = offset;
+    return offset;
+}
+
+uint64 TiffFile::GetLastSubfileOffset(int fd) {
+    if (subfile_count_ == 0)
+        return 0;
+
+    // the last directory is known unless another method appended subfiles
+    return GetSubfileOffset(fd, subfile_count_ - 1);
+}
+
+uint64 TiffFile::AppendSubfile(std::vector<uint8>& encoded, uint64 last_offset) {
+    const uint8 header_size = (version_ == 42) ? 8 : 16;
+    if (encoded.size() <= header_size)
+        throw std::runtime_error("Could not encode subfile!");
+
+    const bool big_endian = encoded[0] == 'M';
+    const uint64 ifd_offset = (version_ == 42)
+        ? TiffDirectory::DecodeUInt(&encoded[4], 4, big_endian)
+        : TiffDirectory::DecodeUInt(&encoded[8], 8, big_endian);
+
+    if (last_offset == 0) {
+        // the in-memory file is written as is, while the header is written
+        // last, so a concurrent reader never finds an incomplete directory
+        WriteSessionData(encoded.data() + header_size, encoded.size() - header_size, header_size);
+        write_at(session_fd_, encoded.data(), header_size, 0);
+        return ifd_offset;
+    }
+
+    // the data is moved by an even distance, so word alignment is kept
+    uint64 file_size = get_file_size(session_fd_);
+    uint64 position = file_size + (file_size & 1);
+    uint64 delta = position - header_size;
+    // the offsets are moved in memory, so the subfile is written at once
+    TiffDirectory::Relocate(encoded.data(), encoded.size(), 0, ifd_offset, delta, big_endian, version_ == 43);
+    WriteSessionData(encoded.data() + header_size, encoded.size() - header_size, position);
+
+    // the directory is complete before it is linked to the chain
+    TiffDirectory(session_fd_, last_offset).SetNextOffset(ifd_offset + delta);
+    return ifd_offset + delta;
+}
+
+template <typename T>
+void TiffFile::WriteSubfile(py::array_t<T> image, TiffTags tiff_tags, bool tiled) {
+    if (async_writer_ != nullptr)
+        throw std::runtime_error("Cannot write a subfile while an asynchronous writer is open!");
+
+    if (memory_tiff_ != nullptr) {
+        // libtiff keeps track of the last directory of the in-memory file
+        if (GetSubfileCount() > 0 && (LoadSubfile(0).tile_width > 0) != tiled)
+            throw std::runtime_error("Cannot mix scanline- and tile-based images within the same TIFF file!");
+
+        SetSubfileTags(memory_tiff_, tiff_tags, tiled);
+        auto c_image = make_c_style(image);
+        T* image_ptr = static_cast<T*>(c_image.request().ptr);
+        if (tiled) {
+            TiffWriter::WriteSubfileByTile<T>(memory_tiff_, image_ptr);
+        } else {
+            TiffWriter::WriteSubfileByScanline<T>(memory_tiff_, image_ptr);
+        }
+        if (!TIFFWriteDirectory(memory_tiff_))
+            throw std::runtime_error("Could not write the directory of the subfile!");
+
+        subfile_tags_[GetSubfileCount()] = tiff_tags;
+        subfile_count_ += 1;
+        return;
     }
 
-    py::array_t<T> image = py::array(
-        py::buffer_info(
-            nullptr,                                                     // Pointer to data (nullptr -> ask NumPy to allocate!)
-            sizeof(T),                                                   // Size of one item
-            py::format_descriptor<T>::value,                             // Buffer format
-            2,                                                           // How many dimensions? 
-            { GetImageLength(subfile_idx), GetImageWidth(subfile_idx) }, // Number of elements for each dimension
-            { sizeof(T) * GetImageWidth(subfile_idx), sizeof(T) }        // Strides for each dimension
-        )
-    );
-    T* image_ptr = static_cast<T*>(image.request().ptr);
+    // the subfile is always appended by a write session, which links the
+    // directory after it is complete and keeps concurrent readers safe
+    const bool owns_session = session_fd_ < 0;
+    if (owns_session)
+        OpenSession();
+
+    try {
+        if (GetSubfileCount() > 0) {
+            TiffDirectory directory(session_fd_, TiffDirectory::GetFirstOffset(session_fd_));
+            if (directory.HasEntry(TIFFTAG_TILEWIDTH) != tiled)
+                throw std::runtime_error("Cannot mix scanline- and tile-based images within the same TIFF file!");
+        }
 
-    if (TIFFIsTiled(tiff)) {
-        TiffReader::ReadSubfileByTile<T>(
-            tiff, subfile_idx, image_ptr
-        );
-    } else {
-        TiffReader::ReadSubfileByScanline<T>(
-            tiff, subfile_idx, image_ptr
+        auto c_image = make_c_style(image);
+        uint64 ifd_offset = StreamSubfile<T>(
+            static_cast<T*>(c_image.request().ptr), tiff_tags, tiled, GetLastSubfileOffset(session_fd_)
         );
+
+        uint32 subfile_idx = GetSubfileCount();
+        subfile_tags_[subfile_idx] = tiff_tags;
+        subfile_offsets_[subfile_idx] = ifd_offset;
+        subfile_count_ += 1;
+    } catch (...) {
+        if (owns_session)
+            CloseSession();
+        throw;
     }
 
-    TIFFClose(tiff);
+    if (owns_session)
+        CloseSession();
+}
 
-    return image;
+void TiffFile::OpenAsyncWriter(uint32 threads, uint32 queue_depth) {
+    if (async_writer_ != nullptr)
+        throw std::runtime_error("An asynchronous writer is already open!");
+    if (queue_depth == 0)
+        throw std::runtime_error("The queue depth must be greater than 0!");
+
+    std::unique_ptr<AsyncWriter> writer(new AsyncWriter());
+    writer->queue_depth = queue_depth;
+    writer->owns_session = session_fd_ < 0;
+    if (writer->owns_session)
+        OpenSession();
+
+    try {
+        writer->last_offset = GetLastSubfileOffset(session_fd_);
+        writer->tiled = -1;
+        if (subfile_count_ > 0) {
+            TiffDirectory directory(session_fd_, TiffDirectory::GetFirstOffset(session_fd_));
+            writer->tiled = directory.HasEntry(TIFFTAG_TILEWIDTH) ? 1 : 0;
+        }
+    } catch (...) {
+        if (writer->owns_session)
+            CloseSession();
+        throw;
+    }
+
+    writer->pool.reset(new ThreadPool(threads));
+    async_writer_ = std::move(writer);
+    async_writer_->append_thread = std::thread(&TiffFile::RunAppendThread, this);
 }
 
 template <typename T>
-py::array_t<T> TiffFile::ReadSubfileRegion(
-    uint16 subfile_idx, uint32 x1, uint32 y1, uint32 x2, uint32 y2
-) {
-    if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
-        throw std::out_of_range("Subfile index out of range!");
+void TiffFile::SubmitSubfile(py::array_t<T> image, TiffTags tiff_tags, bool tiled) {
+    if (async_writer_ == nullptr)
+        throw std::runtime_error("No asynchronous writer is open!");
+    AsyncWriter& writer = *async_writer_;
+
+    auto c_image = make_c_style(image);
+    if (static_cast<uint64>(c_image.size()) != uint64(tiff_tags.image_width) * tiff_tags.image_length * tiff_tags.samples_per_pixel)
+        throw std::runtime_error("The shape of the image data does not match the TIFF Tags!");
+
+    // the frame is copied, so the caller can reuse its buffer right away
+    auto frame = std::make_shared<std::vector<T>>(c_image.data(), c_image.data() + c_image.size());
+
+    uint64 submission_idx;
+    {
+        py::gil_scoped_release release;
+        std::unique_lock<std::mutex> lock(writer.mutex);
+        writer.cv.wait(lock, [&writer] {
+            return writer.error != nullptr || writer.submitted_count - writer.appended_count < writer.queue_depth;
+        });
+        if (writer.error != nullptr)
+            std::rethrow_exception(writer.error);
+        if (writer.tiled >= 0 && writer.tiled != tiled)
+            throw std::runtime_error("Cannot mix scanline- and tile-based images within the same TIFF file!");
 
-    TIFF* tiff = nullptr;
-    if (version_ == 42) {
-        tiff = TIFFOpen(file_path_.c_str(), "r");
-    } else {
-        tiff = TIFFOpen(file_path_.c_str(), "r8");
+        writer.tiled = tiled;
+        submission_idx = writer.submitted_count;
+        writer.submitted_count += 1;
     }
 
-    if (tiff == nullptr) {
-        throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
-    }
+    writer.pool->Submit([this, &writer, frame, tiff_tags, tiled, submission_idx]() {
+        AsyncWriter::EncodedSubfile subfile;
+        subfile.tiff_tags = tiff_tags;
+        std::exception_ptr error;
+        try {
+            subfile.encoded = EncodeSubfile<T>(frame->data(), tiff_tags, tiled);
+        } catch (...) {
+            error = std::current_exception();
+        }
 
-    uint32 region_length = y2 - y1;
-    uint32 region_width = x2 - x1;
+        {
+            std::unique_lock<std::mutex> lock(writer.mutex);
+            if (error != nullptr && writer.error == nullptr)
+                writer.error = error;
+            writer.encoded_subfiles[submission_idx] = std::move(subfile);
+        }
+        writer.cv.notify_all();
+    });
+}
 
-    DEBUG_PRINTF("crop_length/crop_width: %d, %d\n", region_length, region_width);
+void TiffFile::RunAppendThread() {
+    AsyncWriter& writer = *async_writer_;
+    while (true) {
+        AsyncWriter::EncodedSubfile subfile;
+        bool discard;
+        {
+            std::unique_lock<std::mutex> lock(writer.mutex);
+            writer.cv.wait(lock, [&writer] {
+                return writer.stop || writer.encoded_subfiles.count(writer.appended_count) > 0;
+            });
+            auto it = writer.encoded_subfiles.find(writer.appended_count);
+            if (it == writer.encoded_subfiles.end())
+                return;
+
+            subfile = std::move(it->second);
+            writer.encoded_subfiles.erase(it);
+            discard = writer.discarding || subfile.encoded.empty();
+        }
 
-    py::array_t<T> region = py::array(
-        py::buffer_info(
-            nullptr,                                // Pointer to data (nullptr -> ask NumPy to allocate!)
-            sizeof(T),                              // Size of one item
-            py::format_descriptor<T>::value,        // Buffer format
-            2,                                      // How many dimensions? 
-            { region_length, region_width },        // Number of elements for each dimension
-            { sizeof(T) * region_width, sizeof(T) } // Strides for each dimension
-        )
-    );
-    T* region_ptr = static_cast<T*>(region.request().ptr);
+        uint64 ifd_offset = 0;
+        std::exception_ptr error;
+        if (!discard) {
+            try {
+                ifd_offset = AppendSubfile(subfile.encoded, writer.last_offset);
+            } catch (...) {
+                error = std::current_exception();
+                discard = true;
+            }
+        }
 
-    if (TIFFIsTiled(tiff)) {
-        TiffReader::ReadSubfileRegionByTile<T>(
-            tiff, subfile_idx, region_ptr, x1, y1, x2, y2
-        );
-    } else {
-        TiffReader::ReadSubfileRegionByScanline<T>(
-            tiff, subfile_idx, region_ptr, x1, y1, x2, y2
-        );
+        {
+            std::unique_lock<std::mutex> lock(writer.mutex);
+            if (error != nullptr && writer.error == nullptr)
+                writer.error = error;
+            if (discard) {
+                writer.discarding = true;
+            } else {
+                writer.last_offset = ifd_offset;
+                writer.appended_subfiles.emplace_back(subfile.tiff_tags, ifd_offset);
+            }
+            writer.appended_count += 1;
+        }
+        writer.cv.notify_all();
     }
-
-    TIFFClose(tiff);
-
-    return region;
 }
 
-template <typename T>
-void TiffFile::WriteSubfile(py::array_t<T> image, TiffTags tiff_tags, bool tiled) {
-    TIFF* tiff = nullptr;
-    if (GetSubfileCount() > 0) {
-        if (version_ == 42) {
-            tiff = TIFFOpen(file_path_.c_str(), "r");
-        } else {
-            tiff = TIFFOpen(file_path_.c_str(), "r8");
+void TiffFile::Flush() {
+    if (async_writer_ == nullptr)
+        return;
+    AsyncWriter& writer = *async_writer_;
+
+    std::exception_ptr error;
+    {
+        py::gil_scoped_release release;
+        std::unique_lock<std::mutex> lock(writer.mutex);
+        writer.cv.wait(lock, [&writer] { return writer.appended_count == writer.submitted_count; });
+
+        for (const auto& appended_subfile: writer.appended_subfiles) {
+            subfile_tags_[subfile_count_] = appended_subfile.first;
+            subfile_offsets_[subfile_count_] = appended_subfile.second;
+            subfile_count_ += 1;
         }
+        writer.appended_subfiles.clear();
 
-        if (tiff == nullptr) {
-            throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
-        }
+        // nothing is in flight, so the writer can resume after an error
+        std::swap(error, writer.error);
+        writer.discarding = false;
+    }
 
-        TIFFSetDirectory(tiff, 0);
-        if (TIFFIsTiled(tiff) != tiled)
-            throw std::runtime_error("Cannot mix scanline- and tile-based images within the same TIFF file!");
+    if (error != nullptr)
+        std::rethrow_exception(error);
+}
 
-        TIFFClose(tiff);
+void TiffFile::StopAsyncWriter() {
+    AsyncWriter& writer = *async_writer_;
+    {
+        std::unique_lock<std::mutex> lock(writer.mutex);
+        writer.cv.wait(lock, [&writer] { return writer.appended_count == writer.submitted_count; });
+        writer.stop = true;
     }
+    writer.cv.notify_all();
+    writer.append_thread.join();
+    writer.pool.reset();
+}
 
-    if (version_ == 42) {
-        tiff = TIFFOpen(file_path_.c_str(), "a");
-    } else {
-        tiff = TIFFOpen(file_path_.c_str(), "a8");
-    }
+void TiffFile::CloseAsyncWriter() {
+    if (async_writer_ == nullptr)
+        return;
 
-    if (tiff == nullptr) {
-        throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
+    std::exception_ptr error;
+    try {
+        Flush();
+    } catch (...) {
+        error = std::current_exception();
     }
 
-    // Baseline
-    TIFFSetField(tiff, TIFFTAG_SUBFILETYPE, tiff_tags.new_subfile_type);
-    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, tiff_tags.image_width);
-    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, tiff_tags.image_length);
-    TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, tiff_tags.bits_per_sample);
-    TIFFSetField(tiff, TIFFTAG_COMPRESSION, tiff_tags.compression);
-    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, tiff_tags.photometric);
-    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, tiff_tags.samples_per_pixel);
-    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, tiff_tags.rows_per_strip);
-    TIFFSetField(tiff, TIFFTAG_MINSAMPLEVALUE, tiff_tags.min_sample_value);
-    TIFFSetField(tiff, TIFFTAG_MAXSAMPLEVALUE, tiff_tags.max_sample_value);
-    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, tiff_tags.planar_config);
-    // Extension
-    if (tiff_tags.new_subfile_type == 2) {  // add metadata for page file type
-        TIFFSetField(
-            tiff, TIFFTAG_PAGENUMBER,
-            tiff_tags.page_number.page_number, tiff_tags.page_number.page_count
-        );
-    }
+    StopAsyncWriter();
+    bool owns_session = async_writer_->owns_session;
+    async_writer_.reset();
+    if (owns_session)
+        CloseSession();
 
-    if (tiled) {
-        TIFFSetField(tiff, TIFFTAG_TILEWIDTH, tiff_tags.tile_width);  // sets tif->tif_flags |= TIFF_ISTILED
-        TIFFSetField(tiff, TIFFTAG_TILELENGTH, tiff_tags.tile_length);  // sets tif->tif_flags |= TIFF_ISTILED
-    }
-    TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, tiff_tags.sample_format);
+    if (error != nullptr)
+        std::rethrow_exception(error);
+}
 
-    uint16 subfile_idx = GetSubfileCount();
-    subfile_tags_[subfile_idx] = tiff_tags;
-    subfile_count_ += 1;
+void TiffFile::CreateStack(uint32 frame_count, TiffTags tiff_tags) {
+    if (subfile_count_ > 0)
+        throw std::runtime_error("A stack can only be created in an empty TIFF file!");
+    if (session_fd_ >= 0)
+        throw std::runtime_error("A write session is already open!");
+    if (frame_count == 0)
+        throw std::runtime_error("Invalid number of frames: " + std::to_string(frame_count) + "!");
+    if (tiff_tags.compression != COMPRESSION_NONE || tiff_tags.tile_width > 0)
+        throw std::runtime_error("A stack must consist of uncompressed scanline-based subfiles!");
+    if (tiff_tags.bits_per_sample != 8 && tiff_tags.bits_per_sample != 16)
+        throw std::runtime_error("Found unsupported field 'BitsPerSample' (" + std::to_string(tiff_tags.bits_per_sample) + ")!");
+
+    const uint8 header_size = (version_ == 42) ? 8 : 16;
+    const uint64 pixel_count = uint64(tiff_tags.image_width) * tiff_tags.image_length * tiff_tags.samples_per_pixel;
+    tiff_tags.rows_per_strip = tiff_tags.image_length;
+
+    OpenSession();
+    try {
+        // the first frame serves as the template of all frames
+        std::vector<uint8> encoded;
+        if (tiff_tags.bits_per_sample == 8) {
+            std::vector<uint8> zeros(pixel_count, 0);
+            encoded = EncodeSubfile<uint8>(zeros.data(), tiff_tags, false);
+        } else {
+            std::vector<uint16> zeros(pixel_count, 0);
+            encoded = EncodeSubfile<uint16>(zeros.data(), tiff_tags, false);
+        }
 
-    T* image_ptr = static_cast<T*>(make_c_style(image).request().ptr);
+        const uint64 frame_size = pixel_count * (tiff_tags.bits_per_sample / 8);
+        const uint64 page_size = (encoded.size() - header_size) + (encoded.size() & 1);
+        if (version_ == 42 && header_size + frame_count * page_size > std::numeric_limits<uint32>::max())
+            throw std::runtime_error("The stack exceeds the maximum size of a TIFF file, a BigTIFF file is required!");
+        const uint64 ifd_offset = AppendSubfile(encoded, 0);
+        const uint64 data_offset = TiffDirectory(session_fd_, ifd_offset).GetValue(TIFFTAG_STRIPOFFSETS, 0);
+        subfile_tags_[0] = tiff_tags;
+        subfile_offsets_[0] = ifd_offset;
+        subfile_count_ = 1;
+
+        // the other frames are copies of the directory moved by a multiple of the page size
+        const uint8* metadata_ptr = encoded.data() + data_offset + frame_size;
+        const uint64 metadata_size = encoded.size() - data_offset - frame_size;
+        std::vector<uint8> metadata(metadata_size);
+        for (uint32 frame_idx = 1; frame_idx < frame_count; frame_idx++) {
+            const uint64 delta = frame_idx * page_size;
+            if (data_offset > header_size)
+                write_at(session_fd_, encoded.data() + header_size, data_offset - header_size, header_size + delta);
+            std::memcpy(metadata.data(), metadata_ptr, metadata_size);
+            TiffDirectory::Relocate(
+                metadata.data(), metadata_size, data_offset + frame_size, ifd_offset, delta, encoded[0] == 'M', version_ == 43
+            );
+            write_at(session_fd_, metadata.data(), metadata_size, data_offset + frame_size + delta);
+            TiffDirectory(session_fd_, subfile_offsets_[frame_idx - 1]).SetNextOffset(ifd_offset + delta);
 
-    if (tiled) {
-        TiffWriter::WriteSubfileByTile<T>(
-            tiff, subfile_idx, image_ptr
-        );
-    } else {
-        TiffWriter::WriteSubfileByScanline<T>(
-            tiff, subfile_idx, image_ptr
-        );
+            subfile_tags_[frame_idx] = tiff_tags;
+            subfile_offsets_[frame_idx] = ifd_offset + delta;
+            subfile_count_ += 1;
+        }
+        allocate_file(session_fd_, header_size + frame_count * page_size);
+
+        stack_frame_count_ = frame_count;
+        stack_frame_size_ = frame_size;
+        stack_data_offset_ = data_offset;
+        stack_page_size_ = page_size;
+        stack_bits_per_sample_ = tiff_tags.bits_per_sample;
+    } catch (...) {
+        CloseSession();
+        throw;
     }
+}
 
-    TIFFClose(tiff);
+template <typename T>
+void TiffFile::WriteStackFrame(py::array_t<T> frame, uint32 frame_idx) {
+    if (stack_frame_count_ == 0)
+        throw std::runtime_error("No stack is open!");
+    if (frame_idx >= stack_frame_count_)
+        throw std::out_of_range("Frame index out of range!");
+    if (sizeof(T) * 8 != stack_bits_per_sample_)
+        throw std::runtime_error("The frame data does not match field 'BitsPerSample' (" + std::to_string(stack_bits_per_sample_) + ")!");
+
+    auto c_frame = make_c_style(frame);
+    if (static_cast<uint64>(c_frame.size()) * sizeof(T) != stack_frame_size_)
+        throw std::runtime_error("The shape of the frame data does not match the stack!");
+
+    // the byte order of the stack is the host byte order
+    WriteSessionData(c_frame.data(), stack_frame_size_, stack_data_offset_ + frame_idx * stack_page_size_);
+}
+
+void TiffFile::CloseStack() {
+    if (stack_frame_count_ > 0)
+        CloseSession();
 }
 
 template <typename T>
 void TiffFile::WriteSubfileRegion(
-    py::array_t<T> image, uint16 subfile_idx,
+    py::array_t<T> image, uint32 subfile_idx,
     uint32 x1, uint32 y1, uint32 x2, uint32 y2
 ) {
+    CheckFileBacked();
+    CheckNoAsyncWriter();
     if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
         throw std::out_of_range("Subfile index out of range!");
 
-    TIFF* tiff = nullptr;
-    bool is_tiled = false;
-    if (version_ == 42) {
-        tiff = TIFFOpen(file_path_.c_str(), "r");
-        is_tiled = TIFFIsTiled(tiff);
-        TIFFClose(tiff);
-        tiff = TIFFOpen(file_path_.c_str(), "a");
-    } else {
-        tiff = TIFFOpen(file_path_.c_str(), "r8");
-        is_tiled = TIFFIsTiled(tiff);
+    py::array_t<T, py::array::c_style | py::array::forcecast> region = make_c_style(image);
+    if (
+        x1 >= x2 || y1 >= y2 || region.ndim() < 2 ||
+        region.shape(0) != int64(y2 - y1) || region.shape(1) != int64(x2 - x1) ||
+        region.size() != int64(y2 - y1) * (x2 - x1) * LoadSubfile(subfile_idx).samples_per_pixel
+    )
+        throw std::runtime_error("The shape of the region data does not match the region!");
+
+    // rewritten tiles/strips are appended to the file
+    InvalidateIndex();
+    TIFF* tiff = OpenSubfile(subfile_idx, 0);
+    bool is_tiled = TIFFIsTiled(tiff);
+
+    int fd = -1;
+    try {
+        fd = open_file(file_path_, true);
+
+        T* image_ptr = static_cast<T*>(region.request().ptr);
+        if (is_tiled) {
+            TiffWriter::WriteSubfileRegionByTile<T>(
+                tiff, fd, image_ptr,
+                x1, y1, x2, y2
+            );
+        } else {
+            TiffWriter::WriteSubfileRegionByScanline<T>(
+                tiff, fd, image_ptr,
+                x1, y1, x2, y2
+            );
+        }
+    } catch (...) {
+        if (fd >= 0)
+            close_file(fd);
         TIFFClose(tiff);
-        tiff = TIFFOpen(file_path_.c_str(), "a8");
-    }
-
-    if (tiff == nullptr) {
-        throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
-    }
-
-    T* image_ptr = static_cast<T*>(make_c_style(image).request().ptr);
-
-    if (is_tiled) {
-        TiffWriter::WriteSubfileRegionByTile<T>(
-            tiff, subfile_idx, image_ptr,
-            x1, y1, x2, y2
-        );
-    } else {
-        TiffWriter::WriteSubfileRegionByScanline<T>(
-            tiff, subfile_idx, image_ptr,
-            x1, y1, x2, y2
-        );
+        throw;
     }
-
+    close_file(fd);
     TIFFClose(tiff);
+
+    // the reduced-resolution levels are brought up to date by UpdatePyramid()
+    if (is_tiled)
+        MarkDirty(subfile_idx, x1, y1, x2, y2);
 }
 
 template <typename T>
-void TiffFile::WriteMultiscaleSubfile(py::array_t<T> image, TiffTags tiff_tags) {
-    if (GetSubfileCount() > 0) {
+void TiffFile::WriteMultiscaleSubfile(
+    py::array_t<T> image, TiffTags tiff_tags, bool sub_ifds, uint32 threads,
+    std::vector<uint32> factors, uint32 min_level_size
+) {
+    CheckFileBacked();
+    CheckNoAsyncWriter();
+    if (GetSubfileCount() > 0 && !sub_ifds) {
         throw std::runtime_error(
             "Cannot append a multi-scale subfiles to an existing TIFF file!"
         );
     }
+    if (GetSubfileCount() > 0 && GetTileWidth(0) == 0) {
+        throw std::runtime_error("Cannot mix scanline- and tile-based images within the same TIFF file!");
+    }
+
+    if (static_cast<uint64>(image.size()) != uint64(tiff_tags.image_width) * tiff_tags.image_length * tiff_tags.samples_per_pixel)
+        throw std::runtime_error("The shape of the image data does not match the TIFF Tags!");
 
     TIFF* out_tiff = nullptr;
-    if (version_ == 42) {
-        out_tiff = TIFFOpen(file_path_.c_str(), "w");
+    if (GetSubfileCount() > 0) {
+        if (version_ == 42) {
+            out_tiff = TIFFOpen(file_path_.c_str(), "a");
+        } else {
+            out_tiff = TIFFOpen(file_path_.c_str(), "a8");
+        }
     } else {
-        out_tiff = TIFFOpen(file_path_.c_str(), "w8");
+        if (version_ == 42) {
+            out_tiff = TIFFOpen(file_path_.c_str(), "w");
+        } else {
+            out_tiff = TIFFOpen(file_path_.c_str(), "w8");
+        }
     }
 
     if (out_tiff == nullptr) {
@@ -428,92 +1801,519 @@ void TiffFile::WriteMultiscaleSubfile(py::array_t<T> image, TiffTags tiff_tags)
         tiff_tags.new_subfile_type = FILETYPE_REDUCEDIMAGE;
     }
 
-    // Baseline
-    TIFFSetField(out_tiff, TIFFTAG_SUBFILETYPE, tiff_tags.new_subfile_type);
-    TIFFSetField(out_tiff, TIFFTAG_IMAGEWIDTH, tiff_tags.image_width);
-    TIFFSetField(out_tiff, TIFFTAG_IMAGELENGTH, tiff_tags.image_length);
-    TIFFSetField(out_tiff, TIFFTAG_BITSPERSAMPLE, tiff_tags.bits_per_sample);
-    TIFFSetField(out_tiff, TIFFTAG_COMPRESSION, tiff_tags.compression);
-    TIFFSetField(out_tiff, TIFFTAG_PHOTOMETRIC, tiff_tags.photometric);
-    TIFFSetField(out_tiff, TIFFTAG_SAMPLESPERPIXEL, tiff_tags.samples_per_pixel);
-    TIFFSetField(out_tiff, TIFFTAG_ROWSPERSTRIP, tiff_tags.rows_per_strip);
-    TIFFSetField(out_tiff, TIFFTAG_MINSAMPLEVALUE, tiff_tags.min_sample_value);
-    TIFFSetField(out_tiff, TIFFTAG_MAXSAMPLEVALUE, tiff_tags.max_sample_value);
-    TIFFSetField(out_tiff, TIFFTAG_PLANARCONFIG, tiff_tags.planar_config);
-    // Extension
-    TIFFSetField(out_tiff, TIFFTAG_TILEWIDTH, tiff_tags.tile_width);
-    TIFFSetField(out_tiff, TIFFTAG_TILELENGTH, tiff_tags.tile_length);
-    TIFFSetField(out_tiff, TIFFTAG_SAMPLEFORMAT, tiff_tags.sample_format);
+    const std::vector<uint32> level_factors = GetLevelFactors(tiff_tags, factors, min_level_size);
+    const uint32 kPageCount = level_factors.size();
 
-    uint16 subfile_idx = GetSubfileCount();
-    subfile_tags_[subfile_idx] = tiff_tags;
-    subfile_count_ += 1;
+    // with SubIFDs, the full resolution image is the main subfile while
+    // the reduced-resolution levels are nested below it.
+    TiffTags baseline_tags = tiff_tags;
+    if (sub_ifds)
+        baseline_tags.new_subfile_type = 0;
+
+    uint32 subfile_idx = GetSubfileCount();
 
     image = make_c_style(image);
     T* image_ptr = static_cast<T*>(image.request().ptr);
+    const uint64 sample_count = uint64(tiff_tags.image_width) * tiff_tags.image_length * tiff_tags.samples_per_pixel;
 
     uint32 max_value = 0;
-    for (uint32 row = 0; row < tiff_tags.image_length; row++) {
-        for (uint32 column = 0; column < tiff_tags.image_width; column++) {
-            max_value = max(
-                max_value, image_ptr[row * tiff_tags.image_width + column]
-            );
+    for (uint64 i = 0; i < sample_count; i++)
+        max_value = max(max_value, image_ptr[i]);
+    float scaling_factor = 255.f / max_value;
+
+    // called by the writer before the tiles of a level are written
+    auto set_level_tags = [&](uint32 level) {
+        uint64 cumulative_factor = 1;
+        for (uint32 l = 0; l < level; l++)
+            cumulative_factor *= level_factors[l];
+        TiffTags level_tags = (level == 0) ? baseline_tags : GetLevelTags(tiff_tags, cumulative_factor);
+
+        SetTiledTiffTags(out_tiff, level_tags);
+        if (level == 0 && sub_ifds && kPageCount > 0) {
+            // libtiff writes the next kPageCount directories as SubIFDs
+            // and patches their offsets into this directory.
+            std::vector<uint64> subifd_offsets(kPageCount, 0);
+            TIFFSetField(out_tiff, TIFFTAG_SUBIFD, (uint16) kPageCount, subifd_offsets.data());
         }
+
+        if (level == 0 || !sub_ifds) {
+            subfile_tags_[GetSubfileCount()] = level_tags;
+            subfile_count_ += 1;
+        }
+    };
+
+    try {
+        TiffWriter::WriteMultiscaleSubfileByTile<T>(
+            out_tiff, image_ptr, scaling_factor, level_factors, set_level_tags, threads
+        );
+    } catch (...) {
+        TIFFClose(out_tiff);
+        throw;
     }
-    float scaling_factor = 255.f / max_value;
 
-    TiffWriter::WriteScaledSubfileByTile<T, uint8>(
-        out_tiff, subfile_idx, image_ptr, scaling_factor
-    );
-    TIFFWriteDirectory(out_tiff);
+    TIFFClose(out_tiff);
 
-    const uint32 kPageCount = std::ceil(
-        std::log2(
-            float(max(tiff_tags.image_length, tiff_tags.image_width)) /
-            tiff_tags.tile_length
-        )
-    ) + 1;
+    if (sub_ifds) {
+        TIFF* tiff = nullptr;
+        if (version_ == 42) {
+            tiff = TIFFOpen(file_path_.c_str(), "r");
+        } else {
+            tiff = TIFFOpen(file_path_.c_str(), "r8");
+        }
+
+        if (tiff == nullptr) {
+            throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
+        }
+
+        int fd = open_file(file_path_);
+        try {
+            TIFFSetSubDirectory(tiff, GetSubfileOffset(fd, subfile_idx));
+        } catch (...) {
+            close_file(fd);
+            TIFFClose(tiff);
+            throw;
+        }
+        close_file(fd);
+        ReadSubfileLevels(tiff, subfile_idx);
+
+        TIFFClose(tiff);
+    }
+}
+
+void TiffFile::AddSubfileLevels(
+    uint32 subfile_idx, bool sub_ifds, std::vector<uint32> factors, uint32 min_level_size
+) {
+    CheckFileBacked();
+    CheckNoAsyncWriter();
+    if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
+        throw std::out_of_range("Subfile index out of range!");
+
+    TiffTags tiff_tags = LoadSubfile(subfile_idx);
+    if ((tiff_tags.tile_width == 0) || (tiff_tags.tile_length == 0))
+        throw std::runtime_error(
+            "Reduced-resolution levels are written by tiles!\n"
+            "Field 'TileLength' or 'TileWidth' is missing."
+        );
+    if (tiff_tags.samples_per_pixel != 1 || (tiff_tags.bits_per_sample != 8 && tiff_tags.bits_per_sample != 16))
+        throw std::runtime_error(
+            "Can only add reduced-resolution levels to 8-bit or 16-bit single-channel subfiles!"
+        );
+    if (GetSubfileLevelCount(subfile_idx) > 1)
+        throw std::runtime_error(
+            "Subfile '" + std::to_string(subfile_idx) + "' already has reduced-resolution levels!"
+        );
+    // chained levels are only found directly after their subfile
+    if (!sub_ifds && subfile_idx != subfile_count_ - 1)
+        throw std::runtime_error(
+            "Can only add chained reduced-resolution levels to the last subfile!\n"
+            "Use SubIFDs for subfile '" + std::to_string(subfile_idx) + "'."
+        );
+
+    const std::vector<uint32> level_factors = GetLevelFactors(tiff_tags, factors, min_level_size);
+    const uint32 kPageCount = level_factors.size();
+    if (kPageCount == 0)
+        return;
+    InvalidateIndex();
+
+    // reads the offsets of the IFD chain as currently stored in the file,
+    // which is not limited to libtiff's directory count
+    auto read_chain = [this]() {
+        int fd = open_file(file_path_);
+        std::vector<uint64> chain;
+        try {
+            chain = TiffDirectory::GetChainOffsets(fd);
+        } catch (...) {
+            close_file(fd);
+            throw;
+        }
+        close_file(fd);
+        return chain;
+    };
+
+    // the directory offsets of all subfiles are required to restore the
+    // order of the IFD chain after the subfile has been rewritten
+    std::vector<uint64> offsets;
+    uint64 subfile_offset = 0;
+    if (sub_ifds) {
+        int fd = open_file(file_path_);
+        try {
+            subfile_offset = GetSubfileOffset(fd, subfile_idx);
+        } catch (...) {
+            close_file(fd);
+            throw;
+        }
+        close_file(fd);
+        offsets = read_chain();
+        if (offsets.size() != GetSubfileCount() || offsets[subfile_idx] != subfile_offset)
+            throw std::runtime_error("Could not read the IFD chain of file '" + std::string(file_path_) + "'!");
+    }
+
+    // the image data of the subfile remains in place, only directories
+    // are appended to the end of the TIFF file
+    TIFF* out_tiff = nullptr;
+    if (sub_ifds) {
+        out_tiff = TIFFOpen(file_path_.c_str(), "r+");
+        if (out_tiff != nullptr && !TIFFSetSubDirectory(out_tiff, subfile_offset)) {
+            TIFFClose(out_tiff);
+            out_tiff = nullptr;
+        }
+    } else if (version_ == 42) {
+        out_tiff = TIFFOpen(file_path_.c_str(), "a");
+    } else {
+        out_tiff = TIFFOpen(file_path_.c_str(), "a8");
+    }
+
+    if (out_tiff == nullptr) {
+        throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
+    }
+
+    uint64 rewritten_offset = 0;
+    if (sub_ifds) {
+        // libtiff writes the next kPageCount directories as SubIFDs
+        // and patches their offsets into the rewritten directory.
+        std::vector<uint64> subifd_offsets(kPageCount, 0);
+        TIFFSetField(out_tiff, TIFFTAG_SUBIFD, (uint16) kPageCount, subifd_offsets.data());
+        if (!TIFFRewriteDirectory(out_tiff)) {
+            TIFFClose(out_tiff);
+            throw std::runtime_error("Could not rewrite subfile '" + std::to_string(subfile_idx) + "'!");
+        }
+
+        // the rewritten directory is the only unknown offset within the chain
+        for (uint64 offset: read_chain()) {
+            if (std::find(offsets.begin(), offsets.end(), offset) == offsets.end())
+                rewritten_offset = offset;
+        }
+        if (rewritten_offset == 0) {
+            TIFFClose(out_tiff);
+            throw std::runtime_error("Could not rewrite subfile '" + std::to_string(subfile_idx) + "'!");
+        }
+    }
 
+    uint32 level_idx = subfile_idx;
+    uint64 cumulative_factor = 1;
     for (uint32 page: range(0, kPageCount)) {
-        // the TIFF handle must be renewed within each loop to reflect the
-        // newly inserted subfile.
         TIFF* in_tiff = nullptr;
-        if (version_ == 42) {
+        if (sub_ifds && page > 0) {
             in_tiff = TIFFOpen(file_path_.c_str(), "r");
+            if (in_tiff != nullptr) {
+                // the offsets of the SubIFDs written so far are already patched
+                uint16 subifd_count = 0;
+                uint64* subifd_offsets = nullptr;
+                if (
+                    !TIFFSetSubDirectory(in_tiff, rewritten_offset) ||
+                    !TIFFGetField(in_tiff, TIFFTAG_SUBIFD, &subifd_count, &subifd_offsets) ||
+                    subifd_count < page || subifd_offsets[page - 1] == 0 ||
+                    !TIFFSetSubDirectory(in_tiff, subifd_offsets[page - 1])
+                ) {
+                    TIFFClose(in_tiff);
+                    TIFFClose(out_tiff);
+                    throw std::runtime_error(
+                        "Could not read level '" + std::to_string(page) + "' of subfile '" +
+                        std::to_string(subfile_idx) + "'!"
+                    );
+                }
+            }
         } else {
-            in_tiff = TIFFOpen(file_path_.c_str(), "r8");
-        }
-
-        // Baseline
-        TIFFSetField(out_tiff, TIFFTAG_SUBFILETYPE, tiff_tags.new_subfile_type);
-        TIFFSetField(out_tiff, TIFFTAG_IMAGEWIDTH, (tiff_tags.image_width + 1) >> (page + 1));
-        TIFFSetField(out_tiff, TIFFTAG_IMAGELENGTH, (tiff_tags.image_length + 1) >> (page + 1));
-        TIFFSetField(out_tiff, TIFFTAG_BITSPERSAMPLE, tiff_tags.bits_per_sample);
-        TIFFSetField(out_tiff, TIFFTAG_COMPRESSION, tiff_tags.compression);
-        TIFFSetField(out_tiff, TIFFTAG_PHOTOMETRIC, tiff_tags.photometric);
-        TIFFSetField(out_tiff, TIFFTAG_SAMPLESPERPIXEL, tiff_tags.samples_per_pixel);
-        TIFFSetField(out_tiff, TIFFTAG_ROWSPERSTRIP, tiff_tags.rows_per_strip);
-        TIFFSetField(out_tiff, TIFFTAG_MINSAMPLEVALUE, tiff_tags.min_sample_value);
-        TIFFSetField(out_tiff, TIFFTAG_MAXSAMPLEVALUE, tiff_tags.max_sample_value);
-        TIFFSetField(out_tiff, TIFFTAG_PLANARCONFIG, tiff_tags.planar_config);
-        // Extension
-        TIFFSetField(out_tiff, TIFFTAG_TILEWIDTH, tiff_tags.tile_width);
-        TIFFSetField(out_tiff, TIFFTAG_TILELENGTH, tiff_tags.tile_length);
-        TIFFSetField(out_tiff, TIFFTAG_SAMPLEFORMAT, tiff_tags.sample_format);
-
-        TIFFCheckpointDirectory(out_tiff);
+            // the TIFF handle must be renewed within each loop to reflect
+            // the newly appended subfile.
+            in_tiff = OpenSubfile(level_idx);
+        }
 
-        subfile_tags_[GetSubfileCount()] = tiff_tags;
-        subfile_count_ += 1;
+        if (in_tiff == nullptr) {
+            TIFFClose(out_tiff);
+            throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
+        }
 
-        TiffWriter::WriteDownsampledSubfileByTile<uint8>(
-            in_tiff, out_tiff, page, page + 1
-        );
+        cumulative_factor *= level_factors[page];
+        TiffTags level_tags = GetLevelTags(tiff_tags, cumulative_factor);
+        SetTiledTiffTags(out_tiff, level_tags);
+
+        try {
+            // each tile is computed from its parent tiles only
+            BufferPool::Buffer tile_buffer = BufferPool::Acquire(TIFFTileSize(out_tiff));
+            for (uint32 y = 0; y < level_tags.image_length; y += level_tags.tile_length) {
+                for (uint32 x = 0; x < level_tags.image_width; x += level_tags.tile_width) {
+                    if (tiff_tags.bits_per_sample == 8) {
+                        TiffWriter::DownsampleTile<uint8>(in_tiff, x, y, tile_buffer.GetData(), level_factors[page]);
+                    } else {
+                        TiffWriter::DownsampleTile<uint16>(
+                            in_tiff, x, y, tile_buffer.GetData<uint16>(), level_factors[page]
+                        );
+                    }
+                    if (TIFFWriteTile(out_tiff, tile_buffer.GetData(), x, y, 0, 0) < 0)
+                        throw std::runtime_error(
+                            "Error while writing image tile (" + std::to_string(x) + ", " + std::to_string(y) + ")!"
+                        );
+                }
+            }
+        } catch (...) {
+            TIFFClose(in_tiff);
+            TIFFClose(out_tiff);
+            throw;
+        }
 
         TIFFWriteDirectory(out_tiff);
-
         TIFFClose(in_tiff);
+
+        if (!sub_ifds) {
+            level_idx = GetSubfileCount();
+            subfile_tags_[level_idx] = level_tags;
+            subfile_count_ += 1;
+        }
     }
 
     TIFFClose(out_tiff);
+
+    if (sub_ifds) {
+        // depending on the libtiff version, TIFFRewriteDirectory() moves
+        // the subfile to the end of the IFD chain. Its former position is
+        // restored by relinking all directories which are out of order.
+        offsets[subfile_idx] = rewritten_offset;
+        std::vector<uint64> chain = read_chain();
+        std::map<uint64, uint64> next_offsets;  // 0 = TIFF header
+        for (size_t i = 0; i < chain.size(); i++)
+            next_offsets[(i == 0) ? 0 : chain[i - 1]] = chain[i];
+        next_offsets[chain.back()] = 0;
+
+        int fd = open_file(file_path_, true);
+        try {
+            for (size_t i = 0; i <= offsets.size(); i++) {
+                uint64 ifd_offset = (i == 0) ? 0 : offsets[i - 1];
+                uint64 next_offset = (i == offsets.size()) ? 0 : offsets[i];
+                if (next_offsets.count(ifd_offset) > 0 && next_offsets[ifd_offset] == next_offset)
+                    continue;
+                if (ifd_offset == 0)
+                    TiffDirectory::SetFirstOffset(fd, next_offset);
+                else
+                    TiffDirectory(fd, ifd_offset).SetNextOffset(next_offset);
+            }
+        } catch (...) {
+            close_file(fd);
+            throw;
+        }
+        close_file(fd);
+
+        TIFF* tiff = TIFFOpen(file_path_.c_str(), "r");
+        if (tiff == nullptr) {
+            throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
+        }
+        TIFFSetSubDirectory(tiff, rewritten_offset);
+        ReadSubfileLevels(tiff, subfile_idx);
+        TIFFClose(tiff);
+
+        subfile_offsets_[subfile_idx] = rewritten_offset;
+    }
+}
+
+void TiffFile::MarkDirty(uint32 subfile_idx, uint32 x1, uint32 y1, uint32 x2, uint32 y2) {
+    if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
+        throw std::out_of_range("Subfile index out of range!");
+
+    const TiffTags& tiff_tags = LoadSubfile(subfile_idx);
+    if ((tiff_tags.tile_width == 0) || (tiff_tags.tile_length == 0))
+        throw std::runtime_error("Can only track modified tiles of tiled subfiles!");
+
+    x2 = min(x2, tiff_tags.image_width);
+    y2 = min(y2, tiff_tags.image_length);
+    if ((x1 >= x2) || (y1 >= y2))
+        return;
+
+    const uint32 tiles_across = (tiff_tags.image_width + tiff_tags.tile_width - 1) / tiff_tags.tile_width;
+    std::set<uint32>& dirty_tiles = dirty_tiles_[subfile_idx];
+    for (uint32 tile_row = y1 / tiff_tags.tile_length; tile_row <= (y2 - 1) / tiff_tags.tile_length; tile_row++) {
+        for (uint32 tile_column = x1 / tiff_tags.tile_width; tile_column <= (x2 - 1) / tiff_tags.tile_width; tile_column++) {
+            dirty_tiles.insert(tile_row * tiles_across + tile_column);
+        }
+    }
+}
+
+uint32 TiffFile::UpdatePyramid(uint32 subfile_idx) {
+    CheckFileBacked();
+    CheckNoAsyncWriter();
+    if(subfile_idx < 0 || subfile_count_ <= subfile_idx)
+        throw std::out_of_range("Subfile index out of range!");
+    if (dirty_tiles_.count(subfile_idx) == 0 || dirty_tiles_[subfile_idx].empty())
+        return 0;
+
+    const TiffTags& tiff_tags = LoadSubfile(subfile_idx);
+    if (tiff_tags.samples_per_pixel != 1 || (tiff_tags.bits_per_sample != 8 && tiff_tags.bits_per_sample != 16))
+        throw std::runtime_error(
+            "Can only update reduced-resolution levels of 8-bit or 16-bit single-channel subfiles!"
+        );
+    InvalidateIndex();
+
+    std::vector<uint32> level_factors;
+    std::vector<uint64> level_offsets = GetLevelOffsets(subfile_idx, level_factors);
+
+    uint32 tile_count = 0;
+    std::set<uint32> dirty_tiles = dirty_tiles_[subfile_idx];
+    uint32 tiles_across = (tiff_tags.image_width + tiff_tags.tile_width - 1) / tiff_tags.tile_width;
+
+    int fd = open_file(file_path_, true);
+    BufferPool::Buffer tile_buffer;
+    std::vector<uint8> encoded;
+    TIFF* in_tiff = nullptr;
+    TIFF* out_tiff = nullptr;
+    try {
+        for (uint32 level = 1; level < level_offsets.size(); level++) {
+            // the handles are renewed within each loop to reflect the
+            // tiles replaced at the previous level.
+            in_tiff = TIFFOpen(file_path_.c_str(), "r");
+            out_tiff = TIFFOpen(file_path_.c_str(), "r");
+            if (in_tiff == nullptr || out_tiff == nullptr)
+                throw std::runtime_error("Could not open file '" + std::string(file_path_) + "'!");
+            if (
+                !TIFFSetSubDirectory(in_tiff, level_offsets[level - 1]) ||
+                !TIFFSetSubDirectory(out_tiff, level_offsets[level])
+            )
+                throw std::runtime_error("Could not read level '" + std::to_string(level) + "'!");
+
+            TiffWriter::ChunkFormat format = TiffWriter::GetChunkFormat(out_tiff);
+            if (!format.tiled || !TiffWriter::IsSelfContainedCompression(format.compression))
+                throw std::runtime_error(
+                    "Cannot replace the tiles of level '" + std::to_string(level) + "'!\n"
+                    "The level must be tiled and use a self-contained compression scheme."
+                );
+
+            uint32 image_width, image_length;
+            TIFFGetField(out_tiff, TIFFTAG_IMAGEWIDTH, &image_width);
+            TIFFGetField(out_tiff, TIFFTAG_IMAGELENGTH, &image_length);
+            uint32 level_tiles_across = (image_width + format.width - 1) / format.width;
+            uint32 level_tiles_down = (image_length + format.length - 1) / format.length;
+            tile_buffer = BufferPool::Acquire(TIFFTileSize(out_tiff));
+
+            // the parent tiles of a level n + 1 tile are the (up to)
+            // factor x factor tiles of level n at factor times its tile
+            // row and column. The edge tiles of level n may have no
+            // child, if their pixels were cut off by the downsampling.
+            const uint32 factor = level_factors[level - 1];
+            std::set<uint32> level_tiles;
+            for (uint32 tile_idx: dirty_tiles) {
+                const uint32 child_row = (tile_idx / tiles_across) / factor;
+                const uint32 child_column = (tile_idx % tiles_across) / factor;
+                if (child_row < level_tiles_down && child_column < level_tiles_across)
+                    level_tiles.insert(child_row * level_tiles_across + child_column);
+            }
+
+            TiffDirectory directory(fd, level_offsets[level]);
+            for (uint32 tile_idx: level_tiles) {
+                uint32 x = (tile_idx % level_tiles_across) * format.width;
+                uint32 y = (tile_idx / level_tiles_across) * format.length;
+                if (tiff_tags.bits_per_sample == 8) {
+                    TiffWriter::DownsampleTile<uint8>(in_tiff, x, y, tile_buffer.GetData(), factor);
+                } else {
+                    TiffWriter::DownsampleTile<uint16>(in_tiff, x, y, tile_buffer.GetData<uint16>(), factor);
+                }
+                TiffWriter::EncodeChunk(format, tile_buffer.GetData(), encoded);
+                TiffWriter::ReplaceChunk(fd, directory, tile_idx, encoded);
+                tile_count += 1;
+            }
+
+            TIFFClose(in_tiff);
+            TIFFClose(out_tiff);
+            in_tiff = out_tiff = nullptr;
+
+            dirty_tiles = level_tiles;
+            tiles_across = level_tiles_across;
+        }
+    } catch (...) {
+        if (in_tiff != nullptr)
+            TIFFClose(in_tiff);
+        if (out_tiff != nullptr)
+            TIFFClose(out_tiff);
+        close_file(fd);
+        throw;
+    }
+    close_file(fd);
+
+    dirty_tiles_.erase(subfile_idx);
+    return tile_count;
+}
+
+uint64 TiffFile::Compact() {
+    CheckFileBacked();
+    CheckNoAsyncWriter();
+    if (subfile_count_ == 0)
+        return 0;
+    if (session_fd_ >= 0)
+        throw std::runtime_error("Cannot compact the TIFF file while a write session is open!");
+
+    const std::string compact_file_path = file_path_ + ".compact";
+    int in_fd = open_file(file_path_);
+    int out_fd = -1;
+    uint64 file_size, compact_file_size;
+    try {
+        out_fd = create_file(compact_file_path);
+        TiffWriter::CompactFile(in_fd, out_fd);
+        file_size = get_file_size(in_fd);
+        compact_file_size = get_file_size(out_fd);
+    } catch (...) {
+        close_file(in_fd);
+        if (out_fd >= 0) {
+            close_file(out_fd);
+            std::remove(compact_file_path.c_str());
+        }
+        throw;
+    }
+    close_file(in_fd);
+    close_file(out_fd);
+    InvalidateIndex();
+    replace_file(compact_file_path, file_path_);
+
+    // all directories were relocated
+    in_fd = open_file(file_path_);
+    try {
+        ReadChain(in_fd, 0, 0);
+    } catch (...) {
+        close_file(in_fd);
+        throw;
+    }
+    close_file(in_fd);
+    if (use_index_)
+        SaveIndex();
+
+    return file_size - compact_file_size;
+}
+
+uint32 TiffFile::Refresh() {
+    if (IsInMemory() || !file_exists(file_path_))
+        return 0;
+
+    int fd = open_file(file_path_);
+    uint32 subfile_count = subfile_count_;
+    try {
+        if (get_file_size(fd) >= 8) {
+            uint64 next_offset = 0;
+            if (subfile_count_ == 0) {
+                // the file was created after the construction of the TiffFile
+                uint8 header[4];
+                read_at(fd, header, 4, 0);
+                uint16 version = TiffDirectory::DecodeUInt(&header[2], 2, header[0] == 'M');
+                if (version == 42 || version == 43) {
+                    version_ = version;
+                    next_offset = TiffDirectory::GetFirstOffset(fd);
+                }
+            } else {
+                next_offset = TiffDirectory(fd, GetLastSubfileOffset(fd)).GetNextOffset();
+            }
+
+            // only the directories behind the last known subfile are visited
+            if (next_offset != 0)
+                ReadChain(fd, subfile_count, next_offset);
+        }
+    } catch (...) {
+        close_file(fd);
+        throw;
+    }
+    close_file(fd);
+
+    return subfile_count_ - subfile_count;
+}
+
+bool TiffFile::WaitForChange(uint32 timeout_ms) {
+    CheckFileBacked();
+    py::gil_scoped_release release;
+    if (file_watcher_ == nullptr)
+        file_watcher_.reset(new FileWatcher(file_path_));
+    return file_watcher_->Wait(timeout_ms);
 }
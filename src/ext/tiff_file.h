@@ -1,16 +1,34 @@
 #ifndef __TIFFFILE_H__
 #define __TIFFFILE_H__
 
+#include <array>
+#include <condition_variable>
+#include <exception>
 #include <map>
 #include <math.h>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <fstream>
+#include <limits>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
+#include <pybind11/stl.h>
 
 #include <tiffio.h>
+#include "buffer_pool.h"
+#include "file_watcher.h"
+#include "thread_pool.h"
+#include "tiff_append_stream.h"
+#include "tiff_file_stream.h"
+#include "tiff_ifd.h"
+#include "tiff_memory_stream.h"
 #include "tiff_reader.h"
 #include "tiff_writer.h"
 
@@ -72,20 +90,476 @@ class TiffFile {
             // ...
         };
 
+        /**
+         * Structure for the I/O statistics of subfile and region reads.
+         */
+        struct IoStats {
+            uint64 read_count = 0;              /**< Number of reads issued to the file. */
+            uint64 bytes_read = 0;              /**< Number of bytes read from the file. */
+            uint32 max_queue_depth = 0;         /**< Maximum number of reads in flight. */
+            double read_time = 0;               /**< Time in seconds until the reads completed. */
+            uint64 bytes_saved = 0;             /**< Number of bytes read straight into the arrays, i.e. not copied from a tile buffer. */
+        };
+
+        /**
+         * Structure for the metadata of a TIFF file found by ScanMetadata().
+         */
+        struct FileMetadata {
+            bool valid = false;                 /**< If false, the file could not be parsed and the other fields keep their defaults. */
+            uint8 version = 0;                  /**< Version of the TIFF file (42 = classic TIFF, 43 = BigTIFF). */
+            bool big_endian = false;            /**< If true, the TIFF file uses the big-endian byte order. */
+            uint64 file_size = 0;               /**< Size of the file in bytes. */
+            uint32 subfile_count = 0;           /**< Number of subfiles (pages). */
+            uint32 level_count = 0;             /**< Number of levels of the first subfile, including the SubIFDs. */
+            TiffTags tiff_tags;                 /**< TIFF Tags of the first subfile. */
+        };
+
     private:
+        /**
+         * Structure for the state of the asynchronous writer.
+         */
+        struct AsyncWriter {
+            /**
+             * Structure for an encoded subfile waiting to be appended.
+             */
+            struct EncodedSubfile {
+                TiffTags tiff_tags;                 /**< TIFF Tags of the subfile. */
+                std::vector<uint8> encoded;         /**< Content of the in-memory TIFF file (empty = failed). */
+            };
+
+            std::unique_ptr<ThreadPool> pool;       /**< Threads encoding the submitted subfiles. */
+            std::thread append_thread;              /**< Thread appending the encoded subfiles in order. */
+            std::mutex mutex;                       /**< Mutex guarding the state of the writer. */
+            std::condition_variable cv;             /**< Signals an encoded or appended subfile. */
+            uint32 queue_depth;                     /**< Maximum number of subfiles in flight. */
+            int tiled;                              /**< Layout of the subfiles (-1 = unknown, 0 = strips, 1 = tiles). */
+            bool owns_session;                      /**< If true, the writer closes the write session. */
+            bool stop = false;                      /**< If true, the append thread terminates. */
+            bool discarding = false;                /**< If true, subfiles are discarded until the error is reset by a flush. */
+            uint64 submitted_count = 0;             /**< Number of submitted subfiles. */
+            uint64 appended_count = 0;              /**< Number of appended or discarded subfiles. */
+            uint64 last_offset;                     /**< Offset of the last directory of the chain (0 = empty file). */
+            std::map<uint64, EncodedSubfile> encoded_subfiles;          /**< Map of the encoded subfiles per submission index. */
+            std::vector<std::pair<TiffTags, uint64>> appended_subfiles; /**< TIFF Tags and directory offsets of subfiles appended since the last flush. */
+            std::exception_ptr error;               /**< First error of the writer. */
+        };
+
+        /**
+         * Structure for a ring of pooled output arrays of the same shape and
+         * data type.
+         */
+        struct OutputRing {
+            std::vector<py::array> arrays;          /**< Pooled arrays, which are free while only the pool references them. */
+            size_t next = 0;                        /**< Index of the array checked first by the next read. */
+            uint64 last_use = 0;                    /**< Value of the use counter of the pool at the last read of this shape. */
+        };
+
+        static const size_t kMaxOutputRings = 8;    /**< Maximum number of pooled shapes, the least recently read shape is released first. */
+
         std::string file_path_;                     /**< Path to the TIFF file. */
         uint8 version_;                             /**< Version of the TIFF file (default = 42, BigTIFF = 43). */
-        std::map<uint16, TiffTags> subfile_tags_;   /**< Map of all TIFF Tags per subfile. */
-        uint16 subfile_count_;                      /**< Total number of subfiles. */
+        std::map<uint32, TiffTags> subfile_tags_;   /**< Map of all TIFF Tags per subfile (filled on first access). */
+        uint32 subfile_count_;                      /**< Total number of subfiles. */
+        std::map<uint32, uint64> subfile_offsets_;  /**< Map of the directory offsets per subfile (filled on demand). */
+        std::map<uint32, std::vector<uint64>> subifd_offsets_;  /**< Map of the SubIFD offsets (reduced levels) per subfile. */
+        std::map<uint32, std::vector<TiffTags>> subifd_tags_;   /**< Map of the TIFF Tags of all SubIFDs per subfile. */
+        std::map<uint32, std::set<uint32>> dirty_tiles_;        /**< Map of the modified full resolution tiles per subfile. */
+        int session_fd_;                            /**< File descriptor of the open write session (-1 = no session). */
+        bool session_big_endian_;                   /**< Byte order of the TIFF file within the write session. */
+        int session_direct_fd_;                     /**< File descriptor of the session for direct I/O (-1 = buffered I/O). */
+        bool direct_io_;                            /**< If true, write sessions write the image data with direct I/O. */
+        std::unique_ptr<AsyncWriter> async_writer_; /**< State of the asynchronous writer (nullptr = not open). */
+        uint32 stack_frame_count_;                  /**< Number of frames of the preallocated stack (0 = no stack). */
+        uint64 stack_frame_size_;                   /**< Size of the image data of a frame in bytes. */
+        uint64 stack_data_offset_;                  /**< Offset of the image data of the first frame. */
+        uint64 stack_page_size_;                    /**< Distance between the image data of two frames in bytes. */
+        uint16 stack_bits_per_sample_;              /**< Bits per sample of the frames. */
+        std::unique_ptr<TiffMemoryStream> memory_stream_;   /**< In-memory file of a TiffFile written in memory. */
+        TIFF* memory_tiff_;                         /**< TIFF handle writing the in-memory file (nullptr = not in memory). */
+        py::buffer_info buffer_info_;               /**< Buffer export of the Python object holding the TIFF file (kept alive, so the buffer cannot be resized). */
+        const uint8* buffer_data_;                  /**< Start of the buffer holding the TIFF file (nullptr = no buffer). */
+        uint64 buffer_size_;                        /**< Size of the buffer in bytes. */
+        uint64 read_gap_;                           /**< Maximum gap in bytes between two merged reads of tiles/strips. */
+        uint32 queue_depth_;                        /**< Maximum number of reads in flight of a region read. */
+        IoRing io_ring_;                            /**< Ring shared by the region reads, set up once per queue depth (closed = synchronous reads). */
+        uint64 readahead_;                          /**< Number of bytes the kernel is advised to prefetch ahead of a subfile read. */
+        bool use_index_;                            /**< If true, the TIFF file is opened by its sidecar index. */
+        std::map<uint32, std::pair<std::vector<uint64>, std::vector<uint64>>> subfile_chunks_; /**< Map of the tile/strip offsets and byte counts per subfile (filled with the index). */
+        IoStats io_stats_;                          /**< I/O statistics of the subfile and region reads. */
+        uint32 output_pool_size_;                   /**< Maximum number of pooled output arrays per shape and data type (0 = no pool). */
+        std::map<std::tuple<uint32, uint32, size_t>, OutputRing> output_pool_;  /**< Rings of pooled output arrays per (length, width, item size). */
+        uint64 output_pool_uses_;                   /**< Number of reads from the output pool (orders the rings by their last use). */
+        std::unique_ptr<FileWatcher> file_watcher_; /**< Watcher of the TIFF file, which persists between two waits (nullptr = not waited yet). */
+
+        /**
+         * Constructor to initialize an empty TiffFile without a file.
+         */
+        TiffFile();
+
+        /**
+         * Opens the TIFF file, the buffer or the in-memory file with libtiff.
+         * @param mode File mode as for TIFFOpen(); in-memory files are read-only.
+         * @param stream If set, reads the file through the stream instead of libtiff's file access.
+         * @return TIFF handle from libtiff (nullptr = failure)
+         */
+        TIFF* OpenTiff(const std::string& mode, TiffFileStream* stream=nullptr);
+
+        /**
+         * Checks that the TIFF file is backed by a file on disk.
+         * @throw std::runtime_error If the TIFF file is held in memory.
+         */
+        void CheckFileBacked() const;
+
+        /**
+         * Checks that no asynchronous writer is open, as methods which
+         * rewrite the TIFF file would interleave with its appends.
+         * @throw std::runtime_error If an asynchronous writer is open.
+         */
+        void CheckNoAsyncWriter() const;
+
+        /**
+         * Reads the TIFF Tags of the current directory.
+         * @param tiff TIFF handle from libtiff.
+         * @return TIFF Tags of the current directory
+         */
+        static TiffTags ReadTiffTags(TIFF* tiff);
+
+        /**
+         * Adds the statistics of a stream to the I/O statistics.
+         * @param stream Stream which served a subfile or region read.
+         */
+        void AddIoStats(const TiffFileStream& stream);
+
+        /**
+         * Allocates the output array of a read. With an output pool, a pooled
+         * array which is no longer referenced outside the pool is reused.
+         * Otherwise, the array is added to the pool if its ring is not full,
+         * and its pages are touched at once.
+         * @tparam T Data type of an array component (i.e. pixel).
+         * @param length Number of rows.
+         * @param width Number of columns.
+         * @return Output array, whose content is undefined
+         */
+        template <typename T>
+        py::array_t<T> AllocateOutputArray(uint32 length, uint32 width);
+
+        /**
+         * Reads the TIFF Tags of an IFD parsed without libtiff.
+         * @param ifd Parsed IFD.
+         * @return TIFF Tags of the IFD
+         */
+        static TiffTags ReadTiffTags(const TiffIfd& ifd);
+
+        /**
+         * Reads the metadata of a TIFF file for ScanMetadata().
+         * @param file_path Path of the TIFF file.
+         * @return Metadata of the TIFF file (invalid if the file could not be parsed)
+         */
+        static FileMetadata ReadFileMetadata(const std::string& file_path);
+
+        /**
+         * Sets the TIFF Tags of a tiled directory which is about to be written.
+         * @param tiff TIFF handle from libtiff.
+         * @param tiff_tags TIFF Tags of the directory.
+         */
+        static void SetTiledTiffTags(TIFF* tiff, const TiffTags& tiff_tags);
+
+        /**
+         * Sets the TIFF Tags of a new subfile which is about to be written.
+         * @param tiff TIFF handle from libtiff.
+         * @param tiff_tags TIFF Tags of the subfile.
+         * @param tiled If true, the subfile is written in tiles.
+         */
+        static void SetSubfileTags(TIFF* tiff, const TiffTags& tiff_tags, bool tiled);
+
+        /**
+         * Encodes a subfile as a complete TIFF file in memory.
+         * The in-memory file has the version and the byte order of the
+         * TIFF file within the write session.
+         * @tparam T Data type of a subfile component (i.e. pixel).
+         * @param image_ptr Pointer to the image data.
+         * @param tiff_tags TIFF Tags of the subfile.
+         * @param tiled If true, writes the image in tiles. Otherwise, writes the image in strips.
+         * @return Content of the in-memory TIFF file
+         */
+        template <typename T>
+        std::vector<uint8> EncodeSubfile(T* image_ptr, const TiffTags& tiff_tags, bool tiled);
+
+        /**
+         * Appends a subfile to the end of the TIFF file within the write
+         * session while it is encoded, so the image data is streamed to disk
+         * tile by tile (or strip by strip). The subfile is published last,
+         * i.e. the header of an empty file is written or the new directory
+         * is linked to the last directory of the chain once it is complete.
+         * @tparam T Data type of a subfile component (i.e. pixel).
+         * @param image_ptr Pointer to the image data.
+         * @param tiff_tags TIFF Tags of the subfile.
+         * @param tiled If true, writes the image in tiles. Otherwise, writes the image in strips.
+         * @param last_offset Offset of the last directory of the chain (0 = empty file).
+         * @return Offset of the directory of the appended subfile
+         */
+        template <typename T>
+        uint64 StreamSubfile(T* image_ptr, const TiffTags& tiff_tags, bool tiled, uint64 last_offset);
+
+        /**
+         * Writes a block of bytes within the write session.
+         * With direct I/O, the bytes bypass the page cache.
+         * @param data Source buffer.
+         * @param size Number of bytes to write.
+         * @param offset File offset of the first byte.
+         */
+        void WriteSessionData(const void* data, uint64 size, uint64 offset);
+
+        /**
+         * Get the directory offset of a subfile. If the offset is not known
+         * yet, the chain is followed from the closest preceding subfile with
+         * a known offset, which is not limited to libtiff's directory count.
+         * @param fd File descriptor of the TIFF file.
+         * @param subfile_idx Index of the subfile.
+         * @return Offset of the directory of the subfile
+         */
+        uint64 GetSubfileOffset(int fd, uint32 subfile_idx);
+
+        /**
+         * Get the directory offset of the last known subfile of the chain.
+         * The chain is only traversed if the offset is not known yet.
+         * @param fd File descriptor of the TIFF file.
+         * @return Offset of the directory of the last subfile (0 = no subfiles)
+         */
+        uint64 GetLastSubfileOffset(int fd);
+
+        /**
+         * Appends an encoded subfile to the end of the TIFF file within the
+         * write session and links it to the last directory of the chain.
+         * The directory of the last subfile is known, so the chain is not
+         * traversed and the cost does not depend on the number of subfiles.
+         * @param encoded Content of the in-memory TIFF file from EncodeSubfile() (its offsets are moved in place).
+         * @param last_offset Offset of the last directory of the chain (0 = empty file).
+         * @return Offset of the directory of the appended subfile
+         */
+        uint64 AppendSubfile(std::vector<uint8>& encoded, uint64 last_offset);
+
+        /**
+         * Main loop of the thread appending the encoded subfiles of the
+         * asynchronous writer in the order of submission.
+         * After a failed subfile, all further subfiles are discarded until
+         * the next flush, so the TIFF file holds the subfiles submitted
+         * before the failure.
+         */
+        void RunAppendThread();
+
+        /**
+         * Stops the threads of the asynchronous writer once all submitted
+         * subfiles are appended.
+         */
+        void StopAsyncWriter();
+
+        /**
+         * Get the path of the sidecar index of the TIFF file.
+         * @return Path of the index
+         */
+        std::string GetIndexPath() const { return file_path_ + ".idx"; }
+
+        /**
+         * Loads the subfiles from the sidecar index, if it matches the TIFF file.
+         * An index of a TIFF file which only grew since is loaded as well,
+         * so merely the appended subfiles remain to be parsed, provided the
+         * last indexed directory is unchanged apart from its link to the
+         * first appended directory.
+         * @param complete Set to true, if the index matches the size and the modification time of the TIFF file.
+         * @return True, if the index was loaded
+         */
+        bool LoadIndex(bool& complete);
+
+        /**
+         * Saves the subfiles to the sidecar index.
+         * Failures are ignored, e.g. for read-only directories.
+         */
+        void SaveIndex();
+
+        /**
+         * Removes the sidecar index after existing subfiles were modified,
+         * even if the index is not used by this TiffFile.
+         */
+        void InvalidateIndex();
+
+        /**
+         * Forgets the TIFF Tags, offsets and levels of the subfiles from a subfile on.
+         * @param subfile_idx Index of the first subfile to forget.
+         */
+        void ClearSubfiles(uint32 subfile_idx);
+
+        /**
+         * Reads the TIFF Tags and offsets of the subfiles and their levels
+         * from the current directory to the end of the chain.
+         * @param tiff TIFF handle from libtiff set to the directory of the subfile.
+         * @param subfile_idx Index of the subfile of the current directory.
+         */
+        void ReadSubfiles(TIFF* tiff, uint32 subfile_idx=0);
+
+        /**
+         * Reads the directory offsets of the subfiles from a directory to the end
+         * of the chain. The TIFF Tags are read on first access by LoadSubfiles().
+         * @param fd File descriptor of the TIFF file.
+         * @param subfile_idx Index of the subfile of the directory.
+         * @param offset File offset of the directory (0 = first directory of the file).
+         */
+        void ReadChain(int fd, uint32 subfile_idx, uint64 offset);
+
+        /**
+         * Reads the TIFF Tags and levels of the subfiles in a range which were not read yet.
+         * @param first_idx Index of the first subfile.
+         * @param last_idx Index behind the last subfile.
+         */
+        void LoadSubfiles(uint32 first_idx, uint32 last_idx);
+
+        /**
+         * Get the TIFF Tags of a subfile, which are read on first access.
+         * @param subfile_idx Index of the subfile.
+         * @return TIFF Tags of the subfile
+         */
+        TiffTags& LoadSubfile(uint32 subfile_idx);
+
+        /**
+         * Copies the tile/strip offsets and byte counts of the current directory.
+         * @param tiff TIFF handle from libtiff set to the subfile.
+         * @param subfile_idx Index of the subfile.
+         */
+        void ReadSubfileChunks(TIFF* tiff, uint32 subfile_idx);
+
+        /**
+         * Reads the SubIFD offsets and TIFF Tags of the current directory.
+         * @note The TIFF handle is moved to the last SubIFD.
+         * @param tiff TIFF handle from libtiff set to the subfile.
+         * @param subfile_idx Index of the subfile.
+         */
+        void ReadSubfileLevels(TIFF* tiff, uint32 subfile_idx);
+
+        /**
+         * Opens the TIFF file for reading and sets the handle to a subfile.
+         * A subfile is located by its directory offset, e.g. in O(1).
+         * @param subfile_idx Index of the subfile.
+         * @param level Resolution level of the subfile (0 = full resolution, n = n-th SubIFD).
+         * @param stream If set, reads the file through the stream.
+         * @return TIFF handle from libtiff
+         */
+        TIFF* OpenSubfile(uint32 subfile_idx, uint16 level=0, TiffFileStream* stream=nullptr);
+
+        /**
+         * Reads regions of a subfile with coalesced reads.
+         * The tiles/strips of all regions are fetched by a few large reads
+         * before they are decoded, see TiffFileStream::Prefetch().
+         * @tparam T Data type of a subfile component (i.e. pixel).
+         * @param subfile_idx Index of the subfile.
+         * @param regions Regions as (x1, y1, x2, y2) with exclusive lower right coordinates.
+         * @param level Resolution level of the subfile (0 = full resolution, n = n-th SubIFD).
+         * @return Regions as Numpy arrays
+         */
+        template <typename T>
+        std::vector<py::array_t<T>> ReadRegions(uint32 subfile_idx, const std::vector<std::array<uint32, 4>>& regions, uint16 level);
+
+        /**
+         * Computes the downscale factors of the reduced-resolution levels.
+         * The factors are used level by level where the last factor is
+         * repeated until the stopping rule ends the pyramid.
+         * @param tiff_tags TIFF Tags of the full resolution subfile.
+         * @param factors Downscale factor of each level relative to its parent level (empty = 2).
+         * @param min_level_size Minimum width or length of a level (0 = until a level fits into half a tile).
+         * @return Downscale factor of each reduced-resolution level
+         */
+        static std::vector<uint32> GetLevelFactors(
+            const TiffTags& tiff_tags, const std::vector<uint32>& factors, uint32 min_level_size
+        );
+
+        /**
+         * Computes the TIFF Tags of a reduced-resolution level.
+         * The dimensions are ((width + 1) / cumulative_factor, (length + 1) / cumulative_factor).
+         * @param tiff_tags TIFF Tags of the full resolution subfile.
+         * @param cumulative_factor Downscale factor relative to the full resolution subfile.
+         * @return TIFF Tags of the level
+         */
+        static TiffTags GetLevelTags(const TiffTags& tiff_tags, uint64 cumulative_factor);
+
+        /**
+         * Finds the smallest downscale factor which yields the dimensions of a level.
+         * @param tiff_tags TIFF Tags of the full resolution subfile.
+         * @param cumulative_factor Downscale factor of the parent level relative to the full resolution subfile.
+         * @param level_tags TIFF Tags of the level.
+         * @return Downscale factor relative to the parent level (0 = no match)
+         */
+        static uint32 FindLevelFactor(const TiffTags& tiff_tags, uint64 cumulative_factor, const TiffTags& level_tags);
+
+        /**
+         * Get the directory offsets of all resolution levels of a subfile.
+         * The levels are either the SubIFDs of the subfile or, for chained
+         * pyramids, the subsequent reduced-resolution subfiles whose
+         * dimensions match an integer downscale factor.
+         * @param subfile_idx Index of the subfile.
+         * @param factors Downscale factor of each reduced-resolution level relative to its parent level.
+         * @return Directory offsets of the levels (starting with the subfile itself)
+         */
+        std::vector<uint64> GetLevelOffsets(uint32 subfile_idx, std::vector<uint32>& factors);
 
     public:
         /**
          * Constructor to initialize a TiffFile.
          * @param file_path Path to the TIFF file.
          * @param version Version of the TIFF file (this parameter is overwritten if the file already exists).
+         * @param use_index If true, the subfiles are loaded from the sidecar index "<file_path>.idx"
+         *                  instead of parsing all directories. A missing or outdated index is (re)built.
+         */
+        TiffFile(const std::string& file_path, uint8 version=42, bool use_index=false);
+
+        /**
+         * Destructor which closes an open write session.
+         */
+        ~TiffFile();
+
+        /**
+         * Creates a TiffFile which reads a TIFF file from a buffer.
+         * The buffer is referenced rather than copied and libtiff maps it
+         * directly, so no temporary file is needed.
+         * @note The TiffFile is read-only.
+         * @param buffer One-dimensional contiguous buffer (e.g. bytes) holding a TIFF file.
+         * @return TiffFile reading the buffer
+         */
+        static std::unique_ptr<TiffFile> FromBuffer(py::buffer buffer);
+
+        /**
+         * Creates a TiffFile which is written in memory.
+         * The subfiles are added by WriteSubfile() and the encoded TIFF
+         * file is returned by ToBytes().
+         * @param version Version of the TIFF file (default = 42, BigTIFF = 43).
+         * @return TiffFile written in memory
+         */
+        static std::unique_ptr<TiffFile> CreateInMemory(uint8 version=42);
+
+        /**
+         * Reads the metadata of many TIFF files in parallel. The header, the
+         * first directory and the chain of directories of each file are
+         * parsed without libtiff and without constructing a TiffFile. Files
+         * which cannot be parsed are flagged invalid rather than raising.
+         * @param file_paths Paths of the TIFF files.
+         * @param threads Number of worker threads (0 = number of hardware threads).
+         * @return Structured array of the metadata per file
+         */
+        static py::array_t<FileMetadata> ScanMetadata(const std::vector<std::string>& file_paths, uint32 threads=0);
+
+        /**
+         * Get the encoded TIFF file written in memory.
+         * @return Content of the in-memory TIFF file
+         */
+        py::bytes ToBytes();
+
+        /**
+         * Checks whether the TIFF file is held in memory.
+         * @return True, if the TIFF file is a buffer or written in memory
          */
-        TiffFile(const std::string& file_path, uint8 version=42);
-        
+        bool IsInMemory() const { return memory_tiff_ != nullptr || buffer_data_ != nullptr; }
+
+        TiffFile(const TiffFile&) = delete;
+        TiffFile& operator=(const TiffFile&) = delete;
+
         /**
          * Get the path to the TIFF file.
          * @return Path to the TIFF file
@@ -100,117 +574,140 @@ class TiffFile {
          * Get the total number of subfiles.
          * @return Total number of subfiles
          */
-        uint16 GetSubfileCount() { return subfile_count_; }
+        uint32 GetSubfileCount() { return subfile_count_; }
 
         /**
          * Get the TIFF Tags of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return TIFF Tags of the subfile
          */
-        TiffTags GetSubfileTags(uint16 subfile_idx=0);
+        TiffTags GetSubfileTags(uint32 subfile_idx=0);
+
+        /**
+         * Get the TIFF Tags of all subfiles at once.
+         * @return Structured array of the TIFF Tags per subfile
+         */
+        py::array_t<TiffTags> GetSubfileTagsArray();
+
+        /**
+         * Get the number of resolution levels of a subfile.
+         * The full resolution image is level 0 and its reduced-resolution
+         * SubIFDs are the levels 1..n.
+         * @param subfile_idx Index of the subfile.
+         * @return Number of resolution levels of the subfile
+         */
+        uint16 GetSubfileLevelCount(uint32 subfile_idx=0);
+
+        /**
+         * Get the TIFF Tags of a resolution level of a subfile.
+         * @param subfile_idx Index of the subfile.
+         * @param level Resolution level of the subfile.
+         * @return TIFF Tags of the resolution level
+         */
+        TiffTags GetSubfileLevelTags(uint32 subfile_idx=0, uint16 level=0);
 
         /**
          * Get the type of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Type of the subfile
          */
-        uint32 GetSubfileType(uint16 subfile_idx=0);
+        uint32 GetSubfileType(uint32 subfile_idx=0);
         /**
          * Get the image width of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Image width of the subfile
          */
-        uint32 GetImageWidth(uint16 subfile_idx=0);
+        uint32 GetImageWidth(uint32 subfile_idx=0);
         /**
          * Get the image length (height) of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Image length of the subfile
          */
-        uint32 GetImageLength(uint16 subfile_idx=0);
+        uint32 GetImageLength(uint32 subfile_idx=0);
         /**
          * Get the bits per sample of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Bits per sample of the subfile
          */
-        uint16 GetBitsPerSample(uint16 subfile_idx=0);
+        uint16 GetBitsPerSample(uint32 subfile_idx=0);
         /**
          * Get the compression of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Compression of the subfile
          */
-        uint16 GetCompression(uint16 subfile_idx=0);
+        uint16 GetCompression(uint32 subfile_idx=0);
         /**
          * Get the photometric interpretation of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Photometric interpretation of the subfile
          */
-        uint16 GetPhotometricInterpretation(uint16 subfile_idx=0);
+        uint16 GetPhotometricInterpretation(uint32 subfile_idx=0);
         /**
          * Get the samples per pixel of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Samples per pixel of the subfile
          */
-        uint16 GetSamplesPerPixel(uint16 subfile_idx=0);
+        uint16 GetSamplesPerPixel(uint32 subfile_idx=0);
         /**
          * Get the rows per strip of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Rows per strip of the subfile
          */
-        uint32 GetRowsPerStrip(uint16 subfile_idx=0);
+        uint32 GetRowsPerStrip(uint32 subfile_idx=0);
         /**
          * Get the minimum sample value of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Minimum sample value of the subfile
          */
-        uint16 GetMinSampleValue(uint16 subfile_idx=0);
+        uint16 GetMinSampleValue(uint32 subfile_idx=0);
         /**
          * Get the maximum sample value of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Maximum sample value of the subfile
          */
-        uint16 GetMaxSampleValue(uint16 subfile_idx=0);
+        uint16 GetMaxSampleValue(uint32 subfile_idx=0);
         /**
          * Get the planar configuration of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Planar configuration of the subfile
          */
-        uint16 GetPlanarConfiguration(uint16 subfile_idx=0);
+        uint16 GetPlanarConfiguration(uint32 subfile_idx=0);
         /**
          * Get the page number of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Page number of the subfile
          */
-        uint16 GetPageNumber(uint16 subfile_idx=0);
+        uint16 GetPageNumber(uint32 subfile_idx=0);
         /**
          * Get the total number of pages in the document.
          * This number should be the same for all subfiles.
          * @param subfile_idx Index of the subfile.
          * @return Total number of pages in the document
          */
-        uint16 GetPageCount(uint16 subfile_idx=0);
+        uint16 GetPageCount(uint32 subfile_idx=0);
         /**
          * Get the tile width of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Tile width of the subfile
          */
-        uint32 GetTileWidth(uint16 subfile_idx=0);
+        uint32 GetTileWidth(uint32 subfile_idx=0);
         /**
          * Get the tile length (height) of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Tile length of the subfile
          */
-        uint32 GetTileLength(uint16 subfile_idx=0);
+        uint32 GetTileLength(uint32 subfile_idx=0);
         /**
          * Get the sample format of a subfile.
          * @param subfile_idx Index of the subfile.
          * @return Sample format of the subfile
          */
-        uint16 GetSampleFormat(uint16 subfile_idx=0);
+        uint16 GetSampleFormat(uint32 subfile_idx=0);
 
         /**
          * Reads the first subfile.
          * @tparam T Data type of a subfile component (i.e. pixel).
-         * @see ReadSubfile(uint16)
+         * @see ReadSubfile(uint32)
          * @return Image as a Numpy array
          */
         template <typename T>
@@ -222,10 +719,11 @@ class TiffFile {
          * Reads a subfile.
          * @tparam T Data type of a subfile component (i.e. pixel).
          * @param subfile_idx Index of the subfile.
+         * @param level Resolution level of the subfile (0 = full resolution, n = n-th SubIFD).
          * @return Image as a Numpy array
          */
         template <typename T>
-        py::array_t<T> ReadSubfile(uint16 subfile_idx=0);
+        py::array_t<T> ReadSubfile(uint32 subfile_idx=0, uint16 level=0);
 
         /**
          * Reads a region from a subfile.
@@ -235,10 +733,121 @@ class TiffFile {
          * @param y1 Upper left y-coordinate (incl).
          * @param x2 Lower right x-coordinate (excl).
          * @param y2 Lower right y-coordinate (excl).
+         * @param level Resolution level of the subfile (0 = full resolution, n = n-th SubIFD).
          * @return Region as a Numpy array
          */
         template <typename T>
-        py::array_t<T> ReadSubfileRegion(uint16 subfile_idx, uint32 x1, uint32 y1, uint32 x2, uint32 y2);
+        py::array_t<T> ReadSubfileRegion(uint32 subfile_idx, uint32 x1, uint32 y1, uint32 x2, uint32 y2, uint16 level=0);
+
+        /**
+         * Reads several regions from a subfile.
+         * Tiles/strips which are adjacent or close within the file are
+         * fetched by a single read for all regions.
+         * @tparam T Data type of a subfile component (i.e. pixel).
+         * @param subfile_idx Index of the subfile.
+         * @param regions Regions as (x1, y1, x2, y2) with exclusive lower right coordinates.
+         * @param level Resolution level of the subfile (0 = full resolution, n = n-th SubIFD).
+         * @return Regions as Numpy arrays
+         */
+        template <typename T>
+        std::vector<py::array_t<T>> ReadSubfileRegions(uint32 subfile_idx, std::vector<std::array<uint32, 4>> regions, uint16 level=0);
+
+        /**
+         * Get the maximum gap between two tiles/strips merged into one read.
+         * @return Gap in bytes
+         */
+        uint64 GetReadGap() { return read_gap_; }
+
+        /**
+         * Set the maximum gap between two tiles/strips merged into one read.
+         * Larger gaps trade unused bytes for fewer requests, e.g. on
+         * network filesystems.
+         * @param read_gap Gap in bytes (0 = merge adjacent tiles/strips only).
+         */
+        void SetReadGap(uint64 read_gap) { read_gap_ = read_gap; }
+
+        /**
+         * Get the maximum number of reads in flight of a region read.
+         * @return Queue depth
+         */
+        uint32 GetQueueDepth() { return queue_depth_; }
+
+        /**
+         * Set the maximum number of reads in flight of a region read.
+         * The reads are submitted at once through io_uring if available,
+         * see HasIoUring(). Otherwise, the tiles/strips are read one by one.
+         * @param queue_depth Queue depth (<= 1 = synchronous reads).
+         */
+        void SetQueueDepth(uint32 queue_depth) { queue_depth_ = queue_depth; }
+
+        /**
+         * Get the readahead distance of full subfile reads.
+         * @return Readahead in bytes
+         */
+        uint64 GetReadahead() { return readahead_; }
+
+        /**
+         * Set the readahead distance of full subfile reads. The tiles/strips
+         * of a subfile are read in the order of their offsets and the kernel
+         * is advised to prefetch the ones within this distance, so the disk
+         * reads ahead while libtiff decodes.
+         * @param readahead Readahead in bytes (0 = no advice).
+         */
+        void SetReadahead(uint64 readahead) { readahead_ = readahead; }
+
+        /**
+         * Get the size of the output pool.
+         * @return Maximum number of pooled output arrays per shape and data type (0 = no pool)
+         */
+        uint32 GetOutputPoolSize() { return output_pool_size_; }
+
+        /**
+         * Set the size of the output pool, which releases the pooled arrays.
+         * Repeated reads of the same shape, e.g. the frames of a time-lapse,
+         * reuse the output arrays of earlier reads once these are no longer
+         * referenced, instead of allocating and faulting in a new array each.
+         * Each read returns a new array viewing a pooled array, and only the
+         * shapes read most recently are pooled (see kMaxOutputRings).
+         * @param output_pool_size Maximum number of pooled output arrays per shape and data type (0 = no pool).
+         */
+        void SetOutputPoolSize(uint32 output_pool_size);
+
+        /**
+         * Checks whether region reads may use io_uring.
+         * @return True, if io_uring is supported by the build and the kernel (Linux >= 5.6)
+         */
+        static bool HasIoUring() { return IoRing::IsAvailable(); }
+
+        /**
+         * Check if large scratch buffers of the reads and writes are backed by huge pages.
+         * @return True, if huge pages are used. Otherwise, false.
+         */
+        static bool GetHugePages() { return BufferPool::GetHugePages(); }
+
+        /**
+         * Set if large scratch buffers of the reads and writes are backed by
+         * huge pages, which is supported on Linux only.
+         * @param huge_pages If true, huge pages are used for buffers of at least 2 MiB.
+         */
+        static void SetHugePages(bool huge_pages) { BufferPool::SetHugePages(huge_pages); }
+
+        /**
+         * Get the statistics of the pool of scratch buffers shared by all
+         * reads and writes.
+         * @return Statistics of the buffer pool
+         */
+        static BufferPool::Stats GetBufferPoolStats() { return BufferPool::GetStats(); }
+
+        /**
+         * Get the I/O statistics of the subfile and region reads.
+         * @return I/O statistics
+         */
+        IoStats GetIoStats() { return io_stats_; }
+
+        /**
+         * Resets the I/O statistics of the subfile and region reads.
+         */
+        void ResetIoStats() { io_stats_ = IoStats(); }
 
         /**
          * Writes a new subfile to the end of the TIFF file.
@@ -255,6 +864,10 @@ class TiffFile {
 
         /**
          * Writes a new subfile to the end of the TIFF file.
+         * The directory of the subfile is linked to the chain once it is
+         * complete, so concurrent readers can use Refresh() safely.
+         * Within a write session, the subfile is appended without reopening
+         * the TIFF file, see OpenSession().
          * @tparam T Data type of a subfile component (i.e. pixel).
          * @param image Image data as a Numpy array.
          * @param tiff_tags TIFF Tags for the new subfile.
@@ -263,13 +876,128 @@ class TiffFile {
         template <typename T>
         void WriteSubfile(py::array_t<T> image, TiffTags tiff_tags, bool tiled);
 
+        /**
+         * Opens a write session which keeps the TIFF file open.
+         * Within the session, WriteSubfile() encodes each subfile in memory
+         * and appends it with a few positioned writes, i.e. the TIFF file is
+         * neither reopened nor is the directory chain traversed. Each
+         * subfile is linked to the chain right away, so the TIFF file stays
+         * valid if the session is not closed.
+         */
+        void OpenSession();
+
+        /**
+         * Closes the write session.
+         */
+        void CloseSession();
+
+        /**
+         * Checks whether a write session is open.
+         * @return True, if a write session is open
+         */
+        bool IsSessionOpen() { return session_fd_ >= 0; }
+
+        /**
+         * Checks whether write sessions use direct I/O.
+         * @return True, if direct I/O is enabled
+         */
+        bool GetDirectIo() { return direct_io_; }
+
+        /**
+         * Enables direct I/O for the image data of write sessions, e.g. to
+         * write very large files without filling the page cache.
+         * The image data is collected in a bounded aligned staging buffer
+         * while it is encoded and written by large aligned writes, while
+         * the small updates of the header and the IFD chain remain
+         * buffered. If the file system does not support direct I/O, the
+         * data is written through the page cache.
+         * @param direct_io If true, enables direct I/O.
+         */
+        void SetDirectIo(bool direct_io);
+
+        /**
+         * Checks whether the open write session writes with direct I/O.
+         * @return True, if the data of the session bypasses the page cache
+         */
+        bool IsSessionDirectIo() { return session_direct_fd_ >= 0; }
+
+        /**
+         * Opens an asynchronous writer for frame-by-frame acquisition.
+         * SubmitSubfile() copies a frame and returns immediately, while
+         * worker threads encode the frames and a single thread appends
+         * them in the order of submission within a write session.
+         * Other write methods must not be used until CloseAsyncWriter().
+         * @param threads Number of threads encoding the subfiles (0 = number of hardware threads).
+         * @param queue_depth Maximum number of subfiles being encoded or appended before SubmitSubfile() blocks.
+         */
+        void OpenAsyncWriter(uint32 threads=0, uint32 queue_depth=16);
+
+        /**
+         * Submits a new subfile to the asynchronous writer.
+         * The image is copied, so the caller may reuse its buffer. If the
+         * queue is full, the call blocks until a subfile was appended.
+         * @note An error of a previous subfile is raised here as well.
+         * @tparam T Data type of a subfile component (i.e. pixel).
+         * @param image Image data as a Numpy array.
+         * @param tiff_tags TIFF Tags for the new subfile.
+         * @param tiled If true, writes the image in tiles. Otherwise, writes the image in strips.
+         */
+        template <typename T>
+        void SubmitSubfile(py::array_t<T> image, TiffTags tiff_tags, bool tiled);
+
+        /**
+         * Blocks until all submitted subfiles are appended to the TIFF file.
+         * The appended subfiles are available to all other methods
+         * afterwards, while the subfiles in flight are not.
+         * @note The first error of the asynchronous writer is raised and reset.
+         */
+        void Flush();
+
+        /**
+         * Flushes and closes the asynchronous writer.
+         * @note The first error of the asynchronous writer is raised.
+         */
+        void CloseAsyncWriter();
+
+        /**
+         * Creates a stack of uncompressed scanline-based subfiles with a
+         * fixed layout for a known number of frames.
+         * All directories and strip offsets are written up front and the
+         * TIFF file is allocated at its final size, so WriteStackFrame()
+         * is a single positioned write of the raw frame.
+         * Frames which are never written read as zeros. A stack larger
+         * than 4 GiB requires a BigTIFF file.
+         * @param frame_count Number of frames.
+         * @param tiff_tags TIFF Tags of each frame (the whole frame is stored in a single strip).
+         */
+        void CreateStack(uint32 frame_count, TiffTags tiff_tags);
+
+        /**
+         * Writes a frame into the stack created by CreateStack().
+         * @tparam T Data type of a subfile component (i.e. pixel).
+         * @param frame Frame data as a Numpy array.
+         * @param frame_idx Index of the frame.
+         */
+        template <typename T>
+        void WriteStackFrame(py::array_t<T> frame, uint32 frame_idx);
+
+        /**
+         * Closes the stack and its write session.
+         */
+        void CloseStack();
+
         /**
          * Writes a region into an existing subfile.
          * @note libtiff does no support altering the contents of a TIFF file.
          * Which is true for compressed tiles/scanlines where a source
          * scanline/tile uses less disk space than required by the modified
          * scanline/tile.
-         * However, the operation could be implemented for uncompressed subfiles.
+         * Thus, the region of an uncompressed subfile is overwritten in
+         * place using the tile/strip offsets, so the I/O is proportional to
+         * the size of the region. The affected tiles of a compressed tiled
+         * subfile are replaced by copy-on-write, which leaves the former
+         * tiles unreferenced until Compact() is called.
+         * The modified tiles are marked for UpdatePyramid().
          * @tparam T Data type of a subfile component (i.e. pixel).
          * @param image Region data as a Numpy array.
          * @param subfile_idx Index of the subfile.
@@ -280,26 +1008,121 @@ class TiffFile {
          */
         template <typename T>
         void WriteSubfileRegion(
-            py::array_t<T> image, uint16 subfile_idx,
+            py::array_t<T> image, uint32 subfile_idx,
             uint32 x1, uint32 y1, uint32 x2, uint32 y2
         );
 
         /**
          * Writes a multi-scale subfile into a TIFF file.
-         * @note Existing data is overwritten!
+         * By default, each reduced-resolution level is written as another
+         * top-level subfile.
+         * With sub_ifds set, the levels are written as SubIFDs of the full
+         * resolution subfile (OME-TIFF style) and the multi-scale subfile
+         * is appended to the end of the TIFF file. Thus, each page of a
+         * multi-page file may carry its own pyramid.
+         * @note Without sub_ifds, existing data is overwritten!
          * @tparam T Data type of a subfile component (i.e. pixel).
          * @param image Baseline image data as a Numpy array.
          * @param tiff_tags TIFF Tags for the new subfile.
+         * @param sub_ifds If true, writes the reduced-resolution levels as SubIFDs.
+         * @param threads Number of threads computing the tiles (0 = number of hardware threads).
+         * @param factors Downscale factor of each level relative to its parent level; the last factor is repeated (empty = 2).
+         * @param min_level_size Minimum width or length of a level (0 = until a level fits into half a tile).
          */
         template <typename T>
-        void WriteMultiscaleSubfile(py::array_t<T> image, TiffTags tiff_tags);
+        void WriteMultiscaleSubfile(
+            py::array_t<T> image, TiffTags tiff_tags, bool sub_ifds=false, uint32 threads=0,
+            std::vector<uint32> factors=std::vector<uint32>(), uint32 min_level_size=0
+        );
+
+        /**
+         * Adds reduced-resolution levels to an existing tiled subfile.
+         * The subfile is streamed from disk tile by tile and the image data
+         * of the subfile is neither modified nor copied.
+         * By default, each level is appended as another top-level subfile,
+         * which is only supported for the last subfile. With sub_ifds set, the levels are written as SubIFDs of the
+         * subfile. Therefore, the directory of the subfile is rewritten to
+         * the end of the TIFF file while the subfile keeps its index.
+         * @param subfile_idx Index of the subfile.
+         * @param sub_ifds If true, writes the reduced-resolution levels as SubIFDs.
+         * @param factors Downscale factor of each level relative to its parent level; the last factor is repeated (empty = 2).
+         * @param min_level_size Minimum width or length of a level (0 = until a level fits into half a tile).
+         */
+        void AddSubfileLevels(
+            uint32 subfile_idx, bool sub_ifds=false,
+            std::vector<uint32> factors=std::vector<uint32>(), uint32 min_level_size=0
+        );
+
+        /**
+         * Marks a region of a subfile as modified.
+         * The tiles covering the region are recomputed at each
+         * reduced-resolution level by UpdatePyramid().
+         * @param subfile_idx Index of the subfile.
+         * @param x1 Upper left x-coordinate (incl).
+         * @param y1 Upper left y-coordinate (incl).
+         * @param x2 Lower right x-coordinate (excl).
+         * @param y2 Lower right y-coordinate (excl).
+         */
+        void MarkDirty(uint32 subfile_idx, uint32 x1, uint32 y1, uint32 x2, uint32 y2);
+
+        /**
+         * Recomputes the tiles of all reduced-resolution levels which depend
+         * on modified tiles of the subfile.
+         * Recomputed tiles are replaced by copy-on-write, i.e. they are
+         * appended to the TIFF file and the tile offsets are patched.
+         * @param subfile_idx Index of the subfile.
+         * @return Number of recomputed tiles
+         */
+        uint32 UpdatePyramid(uint32 subfile_idx);
+
+        /**
+         * Reads the subfiles which were appended to the TIFF file since the
+         * last refresh, e.g. by another process which is still writing.
+         * Parsing resumes at the last known directory, so the cost depends
+         * on the number of new subfiles only.
+         * @note Existing subfiles are expected to be unchanged, i.e. the
+         * TIFF file must not be compacted meanwhile.
+         * @return Number of new subfiles
+         */
+        uint32 Refresh();
+
+        /**
+         * Blocks until the TIFF file is modified or the timeout expires.
+         * The file stays watched after the first call, so modifications
+         * between two calls are reported by the second one right away.
+         * @param timeout_ms Timeout in milliseconds.
+         * @return True, if the TIFF file was modified
+         */
+        bool WaitForChange(uint32 timeout_ms);
+
+        /**
+         * Reclaims the space of tiles and strips replaced by copy-on-write.
+         * The TIFF file is rewritten such that it contains only the
+         * directories and the tiles/strips which are still referenced.
+         * @return Number of reclaimed bytes
+         */
+        uint64 Compact();
 };
 
+PYBIND11_NUMPY_DTYPE(TiffFile::TiffTags::PageNumber, page_number, page_count);
+PYBIND11_NUMPY_DTYPE(
+    TiffFile::TiffTags,
+    new_subfile_type, image_width, image_length, bits_per_sample, compression, photometric,
+    samples_per_pixel, rows_per_strip, min_sample_value, max_sample_value, planar_config,
+    page_number, tile_width, tile_length, sample_format
+);
+PYBIND11_NUMPY_DTYPE(
+    TiffFile::FileMetadata,
+    valid, version, big_endian, file_size, subfile_count, level_count, tiff_tags
+);
+
 
 PYBIND11_MODULE(tiff_file, m) {
     py::class_<TiffFile> cls_tiff_file(m, "TiffFile");
     py::class_<TiffFile::TiffTags> cls_tiff_tags(cls_tiff_file, "TiffTags");
     py::class_<TiffFile::TiffTags::PageNumber> cls_page_number(cls_tiff_tags, "PageNumber");
+    py::class_<TiffFile::IoStats> cls_io_stats(cls_tiff_file, "IoStats");
+    py::class_<BufferPool::Stats> cls_buffer_pool_stats(cls_tiff_file, "BufferPoolStats");
 
     cls_tiff_tags
         .def(py::init<>());
@@ -328,8 +1151,30 @@ PYBIND11_MODULE(tiff_file, m) {
         .def_readwrite("page_number", &TiffFile::TiffTags::PageNumber::page_number)
         .def_readwrite("page_count", &TiffFile::TiffTags::PageNumber::page_count);
 
+    cls_io_stats
+        .def_readonly("read_count", &TiffFile::IoStats::read_count)
+        .def_readonly("bytes_read", &TiffFile::IoStats::bytes_read)
+        .def_readonly("max_queue_depth", &TiffFile::IoStats::max_queue_depth)
+        .def_readonly("read_time", &TiffFile::IoStats::read_time)
+        .def_readonly("bytes_saved", &TiffFile::IoStats::bytes_saved);
+
+    cls_buffer_pool_stats
+        .def_readonly("allocation_count", &BufferPool::Stats::allocation_count)
+        .def_readonly("reuse_count", &BufferPool::Stats::reuse_count)
+        .def_readonly("cached_bytes", &BufferPool::Stats::cached_bytes);
+
+    cls_tiff_file
+        .def(
+            py::init<const std::string&, uint8, bool>(),
+            py::arg("file_path"), py::arg("version") = 42, py::arg("use_index") = false
+        );
+
     cls_tiff_file
-        .def(py::init<const std::string&, uint8>(), py::arg("file_path"), py::arg("version") = 42);
+        .def_static("from_buffer", &TiffFile::FromBuffer, py::arg("buffer"))
+        .def_static("in_memory", &TiffFile::CreateInMemory, py::arg("version") = 42)
+        .def_static("scan_metadata", &TiffFile::ScanMetadata, py::arg("file_paths"), py::arg("threads") = 0)
+        .def("to_bytes", &TiffFile::ToBytes)
+        .def("is_in_memory", &TiffFile::IsInMemory);
 
     cls_tiff_file
         .def("get_file_path", &TiffFile::GetFilePath)
@@ -339,11 +1184,14 @@ PYBIND11_MODULE(tiff_file, m) {
     auto read_8 = static_cast<py::array_t<uint8> (TiffFile::*)()>(&TiffFile::Read);
     auto read_16 = static_cast<py::array_t<uint16> (TiffFile::*)()>(&TiffFile::Read);
 
-    auto read_subfile_8 = static_cast<py::array_t<uint8> (TiffFile::*)(uint16)>(&TiffFile::ReadSubfile);
-    auto read_subfile_16 = static_cast<py::array_t<uint16> (TiffFile::*)(uint16)>(&TiffFile::ReadSubfile);
+    auto read_subfile_8 = static_cast<py::array_t<uint8> (TiffFile::*)(uint32, uint16)>(&TiffFile::ReadSubfile);
+    auto read_subfile_16 = static_cast<py::array_t<uint16> (TiffFile::*)(uint32, uint16)>(&TiffFile::ReadSubfile);
 
-    auto read_subfile_region_8 = static_cast<py::array_t<uint8> (TiffFile::*)(uint16, uint32, uint32, uint32, uint32)>(&TiffFile::ReadSubfileRegion);
-    auto read_subfile_region_16 = static_cast<py::array_t<uint16> (TiffFile::*)(uint16, uint32, uint32, uint32, uint32)>(&TiffFile::ReadSubfileRegion);
+    auto read_subfile_region_8 = static_cast<py::array_t<uint8> (TiffFile::*)(uint32, uint32, uint32, uint32, uint32, uint16)>(&TiffFile::ReadSubfileRegion);
+    auto read_subfile_region_16 = static_cast<py::array_t<uint16> (TiffFile::*)(uint32, uint32, uint32, uint32, uint32, uint16)>(&TiffFile::ReadSubfileRegion);
+
+    auto read_subfile_regions_8 = static_cast<std::vector<py::array_t<uint8>> (TiffFile::*)(uint32, std::vector<std::array<uint32, 4>>, uint16)>(&TiffFile::ReadSubfileRegions);
+    auto read_subfile_regions_16 = static_cast<std::vector<py::array_t<uint16>> (TiffFile::*)(uint32, std::vector<std::array<uint32, 4>>, uint16)>(&TiffFile::ReadSubfileRegions);
 
     auto write_8 = static_cast<void (TiffFile::*)(py::array_t<uint8>, TiffFile::TiffTags, bool)>(&TiffFile::Write);
     auto write_16 = static_cast<void (TiffFile::*)(py::array_t<uint16>, TiffFile::TiffTags, bool)>(&TiffFile::Write);
@@ -351,14 +1199,23 @@ PYBIND11_MODULE(tiff_file, m) {
     auto write_subfile_8 = static_cast<void (TiffFile::*)(py::array_t<uint8>, TiffFile::TiffTags, bool)>(&TiffFile::WriteSubfile);
     auto write_subfile_16 = static_cast<void (TiffFile::*)(py::array_t<uint16>, TiffFile::TiffTags, bool)>(&TiffFile::WriteSubfile);
 
-    auto write_subfile_region_8 = static_cast<void (TiffFile::*)(py::array_t<uint8>, uint16, uint32, uint32, uint32, uint32)>(&TiffFile::WriteSubfileRegion);
-    auto write_subfile_region_16 = static_cast<void (TiffFile::*)(py::array_t<uint16>, uint16, uint32, uint32, uint32, uint32)>(&TiffFile::WriteSubfileRegion);
+    auto submit_subfile_8 = static_cast<void (TiffFile::*)(py::array_t<uint8>, TiffFile::TiffTags, bool)>(&TiffFile::SubmitSubfile);
+    auto submit_subfile_16 = static_cast<void (TiffFile::*)(py::array_t<uint16>, TiffFile::TiffTags, bool)>(&TiffFile::SubmitSubfile);
+
+    auto write_stack_frame_8 = static_cast<void (TiffFile::*)(py::array_t<uint8>, uint32)>(&TiffFile::WriteStackFrame);
+    auto write_stack_frame_16 = static_cast<void (TiffFile::*)(py::array_t<uint16>, uint32)>(&TiffFile::WriteStackFrame);
 
-    auto write_multiscale_subfile_8 = static_cast<void (TiffFile::*)(py::array_t<uint8>, TiffFile::TiffTags)>(&TiffFile::WriteMultiscaleSubfile);
-    auto write_multiscale_subfile_16 = static_cast<void (TiffFile::*)(py::array_t<uint16>, TiffFile::TiffTags)>(&TiffFile::WriteMultiscaleSubfile);
+    auto write_subfile_region_8 = static_cast<void (TiffFile::*)(py::array_t<uint8>, uint32, uint32, uint32, uint32, uint32)>(&TiffFile::WriteSubfileRegion);
+    auto write_subfile_region_16 = static_cast<void (TiffFile::*)(py::array_t<uint16>, uint32, uint32, uint32, uint32, uint32)>(&TiffFile::WriteSubfileRegion);
+
+    auto write_multiscale_subfile_8 = static_cast<void (TiffFile::*)(py::array_t<uint8>, TiffFile::TiffTags, bool, uint32, std::vector<uint32>, uint32)>(&TiffFile::WriteMultiscaleSubfile);
+    auto write_multiscale_subfile_16 = static_cast<void (TiffFile::*)(py::array_t<uint16>, TiffFile::TiffTags, bool, uint32, std::vector<uint32>, uint32)>(&TiffFile::WriteMultiscaleSubfile);
 
     cls_tiff_file
         .def("get_subfile_tags", &TiffFile::GetSubfileTags)
+        .def("get_subfile_tags_array", &TiffFile::GetSubfileTagsArray)
+        .def("get_subfile_level_count", &TiffFile::GetSubfileLevelCount)
+        .def("get_subfile_level_tags", &TiffFile::GetSubfileLevelTags)
         .def("get_subfile_type", &TiffFile::GetSubfileType)
         .def("get_image_width", &TiffFile::GetImageWidth)
         .def("get_image_length", &TiffFile::GetImageLength)
@@ -377,18 +1234,81 @@ PYBIND11_MODULE(tiff_file, m) {
         .def("get_sample_format", &TiffFile::GetSampleFormat)
         .def("read_8", read_8)
         .def("read_16", read_16)
-        .def("read_subfile_8", read_subfile_8)
-        .def("read_subfile_16", read_subfile_16)
-        .def("read_subfile_region_8", read_subfile_region_8)
-        .def("read_subfile_region_16", read_subfile_region_16)
+        .def("read_subfile_8", read_subfile_8, py::arg("subfile_idx"), py::arg("level") = 0)
+        .def("read_subfile_16", read_subfile_16, py::arg("subfile_idx"), py::arg("level") = 0)
+        .def(
+            "read_subfile_region_8", read_subfile_region_8,
+            py::arg("subfile_idx"), py::arg("x1"), py::arg("y1"), py::arg("x2"), py::arg("y2"), py::arg("level") = 0
+        )
+        .def(
+            "read_subfile_region_16", read_subfile_region_16,
+            py::arg("subfile_idx"), py::arg("x1"), py::arg("y1"), py::arg("x2"), py::arg("y2"), py::arg("level") = 0
+        )
+        .def(
+            "read_subfile_regions_8", read_subfile_regions_8,
+            py::arg("subfile_idx"), py::arg("regions"), py::arg("level") = 0
+        )
+        .def(
+            "read_subfile_regions_16", read_subfile_regions_16,
+            py::arg("subfile_idx"), py::arg("regions"), py::arg("level") = 0
+        )
+        .def("get_read_gap", &TiffFile::GetReadGap)
+        .def("set_read_gap", &TiffFile::SetReadGap)
+        .def("get_queue_depth", &TiffFile::GetQueueDepth)
+        .def("set_queue_depth", &TiffFile::SetQueueDepth)
+        .def("get_readahead", &TiffFile::GetReadahead)
+        .def("set_readahead", &TiffFile::SetReadahead)
+        .def("get_output_pool_size", &TiffFile::GetOutputPoolSize)
+        .def("set_output_pool_size", &TiffFile::SetOutputPoolSize)
+        .def_static("has_io_uring", &TiffFile::HasIoUring)
+        .def_static("get_huge_pages", &TiffFile::GetHugePages)
+        .def_static("set_huge_pages", &TiffFile::SetHugePages, py::arg("huge_pages"))
+        .def_static("get_buffer_pool_stats", &TiffFile::GetBufferPoolStats)
+        .def("get_io_stats", &TiffFile::GetIoStats)
+        .def("reset_io_stats", &TiffFile::ResetIoStats)
         .def("write_8", write_8)
         .def("write_16", write_16)
         .def("write_subfile_8", write_subfile_8)
         .def("write_subfile_16", write_subfile_16)
         .def("write_subfile_region_8", write_subfile_region_8)
         .def("write_subfile_region_16", write_subfile_region_16)
-        .def("write_multiscale_subfile_8", write_multiscale_subfile_8)
-        .def("write_multiscale_subfile_16", write_multiscale_subfile_16);
+        .def(
+            "add_subfile_levels", &TiffFile::AddSubfileLevels,
+            py::arg("subfile_idx"), py::arg("sub_ifds") = false,
+            py::arg("factors") = std::vector<uint32>(), py::arg("min_level_size") = 0
+        )
+        .def("mark_dirty", &TiffFile::MarkDirty)
+        .def("update_pyramid", &TiffFile::UpdatePyramid)
+        .def("compact", &TiffFile::Compact)
+        .def("refresh", &TiffFile::Refresh)
+        .def("wait_for_change", &TiffFile::WaitForChange)
+        .def("open_session", &TiffFile::OpenSession)
+        .def("close_session", &TiffFile::CloseSession)
+        .def("get_direct_io", &TiffFile::GetDirectIo)
+        .def("set_direct_io", &TiffFile::SetDirectIo)
+        .def("is_session_direct_io", &TiffFile::IsSessionDirectIo)
+        .def("is_session_open", &TiffFile::IsSessionOpen)
+        .def("open_async_writer", &TiffFile::OpenAsyncWriter, py::arg("threads") = 0, py::arg("queue_depth") = 16)
+        .def("submit_subfile_8", submit_subfile_8)
+        .def("submit_subfile_16", submit_subfile_16)
+        .def("flush", &TiffFile::Flush)
+        .def("close_async_writer", &TiffFile::CloseAsyncWriter)
+        .def("create_stack", &TiffFile::CreateStack)
+        .def("write_stack_frame_8", write_stack_frame_8)
+        .def("write_stack_frame_16", write_stack_frame_16)
+        .def("close_stack", &TiffFile::CloseStack)
+        .def(
+            "write_multiscale_subfile_8", write_multiscale_subfile_8,
+            py::arg("image"), py::arg("tiff_tags"), py::arg("sub_ifds") = false,
+            py::arg("threads") = 0, py::arg("factors") = std::vector<uint32>(),
+            py::arg("min_level_size") = 0
+        )
+        .def(
+            "write_multiscale_subfile_16", write_multiscale_subfile_16,
+            py::arg("image"), py::arg("tiff_tags"), py::arg("sub_ifds") = false,
+            py::arg("threads") = 0, py::arg("factors") = std::vector<uint32>(),
+            py::arg("min_level_size") = 0
+        );
 }
 
 #endif /* __TIFFFILE_H__ */
@@ -0,0 +1,291 @@
+#include "tiff_file_stream.h"
+
+#include <algorithm>
+
+
+TiffFileStream::TiffFileStream(const std::string& file_path, IoRing* ring) :
+    position_(0), ring_(ring), next_range_(0), in_flight_(0),
+    read_count_(0), bytes_read_(0), max_queue_depth_(0), read_time_(0), next_readahead_(0), readahead_(0)
+{
+    fd_ = open_file(file_path);
+    size_ = get_file_size(fd_);
+}
+
+TiffFileStream::~TiffFileStream() {
+    try {
+        Drain();
+    } catch (const std::runtime_error&) {
+        // the ring is closed before the ranges are released, later streams read synchronously
+        ring_->Close();
+    }
+    close_file(fd_);
+}
+
+TiffFileStream* TiffFileStream::FromTiff(TIFF* tiff) {
+    if (TIFFGetReadProc(tiff) != ReadProc)
+        return nullptr;
+    return static_cast<TiffFileStream*>(TIFFClientdata(tiff));
+}
+
+TIFF* TiffFileStream::Open(const std::string& mode) {
+    position_ = 0;
+    // 'm' disables memory mapping, so that all reads pass through ReadProc
+    return TIFFClientOpen(
+        "file", (mode + "m").c_str(), static_cast<thandle_t>(this),
+        ReadProc, WriteProc, SeekProc, CloseProc, SizeProc, MapProc, UnmapProc
+    );
+}
+
+std::vector<std::pair<uint64, uint64>> TiffFileStream::MergeRanges(
+    std::vector<std::pair<uint64, uint64>> ranges, uint64 max_gap
+) const {
+    std::sort(ranges.begin(), ranges.end());
+
+    // merge adjacent and close ranges
+    std::vector<std::pair<uint64, uint64>> merged_ranges;
+    for (const std::pair<uint64, uint64>& range: ranges) {
+        if (range.second == 0 || range.first >= size_)
+            continue;
+        uint64 end = std::min(range.first + range.second, size_);
+        if (!merged_ranges.empty()) {
+            std::pair<uint64, uint64>& last = merged_ranges.back();
+            if (range.first <= last.first + last.second + max_gap) {
+                last.second = std::max(last.second, end - last.first);
+                continue;
+            }
+        }
+        merged_ranges.emplace_back(range.first, end - range.first);
+    }
+    return merged_ranges;
+}
+
+void TiffFileStream::Prefetch(std::vector<std::pair<uint64, uint64>> ranges, uint64 max_gap) {
+    Drain();
+    ranges_.clear();
+    std::vector<std::pair<uint64, uint64>> merged_ranges = MergeRanges(ranges, max_gap);
+
+    ranges_.resize(merged_ranges.size());
+    for (size_t i = 0; i < merged_ranges.size(); i++) {
+        ranges_[i].offset = merged_ranges[i].first;
+        ranges_[i].data.resize(merged_ranges[i].second);
+    }
+
+    prefetch_start_ = std::chrono::steady_clock::now();
+    next_range_ = 0;
+    if (ranges_.size() > 1 && ring_ != nullptr && ring_->IsOpen()) {
+        SubmitRanges();
+        return;
+    }
+
+    // synchronous reads
+    for (Range& range: ranges_) {
+        read_at(fd_, range.data.data(), range.data.size(), range.offset);
+        range.done = range.data.size();
+        range.complete = true;
+        read_count_ += 1;
+        bytes_read_ += range.data.size();
+    }
+    next_range_ = ranges_.size();
+    if (!ranges_.empty())
+        max_queue_depth_ = std::max(max_queue_depth_, uint32(1));
+    read_time_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - prefetch_start_).count();
+}
+
+void TiffFileStream::SetReadahead(std::vector<std::pair<uint64, uint64>> ranges, uint64 readahead) {
+    readahead_ranges_ = MergeRanges(ranges, 0);
+    next_readahead_ = 0;
+    readahead_ = readahead;
+}
+
+void TiffFileStream::AdviseAhead(uint64 position) {
+    const uint64 end = position + readahead_;
+    while (next_readahead_ < readahead_ranges_.size()) {
+        std::pair<uint64, uint64>& range = readahead_ranges_[next_readahead_];
+        if (range.first >= end)
+            break;
+        // ranges behind the current position were already read
+        if (range.first + range.second > position) {
+            if (range.first < position) {
+                range.second -= position - range.first;
+                range.first = position;
+            }
+            // a large range is advised piecewise as the position advances
+            uint64 size = std::min(range.second, end - range.first);
+            advise_will_need(fd_, range.first, size);
+            range.first += size;
+            range.second -= size;
+            if (range.second > 0)
+                break;
+        }
+        next_readahead_ += 1;
+    }
+}
+
+void TiffFileStream::SubmitRead(size_t range_idx) {
+    Range& range = ranges_[range_idx];
+    uint64 size = std::min(range.data.size() - range.done, uint64(1) << 30);  // a read is limited to 2 GiB
+    ring_->PrepareRead(fd_, &range.data[range.done], uint32(size), range.offset + range.done, range_idx);
+    in_flight_ += 1;
+    read_count_ += 1;
+}
+
+void TiffFileStream::SubmitRanges() {
+    while (next_range_ < ranges_.size() && in_flight_ < ring_->GetEntryCount())
+        SubmitRead(next_range_++);
+    max_queue_depth_ = std::max(max_queue_depth_, in_flight_);
+    ring_->Submit();
+}
+
+void TiffFileStream::CompleteRead(const std::pair<uint64_t, int32_t>& completion) {
+    in_flight_ -= 1;
+
+    Range& range = ranges_[completion.first];
+    if (completion.second <= 0) {
+        range.failed = true;  // the range is read synchronously on demand
+        range.complete = true;
+    } else {
+        range.done += completion.second;
+        bytes_read_ += completion.second;
+        if (range.done < range.data.size())
+            SubmitRead(completion.first);  // short read
+        else
+            range.complete = true;
+    }
+
+    SubmitRanges();
+    if (in_flight_ == 0 && next_range_ == ranges_.size())
+        read_time_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - prefetch_start_).count();
+}
+
+void TiffFileStream::ReapReads() {
+    std::pair<uint64_t, int32_t> completion;
+    while (in_flight_ > 0 && ring_->Peek(completion))
+        CompleteRead(completion);
+}
+
+void TiffFileStream::Drain() {
+    next_range_ = ranges_.size();
+    while (in_flight_ > 0)
+        CompleteRead(ring_->Wait());
+}
+
+const TiffFileStream::Range* TiffFileStream::FindRange(uint64 offset, uint64 size) {
+    // the last range starting at or before the offset
+    auto it = std::upper_bound(
+        ranges_.begin(), ranges_.end(), offset,
+        [](uint64 offset, const Range& range) { return offset < range.offset; }
+    );
+    if (it == ranges_.begin())
+        return nullptr;
+    --it;
+    if (offset + size > it->offset + it->data.size())
+        return nullptr;
+
+    // decoding starts with the first completed tiles while later reads are in flight
+    ReapReads();
+    while (!it->complete)
+        CompleteRead(ring_->Wait());
+    return it->failed ? nullptr : &(*it);
+}
+
+bool TiffFileStream::ReadRows(uint64 offset, uint64 row_size, uint64 row_count, void* data, uint64 stride) {
+    const uint64 size = row_size * row_count;
+    if (offset + size > size_)
+        return false;
+
+    const Range* range;
+    try {
+        range = FindRange(offset, size);
+    } catch (const std::runtime_error&) {
+        range = nullptr;  // falls back to a synchronous read
+    }
+    uint8* rows = static_cast<uint8*>(data);
+    if (range != nullptr) {
+        for (uint64 row_idx = 0; row_idx < row_count; row_idx++)
+            std::memcpy(&rows[row_idx * stride], &range->data[offset - range->offset + row_idx * row_size], row_size);
+        return true;
+    }
+
+    if (readahead_ > 0)
+        AdviseAhead(offset);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    try {
+        read_rows_at(fd_, rows, row_size, row_count, stride, offset);
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+    read_count_ += 1;
+    bytes_read_ += size;
+    max_queue_depth_ = std::max(max_queue_depth_, uint32(1));
+    read_time_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+tmsize_t TiffFileStream::ReadProc(thandle_t handle, void* data, tmsize_t size) {
+    TiffFileStream* stream = static_cast<TiffFileStream*>(handle);
+    if (stream->position_ >= stream->size_)
+        return 0;
+    uint64 available = stream->size_ - stream->position_;
+    if (static_cast<uint64>(size) > available)
+        size = available;
+
+    const Range* range;
+    try {
+        range = stream->FindRange(stream->position_, size);
+    } catch (const std::runtime_error&) {
+        range = nullptr;  // falls back to a synchronous read
+    }
+    if (range != nullptr) {
+        std::memcpy(data, &range->data[stream->position_ - range->offset], size);
+    } else {
+        if (stream->readahead_ > 0)
+            stream->AdviseAhead(stream->position_);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        try {
+            read_at(stream->fd_, data, size, stream->position_);
+        } catch (const std::runtime_error&) {
+            return -1;  // exceptions must not pass through libtiff
+        }
+        stream->read_count_ += 1;
+        stream->bytes_read_ += size;
+        stream->max_queue_depth_ = std::max(stream->max_queue_depth_, uint32(1));
+        stream->read_time_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    stream->position_ += size;
+    return size;
+}
+
+tmsize_t TiffFileStream::WriteProc(thandle_t, void*, tmsize_t) {
+    return 0;  // the stream is read-only
+}
+
+toff_t TiffFileStream::SeekProc(thandle_t handle, toff_t offset, int whence) {
+    TiffFileStream* stream = static_cast<TiffFileStream*>(handle);
+    switch (whence) {
+        case SEEK_SET:
+            stream->position_ = offset;
+            break;
+        case SEEK_CUR:
+            stream->position_ += offset;
+            break;
+        case SEEK_END:
+            stream->position_ = stream->size_ + offset;
+            break;
+    }
+    return stream->position_;
+}
+
+int TiffFileStream::CloseProc(thandle_t) {
+    return 0;  // the file is closed by the destructor
+}
+
+toff_t TiffFileStream::SizeProc(thandle_t handle) {
+    return static_cast<TiffFileStream*>(handle)->size_;
+}
+
+int TiffFileStream::MapProc(thandle_t, void**, toff_t*) {
+    return 0;
+}
+
+void TiffFileStream::UnmapProc(thandle_t, void*, toff_t) {
+}
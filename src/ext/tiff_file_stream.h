@@ -0,0 +1,209 @@
+#ifndef __TIFFFILESTREAM_H__
+#define __TIFFFILESTREAM_H__
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <tiffio.h>
+
+#include "io_ring.h"
+#include "utils.h"
+
+
+/**
+ * Internal class providing positional file access for libtiff.
+ * The stream is opened by TIFFClientOpen() and serves each read by a
+ * single pread() instead of a seek plus a read. Byte ranges known in
+ * advance (e.g. the tiles of a region) are fetched by Prefetch() with a
+ * few large reads, which libtiff then consumes from memory. If io_uring
+ * is available, all these reads are in flight at once and libtiff
+ * decodes a tile as soon as its read has completed. Byte ranges which are
+ * read on demand instead (e.g. the tiles of a full subfile) are announced
+ * by SetReadahead(), so the kernel prefetches them ahead of the reads.
+ */
+class TiffFileStream {
+    private:
+        /**
+         * Internal struct holding a prefetched byte range of the file.
+         */
+        struct Range {
+            uint64 offset;              /**< Offset of the range in the file. */
+            std::vector<uint8> data;    /**< Content of the range. */
+            uint64 done = 0;            /**< Number of bytes read so far. */
+            bool complete = false;      /**< If true, the read of the range has finished. */
+            bool failed = false;        /**< If true, the read of the range has failed. */
+        };
+
+        int fd_;                        /**< File descriptor of the TIFF file. */
+        uint64 size_;                   /**< Size of the file in bytes. */
+        uint64 position_;               /**< Current position within the file. */
+        std::vector<Range> ranges_;     /**< Prefetched ranges sorted by offset. */
+        IoRing* ring_;                  /**< Ring reading the prefetched ranges, shared by the streams of a TiffFile (nullptr = synchronous reads). */
+        size_t next_range_;             /**< Index of the next prefetched range to submit. */
+        uint32 in_flight_;              /**< Number of reads in flight. */
+        std::chrono::steady_clock::time_point prefetch_start_;  /**< Time at which the prefetched ranges were submitted. */
+        uint64 read_count_;             /**< Number of reads issued to the file. */
+        uint64 bytes_read_;             /**< Number of bytes read from the file. */
+        uint32 max_queue_depth_;        /**< Maximum number of reads in flight so far. */
+        double read_time_;              /**< Time in seconds until the reads completed. */
+        std::vector<std::pair<uint64, uint64>> readahead_ranges_;   /**< Announced ranges sorted by offset, which are not advised yet. */
+        size_t next_readahead_;         /**< Index of the next announced range to advise. */
+        uint64 readahead_;              /**< Number of bytes advised ahead of the current position. */
+
+        /**
+         * Sorts byte ranges and merges those separated by at most max_gap bytes.
+         * Empty ranges and ranges beyond the end of the file are dropped.
+         * @param ranges Offset and size of each byte range.
+         * @param max_gap Maximum number of bytes between two merged ranges.
+         * @return Merged ranges sorted by offset
+         */
+        std::vector<std::pair<uint64, uint64>> MergeRanges(std::vector<std::pair<uint64, uint64>> ranges, uint64 max_gap) const;
+
+        /**
+         * Advises the kernel to prefetch the announced ranges up to the
+         * readahead distance from a position.
+         * @param position Position of the next read.
+         */
+        void AdviseAhead(uint64 position);
+
+        /**
+         * Finds the prefetched range holding a byte range of the file.
+         * Blocks until the read of the range has completed.
+         * @param offset Offset of the byte range.
+         * @param size Size of the byte range.
+         * @return Prefetched range (nullptr = not prefetched or failed)
+         */
+        const Range* FindRange(uint64 offset, uint64 size);
+
+        /**
+         * Submits the remainder of a prefetched range to the ring.
+         * @param range_idx Index of the prefetched range.
+         */
+        void SubmitRead(size_t range_idx);
+
+        /**
+         * Submits pending prefetched ranges while the queue is not full.
+         */
+        void SubmitRanges();
+
+        /**
+         * Handles a completed read of the ring and resubmits short reads.
+         * @param completion Index of the prefetched range and result of the read.
+         */
+        void CompleteRead(const std::pair<uint64_t, int32_t>& completion);
+
+        /**
+         * Handles all completed reads of the ring without blocking.
+         */
+        void ReapReads();
+
+        /**
+         * Blocks until all reads in flight have completed.
+         * Pending prefetched ranges are not submitted anymore.
+         */
+        void Drain();
+
+        static tmsize_t ReadProc(thandle_t handle, void* data, tmsize_t size);    /**< Read routine for libtiff. */
+        static tmsize_t WriteProc(thandle_t handle, void* data, tmsize_t size);   /**< Write routine for libtiff. */
+        static toff_t SeekProc(thandle_t handle, toff_t offset, int whence);      /**< Seek routine for libtiff. */
+        static int CloseProc(thandle_t handle);                                   /**< Close routine for libtiff. */
+        static toff_t SizeProc(thandle_t handle);                                 /**< Size routine for libtiff. */
+        static int MapProc(thandle_t handle, void** base, toff_t* size);          /**< Map routine for libtiff. */
+        static void UnmapProc(thandle_t handle, void* base, toff_t size);         /**< Unmap routine for libtiff. */
+
+    public:
+        /**
+         * Constructor to initialize a TiffFileStream.
+         * @param file_path Path to the TIFF file.
+         * @param ring Ring for the prefetched ranges, which must outlive the stream (nullptr = synchronous reads).
+         * @throw std::runtime_error If the file cannot be opened.
+         */
+        explicit TiffFileStream(const std::string& file_path, IoRing* ring=nullptr);
+
+        /**
+         * Destructor which completes the reads in flight, so the ring can
+         * be reused by the next stream, and closes the file.
+         */
+        ~TiffFileStream();
+
+        TiffFileStream(const TiffFileStream&) = delete;
+        TiffFileStream& operator=(const TiffFileStream&) = delete;
+
+        /**
+         * Get the stream which a TIFF handle reads from.
+         * @param tiff TIFF handle from libtiff.
+         * @return Stream of the handle (nullptr = the handle was not opened by a TiffFileStream)
+         */
+        static TiffFileStream* FromTiff(TIFF* tiff);
+
+        /**
+         * Opens the file for reading.
+         * @note The stream must outlive the returned TIFF handle.
+         * @param mode File mode as for TIFFOpen() (read-only).
+         * @return TIFF handle from libtiff (nullptr = failure)
+         */
+        TIFF* Open(const std::string& mode);
+
+        /**
+         * Reads byte ranges of the file into memory.
+         * The ranges are sorted and ranges separated by at most max_gap
+         * bytes are merged, so that the file is read by a few large reads.
+         * The reads are in flight at once if the stream has an open ring.
+         * Previously prefetched ranges are released.
+         * @param ranges Offset and size of each byte range.
+         * @param max_gap Maximum number of unused bytes read to merge two ranges.
+         */
+        void Prefetch(std::vector<std::pair<uint64, uint64>> ranges, uint64 max_gap);
+
+        /**
+         * Announces byte ranges which are read on demand in the order of
+         * their offsets. While reading, the kernel is advised to prefetch
+         * the announced ranges up to readahead bytes ahead of the current
+         * position, so the reads overlap with the decoding.
+         * @param ranges Offset and size of each byte range.
+         * @param readahead Number of bytes advised ahead (0 = no advice).
+         */
+        void SetReadahead(std::vector<std::pair<uint64, uint64>> ranges, uint64 readahead);
+
+        /**
+         * Reads consecutive rows of bytes of the file into rows of a
+         * destination which are a stride apart, bypassing libtiff. The rows
+         * are copied from a prefetched range or read by a single preadv().
+         * @param offset File offset of the first row.
+         * @param row_size Number of bytes per row.
+         * @param row_count Number of rows.
+         * @param data Destination of the first row.
+         * @param stride Distance in bytes between two rows of the destination.
+         * @return True, if the rows were read. Otherwise, false.
+         */
+        bool ReadRows(uint64 offset, uint64 row_size, uint64 row_count, void* data, uint64 stride);
+
+        /**
+         * Get the number of reads issued to the file.
+         * @return Number of reads
+         */
+        uint64 GetReadCount() const { return read_count_; }
+
+        /**
+         * Get the number of bytes read from the file.
+         * @return Number of bytes
+         */
+        uint64 GetBytesRead() const { return bytes_read_; }
+
+        /**
+         * Get the maximum number of reads in flight.
+         * @return Queue depth
+         */
+        uint32 GetMaxQueueDepth() const { return max_queue_depth_; }
+
+        /**
+         * Get the time until the reads completed.
+         * @return Time in seconds
+         */
+        double GetReadTime() const { return read_time_; }
+};
+
+#endif /* __TIFFFILESTREAM_H__ */
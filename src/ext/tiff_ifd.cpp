@@ -0,0 +1,150 @@
+#include "tiff_ifd.h"
+
+
+TiffIfd::Array::Array(int fd, bool big_endian, bool big_tiff, const Field& field) :
+    fd_(fd), big_endian_(big_endian), value_size_(TiffDirectory::GetTypeSize(field.type)),
+    count_(field.count), position_(field.value_position)
+{
+    const uint8 offset_size = big_tiff ? 8 : 4;
+    inline_ = count_ * value_size_ <= offset_size;
+    std::memcpy(value_, field.value, offset_size);
+}
+
+void TiffIfd::Array::Read(uint64 first_idx, uint64 count, uint64* values) const {
+    if (first_idx + count > count_)
+        throw std::out_of_range("Value index out of range!");
+    if (count == 0)
+        return;
+
+    if (inline_) {
+        for (uint64 value_idx = 0; value_idx < count; value_idx++)
+            values[value_idx] = TiffDirectory::DecodeUInt(&value_[(first_idx + value_idx) * value_size_], value_size_, big_endian_);
+        return;
+    }
+
+    // the values are read in blocks to avoid a temporary allocation
+    uint8 bytes[4096];
+    const uint64 block_count = sizeof(bytes) / value_size_;
+    for (uint64 block_idx = 0; block_idx < count; block_idx += block_count) {
+        const uint64 read_count = std::min(block_count, count - block_idx);
+        read_at(fd_, bytes, read_count * value_size_, position_ + (first_idx + block_idx) * value_size_);
+        for (uint64 value_idx = 0; value_idx < read_count; value_idx++)
+            values[block_idx + value_idx] = TiffDirectory::DecodeUInt(&bytes[value_idx * value_size_], value_size_, big_endian_);
+    }
+}
+
+std::vector<uint64> TiffIfd::Array::ReadAll() const {
+    std::vector<uint64> values(count_);
+    Read(0, count_, values.data());
+    return values;
+}
+
+TiffIfd::Header TiffIfd::ReadHeader(int fd) {
+    uint8 bytes[16];
+    if (read_up_to(fd, bytes, 16, 0) < 8)
+        throw std::runtime_error("The file is not a TIFF file!");
+    if ((bytes[0] != 'I' || bytes[1] != 'I') && (bytes[0] != 'M' || bytes[1] != 'M'))
+        throw std::runtime_error("The file is not a TIFF file!");
+
+    Header header;
+    header.big_endian = bytes[0] == 'M';
+    uint16 version = TiffDirectory::DecodeUInt(&bytes[2], 2, header.big_endian);
+    if (version != 42 && version != 43)
+        throw std::runtime_error("Found unsupported TIFF version: " + std::to_string(version) + "!");
+    header.big_tiff = version == 43;
+    header.first_offset = header.big_tiff ?
+        TiffDirectory::DecodeUInt(&bytes[8], 8, header.big_endian) :
+        TiffDirectory::DecodeUInt(&bytes[4], 4, header.big_endian);
+    return header;
+}
+
+TiffIfd::TiffIfd(int fd, const Header& header, uint64 offset) :
+    fd_(fd), header_(header), offset_(offset), next_offset_(0)
+{
+    const uint8 count_size = header_.big_tiff ? 8 : 2;
+    const uint8 entry_size = header_.big_tiff ? 20 : 12;
+    const uint8 offset_size = header_.big_tiff ? 8 : 4;
+    const bool big_endian = header_.big_endian;
+
+    // a single read covers the entry count, the entries and the next offset of common IFDs
+    uint8 bytes[kReadSize];
+    uint64 bytes_position = offset_;
+    size_t bytes_size = read_up_to(fd_, bytes, kReadSize, offset_);
+    if (bytes_size < count_size)
+        throw std::runtime_error("Could not read IFD at offset " + std::to_string(offset_) + "!");
+    const uint64 entry_count = TiffDirectory::DecodeUInt(bytes, count_size, big_endian);
+
+    uint64 position = offset_ + count_size;
+    for (uint64 entry_idx = 0; entry_idx <= entry_count; entry_idx++) {
+        // the last iteration reads the offset to the next IFD
+        const uint8 size = (entry_idx < entry_count) ? entry_size : offset_size;
+        if (position + size > bytes_position + bytes_size) {
+            bytes_position = position;
+            bytes_size = read_up_to(fd_, bytes, kReadSize, position);
+            if (bytes_size < size)
+                throw std::runtime_error("Could not read IFD at offset " + std::to_string(offset_) + "!");
+        }
+        const uint8* entry_ptr = &bytes[position - bytes_position];
+        position += size;
+
+        if (entry_idx == entry_count) {
+            next_offset_ = TiffDirectory::DecodeUInt(entry_ptr, offset_size, big_endian);
+            break;
+        }
+
+        int field_idx = GetFieldIndex(TiffDirectory::DecodeUInt(entry_ptr, 2, big_endian));
+        if (field_idx < 0)
+            continue;
+
+        Field& field = fields_[field_idx];
+        field.type = TiffDirectory::DecodeUInt(entry_ptr + 2, 2, big_endian);
+        field.count = TiffDirectory::DecodeUInt(entry_ptr + 4, offset_size, big_endian);
+        std::memcpy(field.value, entry_ptr + 4 + offset_size, offset_size);
+        // values which fit into the value field are stored inline
+        if (field.count * TiffDirectory::GetTypeSize(field.type) <= offset_size) {
+            field.value_position = position - offset_size;
+        } else {
+            field.value_position = TiffDirectory::DecodeUInt(field.value, offset_size, big_endian);
+        }
+    }
+}
+
+int TiffIfd::GetFieldIndex(uint16 tag) {
+    switch (tag) {
+        case TIFFTAG_SUBFILETYPE: return 0;
+        case TIFFTAG_IMAGEWIDTH: return 1;
+        case TIFFTAG_IMAGELENGTH: return 2;
+        case TIFFTAG_BITSPERSAMPLE: return 3;
+        case TIFFTAG_COMPRESSION: return 4;
+        case TIFFTAG_PHOTOMETRIC: return 5;
+        case TIFFTAG_STRIPOFFSETS: return 6;
+        case TIFFTAG_SAMPLESPERPIXEL: return 7;
+        case TIFFTAG_ROWSPERSTRIP: return 8;
+        case TIFFTAG_STRIPBYTECOUNTS: return 9;
+        case TIFFTAG_MINSAMPLEVALUE: return 10;
+        case TIFFTAG_MAXSAMPLEVALUE: return 11;
+        case TIFFTAG_PLANARCONFIG: return 12;
+        case TIFFTAG_PAGENUMBER: return 13;
+        case TIFFTAG_TILEWIDTH: return 14;
+        case TIFFTAG_TILELENGTH: return 15;
+        case TIFFTAG_TILEOFFSETS: return 16;
+        case TIFFTAG_TILEBYTECOUNTS: return 17;
+        case TIFFTAG_SUBIFD: return 18;
+        case TIFFTAG_SAMPLEFORMAT: return 19;
+        default: return -1;
+    }
+}
+
+const TiffIfd::Field* TiffIfd::GetField(uint16 tag) const {
+    int field_idx = GetFieldIndex(tag);
+    if (field_idx < 0 || fields_[field_idx].type == 0)
+        return nullptr;
+    return &fields_[field_idx];
+}
+
+TiffIfd::Array TiffIfd::GetArray(uint16 tag) const {
+    const Field* field = GetField(tag);
+    if (field == nullptr)
+        return Array();
+    return Array(fd_, header_.big_endian, header_.big_tiff, *field);
+}
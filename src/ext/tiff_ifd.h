@@ -0,0 +1,190 @@
+#ifndef __TIFFIFD_H__
+#define __TIFFIFD_H__
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <tiffio.h>
+#include "tiff_directory.h"
+#include "utils.h"
+
+
+/**
+ * Internal class parsing an image file directory (IFD) of a classic TIFF or
+ * BigTIFF file in either byte order without libtiff. The IFD is read by a
+ * single read and only the fields of the TIFF Tags known to pylibtiff are
+ * decoded, i.e. no memory is allocated. Arrays like the tile offsets are
+ * read on demand.
+ */
+class TiffIfd {
+    public:
+        /**
+         * Structure for the header of a TIFF file.
+         */
+        struct Header {
+            bool big_endian = false;    /**< If true, the TIFF file uses the big-endian byte order. */
+            bool big_tiff = false;      /**< If true, the TIFF file is a BigTIFF file. */
+            uint64 first_offset = 0;    /**< File offset of the first IFD. */
+        };
+
+        /**
+         * Structure for a decoded IFD entry.
+         */
+        struct Field {
+            uint16 type = 0;            /**< Field type of the entry (0 = missing entry). */
+            uint64 count = 0;           /**< Number of values. */
+            uint64 value_position = 0;  /**< File position of the first value. */
+            uint8 value[8];             /**< Value field of the entry, which holds values fitting into it. */
+        };
+
+        /**
+         * Class for the integer values of a field, which are read on demand.
+         * The values are read from the file, unless they are stored within
+         * the entry.
+         */
+        class Array {
+            private:
+                int fd_;                /**< File descriptor of the TIFF file. */
+                bool big_endian_;       /**< If true, the values are stored in big-endian byte order. */
+                uint8 value_size_;      /**< Size of a value in bytes. */
+                uint64 count_;          /**< Number of values. */
+                uint64 position_;       /**< File position of the first value. */
+                bool inline_;           /**< If true, the values are stored in the entry. */
+                uint8 value_[8];        /**< Value field of the entry. */
+
+            public:
+                /**
+                 * Constructor to initialize an empty Array.
+                 */
+                Array() : fd_(-1), big_endian_(false), value_size_(0), count_(0), position_(0), inline_(false) {}
+
+                /**
+                 * Constructor to initialize an Array of a field.
+                 * @param fd File descriptor of the TIFF file.
+                 * @param big_endian If true, the values are stored in big-endian byte order.
+                 * @param big_tiff If true, the TIFF file is a BigTIFF file.
+                 * @param field Field of the values.
+                 */
+                Array(int fd, bool big_endian, bool big_tiff, const Field& field);
+
+                /**
+                 * Get the number of values.
+                 * @return Number of values
+                 */
+                uint64 GetSize() const { return count_; }
+
+                /**
+                 * Reads a range of the values.
+                 * @param first_idx Index of the first value.
+                 * @param count Number of values.
+                 * @param values Destination of the values.
+                 */
+                void Read(uint64 first_idx, uint64 count, uint64* values) const;
+
+                /**
+                 * Reads all values.
+                 * @return Values of the field
+                 */
+                std::vector<uint64> ReadAll() const;
+        };
+
+    private:
+        static const size_t kReadSize = 4096;   /**< Number of bytes read at once, which covers common IFDs. */
+        static const size_t kFieldCount = 20;   /**< Number of decoded fields. */
+
+        int fd_;                                        /**< File descriptor of the TIFF file. */
+        Header header_;                                 /**< Header of the TIFF file. */
+        uint64 offset_;                                 /**< File offset of the IFD. */
+        uint64 next_offset_;                            /**< File offset of the next IFD (0 = end of the chain). */
+        std::array<Field, kFieldCount> fields_;         /**< Decoded fields (see GetFieldIndex()). */
+
+        /**
+         * Get the index of a decoded field.
+         * @param tag Tag of the field.
+         * @return Index within the decoded fields (-1 = the field is not decoded)
+         */
+        static int GetFieldIndex(uint16 tag);
+
+        /**
+         * Get a decoded field.
+         * @param tag Tag of the field.
+         * @return Field (nullptr = missing or not decoded)
+         */
+        const Field* GetField(uint16 tag) const;
+
+    public:
+        /**
+         * Reads the header of a TIFF file.
+         * @param fd File descriptor of the TIFF file.
+         * @return Header of the TIFF file
+         */
+        static Header ReadHeader(int fd);
+
+        /**
+         * Constructor which reads and decodes an IFD.
+         * @param fd File descriptor of the TIFF file.
+         * @param header Header of the TIFF file.
+         * @param offset File offset of the IFD.
+         */
+        TiffIfd(int fd, const Header& header, uint64 offset);
+
+        /**
+         * Get the file offset of the IFD.
+         * @return File offset of the IFD
+         */
+        uint64 GetOffset() const { return offset_; }
+
+        /**
+         * Get the offset of the next IFD.
+         * @return File offset of the next IFD (0 = end of the chain)
+         */
+        uint64 GetNextOffset() const { return next_offset_; }
+
+        /**
+         * Check if the IFD has an entry for a tag.
+         * @param tag Tag of the entry (one of the decoded fields).
+         * @return True, if the entry exists. Otherwise, false.
+         */
+        bool HasField(uint16 tag) const { return GetField(tag) != nullptr; }
+
+        /**
+         * Check if the image of the IFD is organized in tiles.
+         * @return True, if the image is tiled. Otherwise, false.
+         */
+        bool IsTiled() const { return HasField(TIFFTAG_TILEWIDTH); }
+
+        /**
+         * Get a single integer value of a field like TIFFGetField().
+         * @tparam T Type of the value.
+         * @param tag Tag of the field (one of the decoded fields).
+         * @param value Destination of the value, which is kept for a missing field.
+         * @param value_idx Index of the value.
+         * @return True, if the field exists. Otherwise, false.
+         */
+        template <typename T>
+        bool GetValue(uint16 tag, T& value, uint64 value_idx=0) const;
+
+        /**
+         * Get the integer values of a field, which are read on demand.
+         * @param tag Tag of the field (one of the decoded fields).
+         * @return Values of the field (empty for a missing field)
+         */
+        Array GetArray(uint16 tag) const;
+};
+
+template <typename T>
+bool TiffIfd::GetValue(uint16 tag, T& value, uint64 value_idx) const {
+    const Field* field = GetField(tag);
+    if (field == nullptr || value_idx >= field->count)
+        return false;
+
+    uint64 values[1];
+    Array(fd_, header_.big_endian, header_.big_tiff, *field).Read(value_idx, 1, values);
+    value = static_cast<T>(values[0]);
+    return true;
+}
+
+#endif /* __TIFFIFD_H__ */
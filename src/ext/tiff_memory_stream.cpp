@@ -0,0 +1,85 @@
+#include "tiff_memory_stream.h"
+
+
+TIFF* TiffMemoryStream::Open(const std::string& mode) {
+    position_ = 0;
+    return TIFFClientOpen(
+        "memory", mode.c_str(), static_cast<thandle_t>(this),
+        ReadProc, WriteProc, SeekProc, CloseProc, SizeProc, MapProc, UnmapProc
+    );
+}
+
+TIFF* TiffMemoryStream::OpenView(const uint8* data, uint64 size, const std::string& mode) {
+    TiffMemoryStream* stream = new TiffMemoryStream(data, size);
+    TIFF* tiff = stream->Open(mode);
+    if (tiff == nullptr) {
+        delete stream;  // TIFFClientOpen() does not call CloseProc on failure
+        return nullptr;
+    }
+    stream->close_deletes_ = true;
+    return tiff;
+}
+
+tmsize_t TiffMemoryStream::ReadProc(thandle_t handle, void* data, tmsize_t size) {
+    TiffMemoryStream* stream = static_cast<TiffMemoryStream*>(handle);
+    if (stream->position_ >= stream->GetSize())
+        return 0;
+    uint64 available = stream->GetSize() - stream->position_;
+    if (static_cast<uint64>(size) > available)
+        size = available;
+    std::memcpy(data, stream->GetData() + stream->position_, size);
+    stream->position_ += size;
+    return size;
+}
+
+tmsize_t TiffMemoryStream::WriteProc(thandle_t handle, void* data, tmsize_t size) {
+    TiffMemoryStream* stream = static_cast<TiffMemoryStream*>(handle);
+    if (stream->view_data_ != nullptr)
+        return 0;  // views are read-only
+    if (stream->position_ + size > stream->buffer_.size())
+        stream->buffer_.resize(stream->position_ + size);
+    std::memcpy(&stream->buffer_[stream->position_], data, size);
+    stream->position_ += size;
+    return size;
+}
+
+toff_t TiffMemoryStream::SeekProc(thandle_t handle, toff_t offset, int whence) {
+    TiffMemoryStream* stream = static_cast<TiffMemoryStream*>(handle);
+    switch (whence) {
+        case SEEK_SET:
+            stream->position_ = offset;
+            break;
+        case SEEK_CUR:
+            stream->position_ += offset;
+            break;
+        case SEEK_END:
+            stream->position_ = stream->GetSize() + offset;
+            break;
+    }
+    return stream->position_;
+}
+
+int TiffMemoryStream::CloseProc(thandle_t handle) {
+    TiffMemoryStream* stream = static_cast<TiffMemoryStream*>(handle);
+    if (stream->close_deletes_)
+        delete stream;
+    return 0;
+}
+
+toff_t TiffMemoryStream::SizeProc(thandle_t handle) {
+    return static_cast<TiffMemoryStream*>(handle)->GetSize();
+}
+
+int TiffMemoryStream::MapProc(thandle_t handle, void** base, toff_t* size) {
+    TiffMemoryStream* stream = static_cast<TiffMemoryStream*>(handle);
+    if (stream->view_data_ == nullptr)
+        return 0;  // the buffer may be reallocated while writing
+
+    // libtiff reads the raw tiles/strips of a view without copying them
+    *base = const_cast<uint8*>(stream->view_data_);
+    *size = stream->view_size_;
+    return 1;
+}
+
+void TiffMemoryStream::UnmapProc(thandle_t, void*, toff_t) {
+}
@@ -0,0 +1,80 @@
+#ifndef __TIFFMEMORYSTREAM_H__
+#define __TIFFMEMORYSTREAM_H__
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <tiffio.h>
+
+
+/**
+ * Internal class providing an in-memory file for libtiff.
+ * The stream is opened by TIFFClientOpen() and grows on demand.
+ * Alternatively, the stream is a read-only view of external memory,
+ * which is neither copied nor owned by the stream.
+ */
+class TiffMemoryStream {
+    private:
+        std::vector<uint8> buffer_; /**< Content of the in-memory file. */
+        const uint8* view_data_;    /**< Start of the viewed memory (nullptr = no view). */
+        uint64 view_size_;          /**< Size of the viewed memory in bytes. */
+        uint64 position_;           /**< Current position within the in-memory file. */
+        bool close_deletes_;        /**< If true, the stream is deleted by TIFFClose(). */
+
+        const uint8* GetData() const { return view_data_ != nullptr ? view_data_ : buffer_.data(); }    /**< Start of the content. */
+        uint64 GetSize() const { return view_data_ != nullptr ? view_size_ : buffer_.size(); }          /**< Size of the content. */
+
+        static tmsize_t ReadProc(thandle_t handle, void* data, tmsize_t size);    /**< Read routine for libtiff. */
+        static tmsize_t WriteProc(thandle_t handle, void* data, tmsize_t size);   /**< Write routine for libtiff. */
+        static toff_t SeekProc(thandle_t handle, toff_t offset, int whence);      /**< Seek routine for libtiff. */
+        static int CloseProc(thandle_t handle);                                   /**< Close routine for libtiff. */
+        static toff_t SizeProc(thandle_t handle);                                 /**< Size routine for libtiff. */
+        static int MapProc(thandle_t handle, void** base, toff_t* size);          /**< Map routine for libtiff. */
+        static void UnmapProc(thandle_t handle, void* base, toff_t size);         /**< Unmap routine for libtiff. */
+
+    public:
+        /**
+         * Constructor to initialize an empty TiffMemoryStream.
+         */
+        TiffMemoryStream() : view_data_(nullptr), view_size_(0), position_(0), close_deletes_(false) {}
+
+        /**
+         * Constructor to initialize a read-only view of external memory.
+         * @param data Start of the memory holding a TIFF file.
+         * @param size Size of the memory in bytes.
+         */
+        TiffMemoryStream(const uint8* data, uint64 size) :
+            view_data_(data), view_size_(size), position_(0), close_deletes_(false) {}
+
+        TiffMemoryStream(const TiffMemoryStream&) = delete;
+        TiffMemoryStream& operator=(const TiffMemoryStream&) = delete;
+
+        /**
+         * Opens the in-memory file.
+         * @note The stream must outlive the returned TIFF handle.
+         * @param mode File mode as for TIFFOpen().
+         * @return TIFF handle from libtiff
+         */
+        TIFF* Open(const std::string& mode);
+
+        /**
+         * Opens a read-only view of external memory holding a TIFF file.
+         * Each call creates an independent stream which is deleted by
+         * TIFFClose(), so several handles may read the memory at a time.
+         * @note The memory must outlive the returned TIFF handle.
+         * @param data Start of the memory holding a TIFF file.
+         * @param size Size of the memory in bytes.
+         * @param mode File mode as for TIFFOpen() (read-only).
+         * @return TIFF handle from libtiff (nullptr = failure)
+         */
+        static TIFF* OpenView(const uint8* data, uint64 size, const std::string& mode="r");
+
+        /**
+         * Get the content of the in-memory file.
+         * @return Content of the in-memory file
+         */
+        std::vector<uint8>& GetBuffer() { return buffer_; }
+};
+
+#endif /* __TIFFMEMORYSTREAM_H__ */
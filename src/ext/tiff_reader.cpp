@@ -1,7 +1,7 @@
 #include "tiff_reader.h"
 
 
-char TiffReader::errorBuffer_[] = {};
+thread_local char TiffReader::errorBuffer_[] = {};
 
 void TiffReader::ErrorHandler(
     const char* module, const char* format, va_list args
@@ -9,14 +9,115 @@ void TiffReader::ErrorHandler(
     vsnprintf(errorBuffer_, 1024, format, args);
 }
 
+std::vector<std::pair<uint32, uint32>> TiffReader::GetTilesByOffset(
+    TIFF* tiff, uint32 x1, uint32 y1, uint32 x2, uint32 y2, uint32 tile_size
+) {
+    uint64* offsets;
+    if (!TIFFGetField(tiff, TIFFTAG_TILEOFFSETS, &offsets))
+        offsets = nullptr;  // keeps the raster order
+
+    std::vector<std::pair<uint64, std::pair<uint32, uint32>>> tiles;
+    // 64-bit coordinates do not wrap around past the last tile of a 4 Gi pixel wide image
+    for (uint64 img_row = y1; img_row < y2; img_row += tile_size) {
+        for (uint64 img_column = x1; img_column < x2; img_column += tile_size) {
+            uint64 offset = (offsets != nullptr) ? offsets[TIFFComputeTile(tiff, img_column, img_row, 0, 0)] : 0;
+            tiles.push_back(std::make_pair(offset, std::make_pair(img_column, img_row)));
+        }
+    }
+    std::stable_sort(
+        tiles.begin(), tiles.end(),
+        [](const std::pair<uint64, std::pair<uint32, uint32>>& a, const std::pair<uint64, std::pair<uint32, uint32>>& b) {
+            return a.first < b.first;
+        }
+    );
+
+    std::vector<std::pair<uint32, uint32>> origins;
+    origins.reserve(tiles.size());
+    for (const std::pair<uint64, std::pair<uint32, uint32>>& tile: tiles)
+        origins.push_back(tile.second);
+    return origins;
+}
+
+std::vector<uint32> TiffReader::GetStripsByOffset(TIFF* tiff, uint32 y1, uint32 y2) {
+    uint64* offsets;
+    if (!TIFFGetField(tiff, TIFFTAG_STRIPOFFSETS, &offsets))
+        offsets = nullptr;  // keeps the raster order
+
+    std::vector<std::pair<uint64, uint32>> strips;
+    for (uint32 strip = TIFFComputeStrip(tiff, y1, 0); strip <= TIFFComputeStrip(tiff, y2 - 1, 0); strip++)
+        strips.push_back(std::make_pair((offsets != nullptr) ? offsets[strip] : 0, strip));
+    std::stable_sort(
+        strips.begin(), strips.end(),
+        [](const std::pair<uint64, uint32>& a, const std::pair<uint64, uint32>& b) { return a.first < b.first; }
+    );
+
+    std::vector<uint32> indices;
+    indices.reserve(strips.size());
+    for (const std::pair<uint64, uint32>& strip: strips)
+        indices.push_back(strip.second);
+    return indices;
+}
+
+std::vector<std::pair<uint64, uint64>> TiffReader::GetRegionByteRanges(
+    TIFF* tiff, uint32 x1, uint32 y1, uint32 x2, uint32 y2
+) {
+    uint32 image_width, image_length, chunk_width, chunk_length;
+    if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &image_width) || !TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &image_length))
+        return {};
+
+    uint64* offsets;
+    uint64* byte_counts;
+    if (TIFFIsTiled(tiff)) {
+        if (!TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &chunk_width) || !TIFFGetField(tiff, TIFFTAG_TILELENGTH, &chunk_length))
+            return {};
+        if (!TIFFGetField(tiff, TIFFTAG_TILEOFFSETS, &offsets) || !TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &byte_counts))
+            return {};
+    } else {
+        chunk_width = image_width;
+        if (!TIFFGetField(tiff, TIFFTAG_ROWSPERSTRIP, &chunk_length))
+            chunk_length = image_length;  // default
+        if (!TIFFGetField(tiff, TIFFTAG_STRIPOFFSETS, &offsets) || !TIFFGetField(tiff, TIFFTAG_STRIPBYTECOUNTS, &byte_counts))
+            return {};
+    }
+
+    return GetRegionByteRanges(
+        image_width, image_length, chunk_width, chunk_length,
+        offsets, byte_counts, TIFFIsTiled(tiff) ? TIFFNumberOfTiles(tiff) : TIFFNumberOfStrips(tiff),
+        x1, y1, x2, y2
+    );
+}
+
+std::vector<std::pair<uint64, uint64>> TiffReader::GetRegionByteRanges(
+    uint32 image_width, uint32 image_length, uint32 chunk_width, uint32 chunk_length,
+    const uint64* offsets, const uint64* byte_counts, uint32 chunk_count,
+    uint32 x1, uint32 y1, uint32 x2, uint32 y2
+) {
+    std::vector<std::pair<uint64, uint64>> ranges;
+    if (x1 >= x2 || y1 >= y2 || x2 > image_width || y2 > image_length)
+        return ranges;  // reported by the actual read
+    if (chunk_width == 0 || chunk_length == 0)
+        return ranges;
+
+    // chunks are tiles or strips (with the width of the image) in row-major order
+    chunk_length = std::min(chunk_length, image_length);
+    const uint32 chunks_across = (image_width + chunk_width - 1) / chunk_width;
+    for (uint32 chunk_row = y1 / chunk_length; chunk_row <= (y2 - 1) / chunk_length; chunk_row++) {
+        for (uint32 chunk_column = x1 / chunk_width; chunk_column <= (x2 - 1) / chunk_width; chunk_column++) {
+            uint64 chunk = uint64(chunk_row) * chunks_across + chunk_column;
+            if (chunk < chunk_count)
+                ranges.emplace_back(offsets[chunk], byte_counts[chunk]);
+        }
+    }
+
+    return ranges;
+}
+
 template <typename T>
 void TiffReader::ReadSubfileByScanline(
-    TIFF* tiff, uint16 subfile_idx, T* arr_ptr
+    TIFF* tiff, T* arr_ptr
 ) {
     TIFFSetErrorHandler(ErrorHandler);
 
-    TIFFSetDirectory(tiff, subfile_idx);
-
     uint32 image_width, image_length;
     uint16 samples_per_pixel, planar_config;
     if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &image_width))
@@ -33,10 +134,16 @@ void TiffReader::ReadSubfileByScanline(
             "Found unsupported planar configuration '" + std::to_string(planar_config) + "'!"
         );
 
-    for (uint32 img_row = 0; img_row < image_length; img_row++) {
-        if (TIFFReadScanline(tiff, &arr_ptr[(img_row * image_width) * samples_per_pixel], img_row) < 0) {
+    // the strips are decoded in file order, each straight into its rows of the array
+    uint32 rows_per_strip;
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_ROWSPERSTRIP, &rows_per_strip);
+    const uint64 row_size = TIFFScanlineSize64(tiff);
+    for (uint32 strip: GetStripsByOffset(tiff, 0, image_length)) {
+        const uint64 strip_row = uint64(strip) * rows_per_strip;
+        const uint64 rows = std::min<uint64>(rows_per_strip, image_length - strip_row);
+        if (TIFFReadEncodedStrip(tiff, strip, &arr_ptr[(strip_row * image_width) * samples_per_pixel], rows * row_size) < 0) {
             throw std::runtime_error(
-                "Error while reading image row '" + std::to_string(img_row) + "'!\n" +
+                "Error while reading image strip '" + std::to_string(strip) + "'!\n" +
                 std::string(errorBuffer_)
             );
         }
@@ -45,13 +152,11 @@ void TiffReader::ReadSubfileByScanline(
 
 template <typename T>
 void TiffReader::ReadSubfileRegionByScanline(
-    TIFF* tiff, uint16 subfile_idx, T* arr_ptr,
+    TIFF* tiff, T* arr_ptr,
     uint32 x1, uint32 y1, uint32 x2, uint32 y2
 ) {
     TIFFSetErrorHandler(ErrorHandler);
 
-    TIFFSetDirectory(tiff, subfile_idx);
-
     uint32 image_width, image_length;
     uint16 samples_per_pixel, bits_per_sample, planar_config;
     if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &image_width))
@@ -83,101 +188,59 @@ void TiffReader::ReadSubfileRegionByScanline(
         throw std::runtime_error("Invalid crop dimensions defined!");
 
     uint32 arr_width = x2 - x1;
-
-    uint32 img_row, arr_row;
-    T* buffer = (T*) _TIFFmalloc(TIFFScanlineSize(tiff));  // may include padding
-    for (img_row = y1, arr_row = 0; img_row < y2; img_row++, arr_row++) {
-        if (TIFFReadScanline(tiff, buffer, img_row) < 0) {
+    const uint64 pixel_size = samples_per_pixel * (bits_per_sample / 8);
+
+    // the strips are decoded in file order, each into its own rows of the region
+    uint32 rows_per_strip;
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_ROWSPERSTRIP, &rows_per_strip);
+    const uint64 row_size = TIFFScanlineSize64(tiff);
+    BufferPool::Buffer strip_buffer = BufferPool::Acquire(TIFFStripSize(tiff));
+    const uint8* buffer = strip_buffer.GetData();
+    for (uint32 strip: GetStripsByOffset(tiff, y1, y2)) {
+        const uint64 strip_row = uint64(strip) * rows_per_strip;
+        const uint64 rows = std::min<uint64>(rows_per_strip, image_length - strip_row);
+        if (TIFFReadEncodedStrip(tiff, strip, strip_buffer.GetData(), rows * row_size) < 0) {
             throw std::runtime_error(
-                "Error while reading image row '" + std::to_string(img_row) + "'!\n" +
+                "Error while reading image strip '" + std::to_string(strip) + "'!\n" +
                 std::string(errorBuffer_)
             );
         }
 
-        std::memcpy(
-            &arr_ptr[
-                (arr_row * arr_width) *
-                samples_per_pixel
-            ],
-            &buffer[x1 * samples_per_pixel],
-            arr_width * samples_per_pixel * (bits_per_sample / 8)
-        );
+        const uint64 first_row = std::max<uint64>(y1, strip_row);
+        const uint64 last_row = std::min<uint64>(y2, strip_row + rows);
+        for (uint64 img_row = first_row; img_row < last_row; img_row++) {
+            std::memcpy(
+                &arr_ptr[((img_row - y1) * arr_width) * samples_per_pixel],
+                &buffer[(img_row - strip_row) * row_size + x1 * pixel_size],
+                arr_width * pixel_size
+            );
+        }
     }
-    _TIFFfree(buffer);
 }
 
 template <typename T>
-void TiffReader::ReadSubfileByTile(
-    TIFF* tiff, uint16 subfile_idx, T* arr_ptr
+uint64 TiffReader::ReadSubfileByTile(
+    TIFF* tiff, T* arr_ptr
 ) {
-    TIFFSetErrorHandler(ErrorHandler);
-
-    TIFFSetDirectory(tiff, subfile_idx);
-
     uint32 image_width, image_length;
-    uint16 samples_per_pixel, bits_per_sample;
-    uint32 tile_width, tile_length, tile_size;
     if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &image_width))
         throw std::runtime_error("Missing field 'ImageWidth'!");
     if (!TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &image_length))
         throw std::runtime_error("Missing field 'ImageLength'!");
-    if (!TIFFGetField(tiff, TIFFTAG_BITSPERSAMPLE, &bits_per_sample))
-        bits_per_sample = 1;  // default
-    if (!TIFFGetField(tiff, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel))
-        samples_per_pixel = 1;  // default
-    if(!TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &tile_width))
-        throw std::runtime_error("Missing field 'TileWidth'!");
-    if(!TIFFGetField(tiff, TIFFTAG_TILELENGTH, &tile_length))
-        throw std::runtime_error("Missing field 'TileLength'!");
-
-    if (tile_width != tile_length)
-        throw std::runtime_error("The fields 'TileLength' and 'TileWidth' must have the same value!");
-    tile_size = tile_length;
-
-    T* buffer = (T*) _TIFFmalloc(TIFFTileSize(tiff));
 
-    for (uint32 img_row = 0; img_row < image_length; img_row += tile_size) {
-        for (uint32 img_column = 0; img_column < image_width; img_column += tile_size) {
-            if (TIFFReadTile(tiff, buffer, img_column, img_row, 0, 0) < 0) {
-                throw std::runtime_error(
-                    "Error while reading image tile (" + std::to_string(img_column) + ", " + std::to_string(img_row) + ")!\n" +
-                    std::string(errorBuffer_)
-                );
-            }
-
-            uint32 pixels_to_copy = min(tile_size, image_width - img_column);
-
-            for (
-                uint32 tile_row = 0;
-                tile_row < (uint32) min(tile_size, image_length - img_row);
-                tile_row++
-            ) {
-                std::memcpy(
-                    &arr_ptr[
-                        ((img_row + tile_row) * image_width + img_column) * samples_per_pixel
-                    ],
-                    &buffer[
-                        (tile_row * tile_size) * samples_per_pixel
-                    ],
-                    pixels_to_copy * samples_per_pixel * (bits_per_sample / 8)
-                );
-            }
-        }
-    }
-    _TIFFfree(buffer);
+    // the whole subfile is the region covering all tiles
+    return ReadSubfileRegionByTile<T>(tiff, arr_ptr, 0, 0, image_width, image_length);
 }
 
 template <typename T>
-void TiffReader::ReadSubfileRegionByTile(
-    TIFF* tiff, uint16 subfile_idx, T* arr_ptr,
+uint64 TiffReader::ReadSubfileRegionByTile(
+    TIFF* tiff, T* arr_ptr,
     uint32 x1, uint32 y1, uint32 x2, uint32 y2
 ) {
     TIFFSetErrorHandler(ErrorHandler);
 
-    TIFFSetDirectory(tiff, subfile_idx);
-
     uint32 image_width, image_length;
-    uint16 samples_per_pixel, bits_per_sample;
+    uint16 samples_per_pixel, bits_per_sample, compression, fill_order;
     uint32 tile_width, tile_length, tile_size;
     if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &image_width))
         throw std::runtime_error("Missing field 'ImageWidth'!");
@@ -191,6 +254,10 @@ void TiffReader::ReadSubfileRegionByTile(
         throw std::runtime_error("Missing field 'TileWidth'!");
     if(!TIFFGetField(tiff, TIFFTAG_TILELENGTH, &tile_length))
         throw std::runtime_error("Missing field 'TileLength'!");
+    if (!TIFFGetField(tiff, TIFFTAG_COMPRESSION, &compression))
+        compression = COMPRESSION_NONE;  // default
+    if (!TIFFGetField(tiff, TIFFTAG_FILLORDER, &fill_order))
+        fill_order = FILLORDER_MSB2LSB;  // default
 
     if (tile_width != tile_length)
         throw std::runtime_error("The fields 'TileLength' and 'TileWidth' must have the same value!");
@@ -211,54 +278,94 @@ void TiffReader::ReadSubfileRegionByTile(
     // round to tile boundaries
     uint32 img_y1_aligned = y1 - (y1 % tile_size);
     uint32 img_x1_aligned = x1 - (x1 % tile_size);
-    uint32 img_y2_aligned = y2 + (tile_size - 1) - ((y2 + (tile_size - 1)) % tile_size);
-    uint32 img_x2_aligned = x2 + (tile_size - 1) - ((x2 + (tile_size - 1)) % tile_size);
 
     uint32 arr_width = x2 - x1;
-
-    T* buffer = (T*) _TIFFmalloc(TIFFTileSize(tiff));
-
-    for (uint32 img_row = img_y1_aligned; img_row < img_y2_aligned; img_row += tile_size) {
-        for (uint32 img_column = img_x1_aligned; img_column < img_x2_aligned; img_column += tile_size) {
-            if (TIFFReadTile(tiff, buffer, img_column, img_row, 0, 0) < 0) {
-                throw std::runtime_error(
-                    "Error while reading image tile (" + std::to_string(img_column) + ", " + std::to_string(img_row) + ")!\n" +
-                    std::string(errorBuffer_)
-                );
+    const uint64 pixel_size = samples_per_pixel * (bits_per_sample / 8);
+    const uint64 tile_row_size = tile_size * pixel_size;
+
+    // uncompressed tiles in the native byte order are read from the file straight into the array
+    TiffFileStream* stream = TiffFileStream::FromTiff(tiff);
+    uint64* offsets;
+    uint64* byte_counts;
+    const bool raw = (
+        stream != nullptr && compression == COMPRESSION_NONE && fill_order == FILLORDER_MSB2LSB &&
+        (bits_per_sample == 8 || !TIFFIsByteSwapped(tiff)) &&
+        TIFFGetField(tiff, TIFFTAG_TILEOFFSETS, &offsets) && TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &byte_counts)
+    );
+
+    BufferPool::Buffer tile_buffer = BufferPool::Acquire(TIFFTileSize(tiff));
+    T* buffer = tile_buffer.GetData<T>();
+    uint64 direct_bytes = 0;
+
+    // the tiles are decoded in file order, each into its own part of the region
+    for (const std::pair<uint32, uint32>& tile: GetTilesByOffset(tiff, img_x1_aligned, img_y1_aligned, x2, y2, tile_size)) {
+        uint32 img_column = tile.first, img_row = tile.second;
+
+        // rows of the tile within the region
+        uint32 first_row = max(0, int64_t(y1) - img_row);
+        uint32 last_row = min(tile_size, y2 - img_row);
+        uint64 arr_row = max(0, int64_t(img_row) - y1);
+
+        // an interior tile covers whole rows of the tile within the array
+        if (img_column >= x1 && uint64(img_column) + tile_size <= x2) {
+            T* arr_tile_ptr = &arr_ptr[(arr_row * arr_width + (img_column - x1)) * samples_per_pixel];
+            if (raw) {
+                uint32 tile_idx = TIFFComputeTile(tiff, img_column, img_row, 0, 0);
+                if (
+                    byte_counts[tile_idx] >= tile_row_size * tile_size &&
+                    stream->ReadRows(
+                        offsets[tile_idx] + first_row * tile_row_size, tile_row_size, last_row - first_row,
+                        arr_tile_ptr, arr_width * pixel_size
+                    )
+                ) {
+                    direct_bytes += (last_row - first_row) * tile_row_size;
+                    continue;
+                }
+            } else if (arr_width == tile_size && first_row == 0 && last_row == tile_size) {
+                // the rows of the tile are contiguous within the array
+                if (TIFFReadTile(tiff, arr_tile_ptr, img_column, img_row, 0, 0) < 0) {
+                    throw std::runtime_error(
+                        "Error while reading image tile (" + std::to_string(img_column) + ", " + std::to_string(img_row) + ")!\n" +
+                        std::string(errorBuffer_)
+                    );
+                }
+                direct_bytes += tile_size * tile_row_size;
+                continue;
             }
+        }
 
-            uint32 pixels_to_copy = min(
-                tile_size, min((img_column + tile_size) - x1, x2 - img_column)
+        if (TIFFReadTile(tiff, buffer, img_column, img_row, 0, 0) < 0) {
+            throw std::runtime_error(
+                "Error while reading image tile (" + std::to_string(img_column) + ", " + std::to_string(img_row) + ")!\n" +
+                std::string(errorBuffer_)
             );
+        }
 
-            uint32 buffer_row, arr_row;
-            for (
-                buffer_row = max(0, y1 - img_row), arr_row = max(0, img_row - y1);
-                buffer_row < (uint32) min(tile_size, y2 - img_row);
-                buffer_row++, arr_row++
-            ) {
-                std::memcpy(
-                    &arr_ptr[
-                        (arr_row * arr_width + max(0, img_column - x1)) * samples_per_pixel
-                    ],
-                    &buffer[
-                        (buffer_row * tile_size + max(0, x1 - img_column)) * samples_per_pixel
-                    ],
-                    pixels_to_copy * samples_per_pixel * (bits_per_sample / 8)
-                );
-            }
+        // the region may start and end within the same tile
+        uint32 pixels_to_copy = std::min<uint64>(uint64(img_column) + tile_size, x2) - std::max(img_column, x1);
+
+        for (uint32 buffer_row = first_row; buffer_row < last_row; buffer_row++, arr_row++) {
+            std::memcpy(
+                &arr_ptr[
+                    (arr_row * arr_width + max(0, int64_t(img_column) - x1)) * samples_per_pixel
+                ],
+                &buffer[
+                    (uint64(buffer_row) * tile_size + max(0, int64_t(x1) - img_column)) * samples_per_pixel
+                ],
+                pixels_to_copy * pixel_size
+            );
         }
     }
-    _TIFFfree(buffer);
+    return direct_bytes;
 }
 
 
 // explicit instantiation of templates
-template void TiffReader::ReadSubfileByScanline<uint8>(TIFF*, uint16, uint8*);
-template void TiffReader::ReadSubfileByScanline<uint16>(TIFF*, uint16, uint16*);
-template void TiffReader::ReadSubfileRegionByScanline<uint8>(TIFF*, uint16, uint8*, uint32, uint32, uint32, uint32);
-template void TiffReader::ReadSubfileRegionByScanline<uint16>(TIFF*, uint16, uint16*, uint32, uint32, uint32, uint32);
-template void TiffReader::ReadSubfileByTile<uint8>(TIFF*, uint16, uint8*);
-template void TiffReader::ReadSubfileByTile<uint16>(TIFF*, uint16, uint16*);
-template void TiffReader::ReadSubfileRegionByTile<uint8>(TIFF*, uint16, uint8*, uint32, uint32, uint32, uint32);
-template void TiffReader::ReadSubfileRegionByTile<uint16>(TIFF*, uint16, uint16*, uint32, uint32, uint32, uint32);
+template void TiffReader::ReadSubfileByScanline<uint8>(TIFF*, uint8*);
+template void TiffReader::ReadSubfileByScanline<uint16>(TIFF*, uint16*);
+template void TiffReader::ReadSubfileRegionByScanline<uint8>(TIFF*, uint8*, uint32, uint32, uint32, uint32);
+template void TiffReader::ReadSubfileRegionByScanline<uint16>(TIFF*, uint16*, uint32, uint32, uint32, uint32);
+template uint64 TiffReader::ReadSubfileByTile<uint8>(TIFF*, uint8*);
+template uint64 TiffReader::ReadSubfileByTile<uint16>(TIFF*, uint16*);
+template uint64 TiffReader::ReadSubfileRegionByTile<uint8>(TIFF*, uint8*, uint32, uint32, uint32, uint32);
+template uint64 TiffReader::ReadSubfileRegionByTile<uint16>(TIFF*, uint16*, uint32, uint32, uint32, uint32);
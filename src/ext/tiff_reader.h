@@ -1,12 +1,17 @@
 #ifndef __TIFFREADER_H__
 #define __TIFFREADER_H__
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <tiffio.h>
 
+#include "buffer_pool.h"
+#include "tiff_file_stream.h"
 #include "utils.h"
 
 
@@ -15,7 +20,7 @@
  */
 class TiffReader {
     private:
-        static char errorBuffer_[1024]; /**< Buffer containing diagnostic messages from libtiff. */
+        static thread_local char errorBuffer_[1024];    /**< Buffer containing diagnostic messages from libtiff (per thread, as subfiles are encoded and decoded in parallel). */
         /**
          * Error handler routine for libtiff.
          * @param module Module in which an error is detected.
@@ -24,22 +29,82 @@ class TiffReader {
          */
         static void ErrorHandler(const char* module, const char* format, va_list args);
 
+        /**
+         * Get the tiles covering a region in the order of their offsets in
+         * the file, so that tiles written in any order are read sequentially.
+         * @param tiff TIFF handle from libtiff set to the subfile.
+         * @param x1 Upper left x-coordinate of the first tile (incl).
+         * @param y1 Upper left y-coordinate of the first tile (incl).
+         * @param x2 Lower right x-coordinate (excl).
+         * @param y2 Lower right y-coordinate (excl).
+         * @param tile_size Width and length of a tile.
+         * @return Upper left coordinates (x, y) of the tiles
+         */
+        static std::vector<std::pair<uint32, uint32>> GetTilesByOffset(
+            TIFF* tiff, uint32 x1, uint32 y1, uint32 x2, uint32 y2, uint32 tile_size
+        );
+
+        /**
+         * Get the strips covering the rows of a subfile in the order of
+         * their offsets in the file, so that strips written in any order
+         * are read sequentially.
+         * @param tiff TIFF handle from libtiff set to the subfile.
+         * @param y1 First row (incl).
+         * @param y2 Last row (excl).
+         * @return Indices of the strips
+         */
+        static std::vector<uint32> GetStripsByOffset(TIFF* tiff, uint32 y1, uint32 y2);
+
     public:
         /**
-         * Reads a subfile by scanlines.
+         * Get the byte ranges of the tiles or strips covering a region of a subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
+         * @param x1 Upper left x-coordinate (incl).
+         * @param y1 Upper left y-coordinate (incl).
+         * @param x2 Lower right x-coordinate (excl).
+         * @param y2 Lower right y-coordinate (excl).
+         * @return Offset and size of each tile or strip (empty for invalid regions)
+         */
+        static std::vector<std::pair<uint64, uint64>> GetRegionByteRanges(
+            TIFF* tiff, uint32 x1, uint32 y1, uint32 x2, uint32 y2
+        );
+
+        /**
+         * Get the byte ranges of the tiles or strips covering a region of a subfile.
+         * @param image_width Width of the subfile.
+         * @param image_length Length (height) of the subfile.
+         * @param chunk_width Width of a tile (width of the subfile for strips).
+         * @param chunk_length Length (height) of a tile or the rows per strip.
+         * @param offsets Offsets of the tiles or strips.
+         * @param byte_counts Sizes of the tiles or strips.
+         * @param chunk_count Number of tiles or strips.
+         * @param x1 Upper left x-coordinate (incl).
+         * @param y1 Upper left y-coordinate (incl).
+         * @param x2 Lower right x-coordinate (excl).
+         * @param y2 Lower right y-coordinate (excl).
+         * @return Offset and size of each tile or strip (empty for invalid regions)
+         */
+        static std::vector<std::pair<uint64, uint64>> GetRegionByteRanges(
+            uint32 image_width, uint32 image_length, uint32 chunk_width, uint32 chunk_length,
+            const uint64* offsets, const uint64* byte_counts, uint32 chunk_count,
+            uint32 x1, uint32 y1, uint32 x2, uint32 y2
+        );
+
+        /**
+         * Reads a subfile by scanlines. The strips are decoded in the order
+         * of their offsets in the file.
          * @tparam T Data type of a subfile component (i.e. pixel).
-         * @param tiff TIFF handle from libtiff.
-         * @param subfile_idx Index of the subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
          * @param arr_ptr image buffer where to write to.
          */
         template <typename T>
-        static void ReadSubfileByScanline(TIFF* tiff, uint16 subfile_idx, T* arr_ptr);
+        static void ReadSubfileByScanline(TIFF* tiff, T* arr_ptr);
 
         /**
-         * Reads a region of a subfile by scanlines.
+         * Reads a region of a subfile by scanlines. The strips covering the
+         * region are decoded in the order of their offsets in the file.
          * @tparam T Data type of a subfile component (i.e. pixel).
-         * @param tiff TIFF handle from libtiff.
-         * @param subfile_idx Index of the subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
          * @param arr_ptr image buffer where to write to.
          * @param x1 Upper left x-coordinate (incl).
          * @param y1 Upper left y-coordinate (incl).
@@ -48,7 +113,7 @@ class TiffReader {
          */
         template <typename T>
         static void ReadSubfileRegionByScanline(
-            TIFF* tiff, uint16 subfile_idx, T* arr_ptr,
+            TIFF* tiff, T* arr_ptr,
             uint32 x1, uint32 y1, uint32 x2, uint32 y2
         );
 
@@ -56,12 +121,11 @@ class TiffReader {
          * Reads a subfile by strips.
          * @note This operation is not yet supported!
          * @tparam T Data type of a subfile component (i.e. pixel).
-         * @param tiff TIFF handle from libtiff.
-         * @param subfile_idx Index of the subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
          * @param arr_ptr image buffer where to write to.
          */
         template <typename T>
-        static void ReadSubfileByStrip(TIFF* tiff, uint16 subfile_idx, T* arr_ptr) {
+        static void ReadSubfileByStrip(TIFF* tiff, T* arr_ptr) {
             throw std::runtime_error("Reading a TIFF file by strips is not supported!");
         }
 
@@ -69,8 +133,7 @@ class TiffReader {
          * Reads a region of a subfile by strips.
          * @note This operation is not yet supported!
          * @tparam T Data type of a subfile component (i.e. pixel).
-         * @param tiff TIFF handle from libtiff.
-         * @param subfile_idx Index of the subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
          * @param arr_ptr image buffer where to write to.
          * @param x1 Upper left x-coordinate (incl).
          * @param y1 Upper left y-coordinate (incl).
@@ -79,7 +142,7 @@ class TiffReader {
          */
         template <typename T>
         static void ReadSubfileRegionByStrip(
-            TIFF* tiff, uint16 subfile_idx, T* arr_ptr,
+            TIFF* tiff, T* arr_ptr,
             uint32 x1, uint32 y1, uint32 x2, uint32 y2
         ) {
             throw std::runtime_error("Reading a TIFF file by strips is not supported!");
@@ -88,27 +151,33 @@ class TiffReader {
         /**
          * Reads a subfile by tiles.
          * @tparam T Data type of a subfile component (i.e. pixel).
-         * @param tiff TIFF handle from libtiff.
-         * @param subfile_idx Index of the subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
          * @param arr_ptr image buffer where to write to.
+         * @return Number of bytes read straight into the image buffer (see ReadSubfileRegionByTile())
          */
         template <typename T>
-        static void ReadSubfileByTile(TIFF* tiff, uint16 subfile_idx, T* arr_ptr);
+        static uint64 ReadSubfileByTile(TIFF* tiff, T* arr_ptr);
 
         /**
          * Reads a region of a subfile by tiles.
+         * Interior tiles, which cover whole tile rows of the region, skip
+         * the intermediate tile buffer: uncompressed tiles of a handle
+         * opened by a TiffFileStream are read from the file straight into
+         * the region, and tiles whose rows are contiguous within the region
+         * are decoded into it. Other tiles are decoded into a buffer of the
+         * calling thread and copied.
          * @tparam T Data type of a subfile component (i.e. pixel).
-         * @param tiff TIFF handle from libtiff.
-         * @param subfile_idx Index of the subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
          * @param arr_ptr image buffer where to write to.
          * @param x1 Upper left x-coordinate (incl).
          * @param y1 Upper left y-coordinate (incl).
          * @param x2 Lower right x-coordinate (excl).
          * @param y2 Lower right y-coordinate (excl).
+         * @return Number of bytes read straight into the image buffer, i.e. the copies saved
          */
         template <typename T>
-        static void ReadSubfileRegionByTile(
-            TIFF* tiff, uint16 subfile_idx, T* arr_ptr,
+        static uint64 ReadSubfileRegionByTile(
+            TIFF* tiff, T* arr_ptr,
             uint32 x1, uint32 y1, uint32 x2, uint32 y2
         );
 };
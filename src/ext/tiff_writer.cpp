@@ -1,7 +1,7 @@
 #include "tiff_writer.h"
 
 
-char TiffWriter::errorBuffer_[] = {};
+thread_local char TiffWriter::errorBuffer_[] = {};
 
 void TiffWriter::ErrorHandler(
     const char* module, const char* format, va_list args
@@ -9,15 +9,264 @@ void TiffWriter::ErrorHandler(
     vsnprintf(errorBuffer_, 1024, format, args);
 }
 
+TiffWriter::ChunkFormat TiffWriter::GetChunkFormat(TIFF* tiff) {
+    ChunkFormat format;
+    format.tiled = TIFFIsTiled(tiff);
+
+    uint32 rows_per_strip;
+    if (format.tiled) {
+        if (!TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &format.width))
+            throw std::runtime_error("Missing field 'TileWidth'!");
+        if (!TIFFGetField(tiff, TIFFTAG_TILELENGTH, &format.length))
+            throw std::runtime_error("Missing field 'TileLength'!");
+    } else {
+        if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &format.width))
+            throw std::runtime_error("Missing field 'ImageWidth'!");
+        if (!TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &format.length))
+            throw std::runtime_error("Missing field 'ImageLength'!");
+        if (TIFFGetField(tiff, TIFFTAG_ROWSPERSTRIP, &rows_per_strip))
+            format.length = std::min(format.length, rows_per_strip);
+    }
+    if (!TIFFGetField(tiff, TIFFTAG_BITSPERSAMPLE, &format.bits_per_sample))
+        format.bits_per_sample = 1;  // default
+    if (!TIFFGetField(tiff, TIFFTAG_SAMPLESPERPIXEL, &format.samples_per_pixel))
+        format.samples_per_pixel = 1;  // default
+    if (!TIFFGetField(tiff, TIFFTAG_COMPRESSION, &format.compression))
+        format.compression = 1;  // default
+    if (!TIFFGetField(tiff, TIFFTAG_PHOTOMETRIC, &format.photometric))
+        format.photometric = 1;  // min is black
+    if (!TIFFGetField(tiff, TIFFTAG_PLANARCONFIG, &format.planar_config))
+        format.planar_config = 1;  // default
+    if (!TIFFGetField(tiff, TIFFTAG_SAMPLEFORMAT, &format.sample_format))
+        format.sample_format = 1;  // default
+    if (format.compression == COMPRESSION_NONE || !TIFFGetField(tiff, TIFFTAG_PREDICTOR, &format.predictor))
+        format.predictor = 1;  // default
+    format.big_endian = TIFFIsBigEndian(tiff);
+
+    return format;
+}
+
+bool TiffWriter::IsSelfContainedCompression(uint16 compression) {
+    switch (compression) {
+        case COMPRESSION_NONE:
+        case COMPRESSION_LZW:
+        case COMPRESSION_ADOBE_DEFLATE:
+        case COMPRESSION_DEFLATE:
+        case COMPRESSION_PACKBITS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void TiffWriter::EncodeChunk(const ChunkFormat& format, void* chunk_ptr, std::vector<uint8>& encoded) {
+    TiffMemoryStream stream;
+    TIFF* tiff = stream.Open(format.big_endian ? "wb" : "wl");
+    if (tiff == nullptr)
+        throw std::runtime_error("Could not open in-memory TIFF file!");
+
+    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, format.width);
+    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, format.length);
+    TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, format.bits_per_sample);
+    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, format.samples_per_pixel);
+    TIFFSetField(tiff, TIFFTAG_COMPRESSION, format.compression);
+    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, format.photometric);
+    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, format.planar_config);
+    TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, format.sample_format);
+    if (format.predictor != 1)
+        TIFFSetField(tiff, TIFFTAG_PREDICTOR, format.predictor);
+
+    tmsize_t result;
+    uint64* offsets = nullptr;
+    uint64* byte_counts = nullptr;
+    if (format.tiled) {
+        TIFFSetField(tiff, TIFFTAG_TILEWIDTH, format.width);
+        TIFFSetField(tiff, TIFFTAG_TILELENGTH, format.length);
+        result = TIFFWriteEncodedTile(tiff, 0, chunk_ptr, TIFFTileSize(tiff));
+        TIFFGetField(tiff, TIFFTAG_TILEOFFSETS, &offsets);
+        TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &byte_counts);
+    } else {
+        TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, format.length);
+        result = TIFFWriteEncodedStrip(tiff, 0, chunk_ptr, TIFFStripSize(tiff));
+        TIFFGetField(tiff, TIFFTAG_STRIPOFFSETS, &offsets);
+        TIFFGetField(tiff, TIFFTAG_STRIPBYTECOUNTS, &byte_counts);
+    }
+
+    if (result < 0 || offsets == nullptr || byte_counts == nullptr) {
+        TIFFClose(tiff);
+        throw std::runtime_error("Error while encoding a chunk!");
+    }
+
+    std::vector<uint8>& buffer = stream.GetBuffer();
+    encoded.assign(
+        buffer.begin() + offsets[0],
+        buffer.begin() + offsets[0] + byte_counts[0]
+    );
+
+    TIFFClose(tiff);
+}
+
+uint64 TiffWriter::ReplaceChunk(int fd, TiffDirectory& directory, uint32 chunk_idx, const std::vector<uint8>& encoded) {
+    uint16 offsets_tag = TIFFTAG_TILEOFFSETS;
+    uint16 byte_counts_tag = TIFFTAG_TILEBYTECOUNTS;
+    if (!directory.HasEntry(offsets_tag)) {
+        offsets_tag = TIFFTAG_STRIPOFFSETS;
+        byte_counts_tag = TIFFTAG_STRIPBYTECOUNTS;
+    }
+
+    // the entries are validated before the file is modified
+    const TiffDirectory::Entry& offsets_entry = directory.GetEntry(offsets_tag);
+    const TiffDirectory::Entry& byte_counts_entry = directory.GetEntry(byte_counts_tag);
+    if (chunk_idx >= offsets_entry.count || chunk_idx >= byte_counts_entry.count)
+        throw std::out_of_range("Chunk index out of range!");
+
+    // chunks are appended at word boundaries
+    uint64 offset = get_file_size(fd);
+    offset += offset & 1;
+    const uint64 end = offset + encoded.size();
+    for (const TiffDirectory::Entry* entry: {&offsets_entry, &byte_counts_entry}) {
+        const uint8 size = TiffDirectory::GetTypeSize(entry->type);
+        if (size < 8 && (end >> (8 * size)) != 0)
+            throw std::runtime_error(
+                "Chunk at offset " + std::to_string(offset) + " exceeds the field type of tag '" +
+                std::to_string(entry->tag) + "'!"
+            );
+    }
+    write_at(fd, encoded.data(), encoded.size(), offset);
+
+    directory.SetValue(offsets_tag, chunk_idx, offset);
+    directory.SetValue(byte_counts_tag, chunk_idx, encoded.size());
+
+    return offset;
+}
+
+uint64 TiffWriter::CopyDirectory(int in_fd, int out_fd, uint64 offset, std::map<uint64, uint64>& copied) {
+    // an IFD is copied along with the IFDs chained to it
+    uint64 first_offset = 0;
+    uint64 previous_offset = 0;
+    while (offset != 0) {
+        auto it = copied.find(offset);
+        uint64 new_offset = (it != copied.end()) ? it->second : 0;
+        uint64 next_offset = 0;
+
+        if (new_offset == 0) {
+            TiffDirectory directory(in_fd, offset);
+            std::map<uint16, std::vector<uint64>> values;
+
+            // IFDs referred to by this IFD are copied first
+            for (uint16 tag: {TIFFTAG_SUBIFD, TIFFTAG_EXIFIFD, TIFFTAG_GPSIFD, TIFFTAG_INTEROPERABILITYIFD}) {
+                if (!directory.HasEntry(tag))
+                    continue;
+                std::vector<uint64> offsets = directory.GetValues(tag);
+                for (uint64& sub_offset: offsets)
+                    sub_offset = CopyDirectory(in_fd, out_fd, sub_offset, copied);
+                values[tag] = offsets;
+            }
+
+            // chunks are copied as raw data in the order of their index
+            std::vector<uint8> chunk;
+            for (auto tags: {
+                std::make_pair(TIFFTAG_TILEOFFSETS, TIFFTAG_TILEBYTECOUNTS),
+                std::make_pair(TIFFTAG_STRIPOFFSETS, TIFFTAG_STRIPBYTECOUNTS)
+            }) {
+                if (!directory.HasEntry(tags.first) || !directory.HasEntry(tags.second))
+                    continue;
+                std::vector<uint64> offsets = directory.GetValues(tags.first);
+                std::vector<uint64> byte_counts = directory.GetValues(tags.second);
+                for (size_t chunk_idx = 0; chunk_idx < offsets.size() && chunk_idx < byte_counts.size(); chunk_idx++) {
+                    if (byte_counts[chunk_idx] == 0)
+                        continue;  // sparse chunk
+                    chunk.resize(byte_counts[chunk_idx]);
+                    read_at(in_fd, chunk.data(), chunk.size(), offsets[chunk_idx]);
+                    offsets[chunk_idx] = get_file_size(out_fd);
+                    offsets[chunk_idx] += offsets[chunk_idx] & 1;
+                    write_at(out_fd, chunk.data(), chunk.size(), offsets[chunk_idx]);
+                }
+                values[tags.first] = offsets;
+            }
+
+            new_offset = directory.CopyTo(out_fd, values);
+            copied[offset] = new_offset;
+            next_offset = directory.GetNextOffset();
+        }
+
+        if (previous_offset == 0) {
+            first_offset = new_offset;
+        } else {
+            TiffDirectory previous_directory(out_fd, previous_offset);
+            previous_directory.SetNextOffset(new_offset);
+        }
+        previous_offset = new_offset;
+        offset = next_offset;
+    }
+    return first_offset;
+}
+
+void TiffWriter::CompactFile(int in_fd, int out_fd) {
+    uint8 header[16];
+    read_at(in_fd, header, 8, 0);
+    const bool big_tiff = (header[2] == 43) || (header[3] == 43);
+    if (big_tiff)
+        read_at(in_fd, &header[8], 8, 8);
+    write_at(out_fd, header, big_tiff ? 16 : 8, 0);
+
+    std::map<uint64, uint64> copied;
+    uint64 first_offset = CopyDirectory(in_fd, out_fd, TiffDirectory::GetFirstOffset(in_fd), copied);
+    TiffDirectory::SetFirstOffset(out_fd, first_offset);
+}
+
+
+void TiffWriter::CheckRegion(
+    TIFF* tiff, uint16 sample_size,
+    uint32 x1, uint32 y1, uint32 x2, uint32 y2
+) {
+    uint32 image_width, image_length;
+    uint16 bits_per_sample, planar_config;
+    if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &image_width))
+        throw std::runtime_error("Missing field 'ImageWidth'!");
+    if (!TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &image_length))
+        throw std::runtime_error("Missing field 'ImageLength'!");
+    if (!TIFFGetField(tiff, TIFFTAG_BITSPERSAMPLE, &bits_per_sample))
+        bits_per_sample = 1;  // default
+    if (!TIFFGetField(tiff, TIFFTAG_PLANARCONFIG, &planar_config))
+        planar_config = 1;  // default
+
+    if (planar_config != PLANARCONFIG_CONTIG)
+        throw std::runtime_error(
+            "Found unsupported planar configuration '" + std::to_string(planar_config) + "'!"
+        );
+    if (bits_per_sample != 8 * sample_size)
+        throw std::runtime_error(
+            "The region data does not match field 'BitsPerSample' (" + std::to_string(bits_per_sample) + ")!"
+        );
+
+    if (image_length < y2)
+        throw std::runtime_error("y2 out of range!");
+    if (image_width < x2)
+        throw std::runtime_error("x2 out of range!");
+    if (x1 >= x2 || y1 >= y2)
+        throw std::runtime_error("Invalid crop dimensions defined!");
+}
+
+template <typename T>
+void TiffWriter::WriteSamplesAt(
+    int fd, bool swapped, const T* samples_ptr, size_t sample_count,
+    uint64 offset, std::vector<T>& buffer
+) {
+    if (swapped && sizeof(T) == 2) {
+        buffer.assign(samples_ptr, samples_ptr + sample_count);
+        TIFFSwabArrayOfShort(reinterpret_cast<uint16*>(buffer.data()), sample_count);
+        samples_ptr = buffer.data();
+    }
+    write_at(fd, samples_ptr, sample_count * sizeof(T), offset);
+}
 
 template <typename T>
 void TiffWriter::WriteSubfileByScanline(
-    TIFF* tiff, uint16 subfile_idx, T* arr_ptr
+    TIFF* tiff, T* arr_ptr
 ) {
     TIFFSetErrorHandler(ErrorHandler);
 
-    TIFFSetDirectory(tiff, subfile_idx);
-
     uint32 image_width, image_length;
     uint16 samples_per_pixel, planar_config;
     if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &image_width))
@@ -35,7 +284,7 @@ void TiffWriter::WriteSubfileByScanline(
         );
 
     for (uint32 img_row = 0; img_row < image_length; img_row++) {
-        if (TIFFWriteScanline(tiff, &arr_ptr[(img_row * image_width) * samples_per_pixel], img_row) < 0) {
+        if (TIFFWriteScanline(tiff, &arr_ptr[(uint64(img_row) * image_width) * samples_per_pixel], img_row) < 0) {
             throw std::runtime_error(
                 "Error while writing image row '" + std::to_string(img_row) + "'!\n" +
                 std::string(errorBuffer_)
@@ -44,10 +293,130 @@ void TiffWriter::WriteSubfileByScanline(
     }
 }
 
+template <typename T>
+void TiffWriter::ReplaceRegionStrips(
+    TIFF* tiff, int fd, T* arr_ptr,
+    uint32 x1, uint32 y1, uint32 x2, uint32 y2
+) {
+    ChunkFormat format = GetChunkFormat(tiff);
+    if (!IsSelfContainedCompression(format.compression))
+        throw std::runtime_error(
+            "Found unsupported compression '" + std::to_string(format.compression) + "'!\n"
+            "Only strips of self-contained compression schemes can be replaced."
+        );
+
+    uint32 image_width, image_length;
+    TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &image_width);
+    TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &image_length);
+
+    const uint32 rows_per_strip = format.length;
+    const uint16 samples_per_pixel = format.samples_per_pixel;
+    const uint64 row_size = uint64(image_width) * samples_per_pixel;
+    const uint64 arr_row_size = uint64(x2 - x1) * samples_per_pixel;
+
+    TiffDirectory directory(fd, TIFFCurrentDirOffset(tiff));
+    BufferPool::Buffer buffer = BufferPool::Acquire(TIFFStripSize(tiff));
+    T* strip_ptr = buffer.GetData<T>();
+    std::vector<uint8> encoded;
+
+    for (uint32 img_row = y1 - (y1 % rows_per_strip); img_row < y2; img_row += rows_per_strip) {
+        uint32 strip_idx = TIFFComputeStrip(tiff, img_row, 0);
+        uint32 row_begin = std::max(y1, img_row);
+        uint32 row_end = std::min<uint64>(y2, uint64(img_row) + rows_per_strip);
+
+        // the last strip holds the remaining rows only
+        format.length = std::min<uint64>(rows_per_strip, image_length - img_row);
+
+        // a strip which is covered by the region is not decoded
+        bool covered = (
+            x1 == 0 && x2 == image_width &&
+            row_begin == img_row && row_end == img_row + format.length
+        );
+        if (!covered && TIFFReadEncodedStrip(tiff, strip_idx, buffer.GetData(), buffer.GetSize()) < 0) {
+            throw std::runtime_error(
+                "Error while reading image strip '" + std::to_string(strip_idx) + "'!\n" +
+                std::string(errorBuffer_)
+            );
+        }
+
+        for (uint32 row = row_begin; row < row_end; row++) {
+            std::memcpy(
+                &strip_ptr[(row - img_row) * row_size + uint64(x1) * samples_per_pixel],
+                &arr_ptr[(row - y1) * arr_row_size],
+                arr_row_size * sizeof(T)
+            );
+        }
+
+        EncodeChunk(format, buffer.GetData(), encoded);
+        ReplaceChunk(fd, directory, strip_idx, encoded);
+    }
+}
+
+template <typename T>
+void TiffWriter::WriteSubfileRegionByScanline(
+    TIFF* tiff, int fd, T* arr_ptr,
+    uint32 x1, uint32 y1, uint32 x2, uint32 y2
+) {
+    TIFFSetErrorHandler(ErrorHandler);
+
+    CheckRegion(tiff, sizeof(T), x1, y1, x2, y2);
+
+    uint16 compression;
+    if (!TIFFGetField(tiff, TIFFTAG_COMPRESSION, &compression))
+        compression = 1;  // default
+    if (compression != COMPRESSION_NONE) {
+        ReplaceRegionStrips<T>(tiff, fd, arr_ptr, x1, y1, x2, y2);
+        return;
+    }
+
+    uint32 image_width, image_length, rows_per_strip;
+    uint16 samples_per_pixel;
+    uint64* strip_offsets = nullptr;
+    uint64* strip_byte_counts = nullptr;
+    TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &image_width);
+    TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &image_length);
+    if (!TIFFGetField(tiff, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel))
+        samples_per_pixel = 1;  // default
+    if (!TIFFGetField(tiff, TIFFTAG_ROWSPERSTRIP, &rows_per_strip) || rows_per_strip > image_length)
+        rows_per_strip = image_length;  // default: a single strip
+    if (!TIFFGetField(tiff, TIFFTAG_STRIPOFFSETS, &strip_offsets))
+        throw std::runtime_error("Missing field 'StripOffsets'!");
+    if (!TIFFGetField(tiff, TIFFTAG_STRIPBYTECOUNTS, &strip_byte_counts))
+        throw std::runtime_error("Missing field 'StripByteCounts'!");
+
+    const bool swapped = TIFFIsByteSwapped(tiff);
+    const uint64 row_size = uint64(image_width) * samples_per_pixel;
+    const uint64 arr_row_size = uint64(x2 - x1) * samples_per_pixel;
+
+    // rows spanning the full image width are contiguous within a strip.
+    // Thus, they are written at once.
+    const bool full_rows = (x1 == 0) && (x2 == image_width);
+
+    std::vector<T> buffer;
+    uint32 img_row = y1;
+    while (img_row < y2) {
+        uint32 strip_idx = img_row / rows_per_strip;
+        uint32 strip_row = img_row % rows_per_strip;
+        uint32 row_count = full_rows ? std::min(rows_per_strip - strip_row, y2 - img_row) : 1;
+
+        uint64 position = (strip_row * row_size + uint64(x1) * samples_per_pixel) * sizeof(T);
+        uint64 size = ((row_count - 1) * row_size + arr_row_size) * sizeof(T);
+        if (strip_byte_counts[strip_idx] < position + size)
+            throw std::runtime_error("Strip '" + std::to_string(strip_idx) + "' is incomplete!");
+
+        WriteSamplesAt<T>(
+            fd, swapped, &arr_ptr[(img_row - y1) * arr_row_size],
+            (row_count - 1) * row_size + arr_row_size,
+            strip_offsets[strip_idx] + position, buffer
+        );
+        img_row += row_count;
+    }
+}
+
 template <typename T>
 void TiffWriter::_WriteSubfileRegionByScanline(
     std::string in_file_path, std::string out_file_path,
-    uint8 version, uint16 subfile_idx, T* arr_ptr,
+    uint8 version, uint32 subfile_idx, T* arr_ptr,
     uint32 x1, uint32 y1, uint32 x2, uint32 y2
 ) {
     TIFFSetErrorHandler(ErrorHandler);
@@ -108,7 +477,8 @@ void TiffWriter::_WriteSubfileRegionByScanline(
 
     uint32 arr_width = x2 - x1;
 
-    T* buffer = (T*) _TIFFmalloc(TIFFScanlineSize(tiff_r));
+    BufferPool::Buffer scanline = BufferPool::Acquire(TIFFScanlineSize(tiff_r));
+    T* buffer = scanline.GetData<T>();
     for (uint32 img_row = 0; img_row < image_length; img_row++) {
         if (TIFFReadScanline(tiff_r, buffer, img_row) < 0) {
             throw std::runtime_error(
@@ -119,12 +489,12 @@ void TiffWriter::_WriteSubfileRegionByScanline(
 
         if (y1 <= img_row && img_row < y2) {
             std::memcpy(
-                &buffer[x1 * samples_per_pixel],
+                &buffer[uint64(x1) * samples_per_pixel],
                 &arr_ptr[
-                    ((img_row - y1) * arr_width) *
+                    (uint64(img_row - y1) * arr_width) *
                     samples_per_pixel
                 ],
-                arr_width * samples_per_pixel * (bits_per_sample / 8)
+                uint64(arr_width) * samples_per_pixel * (bits_per_sample / 8)
             );
         }
 
@@ -135,19 +505,16 @@ void TiffWriter::_WriteSubfileRegionByScanline(
             );
         }
     }
-    _TIFFfree(buffer);
     TIFFClose(tiff_r);
     TIFFClose(tiff_w);
 }
 
 template <typename T>
 void TiffWriter::WriteSubfileByTile(
-    TIFF* tiff, uint16 subfile_idx, T* arr_ptr
+    TIFF* tiff, T* arr_ptr
 ) {
     TIFFSetErrorHandler(ErrorHandler);
 
-    TIFFSetDirectory(tiff, subfile_idx);
-
     uint32 image_width, image_length;
     uint16 samples_per_pixel, bits_per_sample;
     uint32 tile_width, tile_length, tile_size;
@@ -168,7 +535,8 @@ void TiffWriter::WriteSubfileByTile(
         throw std::runtime_error("The fields 'TileLength' and 'TileWidth' must have the same value!");
     tile_size = tile_length;
 
-    T* buffer = (T*) _TIFFmalloc(TIFFTileSize(tiff));
+    BufferPool::Buffer tile_buffer = BufferPool::Acquire(TIFFTileSize(tiff));
+    T* buffer = tile_buffer.GetData<T>();
 
     for (uint32 img_row = 0; img_row < image_length; img_row += tile_size) {
         for (uint32 img_column = 0; img_column < image_width; img_column += tile_size) {
@@ -181,10 +549,10 @@ void TiffWriter::WriteSubfileByTile(
             ) {
                 std::memcpy(
                     &buffer[
-                        (tile_row * tile_size) * samples_per_pixel
+                        (uint64(tile_row) * tile_size) * samples_per_pixel
                     ],
                     &arr_ptr[
-                        ((img_row + tile_row) * image_width + img_column) * samples_per_pixel
+                        (uint64(img_row + tile_row) * image_width + img_column) * samples_per_pixel
                     ],
                     pixels_to_copy * samples_per_pixel * (bits_per_sample / 8)
                 );
@@ -198,13 +566,154 @@ void TiffWriter::WriteSubfileByTile(
             }
         }
     }
-    _TIFFfree(buffer);
+}
+
+template <typename T>
+void TiffWriter::ReplaceRegionTiles(
+    TIFF* tiff, int fd, T* arr_ptr,
+    uint32 x1, uint32 y1, uint32 x2, uint32 y2
+) {
+    ChunkFormat format = GetChunkFormat(tiff);
+    if (!IsSelfContainedCompression(format.compression))
+        throw std::runtime_error(
+            "Found unsupported compression '" + std::to_string(format.compression) + "'!\n"
+            "Only tiles of self-contained compression schemes can be replaced."
+        );
+
+    uint32 image_width, image_length;
+    TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &image_width);
+    TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &image_length);
+
+    const uint32 tile_width = format.width;
+    const uint32 tile_length = format.length;
+    const uint16 samples_per_pixel = format.samples_per_pixel;
+    const uint64 arr_row_size = uint64(x2 - x1) * samples_per_pixel;
+
+    TiffDirectory directory(fd, TIFFCurrentDirOffset(tiff));
+    BufferPool::Buffer buffer = BufferPool::Acquire(TIFFTileSize(tiff));
+    T* tile_ptr = buffer.GetData<T>();
+    std::vector<uint8> encoded;
+
+    for (uint32 img_row = y1 - (y1 % tile_length); img_row < y2; img_row += tile_length) {
+        for (uint32 img_column = x1 - (x1 % tile_width); img_column < x2; img_column += tile_width) {
+            uint32 tile_idx = TIFFComputeTile(tiff, img_column, img_row, 0, 0);
+
+            uint32 column_begin = std::max(x1, img_column);
+            uint32 column_end = std::min<uint64>(x2, uint64(img_column) + tile_width);
+            uint32 row_begin = std::max(y1, img_row);
+            uint32 row_end = std::min<uint64>(y2, uint64(img_row) + tile_length);
+
+            // a tile which is covered by the region within the image is not decoded
+            bool covered = (
+                column_begin == img_column && row_begin == img_row &&
+                column_end == std::min<uint64>(image_width, uint64(img_column) + tile_width) &&
+                row_end == std::min<uint64>(image_length, uint64(img_row) + tile_length)
+            );
+            if (covered) {
+                std::memset(buffer.GetData(), 0, buffer.GetSize());
+            } else if (TIFFReadEncodedTile(tiff, tile_idx, buffer.GetData(), buffer.GetSize()) < 0) {
+                throw std::runtime_error(
+                    "Error while reading image tile (" + std::to_string(img_column) + ", " + std::to_string(img_row) + ")!\n" +
+                    std::string(errorBuffer_)
+                );
+            }
+
+            for (uint32 row = row_begin; row < row_end; row++) {
+                std::memcpy(
+                    &tile_ptr[(uint64(row - img_row) * tile_width + (column_begin - img_column)) * samples_per_pixel],
+                    &arr_ptr[(row - y1) * arr_row_size + uint64(column_begin - x1) * samples_per_pixel],
+                    uint64(column_end - column_begin) * samples_per_pixel * sizeof(T)
+                );
+            }
+
+            EncodeChunk(format, buffer.GetData(), encoded);
+            ReplaceChunk(fd, directory, tile_idx, encoded);
+        }
+    }
+}
+
+template <typename T>
+void TiffWriter::WriteSubfileRegionByTile(
+    TIFF* tiff, int fd, T* arr_ptr,
+    uint32 x1, uint32 y1, uint32 x2, uint32 y2
+) {
+    TIFFSetErrorHandler(ErrorHandler);
+
+    CheckRegion(tiff, sizeof(T), x1, y1, x2, y2);
+
+    uint16 compression;
+    if (!TIFFGetField(tiff, TIFFTAG_COMPRESSION, &compression))
+        compression = 1;  // default
+    if (compression != COMPRESSION_NONE) {
+        ReplaceRegionTiles<T>(tiff, fd, arr_ptr, x1, y1, x2, y2);
+        return;
+    }
+
+    uint32 tile_width, tile_length;
+    uint16 samples_per_pixel;
+    uint64* tile_offsets = nullptr;
+    uint64* tile_byte_counts = nullptr;
+    if (!TIFFGetField(tiff, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel))
+        samples_per_pixel = 1;  // default
+    if(!TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &tile_width))
+        throw std::runtime_error("Missing field 'TileWidth'!");
+    if(!TIFFGetField(tiff, TIFFTAG_TILELENGTH, &tile_length))
+        throw std::runtime_error("Missing field 'TileLength'!");
+    if (!TIFFGetField(tiff, TIFFTAG_TILEOFFSETS, &tile_offsets))
+        throw std::runtime_error("Missing field 'TileOffsets'!");
+    if (!TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &tile_byte_counts))
+        throw std::runtime_error("Missing field 'TileByteCounts'!");
+
+    const bool swapped = TIFFIsByteSwapped(tiff);
+    const uint64 tile_row_size = uint64(tile_width) * samples_per_pixel;
+    const uint64 arr_row_size = uint64(x2 - x1) * samples_per_pixel;
+    const uint64 tile_size = tile_row_size * tile_length * sizeof(T);
+
+    std::vector<T> buffer;
+    std::vector<T> rows;
+    for (uint32 img_row = y1 - (y1 % tile_length); img_row < y2; img_row += tile_length) {
+        for (uint32 img_column = x1 - (x1 % tile_width); img_column < x2; img_column += tile_width) {
+            uint32 tile_idx = TIFFComputeTile(tiff, img_column, img_row, 0, 0);
+            if (tile_byte_counts[tile_idx] < tile_size)
+                throw std::runtime_error("Tile '" + std::to_string(tile_idx) + "' is incomplete!");
+
+            uint32 column_begin = std::max(x1, img_column);
+            uint32 column_end = std::min<uint64>(x2, uint64(img_column) + tile_width);
+            uint32 row_begin = std::max(y1, img_row);
+            uint32 row_end = std::min<uint64>(y2, uint64(img_row) + tile_length);
+            uint64 sample_count = uint64(column_end - column_begin) * samples_per_pixel;
+            uint64 position = tile_offsets[tile_idx] + (
+                (row_begin - img_row) * tile_row_size + uint64(column_begin - img_column) * samples_per_pixel
+            ) * sizeof(T);
+
+            if (sample_count == tile_row_size) {
+                // the rows span the full tile width and are written at once
+                rows.resize(sample_count * (row_end - row_begin));
+                for (uint32 row = row_begin; row < row_end; row++) {
+                    std::memcpy(
+                        &rows[(row - row_begin) * sample_count],
+                        &arr_ptr[(row - y1) * arr_row_size + uint64(column_begin - x1) * samples_per_pixel],
+                        sample_count * sizeof(T)
+                    );
+                }
+                WriteSamplesAt<T>(fd, swapped, rows.data(), rows.size(), position, buffer);
+            } else {
+                for (uint32 row = row_begin; row < row_end; row++) {
+                    WriteSamplesAt<T>(
+                        fd, swapped,
+                        &arr_ptr[(row - y1) * arr_row_size + uint64(column_begin - x1) * samples_per_pixel],
+                        sample_count, position + (row - row_begin) * tile_row_size * sizeof(T), buffer
+                    );
+                }
+            }
+        }
+    }
 }
 
 template <typename T>
 void TiffWriter::_WriteSubfileRegionByTile(
     std::string in_file_path, std::string out_file_path,
-    uint8 version, uint16 subfile_idx,
+    uint8 version, uint32 subfile_idx,
     T* arr_ptr,
     uint32 x1, uint32 y1, uint32 x2, uint32 y2
 ) {
@@ -276,7 +785,8 @@ void TiffWriter::_WriteSubfileRegionByTile(
 
     uint32 arr_width = x2 - x1;
 
-    T* buffer = (T*) _TIFFmalloc(TIFFTileSize(tiff_r));
+    BufferPool::Buffer tile_buffer = BufferPool::Acquire(TIFFTileSize(tiff_r));
+    T* buffer = tile_buffer.GetData<T>();
 
     for (uint32 img_row = 0; img_row < image_length; img_row += tile_size) {
         for (uint32 img_column = 0; img_column < image_width; img_column += tile_size) {
@@ -292,21 +802,22 @@ void TiffWriter::_WriteSubfileRegionByTile(
                 (img_x1_aligned <= img_column && img_column < img_x2_aligned)
             ) {
                 uint32 pixels_to_copy = min(
-                    tile_size, min((img_column + tile_size) - x1, x2 - img_column)
+                    tile_size, min((uint64(img_column) + tile_size) - x1, x2 - img_column)
                 );
 
-                uint32 buffer_row, arr_row;
+                uint32 buffer_row;
+                uint64 arr_row;
                 for (
-                    buffer_row = max(0, y1 - img_row), arr_row = max(0, img_row - y1);
+                    buffer_row = max(0, int64_t(y1) - img_row), arr_row = max(0, int64_t(img_row) - y1);
                     buffer_row < (uint32) min(tile_size, y2 - img_row);
                     buffer_row++, arr_row++
                 ) {
                     std::memcpy(
                         &buffer[
-                            (buffer_row * tile_size + max(0, x1 - img_column)) * samples_per_pixel
+                            (uint64(buffer_row) * tile_size + max(0, int64_t(x1) - img_column)) * samples_per_pixel
                         ],
                         &arr_ptr[
-                            (arr_row * arr_width + max(0, img_column - x1)) * samples_per_pixel
+                            (arr_row * arr_width + max(0, int64_t(img_column) - x1)) * samples_per_pixel
                         ],
                         pixels_to_copy * samples_per_pixel * (bits_per_sample / 8)
                     );
@@ -321,148 +832,362 @@ void TiffWriter::_WriteSubfileRegionByTile(
             }
         }
     }
-    _TIFFfree(buffer);
     TIFFClose(tiff_r);
     TIFFClose(tiff_w);
 }
 
-template <typename T, typename U>
-void TiffWriter::WriteScaledSubfileByTile(
-    TIFF* tiff, uint16 subfile_idx, T* arr_ptr, float sfactor
+template <typename T>
+void TiffWriter::WriteMultiscaleSubfileByTile(
+    TIFF* tiff, T* arr_ptr, float sfactor, const std::vector<uint32>& factors,
+    const std::function<void(uint32)>& set_level_tags, uint32 thread_count
 ) {
     TIFFSetErrorHandler(ErrorHandler);
 
-    TIFFSetDirectory(tiff, subfile_idx);
+    const uint32 level_count = factors.size() + 1;
+
+    set_level_tags(0);
 
     uint32 image_width, image_length;
-    uint16 samples_per_pixel, bits_per_sample;
-    uint32 tile_width, tile_length, tile_size;
+    uint32 tile_width, tile_length;
     if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &image_width))
         throw std::runtime_error("Missing field 'ImageWidth'!");
     if (!TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &image_length))
         throw std::runtime_error("Missing field 'ImageLength'!");
-    if (!TIFFGetField(tiff, TIFFTAG_BITSPERSAMPLE, &bits_per_sample))
-        bits_per_sample = 1;  // default
-    if (!TIFFGetField(tiff, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel))
-        samples_per_pixel = 1;  // default
     if(!TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &tile_width))
         throw std::runtime_error("Missing field 'TileWidth'!");
     if(!TIFFGetField(tiff, TIFFTAG_TILELENGTH, &tile_length))
         throw std::runtime_error("Missing field 'TileLength'!");
+    uint16 bits_per_sample, samples_per_pixel;
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_BITSPERSAMPLE, &bits_per_sample);
+    TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel);
+    if (bits_per_sample != 8)
+        throw std::runtime_error("Can only write 8-bit multi-scale TIFF subfiles!");
+    // the samples of a pixel are interleaved (PlanarConfiguration 1)
+    const uint32 samples = samples_per_pixel;
+    const uint32 bytes_per_pixel = samples * (bits_per_sample / 8);
 
-    if (tile_width != tile_length)
-        throw std::runtime_error("The fields 'TileLength' and 'TileWidth' must have the same value!");
-    tile_size = tile_length;
+    const ChunkFormat format = GetChunkFormat(tiff);
+    // other compression schemes are encoded by libtiff while writing
+    const bool encode_tiles = IsSelfContainedCompression(format.compression);
+    const tmsize_t tile_size = TIFFTileSize(tiff);
 
-    U* buffer = (U*) _TIFFmalloc(TIFFTileSize(tiff));
+    /**
+     * Structure for the state of a level.
+     */
+    struct Level {
+        uint32 width;                                   /**< Width of the level. */
+        uint32 length;                                  /**< Length of the level. */
+        uint32 factor;                                  /**< Downscale factor relative to the parent level. */
+        uint32 tiles_across;                            /**< Number of tiles in a row. */
+        uint32 tiles_down;                              /**< Number of tiles in a column. */
+        std::vector<uint8> pixels;                      /**< Pixels of the level. */
+        std::vector<std::vector<uint8>> tiles;          /**< Encoded (or raw) tiles of the level. */
+        std::unique_ptr<std::atomic<uint32>[]> pending; /**< Number of unfinished parent tiles per tile. */
+        uint32 done = 0;                                /**< Number of finished tiles. */
+    };
 
-    for (uint32 img_row = 0; img_row < image_length; img_row += tile_size) {
-        for (uint32 img_column = 0; img_column < image_width; img_column += tile_size) {
-            std::memset(buffer, 0, TIFFTileSize(tiff));
-            
-            for (uint32 tile_row=0; tile_row < static_cast<uint32>(min(tile_length, image_length - img_row)); tile_row++) {
-                for (uint32 tile_column=0; tile_column < static_cast<uint32>(min(tile_width, image_width - img_column)); tile_column++) {
-                    buffer[tile_row * tile_width + tile_column] = (U) (
-                        float(arr_ptr[(img_row + tile_row) * image_width + img_column + tile_column]) * sfactor
+    std::vector<Level> levels(level_count);
+    uint64 cumulative_factor = 1;
+    for (uint32 l = 0; l < level_count; l++) {
+        Level& level = levels[l];
+        level.factor = (l == 0) ? 1 : factors[l - 1];
+        cumulative_factor *= level.factor;
+        level.width = (l == 0) ? image_width : max(1, (image_width + 1) / cumulative_factor);
+        level.length = (l == 0) ? image_length : max(1, (image_length + 1) / cumulative_factor);
+        level.tiles_across = (level.width + tile_width - 1) / tile_width;
+        level.tiles_down = (level.length + tile_length - 1) / tile_length;
+        level.pixels.resize(static_cast<size_t>(level.width) * level.length * samples);
+        level.tiles.resize(level.tiles_across * level.tiles_down);
+        level.pending.reset(new std::atomic<uint32>[level.tiles.size()]);
+        for (uint32 tile_row = 0; tile_row < level.tiles_down; tile_row++) {
+            for (uint32 tile_column = 0; tile_column < level.tiles_across; tile_column++) {
+                uint32 parent_count = 0;
+                if (l > 0) {
+                    uint32 parent_rows = min(level.factor, levels[l - 1].tiles_down - level.factor * tile_row);
+                    uint32 parent_columns = min(level.factor, levels[l - 1].tiles_across - level.factor * tile_column);
+                    parent_count = parent_rows * parent_columns;
+                }
+                level.pending[tile_row * level.tiles_across + tile_column] = parent_count;
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable level_done;
+    std::exception_ptr error = nullptr;
+    std::atomic<bool> failed(false);
+
+    ThreadPool pool(thread_count);
+
+    std::function<void(uint32, uint32)> process_tile = [&](uint32 l, uint32 tile_idx) {
+        Level& level = levels[l];
+        if (!failed) {
+            try {
+                uint32 row = (tile_idx / level.tiles_across) * tile_length;
+                uint32 column = (tile_idx % level.tiles_across) * tile_width;
+                uint32 rows = min(tile_length, level.length - row);
+                uint32 columns = min(tile_width, level.width - column);
+
+                if (l == 0) {
+                    for (uint32 y = row; y < row + rows; y++) {
+                        const size_t first = (static_cast<size_t>(y) * level.width + column) * samples;
+                        for (size_t i = first; i < first + size_t(columns) * samples; i++)
+                            level.pixels[i] = (uint8) (float(arr_ptr[i]) * sfactor);
+                    }
+                } else if (samples == 1) {
+                    const Level& parent = levels[l - 1];
+                    const uint32 parent_row = row * level.factor, parent_column = column * level.factor;
+                    DownsampleBlock<uint8>(
+                        &parent.pixels[static_cast<size_t>(parent_row) * parent.width + parent_column],
+                        parent.width, parent.width - parent_column, parent.length - parent_row, level.factor,
+                        &level.pixels[static_cast<size_t>(row) * level.width + column], level.width,
+                        columns, rows
+                    );
+                } else {
+                    // the interleaved samples are downsampled plane by plane
+                    const Level& parent = levels[l - 1];
+                    const uint32 parent_row = row * level.factor, parent_column = column * level.factor;
+                    const uint32 parent_rows = min(rows * level.factor, parent.length - parent_row);
+                    const uint32 parent_columns = min(columns * level.factor, parent.width - parent_column);
+                    BufferPool::Buffer parent_plane = BufferPool::Acquire(size_t(parent_rows) * parent_columns);
+                    BufferPool::Buffer plane = BufferPool::Acquire(size_t(rows) * columns);
+                    for (uint32 sample = 0; sample < samples; sample++) {
+                        for (uint32 y = 0; y < parent_rows; y++) {
+                            const uint8* src = &parent.pixels[
+                                ((static_cast<size_t>(parent_row) + y) * parent.width + parent_column) * samples + sample
+                            ];
+                            for (uint32 x = 0; x < parent_columns; x++)
+                                parent_plane.GetData()[size_t(y) * parent_columns + x] = src[size_t(x) * samples];
+                        }
+                        DownsampleBlock<uint8>(
+                            parent_plane.GetData(), parent_columns, parent_columns, parent_rows, level.factor,
+                            plane.GetData(), columns, columns, rows
+                        );
+                        for (uint32 y = 0; y < rows; y++) {
+                            uint8* dst = &level.pixels[((static_cast<size_t>(row) + y) * level.width + column) * samples + sample];
+                            for (uint32 x = 0; x < columns; x++)
+                                dst[size_t(x) * samples] = plane.GetData()[size_t(y) * columns + x];
+                        }
+                    }
+                }
+
+                std::vector<uint8> tile(tile_size, 0);
+                for (uint32 tile_row = 0; tile_row < rows; tile_row++) {
+                    std::memcpy(
+                        &tile[static_cast<size_t>(tile_row) * tile_width * bytes_per_pixel],
+                        &level.pixels[(static_cast<size_t>(row + tile_row) * level.width + column) * samples],
+                        static_cast<size_t>(columns) * bytes_per_pixel
                     );
                 }
+
+                if (encode_tiles) {
+                    EncodeChunk(format, tile.data(), level.tiles[tile_idx]);
+                } else {
+                    level.tiles[tile_idx] = std::move(tile);
+                }
+            } catch (...) {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+                failed = true;
+            }
+        }
+
+        if (l + 1 < level_count) {
+            Level& child_level = levels[l + 1];
+            uint32 child_row = (tile_idx / level.tiles_across) / child_level.factor;
+            uint32 child_column = (tile_idx % level.tiles_across) / child_level.factor;
+            if (child_row < child_level.tiles_down && child_column < child_level.tiles_across) {
+                uint32 child_idx = child_row * child_level.tiles_across + child_column;
+                if (--child_level.pending[child_idx] == 0)
+                    pool.Submit([&process_tile, l, child_idx] { process_tile(l + 1, child_idx); });
             }
+        }
 
-            if (TIFFWriteTile(tiff, buffer, img_column, img_row, 0, 0) < 0) {
-                throw std::runtime_error(
-                    "Error while writing image tile (" + std::to_string(img_column) + ", " + std::to_string(img_row) + ")!\n" +
-                    std::string(errorBuffer_)
-                );
+        std::unique_lock<std::mutex> lock(mutex);
+        level.done += 1;
+        level_done.notify_all();
+    };
+
+    for (uint32 tile_idx = 0; tile_idx < levels[0].tiles.size(); tile_idx++)
+        pool.Submit([&process_tile, tile_idx] { process_tile(0, tile_idx); });
+
+    for (uint32 l = 0; l < level_count && !failed; l++) {
+        Level& level = levels[l];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            level_done.wait(lock, [&] { return failed || level.done == level.tiles.size(); });
+        }
+        if (failed)
+            break;
+
+        // all tiles of the level are done, so its parent level is no longer required
+        if (l > 0)
+            std::vector<uint8>().swap(levels[l - 1].pixels);
+        if (l + 1 == level_count)
+            std::vector<uint8>().swap(level.pixels);
+
+        try {
+            if (l > 0)
+                set_level_tags(l);
+
+            for (uint32 tile_idx = 0; tile_idx < level.tiles.size(); tile_idx++) {
+                std::vector<uint8>& tile = level.tiles[tile_idx];
+                tmsize_t result;
+                if (encode_tiles) {
+                    result = TIFFWriteRawTile(tiff, tile_idx, tile.data(), tile.size());
+                } else {
+                    result = TIFFWriteEncodedTile(tiff, tile_idx, tile.data(), tile.size());
+                }
+                if (result < 0) {
+                    throw std::runtime_error(
+                        "Error while writing image tile (" + std::to_string(tile_idx) + ") of level " + std::to_string(l) + "!\n" +
+                        std::string(errorBuffer_)
+                    );
+                }
+                std::vector<uint8>().swap(tile);
+            }
+
+            TIFFWriteDirectory(tiff);
+        } catch (...) {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+            failed = true;
+        }
+
+        // the level is released once it is written
+        std::vector<std::vector<uint8>>().swap(level.tiles);
+    }
+
+    pool.Wait();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+template <typename T, uint32 F>
+void TiffWriter::BoxKernel(
+    const T* src_ptr, size_t src_stride, uint32 src_columns, uint32 src_rows, uint32 factor,
+    T* dst_ptr, size_t dst_stride, uint32 columns, uint32 rows
+) {
+    const uint32 f = (F > 0) ? F : factor;
+    const uint64 area = f * f;
+    std::vector<uint64> sums(columns);
+    for (uint32 row = 0; row < rows; row++) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (uint32 j = 0; j < f; j++) {
+            const T* src_row = src_ptr + static_cast<uint32>(min(row * f + j, src_rows - 1)) * src_stride;
+            // boxes within the source block need no clamping of the columns
+            uint32 inner_columns = min(columns, src_columns / f);
+            for (uint32 column = 0; column < inner_columns; column++) {
+                const T* box = src_row + column * f;
+                uint64 sum = 0;
+                for (uint32 i = 0; i < f; i++)
+                    sum += box[i];
+                sums[column] += sum;
+            }
+            for (uint32 column = inner_columns; column < columns; column++) {
+                for (uint32 i = 0; i < f; i++)
+                    sums[column] += src_row[min(column * f + i, src_columns - 1)];
             }
         }
+        T* dst_row = dst_ptr + row * dst_stride;
+        for (uint32 column = 0; column < columns; column++)
+            dst_row[column] = static_cast<T>(sums[column] / area);
     }
-    _TIFFfree(buffer);
 }
 
 template <typename T>
-void TiffWriter::WriteDownsampledSubfileByTile(
-    TIFF* in_tiff, TIFF* out_tiff, uint16 in_subfile_idx, uint16 out_subfile_idx
+void TiffWriter::DownsampleBlock(
+    const T* src_ptr, size_t src_stride, uint32 src_columns, uint32 src_rows, uint32 factor,
+    T* dst_ptr, size_t dst_stride, uint32 columns, uint32 rows
 ) {
-    TIFFSetErrorHandler(ErrorHandler);
+    switch (factor) {
+        case 2:
+            BoxKernel<T, 2>(src_ptr, src_stride, src_columns, src_rows, factor, dst_ptr, dst_stride, columns, rows);
+            break;
+        case 4:
+            BoxKernel<T, 4>(src_ptr, src_stride, src_columns, src_rows, factor, dst_ptr, dst_stride, columns, rows);
+            break;
+        case 8:
+            BoxKernel<T, 8>(src_ptr, src_stride, src_columns, src_rows, factor, dst_ptr, dst_stride, columns, rows);
+            break;
+        default:
+            BoxKernel<T, 0>(src_ptr, src_stride, src_columns, src_rows, factor, dst_ptr, dst_stride, columns, rows);
+    }
+}
 
-    TIFFSetDirectory(in_tiff, in_subfile_idx);
-    TIFFSetDirectory(out_tiff, out_subfile_idx);
+template <typename T>
+void TiffWriter::DownsampleTile(TIFF* in_tiff, uint32 x, uint32 y, T* tile_ptr, uint32 factor) {
+    TIFFSetErrorHandler(ErrorHandler);
 
     uint32 image_width, image_length;
-    uint16 samples_per_pixel, bits_per_sample;
     uint32 tile_width, tile_length;
     if (!TIFFGetField(in_tiff, TIFFTAG_IMAGEWIDTH, &image_width))
         throw std::runtime_error("Missing field 'ImageWidth'!");
     if (!TIFFGetField(in_tiff, TIFFTAG_IMAGELENGTH, &image_length))
         throw std::runtime_error("Missing field 'ImageLength'!");
-    if (!TIFFGetField(in_tiff, TIFFTAG_BITSPERSAMPLE, &bits_per_sample))
-        bits_per_sample = 1;  // default
-    if (!TIFFGetField(in_tiff, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel))
-        samples_per_pixel = 1;  // default
     if(!TIFFGetField(in_tiff, TIFFTAG_TILEWIDTH, &tile_width))
         throw std::runtime_error("Missing field 'TileWidth'!");
     if(!TIFFGetField(in_tiff, TIFFTAG_TILELENGTH, &tile_length))
         throw std::runtime_error("Missing field 'TileLength'!");
 
-    uint32 out_image_width, out_image_length;
-    if (!TIFFGetField(out_tiff, TIFFTAG_IMAGEWIDTH, &out_image_width))
-        throw std::runtime_error("Missing field 'ImageWidth'!");
-    if (!TIFFGetField(out_tiff, TIFFTAG_IMAGELENGTH, &out_image_length))
-        throw std::runtime_error("Missing field 'ImageLength'!");
-
-    if (tile_width != tile_length)
-        throw std::runtime_error("The fields 'TileLength' and 'TileWidth' must have the same value!");
+    // parent region of factor x factor tiles, clipped to the parent subfile
+    const uint64 region_x = uint64(factor) * x, region_y = uint64(factor) * y;
+    if (region_x >= image_width || region_y >= image_length)
+        throw std::out_of_range("Tile (" + std::to_string(x) + ", " + std::to_string(y) + ") out of range!");
+    const uint32 region_width = std::min<uint64>(uint64(factor) * tile_width, image_width - region_x);
+    const uint32 region_length = std::min<uint64>(uint64(factor) * tile_length, image_length - region_y);
 
-    T* in_buffer = (T*) _TIFFmalloc(TIFFTileSize(in_tiff));
-    T* out_buffer = (T*) _TIFFmalloc(TIFFTileSize(out_tiff));
-
-    for (uint32 img_row=0; (img_row < image_length) & ((img_row >> 1) < out_image_length); img_row += tile_length * 2) {
-        for (uint32 img_column=0; (img_column < image_width) & ((img_column >> 1) < out_image_width); img_column += tile_width * 2) {
-            for (uint32 row_delta = 0; row_delta < 2 * tile_length && img_row + row_delta < image_length; row_delta += tile_length) {
-                for (uint32 column_delta = 0; column_delta < 2 * tile_width && img_column + column_delta < image_width; column_delta += tile_width) {
-                    std::memset(in_buffer, 255, TIFFTileSize(in_tiff));
-                    TIFFReadTile(in_tiff, in_buffer, img_column + column_delta, img_row + row_delta, 0, 0);
-                    for (uint32 y = 0; y < tile_length && img_row + row_delta + y < image_length; y += 2) {
-                        for (uint32 x = 0; x < tile_width && img_column + column_delta + x < image_width; x += 2) {
-                            uint32 i1 = in_buffer[y * tile_width + x];
-                            uint32 i2 = in_buffer[y * tile_width + x + 1];
-                            uint32 i3 = in_buffer[(y + 1) * tile_width + x];
-                            uint32 i4 = in_buffer[(y + 1) * tile_width + x + 1];
-                            out_buffer[
-                                ((y + row_delta) / 2) * tile_width + ((x + column_delta) / 2)
-                            ] = (
-                                (i1 + i2 + i3 + i4) / 4
-                            );
-                        }
-                    }
-                }
-            }
-            if (TIFFWriteTile(out_tiff, out_buffer, img_column / 2, img_row / 2, 0, 0) < 0) {
+    BufferPool::Buffer region_buffer = BufferPool::Acquire(sizeof(T) * region_width * region_length);
+    T* region = region_buffer.GetData<T>();
+    BufferPool::Buffer in_tile = BufferPool::Acquire(TIFFTileSize(in_tiff));
+    T* in_buffer = in_tile.GetData<T>();
+    for (uint32 row_delta = 0; row_delta < region_length; row_delta += tile_length) {
+        for (uint32 column_delta = 0; column_delta < region_width; column_delta += tile_width) {
+            if (TIFFReadTile(in_tiff, in_buffer, region_x + column_delta, region_y + row_delta, 0, 0) < 0) {
                 throw std::runtime_error(
-                    "Error while writing image tile (" + std::to_string(img_column) + "," + std::to_string(img_row) + ")!\n" +
+                    "Error while reading image tile (" + std::to_string(region_x + column_delta) + ", " + std::to_string(region_y + row_delta) + ")!\n" +
                     std::string(errorBuffer_)
                 );
             }
+            uint32 rows = min(tile_length, region_length - row_delta);
+            uint32 columns = min(tile_width, region_width - column_delta);
+            for (uint32 tile_row = 0; tile_row < rows; tile_row++) {
+                std::memcpy(
+                    &region[static_cast<size_t>(row_delta + tile_row) * region_width + column_delta],
+                    &in_buffer[tile_row * tile_width],
+                    columns * sizeof(T)
+                );
+            }
         }
     }
 
-    _TIFFfree(out_buffer);
-    _TIFFfree(in_buffer);
+    std::memset(tile_ptr, 0, TIFFTileSize(in_tiff));
+    DownsampleBlock<T>(
+        region, region_width, region_width, region_length, factor,
+        tile_ptr, tile_width, (region_width + factor - 1) / factor, (region_length + factor - 1) / factor
+    );
 }
 
 
 // explicit instantiation of templates
-template void TiffWriter::WriteSubfileByScanline<uint8>(TIFF*, uint16, uint8*);
-template void TiffWriter::WriteSubfileByScanline<uint16>(TIFF*, uint16, uint16*);
-template void TiffWriter::_WriteSubfileRegionByScanline<uint8>(std::string, std::string, uint8, uint16, uint8*, uint32, uint32, uint32, uint32);
-template void TiffWriter::_WriteSubfileRegionByScanline<uint16>(std::string, std::string, uint8, uint16, uint16*, uint32, uint32, uint32, uint32);
-template void TiffWriter::WriteSubfileByTile<uint8>(TIFF*, uint16, uint8*);
-template void TiffWriter::WriteSubfileByTile<uint16>(TIFF*, uint16, uint16*);
-template void TiffWriter::_WriteSubfileRegionByTile<uint8>(std::string, std::string, uint8, uint16, uint8*, uint32, uint32, uint32, uint32);
-template void TiffWriter::_WriteSubfileRegionByTile<uint16>(std::string, std::string, uint8, uint16, uint16*, uint32, uint32, uint32, uint32);
-template void TiffWriter::WriteScaledSubfileByTile<uint8, uint8>(TIFF*, uint16, uint8*, float sfactor);
-template void TiffWriter::WriteScaledSubfileByTile<uint8, uint16>(TIFF*, uint16, uint8*, float sfactor);
-template void TiffWriter::WriteScaledSubfileByTile<uint16, uint8>(TIFF*, uint16, uint16*, float sfactor);
-template void TiffWriter::WriteScaledSubfileByTile<uint16, uint16>(TIFF*, uint16, uint16*, float sfactor);
-template void TiffWriter::WriteDownsampledSubfileByTile<uint8>(TIFF*, TIFF*, uint16, uint16);
-template void TiffWriter::WriteDownsampledSubfileByTile<uint16>(TIFF*, TIFF*, uint16, uint16);
+template void TiffWriter::WriteSubfileByScanline<uint8>(TIFF*, uint8*);
+template void TiffWriter::WriteSubfileByScanline<uint16>(TIFF*, uint16*);
+template void TiffWriter::WriteSubfileRegionByScanline<uint8>(TIFF*, int, uint8*, uint32, uint32, uint32, uint32);
+template void TiffWriter::WriteSubfileRegionByScanline<uint16>(TIFF*, int, uint16*, uint32, uint32, uint32, uint32);
+template void TiffWriter::_WriteSubfileRegionByScanline<uint8>(std::string, std::string, uint8, uint32, uint8*, uint32, uint32, uint32, uint32);
+template void TiffWriter::_WriteSubfileRegionByScanline<uint16>(std::string, std::string, uint8, uint32, uint16*, uint32, uint32, uint32, uint32);
+template void TiffWriter::WriteSubfileByTile<uint8>(TIFF*, uint8*);
+template void TiffWriter::WriteSubfileByTile<uint16>(TIFF*, uint16*);
+template void TiffWriter::WriteSubfileRegionByTile<uint8>(TIFF*, int, uint8*, uint32, uint32, uint32, uint32);
+template void TiffWriter::WriteSubfileRegionByTile<uint16>(TIFF*, int, uint16*, uint32, uint32, uint32, uint32);
+template void TiffWriter::_WriteSubfileRegionByTile<uint8>(std::string, std::string, uint8, uint32, uint8*, uint32, uint32, uint32, uint32);
+template void TiffWriter::_WriteSubfileRegionByTile<uint16>(std::string, std::string, uint8, uint32, uint16*, uint32, uint32, uint32, uint32);
+template void TiffWriter::DownsampleBlock<uint8>(const uint8*, size_t, uint32, uint32, uint32, uint8*, size_t, uint32, uint32);
+template void TiffWriter::DownsampleBlock<uint16>(const uint16*, size_t, uint32, uint32, uint32, uint16*, size_t, uint32, uint32);
+template void TiffWriter::DownsampleTile<uint8>(TIFF*, uint32, uint32, uint8*, uint32);
+template void TiffWriter::DownsampleTile<uint16>(TIFF*, uint32, uint32, uint16*, uint32);
+template void TiffWriter::WriteMultiscaleSubfileByTile<uint8>(TIFF*, uint8*, float, const std::vector<uint32>&, const std::function<void(uint32)>&, uint32);
+template void TiffWriter::WriteMultiscaleSubfileByTile<uint16>(TIFF*, uint16*, float, const std::vector<uint32>&, const std::function<void(uint32)>&, uint32);
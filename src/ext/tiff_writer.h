@@ -1,12 +1,23 @@
 #ifndef __TIFFWRITER_H__
 #define __TIFFWRITER_H__
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <tiffio.h>
 
+#include "buffer_pool.h"
+#include "thread_pool.h"
+#include "tiff_directory.h"
+#include "tiff_memory_stream.h"
 #include "utils.h"
 
 
@@ -15,7 +26,7 @@
  */
 class TiffWriter {
     private:
-        static char errorBuffer_[1024]; /**< Buffer containing diagnostic messages from libtiff. */
+        static thread_local char errorBuffer_[1024];    /**< Buffer containing diagnostic messages from libtiff (per thread, as subfiles are encoded and decoded in parallel). */
         /**
          * Error handler routine for libtiff.
          * @param module Module in which an error is detected.
@@ -24,23 +35,157 @@ class TiffWriter {
          */
         static void ErrorHandler(const char* module, const char* format, va_list args);
 
+        /**
+         * Box filter kernel with a compile-time factor (F = 0 uses factor).
+         * @see DownsampleBlock
+         */
+        template <typename T, uint32 F>
+        static void BoxKernel(
+            const T* src_ptr, size_t src_stride, uint32 src_columns, uint32 src_rows, uint32 factor,
+            T* dst_ptr, size_t dst_stride, uint32 columns, uint32 rows
+        );
+
+        /**
+         * Checks if a region can be written into a subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
+         * @param sample_size Size of a component of the region buffer in bytes.
+         * @param x1 Upper left x-coordinate (incl).
+         * @param y1 Upper left y-coordinate (incl).
+         * @param x2 Lower right x-coordinate (excl).
+         * @param y2 Lower right y-coordinate (excl).
+         */
+        static void CheckRegion(
+            TIFF* tiff, uint16 sample_size,
+            uint32 x1, uint32 y1, uint32 x2, uint32 y2
+        );
+
+        /**
+         * Writes components at a file offset in the byte order of the TIFF file.
+         * @tparam T Data type of a component.
+         * @param fd File descriptor of the TIFF file opened for writing.
+         * @param swapped If true, the byte order of the components is swapped.
+         * @param samples_ptr components to write.
+         * @param sample_count Number of components to write.
+         * @param offset File offset of the first component.
+         * @param buffer Scratch buffer for swapping the byte order.
+         */
+        template <typename T>
+        static void WriteSamplesAt(
+            int fd, bool swapped, const T* samples_ptr, size_t sample_count,
+            uint64 offset, std::vector<T>& buffer
+        );
+
+        /**
+         * Replaces the tiles of a compressed subfile which intersect a region
+         * by copy-on-write.
+         * @see WriteSubfileRegionByTile
+         */
+        template <typename T>
+        static void ReplaceRegionTiles(
+            TIFF* tiff, int fd, T* arr_ptr,
+            uint32 x1, uint32 y1, uint32 x2, uint32 y2
+        );
+
+        /**
+         * Replaces the strips of a compressed subfile which intersect a region
+         * by copy-on-write.
+         * @see WriteSubfileRegionByScanline
+         */
+        template <typename T>
+        static void ReplaceRegionStrips(
+            TIFF* tiff, int fd, T* arr_ptr,
+            uint32 x1, uint32 y1, uint32 x2, uint32 y2
+        );
+
+        /**
+         * Copies an IFD, the IFDs it refers to and its chunks into another
+         * TIFF file. IFDs which were already copied are not copied twice.
+         * @param in_fd File descriptor of the TIFF file to read from.
+         * @param out_fd File descriptor of the TIFF file to write to.
+         * @param offset File offset of the IFD to copy.
+         * @param copied Map of the new offsets per offset of the copied IFDs.
+         * @return File offset of the copied IFD
+         */
+        static uint64 CopyDirectory(int in_fd, int out_fd, uint64 offset, std::map<uint64, uint64>& copied);
+
     public:
+        /**
+         * Structure for the parameters required to encode a tile or a strip.
+         */
+        struct ChunkFormat {
+            bool tiled = true;                  /**< If true, the chunk is a tile. Otherwise, it is a strip. */
+            uint32 width = 0;                   /**< Width of the chunk in pixels. */
+            uint32 length = 0;                  /**< Length (height) of the chunk in pixels. */
+            uint16 bits_per_sample = 8;         /**< Number of bits per component. */
+            uint16 samples_per_pixel = 1;       /**< The number of components per pixel. */
+            uint16 compression = 1;             /**< Compression scheme; 1 = uncompressed. */
+            uint16 photometric = 1;             /**< The color space of the image data. */
+            uint16 planar_config = 1;           /**< How the components of each pixel are stored. */
+            uint16 sample_format = 1;           /**< How to interpret each data sample in a pixel. */
+            uint16 predictor = 1;               /**< Prediction scheme used before coding; 1 = none. */
+            bool big_endian = false;            /**< Byte order of the target TIFF file. */
+        };
+
+        /**
+         * Reads the encoding parameters of a tile or strip of the current directory.
+         * @param tiff TIFF handle from libtiff set to the subfile.
+         * @return Encoding parameters of a tile or (the first) strip
+         */
+        static ChunkFormat GetChunkFormat(TIFF* tiff);
+
+        /**
+         * Checks whether chunks of a compression scheme can be encoded
+         * independently of the TIFF file, i.e. the encoded chunks do not
+         * depend on shared tables (e.g. JPEGTABLES).
+         * @param compression Compression scheme.
+         * @return True, if the chunks can be written as raw data.
+         */
+        static bool IsSelfContainedCompression(uint16 compression);
+
+        /**
+         * Encodes a tile or strip with the codecs of libtiff.
+         * @note This function is thread-safe.
+         * @param format Encoding parameters of the chunk.
+         * @param chunk_ptr Chunk buffer where to read from; the buffer may be altered (e.g. by byte swapping).
+         * @param encoded Encoded chunk.
+         */
+        static void EncodeChunk(const ChunkFormat& format, void* chunk_ptr, std::vector<uint8>& encoded);
+
+        /**
+         * Replaces a tile or strip by copy-on-write.
+         * The encoded chunk is appended to the end of the TIFF file and the
+         * TileOffsets/TileByteCounts (or StripOffsets/StripByteCounts) of
+         * the directory are patched in place. The former chunk becomes
+         * unreferenced. The file is left unchanged if the chunk index is
+         * out of range or if the chunk does not fit the field types (e.g.
+         * beyond 4 GiB in a classic TIFF file).
+         * @param fd File descriptor of the TIFF file opened for writing.
+         * @param directory Directory of the subfile.
+         * @param chunk_idx Index of the tile or strip.
+         * @param encoded Encoded chunk.
+         * @return File offset of the new chunk
+         */
+        static uint64 ReplaceChunk(int fd, TiffDirectory& directory, uint32 chunk_idx, const std::vector<uint8>& encoded);
+
         /**
          * Writes a subfile by scanlines.
          * @tparam T Data type of the image buffer.
-         * @param tiff TIFF handle from libtiff.
-         * @param subfile_idx Index of the subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
          * @param arr_ptr image buffer where to read from.
          */
         template <typename T>
-        static void WriteSubfileByScanline(TIFF* tiff, uint16 subfile_idx, T* arr_ptr);
+        static void WriteSubfileByScanline(TIFF* tiff, T* arr_ptr);
 
         /**
          * Writes a region of a subfile by scanlines.
-         * @note This operation is not supported by libtiff!
+         * libtiff does not support altering the content of a TIFF file.
+         * Thus, the region of an uncompressed subfile is written in place
+         * at the positions given by the strip offsets.
+         * Only the strips of a compressed subfile which intersect the rows
+         * of the region are replaced by copy-on-write (see ReplaceChunk()).
          * @tparam T Data type of the region buffer.
-         * @param tiff TIFF handle from libtiff.
-         * @param subfile_idx Index of the subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
+         * @param fd File descriptor of the TIFF file opened for writing.
          * @param arr_ptr region buffer where to read from.
          * @param x1 Upper left x-coordinate (incl).
          * @param y1 Upper left y-coordinate (incl).
@@ -49,11 +194,9 @@ class TiffWriter {
          */
         template <typename T>
         static void WriteSubfileRegionByScanline(
-            TIFF* tiff, uint16 subfile_idx, T* arr_ptr,
+            TIFF* tiff, int fd, T* arr_ptr,
             uint32 x1, uint32 y1, uint32 x2, uint32 y2
-        ) {
-            throw std::runtime_error("Altering the content of a TIFF file is not supported!");
-        }
+        );
 
         /**
          * Overwrites a region of a subfile by scanlines
@@ -73,7 +216,7 @@ class TiffWriter {
         template <typename T>
         static void _WriteSubfileRegionByScanline(
             std::string in_file_path, std::string out_file_path,
-            uint8 version, uint16 subfile_idx, T* arr_ptr,
+            uint8 version, uint32 subfile_idx, T* arr_ptr,
             uint32 x1, uint32 y1, uint32 x2, uint32 y2
         );
 
@@ -81,12 +224,11 @@ class TiffWriter {
          * Writes a subfile by strips.
          * @note This operation is not yet supported!
          * @tparam T Data type of the image buffer.
-         * @param tiff TIFF handle from libtiff.
-         * @param subfile_idx Index of the subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
          * @param arr_ptr image buffer where to read from.
          */
         template <typename T>
-        static void WriteSubfileByStrip(TIFF* tiff, uint16 subfile_idx, T* arr_ptr) {
+        static void WriteSubfileByStrip(TIFF* tiff, T* arr_ptr) {
             throw std::runtime_error("Writing a TIFF file by strips is not supported!");
         }
 
@@ -104,7 +246,7 @@ class TiffWriter {
          */
         template <typename T>
         static void WriteSubfileRegionByStrip(
-            TIFF* tiff, uint16 subfile_idx, T* arr_ptr,
+            TIFF* tiff, uint32 subfile_idx, T* arr_ptr,
             uint32 x1, uint32 y1, uint32 x2, uint32 y2
         ) {
             throw std::runtime_error("Writing a TIFF file by strips is not supported!");
@@ -113,19 +255,24 @@ class TiffWriter {
         /**
          * Writes a subfile by tiles.
          * @tparam T Data type of the image buffer.
-         * @param tiff TIFF handle from libtiff.
-         * @param subfile_idx Index of the subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
          * @param arr_ptr image buffer where to read from.
          */
         template <typename T>
-        static void WriteSubfileByTile(TIFF* tiff, uint16 subfile_idx, T* arr_ptr);
+        static void WriteSubfileByTile(TIFF* tiff, T* arr_ptr);
 
         /**
          * Writes a region of a subfile by tiles.
-         * @note This operation is not supported by libtiff!
+         * libtiff does not support altering the content of a TIFF file.
+         * Thus, the region of an uncompressed subfile is written in place
+         * at the positions given by the tile offsets. Only the bytes of the
+         * region are written.
+         * The tiles of a compressed subfile are replaced by copy-on-write:
+         * each affected tile is decoded, merged with the region, encoded
+         * and appended to the end of the file (see ReplaceChunk()).
          * @tparam T Data type of the region buffer.
-         * @param tiff TIFF handle from libtiff.
-         * @param subfile_idx Index of the subfile.
+         * @param tiff TIFF handle from libtiff set to the subfile.
+         * @param fd File descriptor of the TIFF file opened for writing.
          * @param arr_ptr region buffer where to read from.
          * @param x1 Upper left x-coordinate (incl).
          * @param y1 Upper left y-coordinate (incl).
@@ -134,11 +281,22 @@ class TiffWriter {
          */
         template <typename T>
         static void WriteSubfileRegionByTile(
-            TIFF* tiff, uint16 subfile_idx, T* arr_ptr,
+            TIFF* tiff, int fd, T* arr_ptr,
             uint32 x1, uint32 y1, uint32 x2, uint32 y2
-        ) {
-            throw std::runtime_error("Altering the content of a TIFF file is not supported!");
-        }
+        );
+
+        /**
+         * Writes a compacted copy of a TIFF file.
+         * Tiles and strips which were replaced by copy-on-write leave
+         * unreferenced data behind. The copy contains only the IFDs
+         * reachable from the header and the chunks they refer to.
+         * @note IFDs referred to by the SubIFDs, EXIF, GPS and
+         * Interoperability tags are copied as well. Other offsets within
+         * private tags are not relocated.
+         * @param in_fd File descriptor of the TIFF file to read from.
+         * @param out_fd File descriptor of the empty TIFF file to write to.
+         */
+        static void CompactFile(int in_fd, int out_fd);
 
         /**
          * Overwrites a region of a subfile by tiles
@@ -158,38 +316,71 @@ class TiffWriter {
         template <typename T>
         static void _WriteSubfileRegionByTile(
             std::string in_file_path, std::string out_file_path,
-            uint8 version, uint16 subfile_idx, T* arr_ptr,
+            uint8 version, uint32 subfile_idx, T* arr_ptr,
             uint32 x1, uint32 y1, uint32 x2, uint32 y2
         );
 
         /**
-         * Writes a new scaled subfile by tiles.
-         * @note This is a slow pixel operation.
-         * @tparam T Data type of the image component (i.e. pixel).
-         * @tparam U Data type of a subfile component (i.e. pixel).
-         * @param tiff TIFF handle from libtiff.
-         * @param subfile_idx Index of the subfile.
-         * @param arr_ptr image buffer where to read from.
-         * @param sfactor Scaling factor.
+         * Downsamples a block by averaging boxes of factor x factor pixels.
+         * The factors 2, 4 and 8 use fused kernels with a compile-time box
+         * size. Boxes exceeding the source block repeat its last row and column.
+         * @tparam T Data type of the image buffer.
+         * @param src_ptr Upper left pixel of the source block.
+         * @param src_stride Number of pixels between two rows of the source.
+         * @param src_columns Number of valid columns of the source block.
+         * @param src_rows Number of valid rows of the source block.
+         * @param factor Downscale factor.
+         * @param dst_ptr Upper left pixel of the destination block.
+         * @param dst_stride Number of pixels between two rows of the destination.
+         * @param columns Number of columns to compute.
+         * @param rows Number of rows to compute.
          */
-        template <typename T, typename U>
-        static void WriteScaledSubfileByTile(
-            TIFF* tiff, uint16 subfile_idx, T* arr_ptr, float sfactor
+        template <typename T>
+        static void DownsampleBlock(
+            const T* src_ptr, size_t src_stride, uint32 src_columns, uint32 src_rows, uint32 factor,
+            T* dst_ptr, size_t dst_stride, uint32 columns, uint32 rows
         );
 
         /**
-         * Writes a downsampled subfile by tiles.
-         * The subfile in in_tiff is downsampled to half and stored in out_file.
+         * Computes a single tile of a downsampled subfile.
+         * The (up to) factor x factor parent tiles are read from in_tiff.
+         * The last row and column of the parent subfile are repeated if the
+         * boxes exceed its dimensions.
          * @tparam T Data type of the image buffer.
-         * @param in_tiff TIFF handle from libtiff.
-         * @param out_tiff TIFF handle from libtiff.
-         * @param in_subfile_idx Index of the subfile to read from.
-         * @param out_subfile_idx Index of the subfile to write to.
+         * @param in_tiff TIFF handle from libtiff set to the subfile to read from.
+         * @param x Upper left x-coordinate of the tile within the downsampled subfile.
+         * @param y Upper left y-coordinate of the tile within the downsampled subfile.
+         * @param tile_ptr Tile buffer where to write to (same tile size as in_tiff).
+         * @param factor Downscale factor.
+         */
+        template <typename T>
+        static void DownsampleTile(TIFF* in_tiff, uint32 x, uint32 y, T* tile_ptr, uint32 factor=2);
+
+        /**
+         * Writes a scaled 8-bit subfile and its downsampled levels by tiles.
+         * The tiles are scaled, downsampled and encoded on a thread pool.
+         * A tile of level n + 1 is computed as soon as its (up to)
+         * factor x factor parent tiles of level n are done. The encoded
+         * tiles are written level by level, where each level ends with a
+         * new directory. The samples of a pixel are interleaved and
+         * downsampled independently. A level is released once it is
+         * written and its child level is done.
+         * @tparam T Data type of the image component (i.e. pixel).
+         * @param tiff TIFF handle from libtiff.
+         * @param arr_ptr image buffer where to read from.
+         * @param sfactor Scaling factor.
+         * @param factors Downscale factor of each reduced-resolution level relative to its parent level.
+         * @param set_level_tags Callback setting the TIFF Tags of a level
+         * on the TIFF handle. It is called before the tiles of a level are
+         * written. The dimensions of a level n > 0 are ((width + 1) / c, (length + 1) / c)
+         * with c being the product of the first n factors.
+         * @param thread_count Number of worker threads (0 = number of hardware threads).
          */
         template <typename T>
-        static void WriteDownsampledSubfileByTile(
-            TIFF* in_tiff, TIFF* out_tiff,
-            uint16 in_subfile_idx, uint16 out_subfile_idx
+        static void WriteMultiscaleSubfileByTile(
+            TIFF* tiff, T* arr_ptr, float sfactor, const std::vector<uint32>& factors,
+            const std::function<void(uint32)>& set_level_tags,
+            uint32 thread_count=0
         );
 };
 
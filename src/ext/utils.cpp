@@ -1,16 +1,33 @@
 #include "utils.h"
 
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
 
-const int& min(const int& a, const int& b) {
+
+int64_t min(int64_t a, int64_t b) {
     return (b < a) ? b : a;
 }
-const int& max(const int& a, const int& b) {
+int64_t max(int64_t a, int64_t b) {
     return (a < b) ? b : a;
 }
 
-std::vector<int> range(int start, int stop, int step) {
-    int s = int((stop - start) / step);
-    std::vector<int> v(s);
+std::vector<int64_t> range(int64_t start, int64_t stop, int64_t step) {
+    int64_t s = (stop - start) / step;
+    std::vector<int64_t> v(s);
     std::generate(v.begin(), v.end(), [n = start-step, step] () mutable { n += step; return n; });
     return v;
 };
@@ -23,3 +40,280 @@ bool file_exists(const std::string& file_path) {
         return false;
     }   
 }
+
+int open_file(const std::string& file_path, bool writable) {
+#ifdef _WIN32
+    int fd = _open(file_path.c_str(), (writable ? _O_RDWR : _O_RDONLY) | _O_BINARY);
+#else
+    int fd = open(file_path.c_str(), writable ? O_RDWR : O_RDONLY);
+#endif
+    if (fd < 0)
+        throw std::runtime_error("Could not open file '" + file_path + "'!");
+    return fd;
+}
+
+int create_file(const std::string& file_path) {
+#ifdef _WIN32
+    int fd = _open(file_path.c_str(), _O_RDWR | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int fd = open(file_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0)
+        throw std::runtime_error("Could not create file '" + file_path + "'!");
+    return fd;
+}
+
+void replace_file(const std::string& src_file_path, const std::string& dst_file_path) {
+#ifdef _WIN32
+    // rename() does not replace an existing file on Windows
+    std::remove(dst_file_path.c_str());
+#endif
+    if (std::rename(src_file_path.c_str(), dst_file_path.c_str()) != 0)
+        throw std::runtime_error("Could not replace file '" + dst_file_path + "'!");
+}
+
+void close_file(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+void read_at(int fd, void* data, size_t size, uint64_t offset) {
+    char* ptr = static_cast<char*>(data);
+    while (size > 0) {
+#ifdef _WIN32
+        _lseeki64(fd, offset, SEEK_SET);
+        int count = _read(fd, ptr, static_cast<unsigned int>((size < (1u << 30)) ? size : (1u << 30)));
+#else
+        ssize_t count = pread(fd, ptr, size, offset);
+#endif
+        if (count <= 0)
+            throw std::runtime_error("Could not read " + std::to_string(size) + " bytes at offset " + std::to_string(offset) + "!");
+        ptr += count;
+        size -= count;
+        offset += count;
+    }
+}
+
+void read_rows_at(int fd, void* data, size_t row_size, size_t row_count, size_t stride, uint64_t offset) {
+    char* rows = static_cast<char*>(data);
+    if (row_size == stride) {
+        read_at(fd, rows, row_size * row_count, offset);
+        return;
+    }
+
+    size_t row_idx = 0;
+#ifndef _WIN32
+    // the rows are passed to the kernel in batches, which fit any IOV_MAX
+    struct iovec iov[256];
+    while (row_idx < row_count) {
+        const size_t count = std::min(row_count - row_idx, sizeof(iov) / sizeof(iov[0]));
+        for (size_t i = 0; i < count; i++) {
+            iov[i].iov_base = rows + (row_idx + i) * stride;
+            iov[i].iov_len = row_size;
+        }
+        ssize_t read_count = preadv(fd, iov, static_cast<int>(count), offset + row_idx * row_size);
+        if (read_count <= 0)
+            break;  // the remaining rows are read one by one
+
+        // a short read may end within a row
+        row_idx += read_count / row_size;
+        size_t done = read_count % row_size;
+        if (done > 0) {
+            read_at(fd, rows + row_idx * stride + done, row_size - done, offset + row_idx * row_size + done);
+            row_idx += 1;
+        }
+    }
+#endif
+    for (; row_idx < row_count; row_idx++)
+        read_at(fd, rows + row_idx * stride, row_size, offset + row_idx * row_size);
+}
+
+size_t read_up_to(int fd, void* data, size_t size, uint64_t offset) {
+    char* ptr = static_cast<char*>(data);
+    size_t total = 0;
+    while (total < size) {
+#ifdef _WIN32
+        _lseeki64(fd, offset + total, SEEK_SET);
+        int count = _read(fd, ptr + total, static_cast<unsigned int>((size - total < (1u << 30)) ? size - total : (1u << 30)));
+#else
+        ssize_t count = pread(fd, ptr + total, size - total, offset + total);
+#endif
+        if (count < 0)
+            throw std::runtime_error("Could not read " + std::to_string(size) + " bytes at offset " + std::to_string(offset) + "!");
+        if (count == 0)
+            break;  // end of the file
+        total += count;
+    }
+    return total;
+}
+
+void write_at(int fd, const void* data, size_t size, uint64_t offset) {
+    const char* ptr = static_cast<const char*>(data);
+    while (size > 0) {
+#ifdef _WIN32
+        _lseeki64(fd, offset, SEEK_SET);
+        int count = _write(fd, ptr, static_cast<unsigned int>((size < (1u << 30)) ? size : (1u << 30)));
+#else
+        ssize_t count = pwrite(fd, ptr, size, offset);
+#endif
+        if (count <= 0)
+            throw std::runtime_error("Could not write " + std::to_string(size) + " bytes at offset " + std::to_string(offset) + "!");
+        ptr += count;
+        size -= count;
+        offset += count;
+    }
+}
+
+int open_file_direct(const std::string& file_path) {
+#if defined(__linux__) && defined(O_DIRECT)
+    return open(file_path.c_str(), O_RDWR | O_DIRECT);
+#elif defined(__APPLE__)
+    int fd = open(file_path.c_str(), O_RDWR);
+    if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+std::unique_ptr<char, void (*)(void*)> allocate_aligned(size_t size, size_t alignment) {
+    void* ptr = nullptr;
+#ifdef _WIN32
+    ptr = _aligned_malloc(size, alignment);
+#else
+    if (posix_memalign(&ptr, alignment, size) != 0)
+        ptr = nullptr;
+#endif
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return std::unique_ptr<char, void (*)(void*)>(
+        static_cast<char*>(ptr),
+#ifdef _WIN32
+        _aligned_free
+#else
+        free
+#endif
+    );
+}
+
+void write_staged_direct(int direct_fd, int fd, char* staging, uint64_t staging_offset, uint64_t begin, uint64_t end) {
+    const uint64_t file_size = get_file_size(fd);
+    const uint64_t aligned_end = (end + kDirectBlockSize - 1) / kDirectBlockSize * kDirectBlockSize;
+
+    // the partial blocks keep the content of the file
+    if (begin > 0) {
+        std::memset(staging, 0, begin);
+        if (staging_offset < file_size)
+            read_at(fd, staging, std::min(staging_offset + begin, file_size) - staging_offset, staging_offset);
+    }
+    if (end < aligned_end) {
+        std::memset(staging + end, 0, aligned_end - end);
+        if (staging_offset + end < file_size)
+            read_at(
+                fd, staging + end, std::min(staging_offset + aligned_end, file_size) - (staging_offset + end),
+                staging_offset + end
+            );
+    }
+    write_at(direct_fd, staging, aligned_end, staging_offset);
+
+    // drops the padding of the last block
+    if (staging_offset + aligned_end > std::max(file_size, staging_offset + end))
+        truncate_file(fd, std::max(file_size, staging_offset + end));
+}
+
+void write_at_direct(int direct_fd, int fd, const void* data, size_t size, uint64_t offset) {
+    const uint64_t start = offset - (offset % kDirectBlockSize);
+    const uint64_t end = offset + size;
+    const uint64_t aligned_end = (end + kDirectBlockSize - 1) / kDirectBlockSize * kDirectBlockSize;
+
+    std::unique_ptr<char, void (*)(void*)> staging = allocate_aligned(
+        std::min(kDirectStagingSize, aligned_end - start), kDirectBlockSize
+    );
+
+    const char* src = static_cast<const char*>(data);
+    for (uint64_t chunk_start = start; chunk_start < aligned_end; chunk_start += kDirectStagingSize) {
+        const uint64_t copy_start = std::max(chunk_start, offset);
+        const uint64_t copy_end = std::min(chunk_start + kDirectStagingSize, end);
+        std::memcpy(staging.get() + (copy_start - chunk_start), src + (copy_start - offset), copy_end - copy_start);
+        write_staged_direct(direct_fd, fd, staging.get(), chunk_start, copy_start - chunk_start, copy_end - chunk_start);
+    }
+}
+
+void advise_will_need(int fd, uint64_t offset, uint64_t size) {
+#if defined(__linux__)
+    posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+#elif defined(__APPLE__)
+    // the advice is limited to an int count
+    while (size > 0) {
+        struct radvisory advisory;
+        advisory.ra_offset = offset;
+        advisory.ra_count = static_cast<int>(std::min(size, uint64_t(1) << 30));
+        if (fcntl(fd, F_RDADVISE, &advisory) != 0)
+            return;
+        offset += advisory.ra_count;
+        size -= advisory.ra_count;
+    }
+#endif
+}
+
+uint64_t get_file_size(int fd) {
+#ifdef _WIN32
+    struct _stat64 stat_buffer;
+    if (_fstat64(fd, &stat_buffer) != 0)
+#else
+    struct stat stat_buffer;
+    if (fstat(fd, &stat_buffer) != 0)
+#endif
+        throw std::runtime_error("Could not determine the file size!");
+    return stat_buffer.st_size;
+}
+
+int64_t get_file_mtime(const std::string& file_path) {
+#ifdef _WIN32
+    struct _stat64 stat_buffer;
+    if (_stat64(file_path.c_str(), &stat_buffer) != 0)
+        return -1;
+    return int64_t(stat_buffer.st_mtime) * 1000000000;
+#else
+    struct stat stat_buffer;
+    if (stat(file_path.c_str(), &stat_buffer) != 0)
+        return -1;
+#if defined(__APPLE__)
+    return int64_t(stat_buffer.st_mtimespec.tv_sec) * 1000000000 + stat_buffer.st_mtimespec.tv_nsec;
+#else
+    return int64_t(stat_buffer.st_mtim.tv_sec) * 1000000000 + stat_buffer.st_mtim.tv_nsec;
+#endif
+#endif
+}
+
+void allocate_file(int fd, uint64_t size) {
+    if (get_file_size(fd) >= size)
+        return;
+#ifdef _WIN32
+    if (_chsize_s(fd, size) != 0)
+#else
+#ifdef __linux__
+    // unlike posix_fallocate(), fallocate() never falls back to writing zeros
+    if (fallocate(fd, 0, 0, size) == 0)
+        return;
+#endif
+    // the file system does not support reserving the space
+    if (ftruncate(fd, size) != 0)
+#endif
+        throw std::runtime_error("Could not allocate " + std::to_string(size) + " bytes!");
+}
+
+void truncate_file(int fd, uint64_t size) {
+#ifdef _WIN32
+    if (_chsize_s(fd, size) != 0)
+#else
+    if (ftruncate(fd, size) != 0)
+#endif
+        throw std::runtime_error("Could not truncate the file!");
+}
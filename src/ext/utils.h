@@ -2,7 +2,10 @@
 #define __UTILS_H__
 
 #include <math.h>
+#include <cstdint>
 #include <fstream>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -32,19 +35,20 @@ py::array_t<T, py::array::c_style | py::array::forcecast> make_c_style(py::array
 }
 
 /**
- * Computes the minimum of two integer values.
+ * Computes the minimum of two integer values. The values are signed 64-bit
+ * integers, so that the pixel coordinates of BigTIFF images do not overflow.
  * @param a First integer value.
  * @param b Second integer value.
  * @return The minimum value
  */
-const int& min(const int& a, const int& b);
+int64_t min(int64_t a, int64_t b);
 /**
  * Computes the maximum of two integer values.
  * @param a First integer value.
  * @param b Second integer value.
  * @return The maximum value
  */
-const int& max(const int& a, const int& b);
+int64_t max(int64_t a, int64_t b);
 
 /**
  * Computes a sequence of integer values.
@@ -53,7 +57,7 @@ const int& max(const int& a, const int& b);
  * @param step Step size.
  * @return The integer sequence
  */
-std::vector<int> range(int start, int stop, int step=1);
+std::vector<int64_t> range(int64_t start, int64_t stop, int64_t step=1);
 
 /**
  * Checks wherever a file exists on the file system.
@@ -62,4 +66,167 @@ std::vector<int> range(int start, int stop, int step=1);
  */
 bool file_exists(const std::string& file_path);
 
+/**
+ * Opens a file for positional reads and writes.
+ * @param file_path Path to the file.
+ * @param writable If true, opens the file for reading and writing.
+ * @return File descriptor
+ */
+int open_file(const std::string& file_path, bool writable=false);
+
+/**
+ * Creates an empty file (or truncates an existing one) for positional reads and writes.
+ * @param file_path Path to the file.
+ * @return File descriptor
+ */
+int create_file(const std::string& file_path);
+
+/**
+ * Replaces a file by another file.
+ * @param src_file_path Path to the file which replaces the other file.
+ * @param dst_file_path Path to the file to be replaced.
+ */
+void replace_file(const std::string& src_file_path, const std::string& dst_file_path);
+
+/**
+ * Closes a file opened by open_file() or create_file().
+ * @param fd File descriptor.
+ */
+void close_file(int fd);
+
+/**
+ * Reads a block of bytes at an absolute file offset.
+ * @note The file position of the descriptor is not relied upon.
+ * @param fd File descriptor.
+ * @param data Destination buffer.
+ * @param size Number of bytes to read.
+ * @param offset File offset of the first byte.
+ */
+void read_at(int fd, void* data, size_t size, uint64_t offset);
+
+/**
+ * Reads consecutive rows of bytes at an absolute file offset into rows of a
+ * destination which are a stride apart (e.g. the rows of a tile into an
+ * image). The rows are read by a single preadv() where available.
+ * @param fd File descriptor.
+ * @param data Destination of the first row.
+ * @param row_size Number of bytes per row.
+ * @param row_count Number of rows.
+ * @param stride Distance in bytes between two rows of the destination.
+ * @param offset File offset of the first byte.
+ */
+void read_rows_at(int fd, void* data, size_t row_size, size_t row_count, size_t stride, uint64_t offset);
+
+/**
+ * Reads up to a number of bytes at an absolute file offset, i.e. a read
+ * beyond the end of the file is short instead of failing.
+ * @param fd File descriptor.
+ * @param data Destination buffer.
+ * @param size Maximum number of bytes to read.
+ * @param offset File offset of the first byte.
+ * @return Number of bytes read
+ */
+size_t read_up_to(int fd, void* data, size_t size, uint64_t offset);
+
+/**
+ * Writes a block of bytes at an absolute file offset.
+ * @param fd File descriptor.
+ * @param data Source buffer.
+ * @param size Number of bytes to write.
+ * @param offset File offset of the first byte.
+ */
+void write_at(int fd, const void* data, size_t size, uint64_t offset);
+
+/**
+ * Opens an existing file for writing with direct I/O, which bypasses the
+ * page cache (O_DIRECT on Linux, F_NOCACHE on macOS).
+ * @param file_path Path to the file.
+ * @return File descriptor (-1 = direct I/O is not supported, e.g. by the file system)
+ */
+int open_file_direct(const std::string& file_path);
+
+/** Alignment of direct writes in bytes (satisfies 512e and 4Kn devices). */
+const uint64_t kDirectBlockSize = 4096;
+
+/** Size of the staging buffers of direct writes in bytes. */
+const uint64_t kDirectStagingSize = 8 << 20;
+
+/**
+ * Allocates a buffer for direct I/O, which is freed with its handle.
+ * @param size Size of the buffer in bytes.
+ * @param alignment Alignment of the buffer in bytes (a power of two).
+ * @return Handle of the buffer
+ */
+std::unique_ptr<char, void (*)(void*)> allocate_aligned(size_t size, size_t alignment);
+
+/**
+ * Writes the bytes held by a staging buffer with a single direct write of
+ * whole blocks. The partial blocks before and after the staged bytes are
+ * filled with the content of the file, which is read through the regular
+ * descriptor, and a file extended by the padding of the last block is
+ * truncated.
+ * @param direct_fd File descriptor opened by open_file_direct().
+ * @param fd Regular file descriptor of the same file.
+ * @param staging Staging buffer allocated by allocate_aligned(), which has
+ *                room for the staged bytes rounded up to whole blocks.
+ * @param staging_offset File offset of the staging buffer (block-aligned).
+ * @param begin Position of the first staged byte within the buffer.
+ * @param end Position after the last staged byte within the buffer.
+ */
+void write_staged_direct(int direct_fd, int fd, char* staging, uint64_t staging_offset, uint64_t begin, uint64_t end);
+
+/**
+ * Writes a block of bytes at an absolute file offset with direct I/O.
+ * The bytes are written through an aligned staging buffer by large
+ * aligned writes. The partial blocks at both ends are merged with the
+ * content of the file, which is read through the regular descriptor,
+ * and a file extended by the padding of the last block is truncated.
+ * @param direct_fd File descriptor opened by open_file_direct().
+ * @param fd Regular file descriptor of the same file.
+ * @param data Source buffer.
+ * @param size Number of bytes to write.
+ * @param offset File offset of the first byte.
+ */
+void write_at_direct(int direct_fd, int fd, const void* data, size_t size, uint64_t offset);
+
+/**
+ * Advises the kernel that a byte range of a file will be read soon, so it
+ * is prefetched into the page cache in the background (posix_fadvise()
+ * with POSIX_FADV_WILLNEED on Linux, F_RDADVISE on macOS). The advice is
+ * ignored where it is not supported.
+ * @param fd File descriptor.
+ * @param offset File offset of the first byte.
+ * @param size Number of bytes.
+ */
+void advise_will_need(int fd, uint64_t offset, uint64_t size);
+
+/**
+ * Get the size of a file.
+ * @param fd File descriptor.
+ * @return Size of the file in bytes
+ */
+uint64_t get_file_size(int fd);
+
+/**
+ * Get the modification time of a file.
+ * @param file_path Path to the file.
+ * @return Modification time in nanoseconds since the epoch (-1 = the file does not exist)
+ */
+int64_t get_file_mtime(const std::string& file_path);
+
+/**
+ * Extends a file to a given size and reserves the disk space if the file
+ * system supports it, so later writes into the file do not allocate blocks.
+ * @param fd File descriptor.
+ * @param size Size of the file in bytes.
+ */
+void allocate_file(int fd, uint64_t size);
+
+/**
+ * Truncates or extends a file to a given size.
+ * @param fd File descriptor.
+ * @param size Size of the file in bytes.
+ */
+void truncate_file(int fd, uint64_t size);
+
 #endif /* __UTILS_H__ */ 
\ No newline at end of file
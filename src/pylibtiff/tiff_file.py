@@ -2,14 +2,75 @@
 This module contains a wrapper around libtiff's TIFF handle.
 """
 
+import contextlib
 import math
 import numpy as np
+import os
+import threading
+
+from collections.abc import Sequence
 
 from pylibtiff.utils import wrap_index
 
 from pylibtiff.ext.tiff_file import TiffFile as TiffFileExtension
 
 
+class SubfileTags(Sequence):
+    """
+    Read-only sequence of the TIFF Tags per subfile. The directory of a
+    subfile is parsed on first access, so opening a TIFF file only walks its
+    chain of directories.
+    """
+
+    def __init__(self, tiff_file_ext):
+        """
+        SubfileTags constructor.
+
+        :param tiff_file_ext: The internal TiffFile extension.
+        """
+        self._tiff_file_ext = tiff_file_ext
+
+    def __len__(self):
+        return self._tiff_file_ext.get_subfile_count()
+
+    def __getitem__(self, subfile_idx):
+        if isinstance(subfile_idx, slice):
+            return [
+                self[idx] for idx in range(*subfile_idx.indices(len(self)))
+            ]
+        return self._tiff_file_ext.get_subfile_tags(
+            wrap_index(subfile_idx, len(self))
+        )
+
+    def to_array(self):
+        """
+        Get the TIFF Tags of all subfiles with a single call.
+
+        :return: Structured Numpy array with a record of TIFF Tags per
+                 subfile, e.g. array['image_width'].
+        """
+        return self._tiff_file_ext.get_subfile_tags_array()
+
+
+def scan_metadata(paths, threads=0):
+    """
+    Reads the metadata of many TIFF files in parallel without opening a
+    TiffFile per file. The header, the first directory and the chain of
+    directories of each file are parsed on a pool of threads.
+
+    :param paths: Iterable of paths to the TIFF files.
+    :param threads: Number of threads (0 = number of hardware threads).
+    :return: Structured Numpy array with a record per file holding the
+             fields valid, version, big_endian, file_size, subfile_count,
+             level_count and the TIFF Tags of the first subfile, e.g.
+             array['tiff_tags']['image_width']. Files which cannot be
+             parsed are flagged by valid = False.
+    """
+    return TiffFileExtension.scan_metadata(
+        [os.fspath(path) for path in paths], threads
+    )
+
+
 class TiffFile:
     """
     Wrapper class around libtiff's TIFF handle.
@@ -21,21 +82,74 @@ class TiffFile:
     """
     subfile_tags = []
     """
-    Dictionary of all TIFF Tags per subfile.
+    Sequence of the TIFF Tags per subfile (see :class:`SubfileTags`).
+    """
+    _watcher = None
+    """
+    Thread and stop event of the watcher started by :meth:`watch`.
     """
 
-    def __init__(self, file_path, version=42):
+    def __init__(self, file_path, version=42, use_index=False):
         """
         TiffFile constructor.
 
         :param file_path: Path to the TIFF file.
         :param version: Version of the TIFF file (default = 42, BigTIFF = 43).
+        :param use_index: If True, the subfiles are loaded from the sidecar
+                          index "<file_path>.idx" instead of parsing all
+                          directories. A missing or outdated index is
+                          (re)built and only the subfiles appended since are
+                          parsed.
+        """
+        self._tiff_file_ext = TiffFileExtension(file_path, version, use_index)
+        self.subfile_tags = SubfileTags(self._tiff_file_ext)
+
+    @classmethod
+    def from_buffer(cls, buffer):
+        """
+        Opens a TIFF file held in memory for reading.
+        The buffer is not copied and must not be modified while reading.
+        A resizable buffer (e.g. a bytearray) cannot be resized while the
+        TiffFile exists.
+
+        :param buffer: Bytes-like object holding a TIFF file.
+        :return: A read-only TiffFile.
+        """
+        return cls._from_extension(TiffFileExtension.from_buffer(buffer))
+
+    @classmethod
+    def in_memory(cls, version=42):
+        """
+        Creates a TIFF file in memory, which is returned by :meth:`to_bytes`.
+
+        :param version: Version of the TIFF file (default = 42, BigTIFF = 43).
+        :return: A TiffFile written in memory.
+        """
+        return cls._from_extension(TiffFileExtension.in_memory(version))
+
+    @classmethod
+    def _from_extension(cls, tiff_file_ext):
+        tiff_file = cls.__new__(cls)
+        tiff_file._tiff_file_ext = tiff_file_ext
+        tiff_file.subfile_tags = SubfileTags(tiff_file_ext)
+        return tiff_file
+
+    def to_bytes(self):
+        """
+        Get the encoded TIFF file written in memory.
+
+        :return: The TIFF file as bytes.
+        """
+        return self._tiff_file_ext.to_bytes()
+
+    @property
+    def in_memory_file(self):
+        """
+        Whether the TIFF file is held in memory instead of a file on disk.
+
+        :return: True, if the TIFF file is held in memory.
         """
-        self._tiff_file_ext = TiffFileExtension(file_path, version)
-        self.subfile_tags = [
-            self._tiff_file_ext.get_subfile_tags(subfile_idx)
-            for subfile_idx in range(self._tiff_file_ext.get_subfile_count())
-        ]
+        return self._tiff_file_ext.is_in_memory()
 
     @property
     def file_path(self):
@@ -71,26 +185,40 @@ class TiffFile:
                 "Only 8bit and 16bit images are supported."
             )
 
-    def read_subfile(self, subfile_idx):
+    def level_count(self, subfile_idx):
+        """
+        Number of resolution levels of a subfile.
+        The full resolution image is level 0 and its reduced-resolution
+        SubIFDs are the levels 1..n.
+
+        :param subfile_idx: Index of the subfile.
+        :return: The number of resolution levels.
+        """
+        subfile_idx = wrap_index(subfile_idx, len(self.subfile_tags))
+        return self._tiff_file_ext.get_subfile_level_count(subfile_idx)
+
+    def read_subfile(self, subfile_idx, level=0):
         """
         Reads a subfile.
 
         :param subfile_idx: Index of the subfile.
+        :param level: Resolution level of the subfile
+                      (0 = full resolution, n = n-th SubIFD).
         :return: An image as Numpy array.
         """
         subfile_idx = wrap_index(subfile_idx, len(self.subfile_tags))
 
         if self.subfile_tags[subfile_idx].bits_per_sample == 8:
-            return self._tiff_file_ext.read_subfile_8(subfile_idx)
+            return self._tiff_file_ext.read_subfile_8(subfile_idx, level)
         elif self.subfile_tags[subfile_idx].bits_per_sample == 16:
-            return self._tiff_file_ext.read_subfile_16(subfile_idx)
+            return self._tiff_file_ext.read_subfile_16(subfile_idx, level)
         else:
             raise RuntimeError(
                 "Cannot read from TIFF file! " +
                 "Only 8bit and 16bit images are supported."
             )
 
-    def read_subfile_region(self, subfile_idx, x1, y1, x2, y2):
+    def read_subfile_region(self, subfile_idx, x1, y1, x2, y2, level=0):
         """
         Reads a region from a subfile.
 
@@ -99,17 +227,48 @@ class TiffFile:
         :param y1: Upper left y-coordinate (incl).
         :param x2: Lower right x-coordinate (excl).
         :param y2: Lower right y-coordinate (excl).
+        :param level: Resolution level of the subfile
+                      (0 = full resolution, n = n-th SubIFD).
         :return: A region as Numpy array.
         """
         subfile_idx = wrap_index(subfile_idx, len(self.subfile_tags))
 
         if self.subfile_tags[subfile_idx].bits_per_sample == 8:
             return self._tiff_file_ext.read_subfile_region_8(
-                subfile_idx, x1, y1, x2, y2
+                subfile_idx, x1, y1, x2, y2, level
             )
         elif self.subfile_tags[subfile_idx].bits_per_sample == 16:
             return self._tiff_file_ext.read_subfile_region_16(
-                subfile_idx, x1, y1, x2, y2
+                subfile_idx, x1, y1, x2, y2, level
+            )
+        else:
+            raise RuntimeError(
+                "Cannot read from TIFF file! " +
+                "Only 8bit and 16bit images are supported."
+            )
+
+    def read_subfile_regions(self, subfile_idx, regions, level=0):
+        """
+        Reads several regions from a subfile.
+        The tiles/strips of all regions are fetched with a few large reads,
+        merging tiles/strips which are at most :attr:`read_gap` bytes apart.
+
+        :param subfile_idx: Index of the subfile.
+        :param regions: List of regions as tuples (x1, y1, x2, y2) with
+                        exclusive lower right coordinates.
+        :param level: Resolution level of the subfile
+                      (0 = full resolution, n = n-th SubIFD).
+        :return: A list of regions as Numpy arrays.
+        """
+        subfile_idx = wrap_index(subfile_idx, len(self.subfile_tags))
+
+        if self.subfile_tags[subfile_idx].bits_per_sample == 8:
+            return self._tiff_file_ext.read_subfile_regions_8(
+                subfile_idx, regions, level
+            )
+        elif self.subfile_tags[subfile_idx].bits_per_sample == 16:
+            return self._tiff_file_ext.read_subfile_regions_16(
+                subfile_idx, regions, level
             )
         else:
             raise RuntimeError(
@@ -117,6 +276,151 @@ class TiffFile:
                 "Only 8bit and 16bit images are supported."
             )
 
+    @property
+    def read_gap(self):
+        """
+        Maximum gap in bytes between two tiles/strips merged into one read.
+
+        :return: The gap in bytes (default = 64 KiB).
+        """
+        return self._tiff_file_ext.get_read_gap()
+
+    @read_gap.setter
+    def read_gap(self, read_gap):
+        self._tiff_file_ext.set_read_gap(read_gap)
+
+    @property
+    def queue_depth(self):
+        """
+        Maximum number of reads in flight of a region read.
+        The reads are submitted at once through io_uring if available,
+        see :meth:`has_io_uring`.
+
+        :return: The queue depth (default = 64, <= 1 = synchronous reads).
+        """
+        return self._tiff_file_ext.get_queue_depth()
+
+    @queue_depth.setter
+    def queue_depth(self, queue_depth):
+        self._tiff_file_ext.set_queue_depth(queue_depth)
+
+    @property
+    def readahead(self):
+        """
+        Number of bytes the kernel is advised to prefetch ahead of a full
+        subfile read. The tiles/strips of a subfile are read in the order of
+        their offsets in the file, so the disk reads ahead while they are
+        decoded.
+
+        :return: The readahead in bytes (default = 16 MiB, 0 = no advice).
+        """
+        return self._tiff_file_ext.get_readahead()
+
+    @readahead.setter
+    def readahead(self, readahead):
+        self._tiff_file_ext.set_readahead(readahead)
+
+    @property
+    def output_pool_size(self):
+        """
+        Maximum number of pooled output arrays per shape and data type.
+        Repeated reads of the same shape, e.g. the frames of a time-lapse,
+        reuse the arrays of earlier reads once these are no longer
+        referenced, instead of allocating a new array each. Only the eight
+        shapes read last are pooled. Setting the size releases the pooled
+        arrays.
+
+        :return: The output pool size (default = 0, 0 = no pool).
+        """
+        return self._tiff_file_ext.get_output_pool_size()
+
+    @output_pool_size.setter
+    def output_pool_size(self, output_pool_size):
+        self._tiff_file_ext.set_output_pool_size(output_pool_size)
+
+    @staticmethod
+    def has_io_uring():
+        """
+        Whether region reads may use io_uring.
+
+        :return: True, if io_uring is supported by the build and the
+            kernel (Linux >= 5.6).
+        """
+        return TiffFileExtension.has_io_uring()
+
+    @staticmethod
+    def get_huge_pages():
+        """
+        Whether large scratch buffers of the reads and writes are backed by
+        huge pages.
+
+        :return: True, if huge pages are used (default = False).
+        """
+        return TiffFileExtension.get_huge_pages()
+
+    @staticmethod
+    def set_huge_pages(huge_pages):
+        """
+        Sets whether scratch buffers of at least 2 MiB are backed by huge
+        pages, which reduces the TLB misses when decoding large tiles and
+        strips. Huge pages are only supported on Linux.
+
+        :param huge_pages: If true, huge pages are used.
+        """
+        TiffFileExtension.set_huge_pages(huge_pages)
+
+    @staticmethod
+    def buffer_pool_stats():
+        """
+        Statistics of the pool of scratch buffers, which keeps the tile,
+        strip and scanline buffers of all reads and writes per thread for
+        reuse.
+
+        :return: A dictionary with the number of buffers allocated from the
+                 system ("allocation_count"), the number of buffers reused
+                 ("reuse_count") and the number of bytes currently cached
+                 ("cached_bytes").
+        """
+        stats = TiffFileExtension.get_buffer_pool_stats()
+        return {
+            'allocation_count': stats.allocation_count,
+            'reuse_count': stats.reuse_count,
+            'cached_bytes': stats.cached_bytes,
+        }
+
+    @property
+    def io_stats(self):
+        """
+        I/O statistics of the subfile and region reads since the last
+        :meth:`reset_io_stats`.
+
+        :return: A dictionary with the number of reads ("read_count"), the
+                 number of bytes read ("bytes_read"), the maximum number of
+                 reads in flight ("max_queue_depth"), the time until the
+                 reads completed in seconds ("read_time"), the resulting
+                 throughput in bytes per second ("throughput") and the
+                 number of bytes read straight into the arrays instead of
+                 being copied from a tile buffer ("bytes_saved").
+        """
+        io_stats = self._tiff_file_ext.get_io_stats()
+        return {
+            'read_count': io_stats.read_count,
+            'bytes_read': io_stats.bytes_read,
+            'max_queue_depth': io_stats.max_queue_depth,
+            'read_time': io_stats.read_time,
+            'bytes_saved': io_stats.bytes_saved,
+            'throughput': (
+                io_stats.bytes_read / io_stats.read_time
+                if io_stats.read_time > 0 else 0.0
+            ),
+        }
+
+    def reset_io_stats(self):
+        """
+        Resets the I/O statistics of the subfile and region reads.
+        """
+        self._tiff_file_ext.reset_io_stats()
+
     def write(self, np_array, tile_size=0):
         """
         Writes a new subfile to the end of the TIFF file.
@@ -129,18 +433,16 @@ class TiffFile:
         """
         return self.write_subfile(np_array, tile_size)
 
-    def write_subfile(self, np_array, tile_size=0, page=None):
+    @staticmethod
+    def _create_subfile_tags(np_array, tile_size, page):
         """
-        Writes a new subfile to the end of the TIFF file.
+        Creates the TIFF Tags of a new subfile.
 
         :param np_array: Image data as a Numpy array.
-        :param tile_size: If set, writes the image in tiles.
-                          Otherwise, writes the image in strips.
-        :param page: Defines the actual page of the subfile.
-                     This parameter expects the tuple (actual_page,
+        :param tile_size: If set, the image is written in tiles.
+        :param page: Page of the subfile as a tuple (actual_page,
                      total_page_number) or None.
-                     If a page is defined, the new subfile's type is set to
-                     "FILETYPE_PAGE" (2), otherwise "undefined" (0).
+        :return: The TIFF Tags of the new subfile.
         """
         bits_per_sample = 0
         if np_array.dtype == np.uint8:
@@ -190,6 +492,23 @@ class TiffFile:
             tiff_tags.page_number.page_number = page[0]
             tiff_tags.page_number.page_count = page[1]
 
+        return tiff_tags
+
+    def write_subfile(self, np_array, tile_size=0, page=None):
+        """
+        Writes a new subfile to the end of the TIFF file.
+
+        :param np_array: Image data as a Numpy array.
+        :param tile_size: If set, writes the image in tiles.
+                          Otherwise, writes the image in strips.
+        :param page: Defines the actual page of the subfile.
+                     This parameter expects the tuple (actual_page,
+                     total_page_number) or None.
+                     If a page is defined, the new subfile's type is set to
+                     "FILETYPE_PAGE" (2), otherwise "undefined" (0).
+        """
+        tiff_tags = self._create_subfile_tags(np_array, tile_size, page)
+
         if np_array.dtype == np.uint8:
             self._tiff_file_ext.write_subfile_8(
                 np_array, tiff_tags, tile_size > 0
@@ -204,14 +523,17 @@ class TiffFile:
                 "Only 8bit and 16bit Numpy arrays are supported."
             )
 
-        self.subfile_tags.append(tiff_tags)
-
     def write_subfile_region(self, np_array, subfile_idx, x1, y1, x2, y2):
         """
         Writes a region into an existing subfile.
 
         .. note:: libtiff does no support altering the contents of a
-                  TIFF file.
+                  TIFF file. Thus, the region of an uncompressed subfile
+                  is overwritten in place. The affected tiles of a
+                  compressed subfile are replaced (copy-on-write), which
+                  leaves unreferenced data until :meth:`compact` is
+                  called. The modified tiles are brought up to date in
+                  the reduced-resolution levels by :meth:`update_pyramid`.
 
         :param np_array: Region data as a Numpy array.
         :param subfile_idx: Index of the subfile.
@@ -236,12 +558,28 @@ class TiffFile:
                 "Only 8bit and 16bit Numpy arrays are supported."
             )
 
-    def write_multiscale_subfile(self, np_array, tile_size):
+    def write_multiscale_subfile(
+        self, np_array, tile_size, sub_ifds=False, threads=0,
+        factors=None, min_level_size=0
+    ):
         """
         Writes a new multi-scale subfile into a TIFF file.
 
+        .. note:: Without sub_ifds, existing data is overwritten!
+
         :param np_array: Image data as a Numpy array.
         :param tile_size: size of the tile width and tile length.
+        :param sub_ifds: If true, writes the reduced-resolution levels as
+                         SubIFDs of the full resolution subfile (OME-TIFF
+                         style) and appends the subfile to the TIFF file.
+                         Otherwise, each level is written as another subfile.
+        :param threads: Number of threads computing the tiles of all levels
+                        (0 = number of hardware threads).
+        :param factors: Downscale factor of each level relative to its parent
+                        level, e.g. [2, 2, 4] for the scales 2, 4 and 16.
+                        The last factor is repeated (default = [2]).
+        :param min_level_size: Minimum width or length of a level
+                               (0 = until a level fits into half a tile).
         """
         tiff_tags = TiffFileExtension.TiffTags()
         tiff_tags.new_subfile_type = 1  # FILETYPE_REDUCEDIMAGE
@@ -261,11 +599,169 @@ class TiffFile:
 
         if np_array.dtype == np.uint8:
             self._tiff_file_ext.write_multiscale_subfile_8(
-                np_array, tiff_tags
+                np_array, tiff_tags, sub_ifds, threads,
+                factors or [], min_level_size
             )
         elif np_array.dtype == np.uint16:
             self._tiff_file_ext.write_multiscale_subfile_16(
-                np_array, tiff_tags
+                np_array, tiff_tags, sub_ifds, threads,
+                factors or [], min_level_size
+            )
+        else:
+            raise RuntimeError(
+                "Cannot write to TIFF file! " +
+                "Only 8bit and 16bit Numpy arrays are supported."
+            )
+
+    def add_levels(
+        self, subfile_idx, sub_ifds=False, factors=None, min_level_size=0
+    ):
+        """
+        Adds reduced-resolution levels to an existing tiled subfile.
+        The image data of the subfile is neither modified nor copied.
+
+        :param subfile_idx: Index of the subfile.
+        :param sub_ifds: If true, writes the reduced-resolution levels as
+                         SubIFDs of the subfile (OME-TIFF style).
+                         Otherwise, each level is appended as another
+                         subfile, which requires the last subfile.
+        :param factors: Downscale factor of each level relative to its parent
+                        level. The last factor is repeated (default = [2]).
+        :param min_level_size: Minimum width or length of a level
+                               (0 = until a level fits into half a tile).
+        """
+        subfile_idx = wrap_index(subfile_idx, len(self.subfile_tags))
+
+        self._tiff_file_ext.add_subfile_levels(
+            subfile_idx, sub_ifds, factors or [], min_level_size
+        )
+
+    def mark_dirty(self, subfile_idx, x1, y1, x2, y2):
+        """
+        Marks a region of a tiled subfile as modified.
+
+        .. seealso:: :func:`update_pyramid`
+
+        :param subfile_idx: Index of the subfile.
+        :param x1: Upper left x-coordinate (incl).
+        :param y1: Upper left y-coordinate (incl).
+        :param x2: Lower right x-coordinate (excl).
+        :param y2: Lower right y-coordinate (excl).
+        """
+        subfile_idx = wrap_index(subfile_idx, len(self.subfile_tags))
+        self._tiff_file_ext.mark_dirty(subfile_idx, x1, y1, x2, y2)
+
+    def update_pyramid(self, subfile_idx):
+        """
+        Recomputes the tiles of all reduced-resolution levels which depend on
+        the modified regions of a subfile. Only the affected tiles are
+        rewritten (copy-on-write).
+
+        :param subfile_idx: Index of the subfile.
+        :return: The number of recomputed tiles.
+        """
+        subfile_idx = wrap_index(subfile_idx, len(self.subfile_tags))
+        return self._tiff_file_ext.update_pyramid(subfile_idx)
+
+    def compact(self):
+        """
+        Rewrites the TIFF file without the data of replaced tiles.
+
+        :return: The number of reclaimed bytes.
+        """
+        return self._tiff_file_ext.compact()
+
+    def open_session(self):
+        """
+        Opens a write session which keeps the TIFF file open.
+        Within the session, :meth:`write_subfile` appends each subfile in
+        constant time, i.e. the TIFF file is neither reopened nor is its
+        directory chain traversed. Each subfile is linked right away, so the
+        TIFF file stays valid if the session is not closed.
+        """
+        self._tiff_file_ext.open_session()
+
+    def close_session(self):
+        """
+        Closes the write session.
+        """
+        self._tiff_file_ext.close_session()
+
+    @property
+    def session_open(self):
+        """
+        Checks whether a write session is open.
+
+        :return: True, if a write session is open.
+        """
+        return self._tiff_file_ext.is_session_open()
+
+    @property
+    def direct_io(self):
+        """
+        Whether write sessions write the image data with direct I/O, i.e.
+        bypassing the page cache (e.g. for very large files).
+        If the file system does not support direct I/O, the data is written
+        through the page cache.
+
+        :return: True, if direct I/O is enabled.
+        """
+        return self._tiff_file_ext.get_direct_io()
+
+    @direct_io.setter
+    def direct_io(self, direct_io):
+        self._tiff_file_ext.set_direct_io(direct_io)
+
+    @contextlib.contextmanager
+    def session(self):
+        """
+        Context manager which opens a write session and closes it on exit.
+
+        Example::
+
+            with tiff_file.session():
+                for frame in frames:
+                    tiff_file.write_subfile(frame)
+        """
+        self.open_session()
+        try:
+            yield self
+        finally:
+            self.close_session()
+
+    def open_writer(self, threads=0, queue_depth=16):
+        """
+        Opens an asynchronous writer for frame-by-frame acquisition.
+        Worker threads compress the frames passed to :meth:`submit` and a
+        single thread appends them in the order of submission.
+
+        :param threads: Number of threads compressing the frames
+                        (0 = number of hardware threads).
+        :param queue_depth: Maximum number of frames in flight before
+                            :meth:`submit` blocks.
+        """
+        self._tiff_file_ext.open_async_writer(threads, queue_depth)
+
+    def submit(self, np_array, tile_size=0, page=None):
+        """
+        Submits a new subfile to the asynchronous writer and returns as soon
+        as the frame is copied. Blocks while the queue is full.
+
+        :param np_array: Image data as a Numpy array.
+        :param tile_size: If set, writes the image in tiles.
+                          Otherwise, writes the image in strips.
+        :param page: Defines the actual page of the subfile, see
+                     :meth:`write_subfile`.
+        """
+        tiff_tags = self._create_subfile_tags(np_array, tile_size, page)
+
+        if np_array.dtype == np.uint8:
+            self._tiff_file_ext.submit_subfile_8(
+                np_array, tiff_tags, tile_size > 0
+            )
+        elif np_array.dtype == np.uint16:
+            self._tiff_file_ext.submit_subfile_16(
+                np_array, tiff_tags, tile_size > 0
             )
         else:
             raise RuntimeError(
@@ -273,7 +769,136 @@ class TiffFile:
                 "Only 8bit and 16bit Numpy arrays are supported."
             )
 
-        self.subfile_tags = [
-            self._tiff_file_ext.get_subfile_tags(subfile_idx)
-            for subfile_idx in range(self._tiff_file_ext.get_subfile_count())
-        ]
+    def flush(self):
+        """
+        Blocks until all submitted subfiles are written and raises the first
+        error of the asynchronous writer.
+        """
+        self._tiff_file_ext.flush()
+
+    def close_writer(self):
+        """
+        Flushes and closes the asynchronous writer and raises its first
+        error.
+        """
+        self._tiff_file_ext.close_async_writer()
+
+    @contextlib.contextmanager
+    def writer(self, threads=0, queue_depth=16):
+        """
+        Context manager which opens an asynchronous writer and closes it on
+        exit.
+
+        Example::
+
+            with tiff_file.writer(queue_depth=32):
+                for frame in camera:
+                    tiff_file.submit(frame)
+
+        :param threads: Number of threads compressing the frames
+                        (0 = number of hardware threads).
+        :param queue_depth: Maximum number of frames in flight before
+                            :meth:`submit` blocks.
+        """
+        self.open_writer(threads, queue_depth)
+        try:
+            yield self
+        finally:
+            self.close_writer()
+
+    def create_stack(self, frame_count, shape, dtype=np.uint16):
+        """
+        Creates a stack of uncompressed frames with a fixed layout. All
+        directories are written up front and the file is allocated at its
+        final size, so :meth:`write_frame` is a single write of the raw
+        frame.
+
+        :param frame_count: Number of frames.
+        :param shape: Shape of a frame as a tuple (length, width).
+        :param dtype: Data type of the frames (np.uint8 or np.uint16).
+        """
+        tiff_tags = TiffFileExtension.TiffTags()
+        tiff_tags.image_width = shape[1]
+        tiff_tags.image_length = shape[0]
+        tiff_tags.bits_per_sample = 8 * np.dtype(dtype).itemsize
+        tiff_tags.compression = 1  # uncompressed
+        tiff_tags.photometric = 1  # min is black
+        tiff_tags.samples_per_pixel = 1
+        tiff_tags.min_sample_value = 0
+        tiff_tags.max_sample_value = np.iinfo(dtype).max
+        tiff_tags.planar_config = 1  # chunky format
+        tiff_tags.sample_format = 1  # unsigned integer
+
+        self._tiff_file_ext.create_stack(frame_count, tiff_tags)
+
+    def write_frame(self, np_array, frame_idx):
+        """
+        Writes a frame into the stack created by :meth:`create_stack`.
+
+        :param np_array: Frame data as a Numpy array.
+        :param frame_idx: Index of the frame.
+        """
+        if np_array.dtype == np.uint8:
+            self._tiff_file_ext.write_stack_frame_8(np_array, frame_idx)
+        elif np_array.dtype == np.uint16:
+            self._tiff_file_ext.write_stack_frame_16(np_array, frame_idx)
+        else:
+            raise RuntimeError(
+                "Cannot write to TIFF file! " +
+                "Only 8bit and 16bit Numpy arrays are supported."
+            )
+
+    def close_stack(self):
+        """
+        Closes the stack.
+        """
+        self._tiff_file_ext.close_stack()
+
+    def refresh(self):
+        """
+        Reads the subfiles which were appended since the last refresh, e.g.
+        by another process which is still acquiring. Only the new
+        directories are visited.
+
+        :return: The number of new subfiles.
+        """
+        return self._tiff_file_ext.refresh()
+
+    def watch(self, callback, interval=1.0):
+        """
+        Starts a background thread which refreshes the TIFF file whenever it
+        is modified (at least once per interval) and calls the callback with
+        the number of new subfiles.
+
+        :param callback: Function called as callback(new_subfile_count).
+        :param interval: Maximum time between two refreshes in seconds.
+        """
+        if self._watcher is not None:
+            raise RuntimeError("The TIFF file is already watched!")
+
+        stop_event = threading.Event()
+
+        def run():
+            while not stop_event.is_set():
+                self._tiff_file_ext.wait_for_change(int(interval * 1000))
+                if stop_event.is_set():
+                    break
+                new_subfile_count = self.refresh()
+                if new_subfile_count > 0:
+                    callback(new_subfile_count)
+
+        thread = threading.Thread(target=run, daemon=True)
+        thread.start()
+        self._watcher = (thread, stop_event)
+
+    def stop_watching(self):
+        """
+        Stops the watcher started by :meth:`watch`.
+        """
+        if self._watcher is None:
+            return
+
+        thread, stop_event = self._watcher
+        stop_event.set()
+        thread.join()
+        self._watcher = None
@@ -3,9 +3,13 @@ Unittests for pylibtiff.ext.tiff_file module.
 """
 import numpy as np
 import os
+import shutil
+import struct
 import unittest
+import zlib
 
 from pylibtiff.ext.tiff_file import TiffFile
+from tests.tiff_samples import write_subfile_chain
 
 
 def parameterized(params_list):
@@ -17,6 +21,59 @@ def parameterized(params_list):
     return parameterized_decorator
 
 
+def write_sparse_tiff(file_path, image_width, image_length, tile_size, dtype, tiles):
+    """
+    Writes a BigTIFF file with a single Deflate compressed and tiled subfile. All tiles share a
+    single zero tile except for the given tiles, so that the image may be far larger than the file.
+    :param file_path: Path of the file.
+    :param image_width: Width of the image.
+    :param image_length: Length of the image.
+    :param tile_size: Width and length of the tiles.
+    :param dtype: Data type of the image (uint8 or uint16).
+    :param tiles: Dictionary of tiles by (tile column, tile row).
+    """
+    dtype = np.dtype(dtype).newbyteorder('<')
+    tiles_across = (image_width + tile_size - 1) // tile_size
+    tiles_down = (image_length + tile_size - 1) // tile_size
+    chunks = [zlib.compress(np.zeros((tile_size, tile_size), dtype).tobytes())]
+    chunk_indices = np.zeros(tiles_across * tiles_down, dtype=np.int64)
+    for (tile_column, tile_row), tile in tiles.items():
+        chunk_indices[tile_row * tiles_across + tile_column] = len(chunks)
+        chunks.append(zlib.compress(tile.astype(dtype).tobytes()))
+
+    chunk_offsets = 16 + np.cumsum([0] + [len(chunk) for chunk in chunks[:-1]])
+    offsets_offset = 16 + sum(len(chunk) for chunk in chunks)
+    counts_offset = offsets_offset + 8 * chunk_indices.size
+    ifd_offset = counts_offset + 8 * chunk_indices.size
+    tile_offsets = chunk_offsets[chunk_indices].astype('<u8')
+    tile_byte_counts = np.array([len(chunk) for chunk in chunks])[chunk_indices].astype('<u8')
+
+    # a single offset and byte count are stored in the directory entry itself
+    single = chunk_indices.size == 1
+    entries = [
+        (256, 4, 1, image_width),
+        (257, 4, 1, image_length),
+        (258, 3, 1, dtype.itemsize * 8),
+        (259, 3, 1, 8),  # Deflate
+        (262, 3, 1, 1),  # min is black
+        (277, 3, 1, 1),
+        (322, 4, 1, tile_size),
+        (323, 4, 1, tile_size),
+        (324, 16, chunk_indices.size, int(tile_offsets[0]) if single else offsets_offset),
+        (325, 16, chunk_indices.size, int(tile_byte_counts[0]) if single else counts_offset),
+    ]
+    with open(file_path, 'wb') as f:
+        f.write(b'II' + struct.pack('<HHHQ', 43, 8, 0, ifd_offset))
+        for chunk in chunks:
+            f.write(chunk)
+        f.write(tile_offsets.tobytes())
+        f.write(tile_byte_counts.tobytes())
+        f.write(struct.pack('<Q', len(entries)))
+        for entry in entries:
+            f.write(struct.pack('<HHQQ', *entry))
+        f.write(struct.pack('<Q', 0))
+
+
 class TiffFileTests(unittest.TestCase):
     """
     A simple test suite for the pylibtiff.ext.tiff_file module.
@@ -94,6 +151,16 @@ class TiffFileTests(unittest.TestCase):
             isinstance(ptif.get_subfile_tags(0), TiffFile.TiffTags)
         )
 
+    @parameterized(parameter_list)
+    def test_get_subfile_level_count(
+        self, file_path, is_tiled, bits_per_sample
+    ):
+        """
+        Test for the TiffFile.get_subfile_level_count() method.
+        """
+        ptif = TiffFile(file_path)
+        self.assertEqual(ptif.get_subfile_level_count(0), 1)
+
     @parameterized(parameter_list)
     def test_get_subfile_type(self, file_path, is_tiled, bits_per_sample):
         """
@@ -365,18 +432,861 @@ class TiffFileTests(unittest.TestCase):
             if os.path.exists('./tests/data/test.tif'):
                 os.remove('./tests/data/test.tif')
 
-    def test_write_subfile_region(self):
+    @parameterized(parameter_list)
+    def test_write_subfile_region(self, file_path, is_tiled, bits_per_sample):
         """
         Test for the TiffFile.write_subfile_region_8() and
         TiffFile.write_subfile_region_16() methods.
         """
-        ptif = TiffFile("./tests/data/grad1024_tiled_8bpp_32bit.tif")
-        arr8 = np.ones((512, 512), dtype=np.uint8) * 255
-        arr16 = np.ones((512, 512), dtype=np.uint16) * 255
+        try:
+            shutil.copyfile(file_path, './tests/data/test.tif')
+            ptif = TiffFile('./tests/data/test.tif')
+
+            dtype = np.uint8 if bits_per_sample == 8 else np.uint16
+            arr = np.arange(300 * 500, dtype=dtype).reshape((300, 500))
+            expected = ptif.read_subfile_region_8(0, 0, 0, 1024, 1024) \
+                if bits_per_sample == 8 \
+                else ptif.read_subfile_region_16(0, 0, 0, 1024, 1024)
+            expected[200:500, 100:600] = arr
+
+            if bits_per_sample == 8:
+                ptif.write_subfile_region_8(arr, 0, 100, 200, 600, 500)
+                with self.assertRaises(RuntimeError):
+                    ptif.write_subfile_region_16(arr.astype(np.uint16), 0, 100, 200, 600, 500)
+                actual = ptif.read_subfile_8(0)
+            else:
+                ptif.write_subfile_region_16(arr, 0, 100, 200, 600, 500)
+                with self.assertRaises(RuntimeError):
+                    ptif.write_subfile_region_8(arr.astype(np.uint8), 0, 100, 200, 600, 500)
+                actual = ptif.read_subfile_16(0)
+            np.testing.assert_array_equal(actual, expected)
+            self.assertEqual(os.path.getsize('./tests/data/test.tif'), os.path.getsize(file_path))
+
+            with self.assertRaises(RuntimeError):
+                ptif.write_subfile_region_8(np.zeros((2, 2), dtype=np.uint8), 0, 0, 0, 3, 3)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_write_subfile_region_compressed(self):
+        """
+        Test for the TiffFile.write_subfile_region_8() and
+        TiffFile.compact() methods using a compressed subfile.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+
+            arr = np.arange(100 * 100, dtype=np.uint8).reshape((100, 100))
+
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.image_width = 100
+            tiff_tags.image_length = 100
+            tiff_tags.bits_per_sample = 8
+            tiff_tags.compression = 5  # LZW
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+            tiff_tags.tile_width = 16
+            tiff_tags.tile_length = 16
+            ptif.write_subfile_8(arr, tiff_tags, True)
+
+            region = np.full((10, 10), 7, dtype=np.uint8)
+            ptif.write_subfile_region_8(region, 0, 45, 45, 55, 55)
+            arr[45:55, 45:55] = region
+            np.testing.assert_array_equal(ptif.read_subfile_8(0), arr)
+
+            file_size = os.path.getsize('./tests/data/test.tif')
+            self.assertGreater(ptif.compact(), 0)
+            self.assertLess(os.path.getsize('./tests/data/test.tif'), file_size)
+            self.assertEqual(ptif.compact(), 0)
+
+            ptif = TiffFile('./tests/data/test.tif')
+            np.testing.assert_array_equal(ptif.read_subfile_8(0), arr)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_write_subfile_region_strips(self):
+        """
+        Test for the TiffFile.write_subfile_region_8() methods using a
+        compressed scanline-based subfile.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+
+            arr = np.arange(100 * 100, dtype=np.uint8).reshape((100, 100))
+
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.image_width = 100
+            tiff_tags.image_length = 100
+            tiff_tags.bits_per_sample = 8
+            tiff_tags.compression = 8  # Deflate
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+            tiff_tags.rows_per_strip = 8
+            ptif.write_subfile_8(arr, tiff_tags, False)
+
+            region = np.full((20, 30), 7, dtype=np.uint8)
+            ptif.write_subfile_region_8(region, 0, 10, 30, 40, 50)
+            arr[30:50, 10:40] = region
+            np.testing.assert_array_equal(ptif.read_subfile_8(0), arr)
+
+            # the rows 30 to 49 are stored in the strips 3 to 6
+            self.assertGreater(ptif.compact(), 0)
+            np.testing.assert_array_equal(ptif.read_subfile_8(0), arr)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_session(self):
+        """
+        Test for the TiffFile.open_session() and TiffFile.close_session()
+        methods.
+        """
+        try:
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.image_width = 40
+            tiff_tags.image_length = 30
+            tiff_tags.bits_per_sample = 16
+            tiff_tags.compression = 5  # LZW
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+            tiff_tags.tile_width = 16
+            tiff_tags.tile_length = 16
+
+            frames = [
+                np.full((30, 40), frame_idx, dtype=np.uint16)
+                for frame_idx in range(50)
+            ]
+
+            ptif = TiffFile('./tests/data/test.tif', 43)
+            ptif.write_subfile_16(frames[0], tiff_tags, True)
+            ptif.open_session()
+            self.assertTrue(ptif.is_session_open())
+            for frame in frames[1:]:
+                ptif.write_subfile_16(frame, tiff_tags, True)
+            self.assertEqual(ptif.get_subfile_count(), 50)
+            np.testing.assert_array_equal(ptif.read_subfile_16(20), frames[20])
+
+            with self.assertRaises(RuntimeError):
+                ptif.write_subfile_16(frames[0], tiff_tags, False)
+            with self.assertRaises(RuntimeError):
+                ptif.compact()
+            ptif.close_session()
+            self.assertFalse(ptif.is_session_open())
+
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(ptif.get_version(), 43)
+            self.assertEqual(ptif.get_subfile_count(), 50)
+            for subfile_idx, frame in enumerate(frames):
+                np.testing.assert_array_equal(ptif.read_subfile_16(subfile_idx), frame)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_direct_io(self):
+        """
+        Test for the TiffFile.set_direct_io() method.
+        """
+        try:
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.image_width = 333
+            tiff_tags.image_length = 111
+            tiff_tags.bits_per_sample = 16
+            tiff_tags.compression = 8  # Deflate
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+            tiff_tags.rows_per_strip = 16
+
+            frames = [
+                np.random.randint(0, 65535, (111, 333), dtype=np.uint16)
+                for _ in range(10)
+            ]
+
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertFalse(ptif.get_direct_io())
+            ptif.set_direct_io(True)
+            self.assertTrue(ptif.get_direct_io())
+            ptif.write_subfile_16(frames[0], tiff_tags, False)
+            ptif.open_session()
+            with self.assertRaises(RuntimeError):
+                ptif.set_direct_io(False)
+            for frame in frames[1:]:
+                ptif.write_subfile_16(frame, tiff_tags, False)
+            ptif.close_session()
+
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(ptif.get_subfile_count(), 10)
+            for subfile_idx, frame in enumerate(frames):
+                np.testing.assert_array_equal(ptif.read_subfile_16(subfile_idx), frame)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_async_writer(self):
+        """
+        Test for the TiffFile.submit_subfile_8() methods.
+        """
+        try:
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.image_width = 64
+            tiff_tags.image_length = 48
+            tiff_tags.bits_per_sample = 8
+            tiff_tags.compression = 8  # Deflate
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+            tiff_tags.tile_width = 16
+            tiff_tags.tile_length = 16
+
+            frames = [
+                np.full((48, 64), frame_idx, dtype=np.uint8)
+                for frame_idx in range(30)
+            ]
+
+            ptif = TiffFile('./tests/data/test.tif')
+            ptif.open_async_writer(threads=2, queue_depth=4)
+            for frame in frames:
+                ptif.submit_subfile_8(frame, tiff_tags, True)
+            ptif.flush()
+            self.assertEqual(ptif.get_subfile_count(), 30)
+
+            # methods which rewrite the file must not interleave with the appends
+            with self.assertRaises(RuntimeError):
+                ptif.write_subfile_region_8(frames[1][:16, :16], 0, 0, 0, 16, 16)
+            with self.assertRaises(RuntimeError):
+                ptif.write_multiscale_subfile_8(frames[0], tiff_tags, True)
+            with self.assertRaises(RuntimeError):
+                ptif.add_subfile_levels(0, True)
+            ptif.mark_dirty(0, 0, 0, 16, 16)
+            with self.assertRaises(RuntimeError):
+                ptif.update_pyramid(0)
+            with self.assertRaises(RuntimeError):
+                ptif.compact()
+            self.assertEqual(ptif.get_subfile_count(), 30)
+
+            # the first error is raised by flush() and the frames in front
+            # of the failed frame are kept
+            invalid_tags = TiffFile.TiffTags()
+            invalid_tags.image_width = 64
+            invalid_tags.image_length = 48
+            invalid_tags.bits_per_sample = 8
+            invalid_tags.photometric = 1  # min is black
+            invalid_tags.tile_width = 16
+            invalid_tags.tile_length = 32
+            ptif.submit_subfile_8(frames[0], tiff_tags, True)
+            ptif.submit_subfile_8(frames[1], invalid_tags, True)
+            with self.assertRaises(RuntimeError):
+                ptif.flush()
+            self.assertEqual(ptif.get_subfile_count(), 31)
+            ptif.close_async_writer()
+
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(ptif.get_subfile_count(), 31)
+            for subfile_idx, frame in enumerate(frames + frames[:1]):
+                np.testing.assert_array_equal(ptif.read_subfile_8(subfile_idx), frame)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_stack(self):
+        """
+        Test for the TiffFile.create_stack() and
+        TiffFile.write_stack_frame_16() methods.
+        """
+        try:
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.image_width = 70
+            tiff_tags.image_length = 50
+            tiff_tags.bits_per_sample = 16
+            tiff_tags.compression = 1  # uncompressed
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+
+            ptif = TiffFile('./tests/data/test.tif', 43)
+            ptif.create_stack(20, tiff_tags)
+            self.assertEqual(ptif.get_subfile_count(), 20)
+            file_size = os.path.getsize('./tests/data/test.tif')
+
+            frames = [
+                np.full((50, 70), 1000 + frame_idx, dtype=np.uint16)
+                for frame_idx in range(20)
+            ]
+            for frame_idx in reversed(range(1, 20)):
+                ptif.write_stack_frame_16(frames[frame_idx], frame_idx)
+            with self.assertRaises(IndexError):
+                ptif.write_stack_frame_16(frames[0], 20)
+            with self.assertRaises(RuntimeError):
+                ptif.write_stack_frame_8(frames[0].astype(np.uint8), 0)
+            ptif.close_stack()
+            self.assertEqual(os.path.getsize('./tests/data/test.tif'), file_size)
+
+            # the frame which was not written reads as zeros
+            frames[0][:] = 0
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(ptif.get_subfile_count(), 20)
+            for subfile_idx, frame in enumerate(frames):
+                np.testing.assert_array_equal(ptif.read_subfile_16(subfile_idx), frame)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_refresh(self):
+        """
+        Test for the TiffFile.refresh() method.
+        """
+        try:
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.image_width = 40
+            tiff_tags.image_length = 30
+            tiff_tags.bits_per_sample = 8
+            tiff_tags.compression = 5  # LZW
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+            tiff_tags.rows_per_strip = 8
+
+            frames = [
+                np.full((30, 40), frame_idx, dtype=np.uint8)
+                for frame_idx in range(5)
+            ]
+
+            reader = TiffFile('./tests/data/test.tif')
+            writer = TiffFile('./tests/data/test.tif')
+            self.assertEqual(reader.refresh(), 0)
+            self.assertFalse(reader.wait_for_change(10))
+
+            # modifications between two waits are reported right away
+            for frame in frames[:2]:
+                writer.write_subfile_8(frame, tiff_tags, False)
+            self.assertTrue(reader.wait_for_change(0))
+            self.assertEqual(reader.refresh(), 2)
+            self.assertFalse(reader.wait_for_change(0))
+
+            writer.open_session()
+            for frame in frames[2:]:
+                writer.write_subfile_8(frame, tiff_tags, False)
+            self.assertTrue(reader.wait_for_change(0))
+            self.assertEqual(reader.refresh(), 3)
+            self.assertEqual(reader.refresh(), 0)
+            writer.close_session()
+
+            self.assertEqual(reader.get_subfile_count(), 5)
+            for subfile_idx, frame in enumerate(frames):
+                np.testing.assert_array_equal(reader.read_subfile_8(subfile_idx), frame)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_get_subfile_tags_array(self):
+        """
+        Test for the TiffFile.get_subfile_tags_array() method.
+        """
+        try:
+            writer = TiffFile('./tests/data/test.tif')
+            for frame_idx in range(10):
+                tiff_tags = TiffFile.TiffTags()
+                tiff_tags.image_width = 40 + frame_idx
+                tiff_tags.image_length = 30
+                tiff_tags.bits_per_sample = 8
+                tiff_tags.compression = 5 if frame_idx % 2 else 1
+                tiff_tags.photometric = 1  # min is black
+                tiff_tags.samples_per_pixel = 1
+                tiff_tags.rows_per_strip = 8
+                writer.write_subfile_8(
+                    np.full((30, 40 + frame_idx), frame_idx, dtype=np.uint8), tiff_tags, False
+                )
+
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(ptif.get_subfile_count(), 10)
+            self.assertEqual(ptif.get_image_width(7), 47)
+            tags_array = ptif.get_subfile_tags_array()
+            self.assertEqual(tags_array.shape, (10,))
+            np.testing.assert_array_equal(tags_array['image_width'], np.arange(40, 50))
+            np.testing.assert_array_equal(tags_array['compression'], [1, 5] * 5)
+            np.testing.assert_array_equal(tags_array['rows_per_strip'], 8)
+            for subfile_idx in range(10):
+                tiff_tags = ptif.get_subfile_tags(subfile_idx)
+                self.assertEqual(tiff_tags.image_width, tags_array['image_width'][subfile_idx])
+                self.assertEqual(tiff_tags.compression, tags_array['compression'][subfile_idx])
+                np.testing.assert_array_equal(
+                    ptif.read_subfile_8(subfile_idx), np.full((30, 40 + subfile_idx), subfile_idx, dtype=np.uint8)
+                )
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_native_ifd_parser(self):
+        """
+        Test for reading the TIFF Tags of a file without libtiff, which must
+        match those read by libtiff from the same file in memory.
+        """
+        try:
+            for version in [42, 43]:
+                tiff_tags = TiffFile.TiffTags()
+                tiff_tags.new_subfile_type = 1  # reduced image type
+                tiff_tags.image_width = 100
+                tiff_tags.image_length = 70
+                tiff_tags.bits_per_sample = 8
+                tiff_tags.compression = 8  # Deflate
+                tiff_tags.photometric = 1  # min is black
+                tiff_tags.samples_per_pixel = 1
+                tiff_tags.tile_width = 32
+                tiff_tags.tile_length = 32
+
+                ptif = TiffFile('./tests/data/test.tif', version)
+                ptif.write_multiscale_subfile_8(np.zeros((70, 100), dtype=np.uint8), tiff_tags, True)
+                tiff_tags.compression = 1
+                ptif.write_subfile_8(np.zeros((70, 100), dtype=np.uint8), tiff_tags, True)
+
+                ptif = TiffFile('./tests/data/test.tif')
+                with open('./tests/data/test.tif', 'rb') as f:
+                    mem_tif = TiffFile.from_buffer(f.read())
+                np.testing.assert_array_equal(ptif.get_subfile_tags_array(), mem_tif.get_subfile_tags_array())
+                for subfile_idx in range(ptif.get_subfile_count()):
+                    self.assertEqual(
+                        ptif.get_subfile_level_count(subfile_idx), mem_tif.get_subfile_level_count(subfile_idx)
+                    )
+                    for level in range(ptif.get_subfile_level_count(subfile_idx)):
+                        self.assertEqual(
+                            ptif.get_subfile_level_tags(subfile_idx, level).image_width,
+                            mem_tif.get_subfile_level_tags(subfile_idx, level).image_width
+                        )
+                os.remove('./tests/data/test.tif')
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_scan_metadata(self):
+        """
+        Test for the TiffFile.scan_metadata() method.
+        """
+        try:
+            writer = TiffFile('./tests/data/test.tif', 43)
+            for frame_idx in range(3):
+                tiff_tags = TiffFile.TiffTags()
+                tiff_tags.image_width = 40
+                tiff_tags.image_length = 30
+                tiff_tags.bits_per_sample = 16
+                tiff_tags.compression = 8  # Deflate
+                tiff_tags.photometric = 1  # min is black
+                tiff_tags.samples_per_pixel = 1
+                tiff_tags.tile_width = 16
+                tiff_tags.tile_length = 16
+                writer.write_subfile_16(np.zeros((30, 40), dtype=np.uint16), tiff_tags, True)
+
+            file_paths = [param['file_path'] for param in self.parameter_list]
+            file_paths += ['./tests/data/test.tif', './tests/data/missing.tif']
+            file_paths += ['./tests/ext/tiff_file_tests.py']  # not a TIFF file
+            metadata = TiffFile.scan_metadata(file_paths, threads=2)
+            self.assertEqual(metadata.shape, (len(file_paths),))
+            np.testing.assert_array_equal(metadata['valid'], [True] * 5 + [False] * 2)
+            for file_idx, file_path in enumerate(file_paths[:5]):
+                ptif = TiffFile(file_path)
+                tiff_tags = ptif.get_subfile_tags(0)
+                self.assertEqual(metadata['version'][file_idx], ptif.get_version())
+                self.assertEqual(metadata['file_size'][file_idx], os.path.getsize(file_path))
+                self.assertEqual(metadata['subfile_count'][file_idx], ptif.get_subfile_count())
+                self.assertEqual(metadata['level_count'][file_idx], ptif.get_subfile_level_count(0))
+                self.assertEqual(metadata['tiff_tags']['image_width'][file_idx], tiff_tags.image_width)
+                self.assertEqual(
+                    metadata['tiff_tags']['bits_per_sample'][file_idx], tiff_tags.bits_per_sample
+                )
+                self.assertEqual(metadata['tiff_tags']['compression'][file_idx], tiff_tags.compression)
+                self.assertEqual(metadata['tiff_tags']['tile_width'][file_idx], tiff_tags.tile_width)
+            self.assertEqual(metadata['version'][4], 43)
+            self.assertEqual(metadata['subfile_count'][4], 3)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_use_index(self):
+        """
+        Test for opening a TiffFile by its sidecar index.
+        """
+        try:
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.image_width = 100
+            tiff_tags.image_length = 80
+            tiff_tags.bits_per_sample = 8
+            tiff_tags.compression = 1
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+            tiff_tags.tile_width = 32
+            tiff_tags.tile_length = 32
+
+            frames = [
+                np.full((80, 100), frame_idx, dtype=np.uint8)
+                for frame_idx in range(8)
+            ]
+
+            writer = TiffFile('./tests/data/test.tif')
+            for frame in frames[:5]:
+                writer.write_subfile_8(frame, tiff_tags, True)
+            self.assertFalse(os.path.exists('./tests/data/test.tif.idx'))
+
+            ptif = TiffFile('./tests/data/test.tif', use_index=True)
+            self.assertTrue(os.path.exists('./tests/data/test.tif.idx'))
+
+            # the index is loaded and extended by the appended subfiles
+            for frame in frames[5:]:
+                writer.write_subfile_8(frame, tiff_tags, True)
+            ptif = TiffFile('./tests/data/test.tif', use_index=True)
+            self.assertEqual(ptif.get_subfile_count(), 8)
+            for subfile_idx, frame in enumerate(frames):
+                self.assertEqual(ptif.get_subfile_tags(subfile_idx).tile_width, 32)
+                np.testing.assert_array_equal(ptif.read_subfile_8(subfile_idx), frame)
+            np.testing.assert_array_equal(
+                ptif.read_subfile_region_8(7, 10, 20, 90, 70), frames[7][20:70, 10:90]
+            )
+
+            # modifications of existing subfiles invalidate the index
+            ptif.write_subfile_region_8(frames[0][:32, :32], 7, 0, 0, 32, 32)
+            self.assertFalse(os.path.exists('./tests/data/test.tif.idx'))
+            ptif = TiffFile('./tests/data/test.tif', use_index=True)
+            self.assertEqual(ptif.get_subfile_count(), 8)
+            np.testing.assert_array_equal(ptif.read_subfile_region_8(7, 0, 0, 32, 32), frames[0][:32, :32])
+
+            # as well as by a TiffFile which does not use the index
+            writer.write_subfile_region_8(frames[1][:32, :32], 7, 0, 0, 32, 32)
+            self.assertFalse(os.path.exists('./tests/data/test.tif.idx'))
+
+            # a replaced file whose last indexed directory moved is parsed again
+            ptif = TiffFile('./tests/data/test.tif', use_index=True)
+            self.assertTrue(os.path.exists('./tests/data/test.tif.idx'))
+            writer = TiffFile('./tests/data/replaced.tif')
+            writer.write_subfile_8(frames[0], tiff_tags, True)
+            tiff_tags.tile_width = 16
+            tiff_tags.tile_length = 16
+            for frame in frames[1:] + frames:
+                writer.write_subfile_8(frame, tiff_tags, True)
+            os.replace('./tests/data/replaced.tif', './tests/data/test.tif')
+            ptif = TiffFile('./tests/data/test.tif', use_index=True)
+            self.assertEqual(ptif.get_subfile_count(), 16)
+            self.assertEqual(ptif.get_subfile_tags(15).tile_width, 16)
+            np.testing.assert_array_equal(ptif.read_subfile_8(15), frames[7])
+        finally:
+            for path in ['./tests/data/test.tif', './tests/data/test.tif.idx', './tests/data/replaced.tif']:
+                if os.path.exists(path):
+                    os.remove(path)
+
+    @parameterized(parameter_list)
+    def test_read_subfile_regions(self, file_path, is_tiled, bits_per_sample):
+        """
+        Test for the TiffFile.read_subfile_regions_X() methods.
+        """
+        tiff_file = TiffFile(file_path)
+        regions = [(0, 0, 64, 64), (100, 0, 300, 50), (0, 0, 1024, 10)]
+        if is_tiled:
+            regions.append((1000, 1000, 1024, 1024))
+
+        if bits_per_sample == 8:
+            expected = [tiff_file.read_subfile_region_8(0, *region) for region in regions]
+            tiff_file.reset_io_stats()
+            arrays = tiff_file.read_subfile_regions_8(0, regions)
+        else:
+            expected = [tiff_file.read_subfile_region_16(0, *region) for region in regions]
+            tiff_file.reset_io_stats()
+            arrays = tiff_file.read_subfile_regions_16(0, regions)
+
+        self.assertEqual(len(arrays), len(regions))
+        for array, expected_array in zip(arrays, expected):
+            np.testing.assert_array_equal(array, expected_array)
+
+        io_stats = tiff_file.get_io_stats()
+        self.assertGreater(io_stats.read_count, 0)
+        self.assertGreater(io_stats.bytes_read, 0)
+        tiff_file.reset_io_stats()
+        self.assertEqual(tiff_file.get_io_stats().read_count, 0)
+
+    def test_read_gap(self):
+        """
+        Test for the TiffFile.set_read_gap() method.
+        """
+        tiff_file = TiffFile('./tests/data/grad1024_tiled_8bpp_32bit.tif')
+        self.assertEqual(tiff_file.get_read_gap(), 64 * 1024)
+
+        # the uncompressed 128 x 128 tiles of the first row are stored back
+        # to back (16 KiB each), so the regions within every other tile are
+        # one tile apart. The reads of the header and the directory are
+        # counted by a region within a single tile.
+        tiff_file.set_queue_depth(1)
+        tiff_file.reset_io_stats()
+        tiff_file.read_subfile_regions_8(0, [(0, 0, 1, 1)])
+        directory_read_count = tiff_file.get_io_stats().read_count - 1
+
+        regions = [(x, 0, x + 1, 1) for x in range(0, 1024, 256)]
+        for read_gap, tile_read_count in [(0, 4), (16 * 1024 - 1, 4), (16 * 1024, 1), (1024 * 1024, 1)]:
+            tiff_file.set_read_gap(read_gap)
+            tiff_file.reset_io_stats()
+            arrays = tiff_file.read_subfile_regions_8(0, regions)
+            self.assertEqual(tiff_file.get_io_stats().read_count, directory_read_count + tile_read_count)
+            for region, array in zip(regions, arrays):
+                np.testing.assert_array_equal(array, tiff_file.read_subfile_region_8(0, *region))
+
+    def test_queue_depth(self):
+        """
+        Test for the TiffFile.set_queue_depth() method.
+        """
+        tiff_file = TiffFile('./tests/data/grad1024_tiled_16bpp_32bit.tif')
+        self.assertEqual(tiff_file.get_queue_depth(), 64)
+
+        # one read per tile, e.g. all tiles in flight at once with io_uring
+        tiff_file.set_read_gap(0)
+        regions = [(x, y, x + 10, y + 10) for y in range(0, 1024, 256) for x in range(0, 1024, 256)]
+        expected = [tiff_file.read_subfile_region_16(0, *region) for region in regions]
+        for queue_depth in [0, 4, 64]:
+            tiff_file.set_queue_depth(queue_depth)
+            tiff_file.reset_io_stats()
+            arrays = tiff_file.read_subfile_regions_16(0, regions)
+            for array, expected_array in zip(arrays, expected):
+                np.testing.assert_array_equal(array, expected_array)
+
+            io_stats = tiff_file.get_io_stats()
+            if queue_depth > 1 and TiffFile.has_io_uring():
+                self.assertGreater(io_stats.max_queue_depth, 1)
+                self.assertLessEqual(io_stats.max_queue_depth, queue_depth)
+            else:
+                self.assertEqual(io_stats.max_queue_depth, 1)
+            self.assertGreaterEqual(io_stats.read_time, 0)
+
+    @parameterized(parameter_list)
+    def test_readahead(self, file_path, is_tiled, bits_per_sample):
+        """
+        Test for the TiffFile.set_readahead() method.
+        """
+        tiff_file = TiffFile(file_path)
+        self.assertEqual(tiff_file.get_readahead(), 16 * 1024 * 1024)
+
+        # the subfile read from memory is decoded by libtiff in raster order
+        with open(file_path, 'rb') as f:
+            mem_file = TiffFile.from_buffer(f.read())
+        read_subfile = 'read_subfile_8' if bits_per_sample == 8 else 'read_subfile_16'
+        expected = getattr(mem_file, read_subfile)(0)
+        for readahead in [0, 4096, 16 * 1024 * 1024]:
+            tiff_file.set_readahead(readahead)
+            self.assertEqual(tiff_file.get_readahead(), readahead)
+            np.testing.assert_array_equal(getattr(tiff_file, read_subfile)(0), expected)
+
+    def test_direct_read(self):
+        """
+        Test for reading interior tiles straight into the array.
+        """
+        try:
+            image = np.arange(200 * 300, dtype=np.uint16).reshape((200, 300))
+            for compression in [1, 8]:  # uncompressed, Deflate
+                tiff_tags = TiffFile.TiffTags()
+                tiff_tags.image_width = 300
+                tiff_tags.image_length = 200
+                tiff_tags.bits_per_sample = 16
+                tiff_tags.compression = compression
+                tiff_tags.photometric = 1  # min is black
+                tiff_tags.samples_per_pixel = 1
+                tiff_tags.tile_width = 64
+                tiff_tags.tile_length = 64
+                TiffFile('./tests/data/test.tif').write_subfile_16(image, tiff_tags, True)
+
+                ptif = TiffFile('./tests/data/test.tif')
+                np.testing.assert_array_equal(ptif.read_subfile_16(0), image)
+                np.testing.assert_array_equal(ptif.read_subfile_region_16(0, 10, 5, 290, 190), image[5:190, 10:290])
+                np.testing.assert_array_equal(ptif.read_subfile_region_16(0, 64, 0, 128, 200), image[:, 64:128])
+                bytes_saved = ptif.get_io_stats().bytes_saved
+                if compression == 1:
+                    # all but the last column of tiles are interior tiles of the subfile
+                    self.assertGreaterEqual(bytes_saved, 256 * 200 * 2)
+                else:
+                    # only tiles whose rows are contiguous within the region are decoded into it
+                    self.assertEqual(bytes_saved, 3 * 64 * 64 * 2)
+                os.remove('./tests/data/test.tif')
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    @parameterized(parameter_list)
+    def test_output_pool_size(self, file_path, is_tiled, bits_per_sample):
+        """
+        Test for the TiffFile.set_output_pool_size() method.
+        """
+        tiff_file = TiffFile(file_path)
+        self.assertEqual(tiff_file.get_output_pool_size(), 0)
+        read_subfile = 'read_subfile_8' if bits_per_sample == 8 else 'read_subfile_16'
+        read_subfile_region = 'read_subfile_region_8' if bits_per_sample == 8 else 'read_subfile_region_16'
+        expected = getattr(tiff_file, read_subfile)(0)
+
+        tiff_file.set_output_pool_size(2)
+        self.assertEqual(tiff_file.get_output_pool_size(), 2)
+        first = getattr(tiff_file, read_subfile)(0)
+        second = getattr(tiff_file, read_subfile)(0)
+        self.assertNotEqual(first.ctypes.data, second.ctypes.data)
+
+        # a full ring whose arrays are in use falls back to a new array
+        third = getattr(tiff_file, read_subfile)(0)
+        self.assertNotIn(third.ctypes.data, [first.ctypes.data, second.ctypes.data])
+
+        # released arrays are reused, while views keep an array in use
+        addresses = [first.ctypes.data, second.ctypes.data]
+        view = first[10:20]
+        del first, second, third
+        frame = getattr(tiff_file, read_subfile)(0)
+        self.assertEqual(frame.ctypes.data, addresses[1])
+        np.testing.assert_array_equal(frame, expected)
+        np.testing.assert_array_equal(view, expected[10:20])
+
+        # regions of the same shape share a ring
+        region = getattr(tiff_file, read_subfile_region)(0, 10, 20, 110, 70)
+        address = region.ctypes.data
+        del region
+        region = getattr(tiff_file, read_subfile_region)(0, 30, 40, 130, 90)
+        self.assertEqual(region.ctypes.data, address)
+        np.testing.assert_array_equal(region, expected[40:90, 30:130])
+
+        # each read returns a new array viewing the pooled array
+        self.assertFalse(region.flags.owndata)
+        other_region = getattr(tiff_file, read_subfile_region)(0, 30, 40, 130, 90)
+        self.assertIsNot(other_region.base, region.base)
+
+        # only the shapes read last are pooled, the others stay valid while in use
+        for width in range(1, 10):
+            getattr(tiff_file, read_subfile_region)(0, 0, 0, width, 10)
+        np.testing.assert_array_equal(region, expected[40:90, 30:130])
+        np.testing.assert_array_equal(other_region, expected[40:90, 30:130])
+
+        tiff_file.set_output_pool_size(0)
+        np.testing.assert_array_equal(getattr(tiff_file, read_subfile)(0), expected)
+
+    @parameterized(parameter_list)
+    def test_buffer_pool(self, file_path, is_tiled, bits_per_sample):
+        """
+        Test for the pool of scratch buffers and the TiffFile.set_huge_pages() method.
+        """
+        tiff_file = TiffFile(file_path)
+        read_subfile = 'read_subfile_8' if bits_per_sample == 8 else 'read_subfile_16'
+        read_subfile_region = 'read_subfile_region_8' if bits_per_sample == 8 else 'read_subfile_region_16'
+        expected = getattr(tiff_file, read_subfile)(0)
+
+        # the second read reuses the tile or scanline buffer of the first one
+        stats = TiffFile.get_buffer_pool_stats()
+        np.testing.assert_array_equal(getattr(tiff_file, read_subfile_region)(0, 10, 20, 500, 400), expected[20:400, 10:500])
+        np.testing.assert_array_equal(getattr(tiff_file, read_subfile_region)(0, 10, 20, 500, 400), expected[20:400, 10:500])
+        self.assertGreater(TiffFile.get_buffer_pool_stats().reuse_count, stats.reuse_count)
+        self.assertGreater(TiffFile.get_buffer_pool_stats().cached_bytes, 0)
+
+        self.assertFalse(TiffFile.get_huge_pages())
+        try:
+            TiffFile.set_huge_pages(True)
+            self.assertTrue(TiffFile.get_huge_pages())
+            np.testing.assert_array_equal(getattr(tiff_file, read_subfile)(0), expected)
+        finally:
+            TiffFile.set_huge_pages(False)
+
+    def test_big_endian(self):
+        """
+        Test for reading big-endian TIFF and BigTIFF files.
+        """
+        for file_path, reference_path in [
+            ('./tests/data/grad1024_tiled_16bpp_32bit_mm.tif', './tests/data/grad1024_tiled_16bpp_32bit.tif'),
+            ('./tests/data/grad1024_scanline_16bpp_64bit_mm.tif', './tests/data/grad1024_scanline_16bpp_32bit.tif'),
+        ]:
+            tiff_file = TiffFile(file_path)
+            reference_file = TiffFile(reference_path)
+            self.assertEqual(tiff_file.get_subfile_count(), reference_file.get_subfile_count())
+            for subfile_idx in range(reference_file.get_subfile_count()):
+                tiff_tags = tiff_file.get_subfile_tags(subfile_idx)
+                reference_tags = reference_file.get_subfile_tags(subfile_idx)
+                for name in [
+                    'image_width', 'image_length', 'bits_per_sample', 'samples_per_pixel',
+                    'rows_per_strip', 'max_sample_value', 'tile_width', 'tile_length'
+                ]:
+                    self.assertEqual(getattr(tiff_tags, name), getattr(reference_tags, name))
+                self.assertEqual(tiff_tags.compression, 8)  # Deflate
+                np.testing.assert_array_equal(
+                    tiff_file.read_subfile_16(subfile_idx), reference_file.read_subfile_16(subfile_idx)
+                )
+                # the strips of a compressed region are decoded as a whole
+                region = (
+                    tiff_tags.image_width // 4, tiff_tags.image_length // 2,
+                    tiff_tags.image_width // 2 + 1, tiff_tags.image_length * 3 // 4 + 1
+                )
+                np.testing.assert_array_equal(
+                    tiff_file.read_subfile_region_16(subfile_idx, *region),
+                    reference_file.read_subfile_region_16(subfile_idx, *region)
+                )
+
+            # the tile offsets are read from the sidecar index
+            try:
+                tiff_file = TiffFile(file_path, use_index=True)
+                np.testing.assert_array_equal(tiff_file.read_subfile_16(0), reference_file.read_subfile_16(0))
+            finally:
+                if os.path.exists(file_path + '.idx'):
+                    os.remove(file_path + '.idx')
+
+    @parameterized(parameter_list)
+    def test_from_buffer(self, file_path, is_tiled, bits_per_sample):
+        """
+        Test for the TiffFile.from_buffer() method.
+        """
+        with open(file_path, 'rb') as file:
+            buffer = file.read()
+
+        tiff_file = TiffFile(file_path)
+        memory_tiff_file = TiffFile.from_buffer(buffer)
+        self.assertTrue(memory_tiff_file.is_in_memory())
+        self.assertFalse(tiff_file.is_in_memory())
+        self.assertEqual(memory_tiff_file.get_subfile_count(), tiff_file.get_subfile_count())
+        if bits_per_sample == 8:
+            np.testing.assert_array_equal(memory_tiff_file.read_8(), tiff_file.read_8())
+        else:
+            np.testing.assert_array_equal(memory_tiff_file.read_16(), tiff_file.read_16())
+
+        tiff_tags = memory_tiff_file.get_subfile_tags(0)
         with self.assertRaises(RuntimeError):
-            ptif.write_subfile_region_8(arr8, 0, 256, 256, 768, 768)
+            memory_tiff_file.write_subfile_8(np.zeros((8, 8), dtype=np.uint8), tiff_tags, False)
         with self.assertRaises(RuntimeError):
-            ptif.write_subfile_region_16(arr16, 0, 256, 256, 768, 768)
+            TiffFile.from_buffer(b'II*\0' + bytes(4))
+
+        # the buffer is locked while it is referenced by the TiffFile
+        resizable_buffer = bytearray(buffer)
+        memory_tiff_file = TiffFile.from_buffer(resizable_buffer)
+        with self.assertRaises(BufferError):
+            resizable_buffer.extend(bytes(8))
+        with self.assertRaises(BufferError):
+            del resizable_buffer[:]
+        self.assertEqual(memory_tiff_file.get_subfile_count(), tiff_file.get_subfile_count())
+        del memory_tiff_file
+        resizable_buffer.extend(bytes(8))
+
+    def test_in_memory(self):
+        """
+        Test for the TiffFile.in_memory() and TiffFile.to_bytes() methods.
+        """
+        for version in [42, 43]:
+            for is_tiled in [False, True]:
+                tiff_tags = TiffFile.TiffTags()
+                tiff_tags.image_width = 70
+                tiff_tags.image_length = 50
+                tiff_tags.bits_per_sample = 16
+                tiff_tags.compression = 8  # Deflate
+                tiff_tags.photometric = 1  # min is black
+                tiff_tags.samples_per_pixel = 1
+                if is_tiled:
+                    tiff_tags.tile_width = 32
+                    tiff_tags.tile_length = 32
+                else:
+                    tiff_tags.rows_per_strip = 16
+
+                frames = [
+                    np.arange(50 * 70, dtype=np.uint16).reshape(50, 70) + frame_idx
+                    for frame_idx in range(3)
+                ]
+
+                tiff_file = TiffFile.in_memory(version)
+                for frame in frames:
+                    tiff_file.write_subfile_16(frame, tiff_tags, is_tiled)
+                self.assertEqual(tiff_file.get_subfile_count(), 3)
+
+                memory_tiff_file = TiffFile.from_buffer(tiff_file.to_bytes())
+                self.assertEqual(memory_tiff_file.get_version(), version)
+                self.assertEqual(memory_tiff_file.get_subfile_count(), 3)
+                for subfile_idx, frame in enumerate(frames):
+                    np.testing.assert_array_equal(memory_tiff_file.read_subfile_16(subfile_idx), frame)
+                    np.testing.assert_array_equal(tiff_file.read_subfile_16(subfile_idx), frame)
 
     def test_write_multiscale_subfile(self):
         """
@@ -411,6 +1321,370 @@ class TiffFileTests(unittest.TestCase):
             if os.path.exists('./tests/data/test.tif'):
                 os.remove('./tests/data/test.tif')
 
+    def test_write_multiscale_subfile_samples(self):
+        """
+        Test for the TiffFile.write_multiscale_subfile_8() methods with
+        several samples per pixel.
+        """
+        try:
+            arr = np.zeros((100, 100, 3), dtype=np.uint8)
+            arr[..., 0] = 10
+            arr[..., 1] = 20
+            arr[..., 2] = 30
+
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.new_subfile_type = 1  # page type
+            tiff_tags.image_width = 100
+            tiff_tags.image_length = 100
+            tiff_tags.bits_per_sample = 8
+            tiff_tags.compression = 8  # Deflate
+            tiff_tags.photometric = 2  # RGB
+            tiff_tags.samples_per_pixel = 3
+            tiff_tags.tile_width = 16
+            tiff_tags.tile_length = 16
+
+            # the image data must hold all samples of each pixel
+            ptif = TiffFile('./tests/data/test.tif')
+            with self.assertRaises(RuntimeError):
+                ptif.write_multiscale_subfile_8(arr[..., 0], tiff_tags)
+            self.assertFalse(os.path.exists('./tests/data/test.tif'))
+
+            ptif.write_multiscale_subfile_8(arr, tiff_tags, threads=4)
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(ptif.get_subfile_count(), 5)
+            for subfile_idx in range(5):
+                self.assertEqual(ptif.get_samples_per_pixel(subfile_idx), 3)
+            self.assertEqual(ptif.get_image_width(4), 6)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_write_multiscale_subfile_sub_ifds(self):
+        """
+        Test for the TiffFile.write_multiscale_subfile_8() methods using
+        SubIFDs.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(ptif.get_subfile_count(), 0)
+
+            arr = np.zeros((100, 100), dtype=np.uint8)
+            arr[25:75, 25:75] = 255
+
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.new_subfile_type = 1  # reduced image type
+            tiff_tags.image_width = 100
+            tiff_tags.image_length = 100
+            tiff_tags.bits_per_sample = 8
+            tiff_tags.compression = 5  # LZW
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+            tiff_tags.rows_per_strip = 2**32 - 1
+            tiff_tags.tile_width = 16
+            tiff_tags.tile_length = 16
+            ptif.write_multiscale_subfile_8(arr, tiff_tags, True)
+            ptif.write_multiscale_subfile_8(arr, tiff_tags, True)
+
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(ptif.get_subfile_count(), 2)
+            self.assertEqual(ptif.get_subfile_level_count(1), 5)
+            self.assertEqual(ptif.get_subfile_type(1), 0)
+            level_tags = ptif.get_subfile_level_tags(1, 1)
+            self.assertEqual(level_tags.new_subfile_type, 1)
+            self.assertEqual(level_tags.image_width, 50)
+
+            arr = ptif.read_subfile_8(1, 1)
+            self.assertEqual(arr.shape, (50, 50))
+            self.assertEqual(arr[25, 25], 255)
+            arr = ptif.read_subfile_region_8(1, 12, 12, 14, 14, 1)
+            self.assertEqual(arr[1, 1], 255)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_write_multiscale_subfile_threads(self):
+        """
+        Test for the TiffFile.write_multiscale_subfile_16() methods using a
+        single and multiple threads.
+        """
+        try:
+            arr = np.arange(101 * 77, dtype=np.uint16).reshape((77, 101))
+
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.new_subfile_type = 1  # reduced image type
+            tiff_tags.image_width = 101
+            tiff_tags.image_length = 77
+            tiff_tags.bits_per_sample = 8
+            tiff_tags.compression = 8  # Deflate
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+            tiff_tags.rows_per_strip = 2**32 - 1
+            tiff_tags.tile_width = 16
+            tiff_tags.tile_length = 16
+
+            levels = []
+            for threads in [1, 4]:
+                ptif = TiffFile('./tests/data/test.tif')
+                ptif.write_multiscale_subfile_16(
+                    arr, tiff_tags, sub_ifds=False, threads=threads
+                )
+                ptif = TiffFile('./tests/data/test.tif')
+                levels.append([
+                    ptif.read_subfile_8(idx, 0)
+                    for idx in range(ptif.get_subfile_count())
+                ])
+                os.remove('./tests/data/test.tif')
+
+            self.assertEqual(len(levels[0]), 5)
+            self.assertEqual(levels[0][1].shape, (39, 51))
+            for single, multiple in zip(*levels):
+                np.testing.assert_array_equal(single, multiple)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_add_subfile_levels(self):
+        """
+        Test for the TiffFile.add_subfile_levels() method.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.new_subfile_type = 0
+            tiff_tags.image_width = 100
+            tiff_tags.image_length = 100
+            tiff_tags.bits_per_sample = 8
+            tiff_tags.compression = 5  # LZW
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+            tiff_tags.rows_per_strip = 2**32 - 1
+            tiff_tags.tile_width = 16
+            tiff_tags.tile_length = 16
+            for value in [0, 255, 0]:
+                arr = np.full((100, 100), value, dtype=np.uint8)
+                ptif.write_subfile_8(arr, tiff_tags, True)
+
+            ptif.add_subfile_levels(1, True)
+            ptif.add_subfile_levels(2)
+
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(ptif.get_subfile_count(), 3 + 4)
+            self.assertEqual(ptif.get_subfile_level_count(1), 5)
+            self.assertEqual(ptif.read_subfile_8(1, 0)[0, 0], 255)
+            self.assertEqual(ptif.read_subfile_8(1, 4).shape, (6, 6))
+            self.assertEqual(ptif.read_subfile_8(1, 4)[0, 0], 255)
+            self.assertEqual(ptif.read_subfile_8(2, 0)[0, 0], 0)
+            self.assertEqual(ptif.get_subfile_type(3), 1)
+            self.assertEqual(ptif.get_image_width(3), 50)
+
+            with self.assertRaises(RuntimeError):
+                ptif.add_subfile_levels(1, True)
+            # chained levels directly follow the last subfile only
+            with self.assertRaises(RuntimeError):
+                ptif.add_subfile_levels(0)
+            with self.assertRaises(RuntimeError):
+                ptif.add_subfile_levels(2)
+            self.assertEqual(ptif.get_subfile_count(), 3 + 4)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    @parameterized([
+        # 2x2 modified tiles of level 0 map to 2x2 tiles of level 1 and
+        # to a single tile of each of the levels 2 to 4
+        {'size': 100, 'regions': [(20, 20, 40, 40)], 'tile_count': 4 + 1 + 1 + 1},
+        # the modified edge tiles of level 0 map to all but one tile of
+        # level 1, whose edge tiles (33 px) have no child in level 2 (16 px)
+        {'size': 66, 'regions': [(32, 0, 66, 66), (0, 32, 66, 66)], 'tile_count': 8 + 1 + 1 + 1},
+    ])
+    def test_update_pyramid(self, size, regions, tile_count):
+        """
+        Test for the TiffFile.mark_dirty() and TiffFile.update_pyramid()
+        methods.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+
+            arr = (np.arange(size * size) % 200).astype(np.uint8).reshape((size, size))
+            arr[0, 0] = 255  # keeps the scaling of level 0
+
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.new_subfile_type = 1  # reduced image type
+            tiff_tags.image_width = size
+            tiff_tags.image_length = size
+            tiff_tags.bits_per_sample = 8
+            tiff_tags.compression = 5  # LZW
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+            tiff_tags.rows_per_strip = 2**32 - 1
+            tiff_tags.tile_width = 16
+            tiff_tags.tile_length = 16
+            ptif.write_multiscale_subfile_8(arr, tiff_tags)
+
+            levels = [
+                ptif.read_subfile_8(idx, 0)
+                for idx in range(ptif.get_subfile_count())
+            ]
+
+            self.assertEqual(ptif.update_pyramid(0), 0)
+            for x1, y1, x2, y2 in regions:
+                region = (201 + np.add.outer(np.arange(y2 - y1), np.arange(x2 - x1)) % 50).astype(np.uint8)
+                arr[y1:y2, x1:x2] = region
+                ptif.write_subfile_region_8(region, 0, x1, y1, x2, y2)
+                # the written region was already marked as modified
+                ptif.mark_dirty(0, x1, y1, x2, y2)
+            self.assertEqual(ptif.update_pyramid(0), tile_count)
+            self.assertEqual(ptif.update_pyramid(0), 0)
+
+            # the levels match those of the modified image
+            reference = TiffFile('./tests/data/reference.tif')
+            reference.write_multiscale_subfile_8(arr, tiff_tags)
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(ptif.get_subfile_count(), len(levels))
+            for idx, level in enumerate(levels):
+                updated = ptif.read_subfile_8(idx, 0)
+                np.testing.assert_array_equal(updated, reference.read_subfile_8(idx, 0))
+                self.assertFalse(np.array_equal(updated, level))
+        finally:
+            for file_path in ['./tests/data/test.tif', './tests/data/reference.tif']:
+                if os.path.exists(file_path):
+                    os.remove(file_path)
+
+    def test_write_multiscale_subfile_factors(self):
+        """
+        Test for the TiffFile.write_multiscale_subfile_8() methods using
+        custom downscale factors.
+        """
+        cases = [
+            ([4], 0, [(25, 25), (6, 6)]),
+            ([2, 2, 4], 0, [(50, 50), (25, 25), (6, 6)]),
+            ([4], 7, [(25, 25)]),
+        ]
+        arr = np.full((100, 100), 255, dtype=np.uint8)
+
+        tiff_tags = TiffFile.TiffTags()
+        tiff_tags.new_subfile_type = 1  # reduced image type
+        tiff_tags.image_width = 100
+        tiff_tags.image_length = 100
+        tiff_tags.bits_per_sample = 8
+        tiff_tags.compression = 5  # LZW
+        tiff_tags.photometric = 1  # min is black
+        tiff_tags.samples_per_pixel = 1
+        tiff_tags.rows_per_strip = 2**32 - 1
+        tiff_tags.tile_width = 16
+        tiff_tags.tile_length = 16
+
+        for factors, min_level_size, shapes in cases:
+            try:
+                ptif = TiffFile('./tests/data/test.tif')
+                ptif.write_multiscale_subfile_8(
+                    arr, tiff_tags, sub_ifds=True,
+                    factors=factors, min_level_size=min_level_size
+                )
+
+                ptif = TiffFile('./tests/data/test.tif')
+                self.assertEqual(ptif.get_subfile_level_count(0), len(shapes) + 1)
+                for level, shape in enumerate(shapes, 1):
+                    level_arr = ptif.read_subfile_8(0, level)
+                    self.assertEqual(level_arr.shape, shape)
+                    self.assertTrue((level_arr == 255).all())
+            finally:
+                if os.path.exists('./tests/data/test.tif'):
+                    os.remove('./tests/data/test.tif')
+
+
+    def test_big_sparse_image(self):
+        """
+        Test for reading regions of images with more than 4 Gi pixels and of images wider than the
+        range of signed 32-bit integers.
+        """
+        cases = [
+            (70000, 70000, 1024, np.uint16),     # 9.1 GiB of pixels
+            (2**31 + 5000, 4096, 4096, np.uint8),
+        ]
+        for image_width, image_length, tile_size, dtype in cases:
+            tiles_across = (image_width + tile_size - 1) // tile_size
+            tiles_down = (image_length + tile_size - 1) // tile_size
+            pattern = (np.arange(tile_size * tile_size) % 251).reshape(tile_size, tile_size)
+            tiles = {
+                (tiles_across - 2, tiles_down - 1): pattern.astype(dtype),
+                (tiles_across - 1, tiles_down - 1): (pattern + 3).astype(dtype),
+            }
+
+            def expected_region(x1, y1, x2, y2):
+                arr = np.zeros((y2 - y1, x2 - x1), dtype=dtype)
+                for (tile_column, tile_row), tile in tiles.items():
+                    tx, ty = tile_column * tile_size, tile_row * tile_size
+                    cx1, cy1 = max(x1, tx), max(y1, ty)
+                    cx2, cy2 = min(x2, tx + tile_size), min(y2, ty + tile_size)
+                    if cx1 < cx2 and cy1 < cy2:
+                        arr[cy1 - y1:cy2 - y1, cx1 - x1:cx2 - x1] = tile[cy1 - ty:cy2 - ty, cx1 - tx:cx2 - tx]
+                return arr
+
+            try:
+                write_sparse_tiff('./tests/data/test.tif', image_width, image_length, tile_size, dtype, tiles)
+                ptif = TiffFile('./tests/data/test.tif')
+                self.assertEqual(ptif.get_image_width(0), image_width)
+                self.assertEqual(ptif.get_image_length(0), image_length)
+
+                x1 = (tiles_across - 2) * tile_size + 100
+                y1 = (tiles_down - 1) * tile_size + 5
+                regions = [
+                    (x1, y1, image_width - 3, min(y1 + 200, image_length)),
+                    (image_width - 17, image_length - 9, image_width, image_length),
+                    (0, 0, 16, 16),
+                ]
+                read_region = ptif.read_subfile_region_8 if dtype == np.uint8 else ptif.read_subfile_region_16
+                read_regions = ptif.read_subfile_regions_8 if dtype == np.uint8 else ptif.read_subfile_regions_16
+                for region in regions:
+                    np.testing.assert_array_equal(read_region(0, *region), expected_region(*region))
+                for arr, region in zip(read_regions(0, regions), regions):
+                    np.testing.assert_array_equal(arr, expected_region(*region))
+            finally:
+                if os.path.exists('./tests/data/test.tif'):
+                    os.remove('./tests/data/test.tif')
+
+    def test_many_subfiles(self):
+        """
+        Test for files with more subfiles than a 16-bit index can address.
+        """
+        subfile_count = 70000
+        try:
+            write_subfile_chain('./tests/data/test.tif', subfile_count)
+            for use_index in [False, True, True]:
+                ptif = TiffFile('./tests/data/test.tif', use_index=use_index)
+                self.assertEqual(ptif.get_subfile_count(), subfile_count)
+                for subfile_idx in [0, 65535, 65536, subfile_count - 1]:
+                    self.assertEqual(ptif.get_image_width(subfile_idx), 1)
+                    self.assertEqual(ptif.read_subfile_8(subfile_idx)[0, 0], subfile_idx % 251)
+
+            with open('./tests/data/test.tif', 'rb') as file:
+                mem_tif = TiffFile.from_buffer(file.read())
+            self.assertEqual(mem_tif.get_subfile_count(), subfile_count)
+            self.assertEqual(mem_tif.read_subfile_8(subfile_count - 1)[0, 0], (subfile_count - 1) % 251)
+            os.remove('./tests/data/test.tif')
+
+            # a stack is not limited to 65535 frames either
+            tiff_tags = TiffFile.TiffTags()
+            tiff_tags.image_width = 2
+            tiff_tags.image_length = 2
+            tiff_tags.bits_per_sample = 8
+            tiff_tags.compression = 1  # uncompressed
+            tiff_tags.photometric = 1  # min is black
+            tiff_tags.samples_per_pixel = 1
+            ptif = TiffFile('./tests/data/test.tif')
+            ptif.create_stack(subfile_count, tiff_tags)
+            ptif.write_stack_frame_8(np.full((2, 2), 7, dtype=np.uint8), subfile_count - 1)
+            ptif.close_stack()
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(ptif.get_subfile_count(), subfile_count)
+            np.testing.assert_array_equal(ptif.read_subfile_8(subfile_count - 1), np.full((2, 2), 7))
+            np.testing.assert_array_equal(ptif.read_subfile_8(65536), np.zeros((2, 2)))
+        finally:
+            for path in ['./tests/data/test.tif', './tests/data/test.tif.idx']:
+                if os.path.exists(path):
+                    os.remove(path)
 
 if __name__ == '__main__':
     unittest.main()
@@ -3,9 +3,12 @@ Unittests for pylibtiff.tiff_file module.
 """
 import numpy as np
 import os
+import shutil
+import time
 import unittest
 
-from pylibtiff import TiffFile, TiffTags
+from pylibtiff import TiffFile, TiffTags, scan_metadata
+from tests.tiff_samples import write_subfile_chain
 
 
 def parameterized(params_list):
@@ -88,6 +91,14 @@ class TiffFileTests(unittest.TestCase):
         self.assertEqual(ptif.subfile_tags[0].image_width, 1024)
         self.assertEqual(ptif.subfile_tags[1].image_width, 512)
 
+    @parameterized(parameter_list)
+    def test_level_count(self, file_path, is_tiled, bits_per_sample):
+        """
+        Test for the TiffFile.level_count() method.
+        """
+        ptif = TiffFile(file_path)
+        self.assertEqual(ptif.level_count(0), 1)
+
     @parameterized(parameter_list)
     def test_read(self, file_path, is_tiled, bits_per_sample):
         """
@@ -170,15 +181,397 @@ class TiffFileTests(unittest.TestCase):
             if os.path.exists('./tests/data/test.tif'):
                 os.remove('./tests/data/test.tif')
 
-    def test_write_subfile_region(self):
+    @parameterized(parameter_list)
+    def test_write_subfile_region(self, file_path, is_tiled, bits_per_sample):
         """
         Test for the TiffFile.write_subfile_region() methods.
         """
-        ptif = TiffFile("./tests/data/grad1024_tiled_8bpp_32bit.tif")
-        arr = np.ones((512, 512), dtype=np.uint8) * 255
-        with self.assertRaises(RuntimeError):
+        try:
+            shutil.copyfile(file_path, './tests/data/test.tif')
+            ptif = TiffFile('./tests/data/test.tif')
+
+            dtype = np.uint8 if bits_per_sample == 8 else np.uint16
+            arr = np.ones((512, 512), dtype=dtype)
+            expected = ptif.read_subfile_region(0, 255, 255, 769, 769)
+            expected[1:-1, 1:-1] = arr
             ptif.write_subfile_region(arr, 0, 256, 256, 768, 768)
 
+            region = ptif.read_subfile_region(0, 255, 255, 769, 769)
+            np.testing.assert_array_equal(region, expected)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_write_subfile_region_strips(self):
+        """
+        Test for the TiffFile.write_subfile_region() methods using a
+        compressed scanline-based subfile.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+            arr = np.arange(1000 * 100, dtype=np.uint16).reshape((1000, 100))
+            ptif.write(arr)
+            file_size = os.path.getsize('./tests/data/test.tif')
+
+            # a band of 40 rows spans 2 of the 25 strips
+            region = np.zeros((40, 100), dtype=np.uint16)
+            ptif.write_subfile_region(region, 0, 0, 500, 100, 540)
+            arr[500:540] = region
+
+            np.testing.assert_array_equal(ptif.read_subfile(0), arr)
+            self.assertLess(
+                os.path.getsize('./tests/data/test.tif') - file_size,
+                file_size // 4
+            )
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_compact(self):
+        """
+        Test for the TiffFile.compact() method.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+            arr = np.full((97, 97), 255, dtype=np.uint8)
+            ptif.write_multiscale_subfile(arr, tile_size=16, sub_ifds=True)
+
+            region = np.ones((20, 20), dtype=np.uint8)
+            ptif.write_subfile_region(region, 0, 10, 10, 30, 30)
+            ptif.update_pyramid(0)
+            self.assertGreater(ptif.compact(), 0)
+
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(ptif.level_count(0), 5)
+            np.testing.assert_array_equal(
+                ptif.read_subfile_region(0, 10, 10, 30, 30), region
+            )
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_session(self):
+        """
+        Test for the TiffFile.session() method.
+        """
+        try:
+            frames = [
+                np.full((50, 60), frame_idx, dtype=np.uint8)
+                for frame_idx in range(20)
+            ]
+            for direct_io in [False, True]:
+                ptif = TiffFile('./tests/data/test.tif')
+                ptif.direct_io = direct_io
+                with ptif.session():
+                    self.assertTrue(ptif.session_open)
+                    for frame in frames:
+                        ptif.write_subfile(frame)
+                self.assertFalse(ptif.session_open)
+
+                ptif = TiffFile('./tests/data/test.tif')
+                self.assertEqual(len(ptif.subfile_tags), 20)
+                for subfile_idx, frame in enumerate(frames):
+                    np.testing.assert_array_equal(
+                        ptif.read_subfile(subfile_idx), frame
+                    )
+                os.remove('./tests/data/test.tif')
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_writer(self):
+        """
+        Test for the TiffFile.writer() and TiffFile.submit() methods.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+            frames = [
+                np.random.randint(0, 4096, (100, 120), dtype=np.uint16)
+                for _ in range(25)
+            ]
+            with ptif.writer(queue_depth=4):
+                for frame in frames:
+                    ptif.submit(frame, tile_size=32)
+            self.assertEqual(len(ptif.subfile_tags), 25)
+
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(len(ptif.subfile_tags), 25)
+            for subfile_idx, frame in enumerate(frames):
+                np.testing.assert_array_equal(
+                    ptif.read_subfile(subfile_idx), frame
+                )
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_stack(self):
+        """
+        Test for the TiffFile.create_stack() and TiffFile.write_frame()
+        methods.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+            frames = [
+                np.random.randint(0, 256, (60, 80), dtype=np.uint8)
+                for _ in range(10)
+            ]
+            ptif.create_stack(10, (60, 80), dtype=np.uint8)
+            self.assertEqual(len(ptif.subfile_tags), 10)
+            for frame_idx, frame in enumerate(frames):
+                ptif.write_frame(frame, frame_idx)
+            ptif.close_stack()
+
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(len(ptif.subfile_tags), 10)
+            for subfile_idx, frame in enumerate(frames):
+                np.testing.assert_array_equal(
+                    ptif.read_subfile(subfile_idx), frame
+                )
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_watch(self):
+        """
+        Test for the TiffFile.watch() method.
+        """
+        try:
+            writer = TiffFile('./tests/data/test.tif')
+            writer.write_subfile(np.zeros((40, 50), dtype=np.uint8))
+
+            reader = TiffFile('./tests/data/test.tif')
+            new_subfile_counts = []
+            reader.watch(new_subfile_counts.append, interval=0.05)
+            try:
+                for frame_idx in range(1, 4):
+                    writer.write_subfile(
+                        np.full((40, 50), frame_idx, dtype=np.uint8)
+                    )
+
+                deadline = time.time() + 5
+                while sum(new_subfile_counts) < 3 and time.time() < deadline:
+                    time.sleep(0.01)
+            finally:
+                reader.stop_watching()
+
+            self.assertEqual(sum(new_subfile_counts), 3)
+            self.assertEqual(len(reader.subfile_tags), 4)
+            np.testing.assert_array_equal(
+                reader.read_subfile(3), np.full((40, 50), 3, dtype=np.uint8)
+            )
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_subfile_tags_lazy(self):
+        """
+        Test for the lazily read TiffFile.subfile_tags.
+        """
+        try:
+            writer = TiffFile('./tests/data/test.tif')
+            for frame_idx in range(5):
+                writer.write_subfile(
+                    np.zeros((30, 40 + frame_idx), dtype=np.uint16),
+                    tile_size=16
+                )
+
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(len(ptif.subfile_tags), 5)
+            self.assertEqual(ptif.subfile_tags[-1].image_width, 44)
+            self.assertEqual(
+                [tiff_tags.image_width for tiff_tags in ptif.subfile_tags[1:3]],
+                [41, 42]
+            )
+            with self.assertRaises(IndexError):
+                ptif.subfile_tags[5]
+
+            tags_array = ptif.subfile_tags.to_array()
+            np.testing.assert_array_equal(
+                tags_array['image_width'], np.arange(40, 45)
+            )
+            np.testing.assert_array_equal(tags_array['bits_per_sample'], 16)
+            np.testing.assert_array_equal(tags_array['tile_width'], 16)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_scan_metadata(self):
+        """
+        Test for the scan_metadata() function.
+        """
+        try:
+            writer = TiffFile('./tests/data/test.tif')
+            for frame_idx in range(4):
+                writer.write_subfile(
+                    np.zeros((30, 40), dtype=np.uint8), tile_size=16
+                )
+
+            file_paths = [
+                './tests/data/test.tif',
+                './tests/data/missing.tif',
+                self.parameter_list[0]['file_path'],
+            ]
+            metadata = scan_metadata(file_paths, threads=2)
+            np.testing.assert_array_equal(
+                metadata['valid'], [True, False, True]
+            )
+            self.assertEqual(metadata['subfile_count'][0], 4)
+            self.assertEqual(metadata['tiff_tags']['image_width'][0], 40)
+            self.assertEqual(metadata['tiff_tags']['tile_width'][0], 16)
+            self.assertEqual(
+                metadata['tiff_tags']['bits_per_sample'][2],
+                self.parameter_list[0]['bits_per_sample']
+            )
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_use_index(self):
+        """
+        Test for opening a TiffFile by its sidecar index.
+        """
+        try:
+            frames = [
+                np.full((40, 50), frame_idx, dtype=np.uint8)
+                for frame_idx in range(6)
+            ]
+            writer = TiffFile('./tests/data/test.tif')
+            for frame in frames[:3]:
+                writer.write_subfile(frame)
+
+            ptif = TiffFile('./tests/data/test.tif', use_index=True)
+            self.assertTrue(os.path.exists('./tests/data/test.tif.idx'))
+            self.assertEqual(len(ptif.subfile_tags), 3)
+
+            for frame in frames[3:]:
+                writer.write_subfile(frame)
+            ptif = TiffFile('./tests/data/test.tif', use_index=True)
+            self.assertEqual(len(ptif.subfile_tags), 6)
+            for subfile_idx, frame in enumerate(frames):
+                np.testing.assert_array_equal(
+                    ptif.read_subfile(subfile_idx), frame
+                )
+        finally:
+            for path in ['./tests/data/test.tif', './tests/data/test.tif.idx']:
+                if os.path.exists(path):
+                    os.remove(path)
+
+    def test_read_subfile_regions(self):
+        """
+        Test for the TiffFile.read_subfile_regions() method.
+        """
+        ptif = TiffFile('./tests/data/grad1024_tiled_16bpp_32bit.tif')
+        regions = [(0, 0, 100, 100), (50, 60, 70, 80), (900, 0, 1024, 1024)]
+        ptif.read_gap = 0
+        self.assertEqual(ptif.read_gap, 0)
+
+        image = ptif.read_subfile(0)
+        for queue_depth in [1, 64]:
+            ptif.queue_depth = queue_depth
+            ptif.reset_io_stats()
+            arrays = ptif.read_subfile_regions(0, regions)
+            io_stats = ptif.io_stats
+            self.assertGreater(io_stats['read_count'], 0)
+            self.assertGreater(io_stats['bytes_read'], 0)
+            self.assertGreaterEqual(io_stats['throughput'], 0)
+            self.assertGreaterEqual(io_stats['bytes_saved'], 0)
+            self.assertLessEqual(io_stats['max_queue_depth'], queue_depth)
+            if queue_depth == 1 or not TiffFile.has_io_uring():
+                self.assertEqual(io_stats['max_queue_depth'], 1)
+
+            for (x1, y1, x2, y2), array in zip(regions, arrays):
+                np.testing.assert_array_equal(array, image[y1:y2, x1:x2])
+
+    def test_readahead(self):
+        """
+        Test for the TiffFile.readahead property.
+        """
+        ptif = TiffFile('./tests/data/grad1024_tiled_16bpp_32bit.tif')
+        self.assertEqual(ptif.readahead, 16 * 1024 * 1024)
+
+        image = ptif.read_subfile(0)
+        ptif.readahead = 0
+        self.assertEqual(ptif.readahead, 0)
+        np.testing.assert_array_equal(ptif.read_subfile(0), image)
+
+    def test_output_pool_size(self):
+        """
+        Test for the TiffFile.output_pool_size property.
+        """
+        ptif = TiffFile('./tests/data/grad1024_tiled_16bpp_32bit.tif')
+        self.assertEqual(ptif.output_pool_size, 0)
+        image = ptif.read_subfile(0)
+
+        ptif.output_pool_size = 2
+        self.assertEqual(ptif.output_pool_size, 2)
+        frame = ptif.read_subfile(0)
+        address = frame.ctypes.data
+        np.testing.assert_array_equal(frame, image)
+
+        # the array is reused once it is released
+        del frame
+        frame = ptif.read_subfile(0)
+        self.assertEqual(frame.ctypes.data, address)
+        np.testing.assert_array_equal(frame, image)
+
+    def test_buffer_pool(self):
+        """
+        Test for the TiffFile.buffer_pool_stats() and
+        TiffFile.set_huge_pages() methods.
+        """
+        ptif = TiffFile('./tests/data/grad1024_tiled_16bpp_32bit.tif')
+        image = ptif.read_subfile(0)
+
+        stats = TiffFile.buffer_pool_stats()
+        np.testing.assert_array_equal(
+            ptif.read_subfile_region(0, 100, 100, 300, 200),
+            image[100:200, 100:300]
+        )
+        self.assertGreater(
+            TiffFile.buffer_pool_stats()['reuse_count'], stats['reuse_count']
+        )
+
+        try:
+            TiffFile.set_huge_pages(True)
+            self.assertTrue(TiffFile.get_huge_pages())
+            np.testing.assert_array_equal(ptif.read_subfile(0), image)
+        finally:
+            TiffFile.set_huge_pages(False)
+
+    def test_in_memory(self):
+        """
+        Test for the TiffFile.in_memory() and TiffFile.from_buffer() methods.
+        """
+        arr = np.arange(60 * 80, dtype=np.uint16).reshape(60, 80)
+
+        tiff_file = TiffFile.in_memory()
+        self.assertTrue(tiff_file.in_memory_file)
+        tiff_file.write_subfile(arr, tile_size=16)
+        tiff_file.write_subfile(arr[::2, ::2].copy(), tile_size=16)
+        buffer = tiff_file.to_bytes()
+        self.assertIsInstance(buffer, bytes)
+
+        memory_tiff_file = TiffFile.from_buffer(buffer)
+        self.assertEqual(len(memory_tiff_file.subfile_tags), 2)
+        np.testing.assert_array_equal(memory_tiff_file.read_subfile(0), arr)
+        np.testing.assert_array_equal(memory_tiff_file.read_subfile(1), arr[::2, ::2])
+        np.testing.assert_array_equal(
+            memory_tiff_file.read_subfile_region(0, 10, 20, 50, 40),
+            arr[20:40, 10:50]
+        )
+        with self.assertRaises(RuntimeError):
+            memory_tiff_file.write_subfile(arr)
+
+        try:
+            with open('./tests/data/test.tif', 'wb') as file:
+                file.write(buffer)
+            np.testing.assert_array_equal(
+                TiffFile('./tests/data/test.tif').read_subfile(0), arr
+            )
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
     def test_write_multiscale_subfile(self):
         """
         Test for the TiffFile.write_multiscale_subfile() methods.
@@ -201,6 +594,153 @@ class TiffFileTests(unittest.TestCase):
             if os.path.exists('./tests/data/test.tif'):
                 os.remove('./tests/data/test.tif')
 
+    def test_write_multiscale_subfile_sub_ifds(self):
+        """
+        Test for the TiffFile.write_multiscale_subfile() methods using
+        SubIFDs.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+
+            arr = np.zeros((97, 97), dtype=np.uint8)
+            radius = 48
+            for y in range(-radius, radius):
+                for x in range(-radius, radius):
+                    arr[y+radius, x+radius] = x**2 + y**2 <= radius**2
+
+            ptif.write_multiscale_subfile(arr, tile_size=16, sub_ifds=True)
+            ptif.write_multiscale_subfile(arr, tile_size=16, sub_ifds=True)
+
+            self.assertEqual(len(ptif.subfile_tags), 2)
+            self.assertEqual(ptif.level_count(1), 5)
+
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(len(ptif.subfile_tags), 2)
+            self.assertEqual(ptif.level_count(-1), 5)
+            self.assertEqual(ptif.read_subfile(1, level=1).shape, (49, 49))
+            self.assertEqual(
+                ptif.read_subfile_region(1, 0, 0, 4, 4, level=2).shape, (4, 4)
+            )
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_add_levels(self):
+        """
+        Test for the TiffFile.add_levels() method.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+            arr = np.full((97, 97), 7, dtype=np.uint16)
+            ptif.write(arr, tile_size=16)
+            ptif.write(arr, tile_size=16)
+
+            ptif.add_levels(0, sub_ifds=True)
+
+            self.assertEqual(len(ptif.subfile_tags), 2)
+            self.assertEqual(ptif.level_count(0), 5)
+            self.assertEqual(ptif.read_subfile(0, level=1).shape, (49, 49))
+            self.assertEqual(ptif.read_subfile(0, level=1)[0, 0], 7)
+            self.assertEqual(ptif.level_count(1), 1)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_update_pyramid(self):
+        """
+        Test for the TiffFile.mark_dirty() and TiffFile.update_pyramid()
+        methods.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+            arr = np.full((97, 97), 255, dtype=np.uint8)
+            ptif.write_multiscale_subfile(arr, tile_size=16, sub_ifds=True)
+
+            ptif.mark_dirty(0, 0, 0, 97, 97)
+            self.assertEqual(ptif.update_pyramid(0), 16 + 4 + 1 + 1)
+            self.assertEqual(ptif.update_pyramid(0), 0)
+
+            # the written region is brought up to date in all levels
+            ptif.write_subfile_region(
+                np.zeros((32, 32), dtype=np.uint8), 0, 0, 0, 32, 32
+            )
+            self.assertEqual(ptif.update_pyramid(0), 1 + 1 + 1 + 1)
+            for level in range(1, ptif.level_count(0)):
+                size = 32 >> level
+                level_arr = ptif.read_subfile(0, level=level)
+                self.assertTrue(np.all(level_arr[:size, :size] == 0))
+                self.assertTrue(np.all(level_arr[size:, :] == 255))
+                self.assertTrue(np.all(level_arr[:, size:] == 255))
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_update_pyramid_edge(self):
+        """
+        Test for the TiffFile.update_pyramid() method with modified edge
+        tiles, whose pixels are cut off by the downsampling.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+            arr = np.full((66, 66), 255, dtype=np.uint8)
+            ptif.write_multiscale_subfile(arr, tile_size=16, sub_ifds=True)
+
+            # the edge tiles of level 1 (33 px) have no child in level 2
+            # (16 px)
+            ptif.write_subfile_region(
+                np.zeros((66, 2), dtype=np.uint8), 0, 64, 0, 66, 66
+            )
+            ptif.write_subfile_region(
+                np.zeros((2, 66), dtype=np.uint8), 0, 0, 64, 66, 66
+            )
+            self.assertEqual(ptif.update_pyramid(0), 3 + 3 - 1)
+            self.assertEqual(ptif.update_pyramid(0), 0)
+
+            level_arr = ptif.read_subfile(0, level=1)
+            self.assertTrue(np.all(level_arr[:, 32] == 0))
+            self.assertTrue(np.all(level_arr[32, :] == 0))
+            self.assertTrue(np.all(level_arr[:32, :32] == 255))
+            for level in range(2, ptif.level_count(0)):
+                level_arr = ptif.read_subfile(0, level=level)
+                self.assertTrue(np.all(level_arr == 255))
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+    def test_write_multiscale_subfile_factors(self):
+        """
+        Test for the TiffFile.write_multiscale_subfile() methods using custom
+        downscale factors.
+        """
+        try:
+            ptif = TiffFile('./tests/data/test.tif')
+            arr = np.full((97, 97), 255, dtype=np.uint8)
+            ptif.write_multiscale_subfile(
+                arr, tile_size=16, sub_ifds=True, factors=[4], min_level_size=6
+            )
+
+            self.assertEqual(ptif.level_count(0), 3)
+            self.assertEqual(ptif.read_subfile(0, level=1).shape, (24, 24))
+            self.assertEqual(ptif.read_subfile(0, level=2).shape, (6, 6))
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
+
+
+    def test_many_subfiles(self):
+        """
+        Test for files with more subfiles than a 16-bit index can address.
+        """
+        try:
+            write_subfile_chain('./tests/data/test.tif', 70000)
+            ptif = TiffFile('./tests/data/test.tif')
+            self.assertEqual(len(ptif.subfile_tags), 70000)
+            self.assertEqual(ptif.subfile_tags[-1].image_width, 1)
+            self.assertEqual(ptif.read_subfile(65536)[0, 0], 65536 % 251)
+            self.assertEqual(ptif.read_subfile(-1)[0, 0], 69999 % 251)
+        finally:
+            if os.path.exists('./tests/data/test.tif'):
+                os.remove('./tests/data/test.tif')
 
 if __name__ == '__main__':
     unittest.main()
@@ -0,0 +1,38 @@
+"""
+Writers of sample TIFF files shared by the unittests.
+"""
+import struct
+
+
+def write_subfile_chain(file_path, subfile_count):
+    """
+    Writes a classic TIFF file with a chain of 1x1 pixel 8-bit subfiles,
+    whose pixel is the subfile index modulo 251.
+
+    :param file_path: Path of the file.
+    :param subfile_count: Number of subfiles.
+    """
+    ifd_size = 2 + 9 * 12 + 4
+    data = bytearray(struct.pack('<2sHI', b'II', 42, 8))
+    for subfile_idx in range(subfile_count):
+        ifd_offset = len(data)
+        next_ifd_offset = ifd_offset + ifd_size + 2
+        if subfile_idx + 1 == subfile_count:
+            next_ifd_offset = 0
+        entries = [
+            (256, 3, 1, 1),
+            (257, 3, 1, 1),
+            (258, 3, 1, 8),
+            (259, 3, 1, 1),  # no compression
+            (262, 3, 1, 1),  # min is black
+            (273, 4, 1, ifd_offset + ifd_size),
+            (277, 3, 1, 1),
+            (278, 3, 1, 1),
+            (279, 4, 1, 1),
+        ]
+        data += struct.pack('<H', len(entries))
+        for entry in entries:
+            data += struct.pack('<HHII', *entry)
+        data += struct.pack('<IBx', next_ifd_offset, subfile_idx % 251)
+    with open(file_path, 'wb') as f:
+        f.write(data)